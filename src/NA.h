@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
+#ifndef NA_GUARD
+#define NA_GUARD
+
 #include <cmath>
 #include <limits>
 
@@ -63,6 +66,17 @@ public:
     static constexpr unsigned value = std::numeric_limits<unsigned>::max();
 };
 
+// as GDAL's default for Byte and UInt16
+template <> class NA<unsigned char> {
+public:
+    static constexpr unsigned char value = std::numeric_limits<unsigned char>::max();
+};
+
+template <> class NA<unsigned short> {
+public:
+    static constexpr unsigned short value = std::numeric_limits<unsigned short>::max();
+};
+
 
 template <typename T>
 void set_NA(std::vector<T> &v, double naflag) {
@@ -113,3 +127,4 @@ bool is_NAN(float v) {
 
 */
 
+#endif
@@ -211,6 +211,20 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// arith_benchmark
+Rcpp::NumericVector arith_benchmark(std::string type, std::vector<std::string> opers, double n, int reps);
+RcppExport SEXP _terra_arith_benchmark(SEXP typeSEXP, SEXP opersSEXP, SEXP nSEXP, SEXP repsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type type(typeSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type opers(opersSEXP);
+    Rcpp::traits::input_parameter< double >::type n(nSEXP);
+    Rcpp::traits::input_parameter< int >::type reps(repsSEXP);
+    rcpp_result_gen = Rcpp::wrap(arith_benchmark(type, opers, n, reps));
+    return rcpp_result_gen;
+END_RCPP
+}
 // setGDALCacheSizeMB
 void setGDALCacheSizeMB(double x);
 RcppExport SEXP _terra_setGDALCacheSizeMB(SEXP xSEXP) {
@@ -397,6 +411,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"_terra_set_gdal_warnings", (DL_FUNC) &_terra_set_gdal_warnings, 1},
     {"_terra_gdal_init", (DL_FUNC) &_terra_gdal_init, 1},
     {"_terra_percRank", (DL_FUNC) &_terra_percRank, 5},
+    {"_terra_arith_benchmark", (DL_FUNC) &_terra_arith_benchmark, 4},
     {"_terra_setGDALCacheSizeMB", (DL_FUNC) &_terra_setGDALCacheSizeMB, 1},
     {"_terra_getGDALCacheSizeMB", (DL_FUNC) &_terra_getGDALCacheSizeMB, 0},
     {"_terra_get_proj_search_paths", (DL_FUNC) &_terra_get_proj_search_paths, 0},
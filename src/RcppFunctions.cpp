@@ -1,6 +1,7 @@
 #include <Rcpp.h>
 #include "spatRasterMultiple.h"
 #include "string_utils.h"
+#include "kernels.h"
 
 #include "gdal_priv.h"
 #include "gdalio.h"
@@ -428,6 +429,15 @@ std::vector<double> percRank(std::vector<double> x, std::vector<double> y, doubl
 }
 
 
+// [[Rcpp::export(name = ".arith_benchmark")]]
+Rcpp::NumericVector arith_benchmark(std::string type, std::vector<std::string> opers, double n, int reps) {
+	std::vector<double> gbs = benchmark_kernels(type, opers, n, reps);
+	Rcpp::NumericVector out = Rcpp::wrap(gbs);
+	out.names() = opers;
+	return out;
+}
+
+
 // [[Rcpp::export(name = ".setGDALCacheSizeMB")]]
 void setGDALCacheSizeMB(double x) {
   GDALSetCacheMax64(static_cast<int64_t>(x) * 1024 * 1024);
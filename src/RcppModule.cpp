@@ -189,8 +189,13 @@ RCPP_MODULE(spat){
 		//.property("append", &SpatOptions::get_append, &SpatOptions::set_append )
 		.field("datatype_set", &SpatOptions::datatype_set)
 		.field("threads", &SpatOptions::threads)
+		.property("nthreads", &SpatOptions::get_nthreads, &SpatOptions::set_nthreads)
+		.property("lazy", &SpatOptions::get_lazy, &SpatOptions::set_lazy)
+		.property("tempfiletype", &SpatOptions::get_tempfiletype, &SpatOptions::set_tempfiletype)
 		.property("progress", &SpatOptions::get_progress, &SpatOptions::set_progress)
 		.property("ncopies", &SpatOptions::get_ncopies, &SpatOptions::set_ncopies)
+		.field("overviews", &SpatOptions::overviews)
+		.field("overview_method", &SpatOptions::overview_method)
 
 		.property("def_filetype", &SpatOptions::get_def_filetype, &SpatOptions::set_def_filetype )
 		.property("def_datatype", &SpatOptions::get_def_datatype, &SpatOptions::set_def_datatype )
@@ -404,6 +409,7 @@ RCPP_MODULE(spat){
 		.method("relate_first", &SpatVector::relateFirst)
 		.method("relate_between", ( std::vector<int> (SpatVector::*)(SpatVector, std::string))( &SpatVector::relate ))
 		.method("relate_within", ( std::vector<int> (SpatVector::*)(std::string, bool))( &SpatVector::relate ))
+		.method("index_pairs", &SpatVector::index_pairs)
 		.method("crop_ext", ( SpatVector (SpatVector::*)(SpatExtent))( &SpatVector::crop ))
 		.method("crop_vct", ( SpatVector (SpatVector::*)(SpatVector))( &SpatVector::crop ))
 
@@ -626,6 +632,7 @@ RCPP_MODULE(spat){
 		.method("adjacentMat", &SpatRaster::adjacentMat, "adjacent with matrix")
 		.method("adjacent", &SpatRaster::adjacent, "adjacent")
 		.method("aggregate", &SpatRaster::aggregate, "aggregate")
+		.method("pyramid", &SpatRaster::pyramid, "pyramid")
 		.method("align", &SpatRaster::align, "align")
 		.method("apply", &SpatRaster::apply, "apply")
 		.method("rapply", &SpatRaster::rapply, "rapply")
@@ -646,10 +653,14 @@ RCPP_MODULE(spat){
 		.method("bilinearValues", &SpatRaster::bilinearValues, "bilin")
 
 		.method("patches", &SpatRaster::clumps, "patches")
+		.method("patch_stats", &SpatRaster::patch_stats, "patch_stats")
 		.method("boundaries", &SpatRaster::edges, "edges")
 		.method("buffer", &SpatRaster::buffer, "buffer")
 		.method("gridDistance", &SpatRaster::gridDistance)
 		.method("costDistance", &SpatRaster::costDistance)
+		.method("fillSinks", &SpatRaster::fillSinks)
+		.method("flowAccumulation", &SpatRaster::flowAccumulation)
+		.method("watershed", &SpatRaster::watershed)
 		.method("rastDistance", &SpatRaster::distance)
 		.method("rastDirection", &SpatRaster::direction)
 		.method("make_tiles", &SpatRaster::make_tiles)
@@ -675,6 +686,7 @@ RCPP_MODULE(spat){
 //		.method("extractXYFlat", &SpatRaster::extractXYFlat, "extractXYflat")
 		.method("extractVector", &SpatRaster::extractVector, "extractVector")
 		.method("extractVectorFlat", &SpatRaster::extractVectorFlat, "extractVectorFlat")
+		.method("extractVectorSummary", &SpatRaster::extractVectorSummary, "extractVectorSummary")
 		.method("flip", &SpatRaster::flip, "flip")
 		.method("focal", &SpatRaster::focal, "focal")
 		.method("focalValues", &SpatRaster::focal_values, "focalValues")
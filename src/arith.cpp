@@ -20,134 +20,10 @@
 #include "recycle.h"
 #include "math_utils.h"
 #include "vecmath.h"
+#include "kernels.h"
 
 //#include "modal.h"
 
-/*
-// need to take care of NAs here. OK for NAN, but not for int types
-//template <typename T>
-//void operator+(std::vector<T>& a, const std::vector<T>& b) {
-void operator+(std::vector<double>& a, const std::vector<double>& b) {
-    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::plus<double>());
-}
-
-
-//template <typename T>
-void operator-(std::vector<double>& a, const std::vector<double>& b) {
-   std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::minus<double>());
-}
-
-
-//template <typename T>
-void operator/(std::vector<double>& a, const std::vector<double>& b) {
-    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::divides<double>());
-}
-
-//template <typename T>
-void operator*(std::vector<double>& a, const std::vector<double>& b) {
-    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::multiplies<double>());
-}
-
-*/
-
-//template <typename T>
-void operator%(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::modulus<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = std::fmod(a[i], b[i]);
-		}
-	}
-}
-
-
-//template <typename T>
-void operator==(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::equal_to<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] == b[i];
-		}
-	}
-}
-
-//template <typename T>
-void operator!=(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::not_equal_to<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] != b[i];
-		}
-	}
-}
-
-//template <typename T>
-void operator>=(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::greater_equal<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] >= b[i];
-		}
-	}
-}
-
-//template <typename T>
-void operator<=(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::less_equal<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] <= b[i];
-		}
-	}
- }
-
-
-//template <typename T>
-void operator>(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::greater<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] > b[i];
-		}
-	}
-}
-
-//template <typename T>
-void operator<(std::vector<double>& a, const std::vector<double>& b) {
-//    std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::less<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = a[i] < b[i];
-		}
-	}
-}
-
-
-//template <typename T>
-void power(std::vector<double>& a, const std::vector<double>& b) {
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			a[i] = NAN;
-		} else {
-			a[i] = std::pow(a[i], b[i]);
-		}
-	}
-}
-
 
 bool smooth_operator(std::string oper, bool &logical) {
 	std::vector<std::string> f {"==", "!=", ">", "<", ">=", "<="};
@@ -181,56 +57,14 @@ SpatRaster SpatRaster::arith(SpatRaster x, std::string oper, SpatOptions &opt) {
 		return(out);
 	}
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!x.readStart()) {
-		out.setError(x.getError());
-		return(out);
-	}
- 	if (!out.writeStart(opt)) {
-		readStop();
-		x.readStop();
-		return out;
-	}
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a, b;
-		readBlock(a, out.bs, i);
-		x.readBlock(b, out.bs, i);
+	BinaryKernel kernel = getBinaryKernel(oper);
+	CellWorker fun = [kernel](std::vector<std::vector<double>> &v, size_t n) {
+		std::vector<double> &a = v[0];
+		std::vector<double> &b = v[1];
 		recycle(a,b);
-		if (oper == "+") {
-			std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::plus<double>());
-		} else if (oper == "-") {
-			std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::minus<double>());
-		} else if (oper == "*") {
-			std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::multiplies<double>());
-		} else if (oper == "/") {
-			std::transform(a.begin(), a.end(), b.begin(), a.begin(), std::divides<double>());
-		} else if (oper == "^") {
-			power(a, b);
-		} else if (oper == "%") {
-			 a % b;
-		} else if (oper == "==") {
-			a == b;
-		} else if (oper == "!=") {
-			a != b;
-		} else if (oper == ">=") {
-			a >= b;
-		} else if (oper == "<=") {
-			a <= b;
-		} else if (oper == ">") {
-			a > b;
-		} else if (oper == "<") {
-			a < b;
-		}
-		if (!out.writeBlock(a, i)) return out;
-
-	}
-	out.writeStop();
-	readStop();
-	x.readStop();
+		kernel(a.data(), b.data(), a.size());
+	};
+	out.writeCells({this, &x}, fun, opt);
 	return(out);
 }
 
@@ -255,89 +89,16 @@ SpatRaster SpatRaster::arith(double x, std::string oper, bool reverse, SpatOptio
 	}
 
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a;
-		readBlock(a, out.bs, i);
+	ScalarKernel kernel = getScalarKernel(oper, reverse);
+	CellWorker fun = [kernel, x](std::vector<std::vector<double>> &v, size_t n) {
+		std::vector<double> &a = v[0];
 		if (std::isnan(x)) {
-			for(double& d : a)  d = NAN;
-		} else if (oper == "+") {
-			for(double& d : a)  d += x;
-		} else if (oper == "-") {
-			if (reverse) {
-				for(double& d : a)  d = x - d;
-			} else {
-				for(double& d : a)  d -= x;
-			}
-		} 
-		else if (oper == "*") {
-			for(double& d : a)  d *= x;
-		} else if (oper == "/") {
-			if (reverse) {
-				for(double& d : a)  d = x / d;
-			} else {
-				for(double& d : a)  d /= x;
-			}
-		} else if (oper == "^") {
-			if (reverse) {
-				for(double& d : a)  d = std::pow(x, d);
-			} else {
-				for(double& d : a)  d = std::pow(d, x);
-			}
-		} else if (oper == "%") {
-			if (reverse) {
-				for (size_t i=0; i<a.size(); i++) {
-					a[i] = std::fmod(x, a[i]);
-				}
-			} else {
-				for (size_t i=0; i<a.size(); i++) {
-					a[i] = std::fmod(a[i], x);
-				}
-			}
-		} else if (oper == "==") {
-			for(double& d : a) if (!std::isnan(d)) d = d == x;
-		} else if (oper == "!=") {
-			for(double& d : a) if (!std::isnan(d)) d = d != x;
-		} else if (oper == ">=") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x >= d;
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d >= x;
-			}
-		} else if (oper == "<=") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x <= d;
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d <= x;
-			}
-		} else if (oper == ">") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x > d;
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d > x;
-			}
-		} else if (oper == "<") {
-			if (reverse) {
-				for(double& d : a) if (!std::isnan(d)) d = x < d;
-			} else {
-				for(double& d : a) if (!std::isnan(d)) d = d < x;
-			}
+			std::fill(a.begin(), a.end(), NAN);
 		} else {
-			// stop
+			kernel(a.data(), x, a.size());
 		}
-		if (!out.writeBlock(a, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	};
+	out.writeCells({this}, fun, opt);
 	return(out);
 }
 
@@ -385,115 +146,37 @@ SpatRaster SpatRaster::arith(std::vector<double> x, std::string oper, bool rever
 	}
 
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-
-	unsigned nc = ncol();
 	recycle(x, outnl);
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> v;
-		readBlock(v, out.bs, i);
+	ScalarKernel kernel = getScalarKernel(oper, reverse);
+	CellWorker fun = [kernel, x, innl, outnl](std::vector<std::vector<double>> &vin, size_t n) {
+		std::vector<double> &v = vin[0];
 		if (outnl > innl) {
-			recycle(v, outnl * out.bs.nrows[i] * nc);
+			recycle(v, outnl * n);
 		}
-		std::vector<double> vv;
-		unsigned off = out.bs.nrows[i] * nc;
 		for (size_t j=0; j<outnl; j++) {
-			unsigned s = j * off;
-			std::vector<double> a(v.begin()+s, v.begin()+s+off);
+			double *a = v.data() + j * n;
 			if (std::isnan(x[j])) {
-				for(double& d : a) d = NAN;
-			} else if (oper == "+") {
-				for(double& d : a) d += x[j];
-			} else if (oper == "-") {
-				if (reverse) {
-					for(double& d : a) d = x[j] - d;
-				} else {
-					for(double& d : a) d -= x[j];
-				}
-			} else if (oper == "*") {
-				for(double& d : a)  d *= x[j];
-			} else if (oper == "/") {
-				if (reverse) {
-					for(double& d : a) d = x[j] / d;
-				} else {
-					for(double& d : a) d /= x[j];
-				}
-			} else if (oper == "^") {
-				if (reverse) {
-					for(double& d : a)  d = std::pow(x[j], d);
-				} else {
-					for(double& d : a)  d = std::pow(d, x[j]);
-				}
-			} else if (oper == "%") {
-				if (reverse) {
-					for (size_t k=0; k<a.size(); k++) {
-						a[k] = std::fmod(x[j], a[k]);
-					}
-				} else {
-					for (size_t k=0; k<a.size(); k++) {
-						a[k] = std::fmod(a[k], x[j]);
-					}
-				}
-			} else if (oper == "==") {
-				for(double& d : a) if (!std::isnan(d)) d = d == x[j];
-			} else if (oper == "!=") {
-				for(double& d : a) if (!std::isnan(d)) d = d != x[j];
-			} else if (oper == ">=") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] >= d;
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d >= x[j];
-				}
-			} else if (oper == "<=") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] <= d;
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d <= x[j];
-				}
-			} else if (oper == ">") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] > d;
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d > x[j];
-				}
-			} else if (oper == "<") {
-				if (reverse) {
-					for(double& d : a) if (!std::isnan(d)) d = x[j] < d;
-				} else {
-					for(double& d : a) if (!std::isnan(d)) d = d < x[j];
-				}
+				std::fill(a, a + n, NAN);
 			} else {
-				// stop
+				kernel(a, x[j], n);
 			}
-			std::copy(a.begin(), a.end(), v.begin()+s);
 		}
-		if (!out.writeBlock(v, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	};
+	out.writeCells({this}, fun, opt);
 	return(out);
 }
 
 
 
-template <typename T> int sign(T value) {
-    return (T(0) < value) - (value < T(0));
+// apply a cell-by-cell kernel to all layers of x
+void apply_kernel(SpatRaster &x, SpatRaster &out, UnaryKernel kernel, SpatOptions &opt) {
+	CellWorker fun = [kernel](std::vector<std::vector<double>> &v, size_t n) {
+		kernel(v[0].data(), v[0].size());
+	};
+	out.writeCells({&x}, fun, opt);
 }
 
 
-double dabs(double x) {
-	return (x < 0 ? -1 * x : x);
-}
-
 SpatRaster SpatRaster::math(std::string fun, SpatOptions &opt) {
 
 	SpatRaster out = geometry();
@@ -509,51 +192,7 @@ SpatRaster SpatRaster::math(std::string fun, SpatOptions &opt) {
 		return out;
 	}
 
-	std::function<double(double)> mathFun;
-	if (fun == "sqrt") {
-		mathFun = static_cast<double(*)(double)>(sqrt);
-	} else if (fun == "abs") {
-		mathFun = dabs;
-	} else if (fun == "log") {
-		mathFun = static_cast<double(*)(double)>(log);
-	} else if (fun == "log2") {
-		mathFun = static_cast<double(*)(double)>(log2);
-	} else if (fun == "log10") {
-		mathFun = static_cast<double(*)(double)>(log10);
-	} else if (fun == "log1p") {
-		mathFun = static_cast<double(*)(double)>(log1p);
-	} else if (fun == "exp") {
-		mathFun = static_cast<double(*)(double)>(exp);
-	} else if (fun == "expm1") {
-		mathFun = static_cast<double(*)(double)>(expm1);
-	} else if (fun == "sign") {
-		mathFun = sign<double>;
-	} else if (fun == "ceiling") {
-		mathFun = static_cast<double(*)(double)>(ceil);
-	} else if (fun == "floor") {
-		mathFun = static_cast<double(*)(double)>(floor);
-	} else if (fun == "trunc") {
-		mathFun = static_cast<double(*)(double)>(trunc);
-	}
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a;
-		readBlock(a, out.bs, i);
-		for(double& d : a) if (!std::isnan(d)) d = mathFun(d);
-		if (!out.writeBlock(a, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	apply_kernel(*this, out, getUnaryKernel(fun), opt);
 	return(out);
 }
 
@@ -572,47 +211,20 @@ SpatRaster SpatRaster::math2(std::string fun, unsigned digits, SpatOptions &opt)
 
 	if (digits == 0) out.setValueType(1);
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a;
-		readBlock(a, out.bs, i);
-		if (fun == "round") {
-			for(double& d : a) d = roundn(d, digits);
-		} else if (fun == "signif") {
-			for(double& d : a) if (!std::isnan(d)) d = signif(d, digits);
+	bool round = fun == "round";
+	CellWorker cfun = [round, digits](std::vector<std::vector<double>> &v, size_t n) {
+		if (round) {
+			for(double& d : v[0]) d = roundn(d, digits);
+		} else {
+			for(double& d : v[0]) if (!std::isnan(d)) d = signif(d, digits);
 		} 
-		if (!out.writeBlock(a, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	};
+	out.writeCells({this}, cfun, opt);
 	return(out);
 }
 
 
 
-double sin_pi(double &x) {
-	return sin(x * M_PI);
-}
-
-double cos_pi(double &x) {
-	return sin(x * M_PI);
-}
-
-double tan_pi(double &x) {
-	return sin(x * M_PI);
-}
-
-
-
 SpatRaster SpatRaster::trig(std::string fun, SpatOptions &opt) {
 
 	SpatRaster out = geometry();
@@ -624,57 +236,7 @@ SpatRaster SpatRaster::trig(std::string fun, SpatOptions &opt) {
 		return out;
 	}
 
-	std::function<double(double&)> trigFun;
-	if (fun == "sin") {
-		trigFun = static_cast<double(*)(double)>(sin);
-	} else if (fun == "cos") {
-		trigFun = static_cast<double(*)(double)>(cos);
-	} else if (fun == "tan") {
-		trigFun = static_cast<double(*)(double)>(tan);
-	} else if (fun == "asin") {
-		trigFun = static_cast<double(*)(double)>(asin);
-	} else if (fun == "acos") {
-		trigFun = static_cast<double(*)(double)>(acos);
-	} else if (fun == "atan") {
-		trigFun = static_cast<double(*)(double)>(atan);
-	} else if (fun == "sinh") {
-		trigFun = static_cast<double(*)(double)>(sinh);
-	} else if (fun == "cosh") {
-		trigFun = static_cast<double(*)(double)>(cosh);
-	} else if (fun == "tanh") {
-		trigFun = static_cast<double(*)(double)>(tanh);
-	} else if (fun == "asinh") {
-		trigFun = static_cast<double(*)(double)>(asinh);
-	} else if (fun == "acosh") {
-		trigFun = static_cast<double(*)(double)>(acosh);
-	} else if (fun == "atanh") {
-		trigFun = static_cast<double(*)(double)>(atanh);
-	} else if (fun == "sinpi") {
-		trigFun = sin_pi;
-	} else if (fun == "cospi") {
-		trigFun = cos_pi;
-	} else if (fun == "tanpi") {
-		trigFun = tan_pi;
-	}
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a;
-		readValues(a, out.bs.row[i], out.bs.nrows[i], 0, ncol());
-		for (double& d : a) if (!std::isnan(d)) d = trigFun(d);
-		if (!out.writeBlock(a, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	apply_kernel(*this, out, getUnaryKernel(fun), opt);
 	return(out);
 }
 
@@ -682,91 +244,29 @@ SpatRaster SpatRaster::trig(std::string fun, SpatOptions &opt) {
 SpatRaster SpatRaster::atan_2(SpatRaster x, SpatOptions &opt) {
 	SpatRaster out = geometry();
 	if (!hasValues()) return out;
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!x.readStart()) {
-		out.setError(x.getError());
-		return(out);
-	}
-  	if (!out.writeStart(opt)) {
-		readStop();
-		x.readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a, b;
-		readValues(a, out.bs.row[i], out.bs.nrows[i], 0, ncol());
-		x.readValues(b, out.bs.row[i], out.bs.nrows[i], 0, ncol());
+	CellWorker fun = [](std::vector<std::vector<double>> &v, size_t n) {
+		std::vector<double> &a = v[0];
+		std::vector<double> &b = v[1];
 		recycle(a, b);
-		std::vector<double> d(a.size());
 		for (size_t i=0; i<a.size(); i++) {
 			if (std::isnan(a[i]) || std::isnan(b[i])) {
-				d[i] = NAN;
+				a[i] = NAN;
 			} else {
-				d[i] = atan2(a[i], b[i]);
+				a[i] = atan2(a[i], b[i]);
 			}
 		}
-		if (!out.writeBlock(d, i)) return out;
-	}
-	out.writeStop();
-	readStop();
-	x.readStop();
+	};
+	out.writeCells({this, &x}, fun, opt);
 	return(out);
 }
 
 
 
-template <typename T>
-std::vector<T> operator&(const std::vector<T>& a, const std::vector<T>& b) {
-    std::vector<T> result;
-    result.reserve(a.size());
-    std::transform(a.begin(), a.end(), b.begin(), std::back_inserter(result), std::logical_and<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			result[i] = NAN;
-		} 
-	}
-    return result;
-}
-
-
-template <typename T>
-std::vector<T> operator|(const std::vector<T>& a, const std::vector<T>& b) {
-    std::vector<T> result;
-    result.reserve(a.size());
-    std::transform(a.begin(), a.end(), b.begin(), std::back_inserter(result), std::logical_or<T>());
-	for (size_t i=0; i<a.size(); i++) {
-		if (std::isnan(a[i]) || std::isnan(b[i])) {
-			result[i] = NAN;
-		} 
-	}
-    return result;
-}
-
-
 SpatRaster SpatRaster::isnot(SpatOptions &opt) {
 	SpatRaster out = geometry();
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
-		for (size_t j=0; j<a.size(); j++) {
-			a[i] = !a[i];
-		}
-		if (!out.writeBlock(a, i)) return out;
-
-	}
-	out.writeStop();
-	readStop();
+	out.setValueType(3);
+	if (!hasValues()) return out;
+	apply_kernel(*this, out, getUnaryKernel("!"), opt);
 	return(out);
 }
 
@@ -786,37 +286,11 @@ SpatRaster SpatRaster::logic(SpatRaster x, std::string oper, SpatOptions &opt) {
 		return(out);
 	}
 
- 	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!x.readStart()) {
-		out.setError(x.getError());
-		return(out);
-	}
-
- 	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
-		std::vector<double> b;
-		x.readBlock(b, out.bs, i);
-		if (oper == "&") {
-			a = a & b; 
-		} else if (oper == "|") {
-			a = a | b; 
-		} else {
-			// stop
-		}
-		if (!out.writeBlock(a, i)) return out;
-
-	}
-	out.writeStop();
-	readStop();
-	x.readStop();
+	BinaryKernel kernel = getBinaryKernel(oper);
+	CellWorker fun = [kernel](std::vector<std::vector<double>> &v, size_t n) {
+		kernel(v[0].data(), v[1].data(), v[0].size());
+	};
+	out.writeCells({this, &x}, fun, opt);
 	return(out);
 }
 
@@ -826,37 +300,23 @@ SpatRaster SpatRaster::logic(bool x, std::string oper, SpatOptions &opt) {
 
 	SpatRaster out = geometry();
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-  	if (!out.writeStart(opt)) {
-		readStop();
+	std::vector<std::string> f {"&", "|", "istrue", "isfalse"}; 
+	if (std::find(f.begin(), f.end(), oper) == f.end()) {
+		out.setError("unknown operator: " + oper);
 		return out;
 	}
-	std::vector<double> v, m;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
-		if (std::isnan(x)) {
-			for(double& d : a)  d = NAN;
-		} else if (oper == "&") {
-			for(double& d : a)  d = (d==1) & x;
-		} else if (oper == "|") {
-			for(double& d : a)  d = (d==1) | x;
-		} else if (oper == "istrue") {
-			for(double& d : a)  d = d==1 ? 1 : 0;
-		} else if (oper == "isfalse") {
-			for(double& d : a)  d = d!=1 ? 1 : 0;
+
+	UnaryKernel ukernel = getUnaryKernel(oper);
+	ScalarKernel skernel = getScalarKernel(oper, false);
+	double dx = x;
+	CellWorker fun = [ukernel, skernel, dx](std::vector<std::vector<double>> &v, size_t n) {
+		if (ukernel != NULL) {
+			ukernel(v[0].data(), v[0].size());
 		} else {
-			out.setError("unknown operator: " + oper);
-			return out;
+			skernel(v[0].data(), dx, v[0].size());
 		}
-		if (!out.writeBlock(a, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	};
+	out.writeCells({this}, fun, opt);
 	return(out);
 }
 
@@ -918,16 +378,17 @@ SpatRaster SpatRaster::cum(std::string fun, bool narm, SpatOptions &opt) {
 }
 
 
-double vstdev(std::vector<double> v, bool narm) {
-	double m = vmean(v, narm);
-	for (double& d : v) d = pow(d - m, 2);
-	m = vmean(v, narm);
-	return sqrt(m);
+// the layers of each cell of x are reduced to the nout() layers of out
+void reduce_layers(SpatRaster &x, SpatRaster &out, const LayerReducer &reducer, SpatOptions &opt) {
+	CellWorker fun = [reducer](std::vector<std::vector<double>> &v, size_t n) {
+		std::vector<double> b(n * reducer.nout());
+		reducer.reduce(v[0], n, b.data());
+		v[0] = std::move(b);
+	};
+	out.writeCells({&x}, fun, opt);
 }
 
 
-
-
 SpatRaster SpatRaster::summary_numb(std::string fun, std::vector<double> add, bool narm, SpatOptions &opt) {
 
 	SpatRaster out = geometry(1);
@@ -937,47 +398,12 @@ SpatRaster SpatRaster::summary_numb(std::string fun, std::vector<double> add, bo
 		return range(add, narm, opt);
 	} 
 	out.source[0].names[0] = fun;
-	std::function<double(std::vector<double>&, bool)> sumFun;
-	if (fun == "std") {
-		sumFun = vstdev;
-	} else {
-		if (!haveFun(fun)) {
-			out.setError("unknown function argument");
-			return out;
-		}
-		sumFun = getFun(fun);
-	}
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-
-	if (!out.writeStart(opt)) {
-		readStop();
+	LayerReducer reducer;
+	if (!reducer.init(fun, narm, add)) {
+		out.setError("unknown function argument");
 		return out;
 	}
-	unsigned nl = nlyr();
-	std::vector<double> v(nl);
-	if (add.size() > 0) v.insert( v.end(), add.begin(), add.end() );
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
-		unsigned nc = out.bs.nrows[i] * out.ncol();
-		std::vector<double> b(nc);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
-			}
-			b[j] = sumFun(v, narm);
-		}
-		if (!out.writeBlock(b, i)) return out;
-
-	}
-	out.writeStop();
-	readStop();
+	reduce_layers(*this, out, reducer, opt);
 	return(out);
 }
 
@@ -1005,39 +431,15 @@ SpatRaster SpatRaster::modal(std::vector<double> add, std::string ties, bool nar
 	} 
 	size_t ities = std::distance(f.begin(), it);
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-
 	uint32_t seed = 1;
 	std::default_random_engine rgen(seed);
 	std::uniform_real_distribution<double> dist (0.0,1.0);
 
-	unsigned nl = nlyr();
-	std::vector<double> v(nl);
-	v.insert( v.end(), add.begin(), add.end() );
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
-		unsigned nc = out.bs.nrows[i] * out.ncol();
-		std::vector<double> b(nc);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
-			}
-			b[j] = modal_value(v, ities, narm, rgen, dist);
-		}
-		if (!out.writeBlock(b, i)) return out;
-	}
-	out.writeStop();
-	readStop();
+	LayerReducer reducer;
+	reducer.init([ities, rgen, dist](std::vector<double> &v, bool narm) {
+		return modal_value(v, ities, narm, rgen, dist);
+	}, narm, add);
+	reduce_layers(*this, out, reducer, opt);
 	return(out);
 }
 
@@ -1050,38 +452,9 @@ SpatRaster SpatRaster::range(std::vector<double> add, bool narm, SpatOptions &op
 	out.source[0].names[1] = "range_max" ;
   	if (!hasValues()) { return out; }
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	unsigned nl = nlyr();
-	std::vector<double> v(nl);
-	v.insert( v.end(), add.begin(), add.end() );
-
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> a; 
-		readBlock(a, out.bs, i);
-		unsigned nc = out.bs.nrows[i] * out.ncol();
-		std::vector<double> b(nc * 2);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<nl; k++) {
-				v[k] = a[j+k*nc];
-			}
-			std::vector<double> rng = vrange(v, narm);
-			b[j] = rng[0];
-			b[j+nc] = rng[1];
-		}
-		if (!out.writeBlock(b, i)) return out;
-
-	}
-	out.writeStop();
-	readStop();
+	LayerReducer reducer;
+	reducer.init("range", narm, add);
+	reduce_layers(*this, out, reducer, opt);
 	return(out);
 }
 
@@ -1100,53 +473,29 @@ SpatRaster SpatRasterStack::summary_numb(std::string fun, std::vector<double> ad
 	}
   	if (!ds[0].hasValues()) { return out; }
 
-	std::function<double(std::vector<double>&, bool)> sumFun;
-	if (fun == "std") {
-		sumFun = vstdev;
-	} else {
-		if (!haveFun(fun)) {
-			out.setError("unknown function argument");
-			return out;
-		}
-		sumFun = getFun(fun);
-	}
-
-	for (size_t i=0; i < ns; i++) {
-		if (!ds[i].readStart()) {
-			out.setError(ds[i].getError());
-			return(out);
-		}
+	LayerReducer reducer;
+	if (!reducer.init(fun, narm, add)) {
+		out.setError("unknown function argument");
+		return out;
 	}
 
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
+	// the values of a cell and layer in each of the datasets are reduced
+	std::vector<SpatRaster*> x(ns);
+	for (size_t i=0; i<ns; i++) {
+		x[i] = &ds[i];
 	}
-	std::vector<double> v(ns);
-	if (add.size() > 0) v.insert( v.end(), add.begin(), add.end() );
-
-	std::vector<std::vector<double>> a(ns); 
-	for (size_t i=0; i < out.bs.n; i++) {
-		unsigned nc = out.bs.nrows[i] * out.ncol() * nl;
-		for (size_t j=0; j < ns; j++) {
-			ds[j].readBlock(a[j], out.bs, i);
-			recycle(a[j], nc);
+	CellWorker cfun = [reducer, nl](std::vector<std::vector<double>> &v, size_t n) {
+		size_t nc = n * nl;
+		std::vector<const double*> p(v.size());
+		for (size_t k=0; k<v.size(); k++) {
+			recycle(v[k], nc);
+			p[k] = v[k].data();
 		}
 		std::vector<double> b(nc);
-		for (size_t j=0; j<nc; j++) {
-			for (size_t k=0; k<ns; k++) {
-				v[k] = a[k][j];
-			}
-			b[j] = sumFun(v, narm);
-		}
-		if (!out.writeBlock(b, i)) return out;
-
-	}
-	for (size_t i=0; i < ns; i++) {
-		ds[i].readStop();
-	}
-	out.writeStop();
+		reducer.reduce(p, nc, b.data());
+		v[0] = std::move(b);
+	};
+	out.writeCells(x, cfun, opt);
 	return(out);
 }
 
@@ -1162,25 +511,8 @@ SpatRaster SpatRasterStack::summary(std::string fun, bool narm, SpatOptions &opt
 SpatRaster SpatRaster::isnan(SpatOptions &opt) {
 	SpatRaster out = geometry();
 	out.setValueType(3);
-	
-    if (!hasValues()) return out;
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i=0; i<out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		for (double &d : v) d = std::isnan(d);
-		if (!out.writeBlock(v, i)) return out;
-	}
-	readStop();
-	out.writeStop();
+	if (!hasValues()) return out;
+	apply_kernel(*this, out, getUnaryKernel("isnan"), opt);
 	return(out);
 }
 
@@ -1188,24 +520,8 @@ SpatRaster SpatRaster::isnan(SpatOptions &opt) {
 SpatRaster SpatRaster::isnotnan(SpatOptions &opt) {
 	SpatRaster out = geometry();
 	out.setValueType(3);
-    if (!hasValues()) return out;
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i=0; i<out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		for (double &d : v) d = ! std::isnan(d);
-		if (!out.writeBlock(v, i)) return out;
-	}
-	readStop();
-	out.writeStop();
+	if (!hasValues()) return out;
+	apply_kernel(*this, out, getUnaryKernel("isnotnan"), opt);
 	return(out);
 }
 
@@ -1213,24 +529,8 @@ SpatRaster SpatRaster::isnotnan(SpatOptions &opt) {
 SpatRaster SpatRaster::isfinite(SpatOptions &opt) {
 	SpatRaster out = geometry();
 	out.setValueType(3);
-    if (!hasValues()) return out;
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i=0; i<out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		for (double &d : v) d = std::isfinite(d);
-		if (!out.writeBlock(v, i)) return out;
-	}
-	readStop();
-	out.writeStop();
+	if (!hasValues()) return out;
+	apply_kernel(*this, out, getUnaryKernel("isfinite"), opt);
 	return(out);
 }
 
@@ -1238,24 +538,7 @@ SpatRaster SpatRaster::isfinite(SpatOptions &opt) {
 SpatRaster SpatRaster::isinfinite(SpatOptions &opt) {
 	SpatRaster out = geometry();
 	out.setValueType(3);
-	
-    if (!hasValues()) return out;
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i=0; i<out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		for (double &d : v) d = std::isinf(d);
-		if (!out.writeBlock(v, i)) return out;
-	}
-	readStop();
-	out.writeStop();
+	if (!hasValues()) return out;
+	apply_kernel(*this, out, getUnaryKernel("isinfinite"), opt);
 	return(out);
 }
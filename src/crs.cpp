@@ -336,27 +336,70 @@ SpatVector SpatVector::project(std::string crs) {
 	std::vector<unsigned> keeprows;
 
 
-	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
-		SpatGeom gg;
-		gg.gtype = g.gtype;
-		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
-			if (poCT->Transform(p.x.size(), &p.x[0], &p.y[0]) ) {
-				SpatPart pp(p.x, p.y);
-				if (p.hasHoles()) {
-					for (size_t k=0; k < p.nHoles(); k++) {
-						SpatHole h = p.getHole(k);
-						if (poCT->Transform(h.x.size(), &h.x[0], &h.y[0])) {
-							pp.addHole(h.x, h.y);
-						}
+	// the coordinates of a range of geometries (of at most "chunk" coordinates,
+	// or a single geometry) are transformed together; a part (or hole) is
+	// dropped if any of its coordinates could not be transformed
+	const size_t chunk = 1048576;
+	std::vector<double> x, y;
+	std::vector<int> ok;
+	size_t ng = size();
+	size_t i = 0;
+	while (i < ng) {
+		size_t j = i;
+		size_t n = 0;
+		do {
+			n += geoms[j].ncoords();
+			j++;
+		} while ((j < ng) && ((n + geoms[j].ncoords()) <= chunk));
+
+		x.resize(0);
+		y.resize(0);
+		x.reserve(n);
+		y.reserve(n);
+		for (size_t k=i; k<j; k++) {
+			for (const SpatPart &p : geoms[k].parts) {
+				x.insert(x.end(), p.x.begin(), p.x.end());
+				y.insert(y.end(), p.y.begin(), p.y.end());
+				for (const SpatHole &h : p.holes) {
+					x.insert(x.end(), h.x.begin(), h.x.end());
+					y.insert(y.end(), h.y.begin(), h.y.end());
+				}
+			}
+		}
+		ok.assign(n, TRUE);
+		for (size_t start=0; start<n; start+=chunk) {
+			int m = std::min(chunk, n - start);
+			poCT->Transform(m, &x[start], &y[start], NULL, &ok[start]);
+		}
+
+		size_t off = 0;
+		auto ring_ok = [&](size_t m) {
+			return (m > 0) && (std::find(ok.begin()+off, ok.begin()+off+m, FALSE) == (ok.begin()+off+m));
+		};
+		for (size_t k=i; k<j; k++) {
+			SpatGeom gg;
+			gg.gtype = geoms[k].gtype;
+			for (const SpatPart &p : geoms[k].parts) {
+				size_t m = p.x.size();
+				bool pok = ring_ok(m);
+				SpatPart pp;
+				if (pok) {
+					pp = SpatPart(std::vector<double>(x.begin()+off, x.begin()+off+m), std::vector<double>(y.begin()+off, y.begin()+off+m));
+				}
+				off += m;
+				for (const SpatHole &h : p.holes) {
+					m = h.x.size();
+					if (pok && ring_ok(m)) {
+						pp.addHole(std::vector<double>(x.begin()+off, x.begin()+off+m), std::vector<double>(y.begin()+off, y.begin()+off+m));
 					}
+					off += m;
 				}
-				gg.addPart(pp);
+				if (pok) gg.addPart(pp);
 			}
+			keeprows.push_back(k);
+			s.addGeom(gg);
 		}
-		keeprows.push_back(i);
-		s.addGeom(gg);
+		i = j;
 	}
 	s.df = df.subset_rows(keeprows);
 	OCTDestroyCoordinateTransformation(poCT);
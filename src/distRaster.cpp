@@ -23,6 +23,10 @@
 #include "recycle.h"
 #include "math_utils.h"
 #include "vecmath.h"
+#include "file_utils.h"
+#include "tiledgrid.h"
+#include <queue>
+#include <numeric>
 
 void shortDistPoints(std::vector<double> &d, const std::vector<double> &x, const std::vector<double> &y, const std::vector<double> &px, const std::vector<double> &py, const bool& lonlat, const double &lindist) {
 	if (lonlat) {
@@ -191,43 +195,6 @@ SpatRaster SpatRaster::distance_vector(SpatVector p, SpatOptions &opt) {
 
 
 
-SpatRaster SpatRaster::distance(SpatOptions &opt) {
-	SpatRaster out = geometry(1);
-	if (!hasValues()) {
-		out.setError("SpatRaster has no values");
-		return out;
-	}
-
-	SpatOptions ops(opt);
-	size_t nl = nlyr();
-	if (nl > 1) {
-		std::vector<std::string> nms = getNames();
-		if (ops.names.size() == nms.size()) {
-			nms = opt.names;
-		}		
-		out.source.resize(nl);
-		for (unsigned i=0; i<nl; i++) {
-			std::vector<unsigned> lyr = {i};
-			SpatRaster r = subset(lyr, ops);
-			ops.names = {nms[i]};
-			r = r.distance(ops);
-			out.source[i] = r.source[0];
-		}
-		if (opt.get_filename() != "") {
-			out = out.writeRaster(opt);
-		}
-		return out;
-	}
-
-	out = edges(false, "inner", 8, NAN, ops);
-	SpatVector p = out.as_points(false, true, ops);
-	if (p.size() == 0) {
-		return out.init({0}, opt);
-	}
-	out = disdir_vector_rasterize(p, false, true, false, false, opt);
-	return out;
-}
-
 SpatRaster SpatRaster::direction(bool from, bool degrees, SpatOptions &opt) {
 	SpatRaster out = geometry(1);
 	if (!hasValues()) {
@@ -463,537 +430,647 @@ std::vector<double>  SpatVector::distance(SpatVector x, bool pairwise) {
 	return d;
 }
 
-double minCostDist(std::vector<double> &d) { 
-	d.erase(std::remove_if(d.begin(), d.end(),
-		[](const double& v) { return std::isnan(v); }), d.end());
-	std::sort(d.begin(), d.end());
-	return d.size() > 0 ? d[1] : NAN;
-}
-	
+// the type of a cell in the search. DistanceSetup sets, for cell k of
+// the n cells in v (all layers of a block), the cost of passing through
+// it and the id of an origin cell. "cell" is the cell number
+enum DistanceCell { DIST_CELL=0, DIST_ORIGIN=1, DIST_BARRIER=2, DIST_ERROR=3 };
+typedef std::function<DistanceCell(const std::vector<double> &v, size_t n, size_t k, size_t cell, double &cost, double &id)> DistanceSetup;
 
-std::vector<double> cost_dist_planar(double source, std::vector<double> &v, std::vector<double> &above, std::vector<double> res, size_t nr, size_t nc, double lindist) {
 
-	double dx = res[0] * lindist;
-	double dy = res[1] * lindist;
-	double dxy = sqrt(dx * dx + dy *dy);
+// Dijkstra's shortest paths from all origins at once, over the graph of cells
+// connected to their eight neighbors. The cost of moving between two cells is
+// the distance between their centers, multiplied by their average cost if "costs"
+SpatRaster gridDijkstra(SpatRaster &x, DistanceSetup setup, bool costs, bool allocation, SpatOptions &opt) {
 
-	std::vector<double> dist(v.size(), 0);
+	SpatRaster out = x.geometry(allocation ? 2 : 1);
+	if (allocation) {
+		out.setNames({"distance", "allocation"});
+	}
+	size_t nr = x.nrow();
+	size_t nc = x.ncol();
 
-	std::vector<double> cd;
+	size_t nv = 1 + costs + allocation;
+	SpatRaster g = x.geometry(nv);
+	SpatOptions mopt(opt);
+	mopt.ncopies = 2;
+	TiledGrid grid;
+	std::string msg;
+	std::string tmpfile = tempFile(opt.get_tempdir(), opt.pid, "_dist.bin");
+	if (!grid.init(nr, nc, nv, g.canProcessInMemory(mopt), tmpfile, msg)) {
+		out.setError(msg);
+		return out;
+	}
+	double* dist = grid.var(0);
+	double* cost = costs ? grid.var(1) : NULL;
+	double* ids = allocation ? grid.var(nv-1) : NULL;
 
-	//top to bottom
-    //left to right
+	typedef std::pair<double, size_t> QItem;
+	std::priority_queue<QItem, std::vector<QItem>, std::greater<QItem>> queue;
 
-	//first cell, no cell left of it
-	if (std::isnan(v[0]) ) { 
-		dist[0] = NAN;	
-	} else if (v[0] != source) {
-		cd = {v[0], above[0] * dy};
-		dist[0] = minCostDist(cd);
+	if (!x.readStart()) {
+		out.setError(x.getError());
+		return out;
 	}
-	for (size_t i=1; i<nc; i++) { //first row, no row above it, use "above"
-		if (!std::isnan(v[i])) {
-			dist[i] = NAN;	
-		} else if (v[i] != source) {
-			cd = {above[i] * dy, above[i-1] * dxy, dist[i-1] * dx};
-			dist[i] = v[i] + minCostDist(cd);
+	BlockSize bs = x.getBlockSize(opt);
+	std::vector<double> v;
+	double inf = std::numeric_limits<double>::infinity();
+	for (size_t i=0; i<bs.n; i++) {
+		x.readBlock(v, bs, i);
+		if (x.hasError()) {
+			out.setError(x.getError());
+			x.readStop();
+			return out;
+		}
+		size_t n = bs.nrows[i] * nc;
+		size_t off = bs.row[i] * nc;
+		for (size_t k=0; k<n; k++) {
+			size_t t = grid.cell(bs.row[i] + k / nc, k % nc);
+			double cst = 0, id = NAN;
+			DistanceCell type = setup(v, n, k, off + k, cst, id);
+			if (type == DIST_ERROR) {
+				x.readStop();
+				out.setError("cost values cannot be negative");
+				return out;
+			} else if (type == DIST_ORIGIN) {
+				dist[t] = 0;
+			} else if (type == DIST_BARRIER) {
+				dist[t] = NAN;
+			} else {
+				dist[t] = inf;
+			}
+			if (costs) cost[t] = cst;
+			if (allocation) ids[t] = id;
 		}
 	}
+	x.readStop();
 
-	for (size_t r=1; r<nr; r++) { //other rows
-		size_t start=r*nc;
-		if (std::isnan(v[start])) {
-			dist[start] = NAN;			
-		} else if (v[start] != source) {
-			cd = {dist[start-nc] * dy, dist[start-nc] * dy };
-			dist[start] = v[start] + minCostDist(cd);
+	// the distance between adjacent cells in row r (wx),
+	// and between row r and r+1 (wy, and diagonally, wxy)
+	std::vector<double> wx(nr), wy(nr, NAN), wxy(nr, NAN);
+	std::vector<double> res = x.resolution();
+	bool lonlat = x.is_lonlat();
+	bool wrap = lonlat && x.is_global_lonlat();
+	if (lonlat) {
+		for (size_t r=0; r<nr; r++) {
+			double lat = x.yFromRow(r);
+			wx[r] = distance_lonlat(0, lat, res[0], lat);
+			if (r < (nr-1)) {
+				double lat2 = lat - res[1];
+				wy[r] = distance_lonlat(0, lat, 0, lat2);
+				wxy[r] = distance_lonlat(0, lat, res[0], lat2);
+			}
 		}
-		size_t end = start+nc;
-		for (size_t i=(start+1); i<end; i++) {
-			if (!std::isnan(v[i])) {
-				if (v[i] == source) {
-					dist[i] = 0;
+	} else {
+		double m = x.source[0].srs.to_meter();
+		m = std::isnan(m) ? 1 : m;
+		double dx = res[0] * m;
+		double dy = res[1] * m;
+		std::fill(wx.begin(), wx.end(), dx);
+		std::fill(wy.begin(), wy.end(), dy);
+		std::fill(wxy.begin(), wxy.end(), sqrt(dx * dx + dy * dy));
+	}
+
+	// only the origins at the front (with a neighbor that is not an origin or
+	// a barrier) are queued, so that the queue is not as large as the raster
+	// if most cells are origins
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			if (dist[grid.cell(r, c)] != 0) continue;
+			bool front = false;
+			for (int dr=-1; (dr<2) && !front; dr++) {
+				if (((dr < 0) && (r == 0)) || ((dr > 0) && (r == (nr-1)))) continue;
+				for (int dc=-1; (dc<2) && !front; dc++) {
+					if ((dr == 0) && (dc == 0)) continue;
+					size_t c2;
+					if ((dc < 0) && (c == 0)) {
+						if (!wrap) continue;
+						c2 = nc-1;
+					} else if ((dc > 0) && (c == (nc-1))) {
+						if (!wrap) continue;
+						c2 = 0;
+					} else {
+						c2 = c + dc;
+					}
+					front = dist[grid.cell(r + dr, c2)] == inf;
+				}
+			}
+			if (front) queue.push(QItem(0, r * nc + c));
+		}
+	}
+
+	while (!queue.empty()) {
+		QItem q = queue.top();
+		queue.pop();
+		size_t r = q.second / nc;
+		size_t c = q.second % nc;
+		size_t t = grid.cell(r, c);
+		// an older (longer) path to this cell
+		if (q.first > dist[t]) continue;
+		for (int dr=-1; dr<2; dr++) {
+			if (((dr < 0) && (r == 0)) || ((dr > 0) && (r == (nr-1)))) continue;
+			size_t r2 = r + dr;
+			size_t wr = dr < 0 ? r2 : r;
+			for (int dc=-1; dc<2; dc++) {
+				if ((dr == 0) && (dc == 0)) continue;
+				size_t c2;
+				if ((dc < 0) && (c == 0)) {
+					if (!wrap) continue;
+					c2 = nc-1;
+				} else if ((dc > 0) && (c == (nc-1))) {
+					if (!wrap) continue;
+					c2 = 0;
 				} else {
-					cd = { v[i], dist[i-1] * dx, dist[i-nc] * dy, dist[i-nc-1] * dxy };
-					dist[i] = minCostDist(cd);
+					c2 = c + dc;
+				}
+				size_t t2 = grid.cell(r2, c2);
+				// false for barriers (NAN) and cells that are done
+				if (!(dist[t2] > q.first)) continue;
+				double w = dr == 0 ? wx[r] : (dc == 0 ? wy[wr] : wxy[wr]);
+				if (costs) {
+					w *= (cost[t] + cost[t2]) / 2;
+				}
+				double d = q.first + w;
+				if (d < dist[t2]) {
+					dist[t2] = d;
+					if (allocation) ids[t2] = ids[t];
+					queue.push(QItem(d, r2 * nc + c2));
 				}
 			}
 		}
 	}
 
-	//right to left
-	if ( !std::isnan(v[nc-1])) { //first cell
-		if (v[0] == source) {
-			dist[nc-1] = 0;
-		} else {
-			cd = {v[nc-1], above[nc-1] * dy};
-			dist[0] = minCostDist(cd);
-		}
-	}
-
-	for (int i=(nc-2); i > -1; i--) { // other cells on first row
-		if (!std::isnan(v[i])) {
-			if (v[i] == source) {
-				dist[i] = 0;
-			} else {
-				cd = { v[i], dist[i+1], above[i+1] * dxy, above[i] * dy, dist[i] };
-				dist[i] = minCostDist(cd);
-			}
-		}
+	if (!out.writeStart(opt)) {
+		return out;
 	}
-
-	for (size_t r=1; r<nr; r++) { // other rows
-		size_t start=(r+1)*nc-1;
-		if (!std::isnan(v[start])) {
-			if (v[start] == source) {
-				dist[start] = 0;
-			} else {	
-				cd = { dist[start], dist[start-nc] * dy };
-				dist[start] = minCostDist(cd);
-			}
-		}
-		for (size_t i=start-1; i>=(r*nc); i--) {
-			if (std::isnan(v[i])) {
-				cd = { dist[i], dist[i+1], dist[i-nc], dist[i-nc+1] };
-				dist[i] = minCostDist(cd);
-			}
+	for (size_t i=0; i<out.bs.n; i++) {
+		size_t n = out.bs.nrows[i] * nc;
+		v.resize(0);
+		v.resize(allocation ? 2*n : n);
+		for (size_t k=0; k<n; k++) {
+			size_t t = grid.cell(out.bs.row[i] + k / nc, k % nc);
+			// unreachable cells are NA
+			bool ok = dist[t] < inf;
+			v[k] = ok ? dist[t] : NAN;
+			if (allocation) v[n+k] = ok ? ids[t] : NAN;
 		}
+		if (!out.writeBlock(v, i)) return out;
 	}
-
-	size_t off = (nr-1) * nc;
-	above = std::vector<double>(dist.begin()+off, dist.end());
-
-	return dist;
+	out.writeStop();
+	return out;
 }
 
 
-SpatRaster SpatRaster::costDistance(double to, SpatOptions &opt) {
+SpatRaster SpatRaster::costDistance(double target, bool allocation, SpatOptions &opt) {
 
 	SpatRaster out = geometry(1);
 	if (!hasValues()) {
 		out.setError("cannot compute distance for a raster with no values");
 		return out;
 	}
-
-	SpatOptions ops(opt);
-	if (nlyr() > 1) {
-		std::vector<unsigned> lyr = {0};
+	if (nlyr() > 2) {
+		std::vector<unsigned> lyr = {0, 1};
+		SpatOptions ops(opt);
 		out = subset(lyr, ops);
-		out = out.costDistance(to, opt);
-		out.addWarning("distance computations are only done for the first input layer");
+		out = out.costDistance(target, allocation, opt);
+		out.addWarning("distance computations are only done for the first two input layers");
 		return out;
 	}
 
-	//bool isgeo = out.islonlat
-
-	double m = source[0].srs.to_meter();
-	m = std::isnan(m) ? 1 : m;
-
-	std::vector<double> res = resolution();
-
-	SpatRaster first = out.geometry();
-
-	std::string tempfile = "";
-	std::vector<double> above(ncol(), std::numeric_limits<double>::infinity());
-    std::vector<double> d, v, vv;
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	std::string filename = opt.get_filename();
-	opt.set_filenames({""});
- 	if (!first.writeStart(opt)) { return first; }
-
-//	bool lonlat = is_lonlat(); 
-	size_t nc = ncol();
-	for (size_t i = 0; i < first.bs.n; i++) {
-        readBlock(v, first.bs, i);
-//		if (lonlat) {
-//			double lat = yFromRow(first.bs.row[i]);
-//			d = broom_dist_geo(v, above, res, first.bs.nrows[i], nc, lat, -1);
-//		} else {
-			d = cost_dist_planar(to, v, above, res, first.bs.nrows[i], nc, m);
-//		}
-		if (!first.writeValues(d, first.bs.row[i], first.bs.nrows[i])) return first;
-	}
-	first.writeStop();
-
-	if (!first.readStart()) {
-		out.setError(first.getError());
-		return(out);
-	}
-
-	opt.set_filenames({filename});
-	above = std::vector<double>(ncol(), std::numeric_limits<double>::infinity());
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (int i = out.bs.n; i>0; i--) {
-        readBlock(v, out.bs, i-1);
-		std::reverse(v.begin(), v.end());
-//		if (lonlat) {
-//			double lat = yFromRow(out.bs.row[i-1] + out.bs.nrows[i-1] - 1);
-//			d = broom_dist_geo(v, above, res, out.bs.nrows[i-1], nc, lat, 1);
-//		} else {
-			d = cost_dist_planar(to, v, above, res, out.bs.nrows[i-1], nc, m);
-//		}
-		first.readBlock(vv, out.bs, i-1);
-	    std::transform (d.rbegin(), d.rend(), vv.begin(), vv.begin(), [](double a, double b) {return std::min(a,b);});
-		if (!out.writeValues(vv, out.bs.row[i-1], out.bs.nrows[i-1])) return out;
+	DistanceSetup setup;
+	if (nlyr() == 1) {
+		// the origins are the cells with the target value
+		setup = [target](const std::vector<double> &v, size_t n, size_t k, size_t cell, double &cost, double &id) {
+			double c = v[k];
+			if (std::isnan(c)) return DIST_BARRIER;
+			if (c == target) {
+				id = cell + 1;
+				return DIST_ORIGIN;
+			}
+			if (c < 0) return DIST_ERROR;
+			cost = c;
+			return DIST_CELL;
+		};
+	} else {
+		// the origins are the cells that are not NA in the second layer
+		setup = [](const std::vector<double> &v, size_t n, size_t k, size_t cell, double &cost, double &id) {
+			double c = v[k];
+			if (c < 0) return DIST_ERROR;
+			if (!std::isnan(v[n+k])) {
+				cost = std::isnan(c) ? 0 : c;
+				id = v[n+k];
+				return DIST_ORIGIN;
+			}
+			if (std::isnan(c)) return DIST_BARRIER;
+			cost = c;
+			return DIST_CELL;
+		};
 	}
-	out.writeStop();
-	readStop();
-	first.readStop();
-
-	return(out);
-
+	return gridDijkstra(*this, setup, true, allocation, opt);
 }
 
 
+SpatRaster SpatRaster::gridDistance(std::vector<double> origin, std::vector<double> omit, bool allocation, SpatOptions &opt) {
 
-
-std::vector<double> broom_dist_planar(std::vector<double> &v, std::vector<double> &above, std::vector<double> res, size_t nr, size_t nc, double lindist) {
-
-	double dx = res[0] * lindist;
-	double dy = res[1] * lindist;
-	double dxy = sqrt(dx * dx + dy *dy);
-
-	std::vector<double> dist(v.size(), 0);
-
-    //left to right
-	//first cell, no cell left of it
-	if ( std::isnan(v[0]) ) { 
-		dist[0] = above[0] + dy;
-	}
-	//first row, no row above it, use "above"
-	for (size_t i=1; i<nc; i++) { 
-		if (std::isnan(v[i])) {
-			dist[i] = std::min(std::min(above[i] + dy, above[i-1] + dxy), dist[i-1] + dx);
-		}
+	SpatRaster out = geometry(1);
+	if (!hasValues()) {
+		out.setError("cannot compute distance for a raster with no values");
+		return out;
 	}
 
-	//other rows
-	for (size_t r=1; r<nr; r++) { 
-		size_t start=r*nc;
-		if (std::isnan(v[start])) {
-			dist[start] = dist[start-nc] + dy;
+	SpatOptions ops(opt);
+	size_t nl = nlyr();
+	if (nl > 1) {
+		out.source.resize(nl);
+		for (unsigned i=0; i<nl; i++) {
+			std::vector<unsigned> lyr = {i};
+			SpatRaster r = subset(lyr, ops);
+			r = r.gridDistance(origin, omit, allocation, ops);
+			if (r.hasError()) return r;
+			out.source[i] = r.source[0];
 		}
-
-		size_t end = start+nc;
-		for (size_t i=(start+1); i<end; i++) {
-			if (std::isnan(v[i])) {
-				dist[i] = std::min(std::min(dist[i-1] + dx, dist[i-nc] + dy), dist[i-nc-1] + dxy);
-			}
+		if (opt.get_filename() != "") {
+			out = out.writeRaster(opt);
 		}
+		return out;
 	}
 
-	//right to left
-	//first cell
-	if ( std::isnan(v[nc-1])) { 
-		dist[nc-1] = std::min(dist[nc-1], above[nc-1] + dy);
-	}
+	// values are looked up in sorted vectors; NA is a separate case
+	bool anyorigin = origin.empty();
+	bool naorigin = std::any_of(origin.begin(), origin.end(), [](double d){ return std::isnan(d); });
+	bool naomit = std::any_of(omit.begin(), omit.end(), [](double d){ return std::isnan(d); });
+	std::sort(origin.begin(), origin.end());
+	std::sort(omit.begin(), omit.end());
 
-	// other cells on first row
-	for (int i=(nc-2); i > -1; i--) { 
-		if (std::isnan(v[i])) {
-			dist[i] = std::min(std::min(std::min(dist[i+1] + dx, above[i+1] + dxy), above[i] + dy), dist[i]);
+	DistanceSetup setup = [&](const std::vector<double> &v, size_t n, size_t k, size_t cell, double &cost, double &id) {
+		double d = v[k];
+		bool isna = std::isnan(d);
+		bool orig = anyorigin ? !isna : (isna ? naorigin : std::binary_search(origin.begin(), origin.end(), d));
+		if (orig) {
+			id = d;
+			return DIST_ORIGIN;
 		}
-	}
-
-	// other rows
-	for (size_t r=1; r<nr; r++) { 
-		size_t start=(r+1)*nc-1;
-		if (std::isnan(v[start])) {
-			dist[start] = std::min(dist[start], dist[start-nc] + dy);
+		if (isna ? naomit : std::binary_search(omit.begin(), omit.end(), d)) {
+			return DIST_BARRIER;
 		}
-		for (size_t i=start-1; i>=(r*nc); i--) {
-			if (std::isnan(v[i])) {
-				dist[i] = std::min(std::min(std::min(dist[i], dist[i+1] + dx), dist[i-nc] + dy), dist[i-nc+1] + dxy);
-			}
-		}
-	}
-	size_t off = (nr-1) * nc;
-	above = std::vector<double>(dist.begin()+off, dist.end());
-	return dist;
+		return DIST_CELL;
+	};
+	return gridDijkstra(*this, setup, false, allocation, opt);
 }
 
 
+// A KD-tree of points on the unit sphere, to find the nearest of many points on the
+// earth. The nearest point by chord (straight line) distance is the nearest on a
+// sphere. Distances on the ellipsoid are within 1.1% of those on a sphere, so the
+// geodesic distance is computed for all points within 1.011 times that distance.
+class SphereKDTree {
+	public:
+		void build(std::vector<double> &lon, std::vector<double> &lat) {
+			size_t n = lon.size();
+			plon = lon;
+			plat = lat;
+			xyz.resize(3 * n);
+			double d2r = M_PI / 180;
+			for (size_t i=0; i<n; i++) {
+				double cl = cos(lat[i] * d2r);
+				xyz[3*i] = cl * cos(lon[i] * d2r);
+				xyz[3*i+1] = cl * sin(lon[i] * d2r);
+				xyz[3*i+2] = sin(lat[i] * d2r);
+			}
+			id.resize(n);
+			std::iota(id.begin(), id.end(), 0);
+			axis.resize(n);
+			split(0, n);
+		}
+
+		// the index of the point nearest to (lon, lat), and the distance (m) to it in d
+		size_t nearest(double lon, double lat, double &d) {
+			double d2r = M_PI / 180;
+			double cl = cos(lat * d2r);
+			double q[3] = {cl * cos(lon * d2r), cl * sin(lon * d2r), sin(lat * d2r)};
+			double best = std::numeric_limits<double>::infinity();
+			size_t bi = 0;
+			search(0, id.size(), q, best, bi);
+			// chord to angle, and the margin for the ellipsoid
+			double a = 2 * asin(std::min(1.0, sqrt(best) / 2)) * 1.011;
+			double r = 2 * sin(std::min(a, M_PI) / 2);
+			d = distance_lonlat(lon, lat, plon[bi], plat[bi]);
+			candidates(0, id.size(), q, r * r, lon, lat, d, bi);
+			return bi;
+		}
+
+	private:
+		std::vector<double> xyz, plon, plat;
+		std::vector<size_t> id;
+		std::vector<unsigned char> axis;
+
+		// sort the points such that the median of [lo, hi) splits them on the axis with the
+		// largest spread
+		void split(size_t lo, size_t hi) {
+			if ((hi - lo) < 2) return;
+			double mn[3] = {2, 2, 2}, mx[3] = {-2, -2, -2};
+			for (size_t i=lo; i<hi; i++) {
+				for (size_t j=0; j<3; j++) {
+					mn[j] = std::min(mn[j], xyz[3*id[i]+j]);
+					mx[j] = std::max(mx[j], xyz[3*id[i]+j]);
+				}
+			}
+			unsigned char a = 0;
+			if ((mx[1] - mn[1]) > (mx[a] - mn[a])) a = 1;
+			if ((mx[2] - mn[2]) > (mx[a] - mn[a])) a = 2;
+			size_t mid = lo + (hi - lo) / 2;
+			std::nth_element(id.begin() + lo, id.begin() + mid, id.begin() + hi, [&](size_t i, size_t j) { return xyz[3*i+a] < xyz[3*j+a]; });
+			axis[mid] = a;
+			split(lo, mid);
+			split(mid+1, hi);
+		}
+
+		double dist2(size_t i, const double q[3]) {
+			const double *p = &xyz[3*i];
+			return (p[0]-q[0])*(p[0]-q[0]) + (p[1]-q[1])*(p[1]-q[1]) + (p[2]-q[2])*(p[2]-q[2]);
+		}
+
+		void search(size_t lo, size_t hi, const double q[3], double &best, size_t &bi) {
+			if (lo >= hi) return;
+			size_t mid = lo + (hi - lo) / 2;
+			size_t i = id[mid];
+			double d = dist2(i, q);
+			if (d < best) {
+				best = d;
+				bi = i;
+			}
+			if ((hi - lo) == 1) return;
+			double diff = q[axis[mid]] - xyz[3*i+axis[mid]];
+			if (diff < 0) {
+				search(lo, mid, q, best, bi);
+				if ((diff * diff) < best) search(mid+1, hi, q, best, bi);
+			} else {
+				search(mid+1, hi, q, best, bi);
+				if ((diff * diff) < best) search(lo, mid, q, best, bi);
+			}
+		}
 
-inline double minNArm(const double &a, const double &b) {
-	if (std::isnan(a)) return b;
-	if (std::isnan(b)) return a;
-	return std::min(a, b);
-}
-
-inline void DxDxy(const double &lat, const int &row, double xres, double yres, const int &dir, double &dx,  double &dy, double &dxy) {
-	double rlat = lat + row * yres * dir;
-	dx  = distance_lonlat(0, rlat     , xres, rlat);
-	yres *= -dir;
-	dy  = distance_lonlat(0, rlat, 0, rlat+yres);
-	dxy = distance_lonlat(0, rlat, xres, rlat+yres);
-	dy = std::isnan(dy) ? std::numeric_limits<double>::infinity() : dy;
-	dxy = std::isnan(dxy) ? std::numeric_limits<double>::infinity() : dxy;
-}
+		void candidates(size_t lo, size_t hi, const double q[3], double r2, double lon, double lat, double &d, size_t &bi) {
+			if (lo >= hi) return;
+			size_t mid = lo + (hi - lo) / 2;
+			size_t i = id[mid];
+			if ((i != bi) && (dist2(i, q) <= r2)) {
+				double g = distance_lonlat(lon, lat, plon[i], plat[i]);
+				if (g < d) {
+					d = g;
+					bi = i;
+				}
+			}
+			if ((hi - lo) == 1) return;
+			double diff = q[axis[mid]] - xyz[3*i+axis[mid]];
+			if ((diff < 0) || ((diff * diff) <= r2)) candidates(lo, mid, q, r2, lon, lat, d, bi);
+			if ((diff >= 0) || ((diff * diff) <= r2)) candidates(mid+1, hi, q, r2, lon, lat, d, bi);
+		}
+};
 
 
-std::vector<double> broom_dist_geo(std::vector<double> &v, std::vector<double> &above, std::vector<double> res, size_t nr, size_t nc, double lat, double latdir) {
+// The distance from each NA cell to the nearest cell that is not NA on a longitude/latitude
+// raster. Only the cells that are not NA and that have an NA neighbor can be nearest. These
+// are found in a first pass over the raster, and put in a KD-tree
+SpatRaster distance_lonlat_kdtree(SpatRaster &x, bool cells, SpatOptions &opt) {
 
-//	double dy = distance_lonlat(0, 0, 0, res[1]);
-	double dx, dy, dxy;
-	std::vector<double> dist(v.size(), 0);
+	SpatRaster out = x.geometry(cells ? 2 : 1);
+	if (cells) out.setNames({"distance", "cell"});
+	size_t nr = x.nrow();
+	size_t nc = x.ncol();
+	bool wrap = x.is_global_lonlat();
 
-	//top to bottom
-    //left to right
-	DxDxy(lat, 0, res[0], res[1], latdir, dx, dy, dxy);
-	//first cell, no cell left of it
-	if ( std::isnan(v[0]) ) { 
-		dist[0] = above[0] + dy;
-	}
-	//first row, no row above it, use "above"
-	for (size_t i=1; i<nc; i++) { 
-		if (std::isnan(v[i])) {
-			dist[i] = std::min(std::min(above[i] + dy, above[i-1] + dxy), dist[i-1] + dx);
-		}
+	std::vector<double> lon, lat, bcell;
+	if (!x.readStart()) {
+		out.setError(x.getError());
+		return out;
 	}
-
-	//other rows
-	for (size_t r=1; r<nr; r++) { 
-		DxDxy(lat, r, res[0], res[1], latdir, dx, dy, dxy);
-		size_t start=r*nc;
-		if (std::isnan(v[start])) {
-			dist[start] = dist[start-nc] + dy;
-		}
-		size_t end = start+nc;
-		for (size_t i=(start+1); i<end; i++) {
-			if (std::isnan(v[i])) {
-				dist[i] = std::min(std::min(dist[i-1] + dx, dist[i-nc] + dy), dist[i-nc-1] + dxy);
+	BlockSize bs = x.getBlockSize(opt);
+	std::vector<double> v;
+	for (size_t i=0; i<bs.n; i++) {
+		// with the row above and below the block
+		size_t r0 = bs.row[i] > 0 ? bs.row[i] - 1 : 0;
+		size_t r1 = std::min(nr, bs.row[i] + bs.nrows[i] + 1);
+		x.readValues(v, r0, r1 - r0, 0, nc);
+		for (size_t r=bs.row[i]; r<(bs.row[i] + bs.nrows[i]); r++) {
+			double y = x.yFromRow(r);
+			for (size_t c=0; c<nc; c++) {
+				if (std::isnan(v[(r - r0) * nc + c])) continue;
+				bool edge = false;
+				for (long dr=-1; (dr<2) && (!edge); dr++) {
+					long rr = r + dr;
+					if ((rr < 0) || (rr >= (long)nr)) continue;
+					for (long dc=-1; dc<2; dc++) {
+						long cc = c + dc;
+						if ((cc < 0) || (cc >= (long)nc)) {
+							if (!wrap) continue;
+							cc = cc < 0 ? nc - 1 : 0;
+						}
+						if (std::isnan(v[(rr - r0) * nc + cc])) {
+							edge = true;
+							break;
+						}
+					}
+				}
+				if (edge) {
+					lon.push_back(x.xFromCol(c));
+					lat.push_back(y);
+					bcell.push_back(r * nc + c);
+				}
 			}
 		}
 	}
 
-	//right to left
-	DxDxy(lat, 0, res[0], res[1], latdir, dx, dy, dxy);
-	 //first cell
-	if ( std::isnan(v[nc-1])) {
-		dist[nc-1] = std::min(dist[nc-1], above[nc-1] + dy);
-	}
+	SphereKDTree tree;
+	tree.build(lon, lat);
+	std::vector<double>().swap(lon);
+	std::vector<double>().swap(lat);
 
-	// other cells on first row
-	for (int i=(nc-2); i > -1; i--) { 
-		if (std::isnan(v[i])) {
-			dist[i] = std::min(std::min(std::min(dist[i+1] + dx, above[i+1] + dxy), above[i] + dy), dist[i]);
-		}
+ 	if (!out.writeStart(opt)) {
+		x.readStop();
+		return out;
 	}
-	// other rows
-	for (size_t r=1; r<nr; r++) { 
-		DxDxy(lat, r, res[0], res[1], latdir, dx, dy, dxy);
-
-		size_t start=(r+1)*nc-1;
-		if (std::isnan(v[start])) {
-			dist[start] = std::min(dist[start], dist[start-nc] + dy);
-		}
-		for (size_t i=start-1; i>=(r*nc); i--) {
-			if (std::isnan(v[i])) {
-				dist[i] = std::min(std::min(std::min(dist[i], dist[i+1] + dx), dist[i-nc] + dy), dist[i-nc+1] + dxy);
+	for (size_t i=0; i<out.bs.n; i++) {
+		x.readBlock(v, out.bs, i);
+		size_t n = out.bs.nrows[i] * nc;
+		size_t off = out.bs.row[i] * nc;
+		std::vector<double> d(n, 0);
+		if (cells) d.resize(2 * n, NAN);
+		for (size_t k=0; k<n; k++) {
+			if (!std::isnan(v[k])) {
+				if (cells) d[n+k] = off + k + 1;
+			} else if (!bcell.empty()) {
+				size_t r = out.bs.row[i] + k / nc;
+				size_t j = tree.nearest(x.xFromCol(k % nc), x.yFromRow(r), d[k]);
+				if (cells) d[n+k] = bcell[j] + 1;
 			}
 		}
+		if (!out.writeBlock(d, i)) return out;
 	}
-
-	size_t off = (nr-1) * nc;
-	above = std::vector<double>(dist.begin()+off, dist.end());
-
-	return dist;
+	out.writeStop();
+	x.readStop();
+	return out;
 }
 
 
-std::vector<double> broom_dist_geo_global(std::vector<double> &v, std::vector<double> &above, std::vector<double> res, size_t nr, size_t nc, double lat, double latdir) {
+// The exact Euclidean distance transform of Felzenszwalb and Huttenlocher (2012), Theory
+// of Computing 8:415-428. First, for each column, the nearest non-NA cell in that column
+// is found; then for each row, the nearest of these with the lower envelope of parabolas.
+// The rows are processed from the bottom up (the nearest cell below, stored in a TiledGrid)
+// and then from the top down (the nearest cell above, and the rows), one block at a time.
+SpatRaster distance_plane_edt(SpatRaster &x, bool cells, SpatOptions &opt) {
 
-//	double dy = distance_lonlat(0, 0, 0, res[1]);
-	double dx, dy, dxy;
-	std::vector<double> dist(v.size(), 0);
-	size_t stopnc = nc - 1;
-	//top to bottom
-    //left to right
-	DxDxy(lat, 0, res[0], res[1], latdir, dx, dy, dxy);
-	//first cell, no cell left of it
-	if ( std::isnan(v[0]) ) { 
-		dist[0] = std::min(above[0] + dy, above[stopnc] + dxy);
-	}
-	//first row, no row above it, use "above"
-	for (size_t i=1; i<nc; i++) { 
-		if (std::isnan(v[i])) {
-			dist[i] = std::min(std::min(std::min(above[i] + dy, above[i-1] + dxy), 
-								dist[i-1] + dx), dist[0] + dx * (nc-i));
-		}
+	SpatRaster out = x.geometry(cells ? 2 : 1);
+	if (cells) out.setNames({"distance", "cell"});
+	size_t nr = x.nrow();
+	size_t nc = x.ncol();
+	double m = x.source[0].srs.to_meter();
+	m = std::isnan(m) ? 1 : m;
+	double dx = x.xres() * m;
+	double dy = x.yres() * m;
+
+	SpatRaster g = x.geometry(1);
+	TiledGrid grid;
+	std::string msg;
+	std::string tmpfile = tempFile(opt.get_tempdir(), opt.pid, "_dist.bin");
+	if (!grid.init(nr, nc, 1, g.canProcessInMemory(opt), tmpfile, msg)) {
+		out.setError(msg);
+		return out;
 	}
+	double* below = grid.var(0);
 
-	//other rows
-	for (size_t r=1; r<nr; r++) { 
-		DxDxy(lat, r, res[0], res[1], latdir, dx, dy, dxy);
-		size_t start=r*nc;
-		if (std::isnan(v[start])) {
-			dist[start] = std::min(dist[start-nc] + dy, dist[start-1] + dxy);
-		}
-
-		size_t end = start+nc;
-		for (size_t i=(start+1); i<end; i++) {
-			if (std::isnan(v[i])) {
-				dist[i] = std::min(std::min(std::min(dist[i-1] + dx, dist[i-nc] + dy), 
-						dist[i-nc-1] + dxy), dist[start] + dx * (end-i));			
+	if (!x.readStart()) {
+		out.setError(x.getError());
+		return out;
+	}
+	BlockSize bs = x.getBlockSize(opt);
+	std::vector<double> v;
+	// the row of the nearest non-NA cell at or below each cell in its column
+	std::vector<double> nearest(nc, NAN);
+	bool anyvalue = false;
+	for (size_t i=bs.n; i>0; i--) {
+		x.readBlock(v, bs, i-1);
+		for (size_t k=bs.nrows[i-1]; k>0; k--) {
+			size_t r = bs.row[i-1] + k - 1;
+			const double *vr = &v[(k-1) * nc];
+			for (size_t c=0; c<nc; c++) {
+				if (!std::isnan(vr[c])) nearest[c] = r;
+				below[grid.cell(r, c)] = nearest[c];
 			}
 		}
-	}
-
-	//right to left
-	DxDxy(lat, 0, res[0], res[1], latdir, dx, dy, dxy);
-	 //first cell
-	if ( std::isnan(v[nc-1])) {
-		dist[stopnc] = std::min(std::min(dist[stopnc], above[stopnc] + dy), above[0] + dxy);
-	}
-
-	// other cells on first row
-	for (int i=(nc-2); i > -1; i--) { 
-		if (std::isnan(v[i])) {
-			dist[i] = std::min(std::min(std::min(std::min(dist[i+1] + dx, above[i+1] + dxy), 
-						above[i] + dy), dist[i]), dist[stopnc] + dx * (i+1));
+		if (!anyvalue) {
+			anyvalue = std::any_of(nearest.begin(), nearest.end(), [](double d) { return !std::isnan(d); });
 		}
 	}
-	// other rows
-	for (size_t r=1; r<nr; r++) { 
-		DxDxy(lat, r, res[0], res[1], latdir, dx, dy, dxy);
 
-		size_t start=(r+1)*nc-1;
-		if (std::isnan(v[start])) {
-			//dist[start] = std::min(dist[start], dist[start-nc] + dy);
-			dist[start] = std::min(std::min(dist[start], dist[start-nc] + dy), dist[start-nc-stopnc] + dxy);
-		}
-		size_t end = r*nc;
-		for (size_t i=start-1; i>=end; i--) {
-			if (std::isnan(v[i])) {
-			//	dist[i] = std::min(std::min(std::min(dist[i], dist[i+1] + dx), dist[i-nc] + dy), dist[i-nc+1] + dxy);
-				dist[i] = std::min(std::min(std::min(std::min(dist[i], dist[i+1] + dx), dist[i-nc] + dy), 
-						dist[i-nc+1] + dxy), dist[start] + dx * (i-end));
+ 	if (!out.writeStart(opt)) {
+		x.readStop();
+		return out;
+	}
+	std::fill(nearest.begin(), nearest.end(), NAN);
+	std::vector<double> above(nc, NAN), f(nc);
+	// the lower envelope: the columns of the parabolas (p) and where they start (z)
+	std::vector<size_t> p(nc);
+	std::vector<double> z(nc + 1);
+	double inf = std::numeric_limits<double>::infinity();
+	double ratio = (dy * dy) / (dx * dx);
+	for (size_t i=0; i<out.bs.n; i++) {
+		x.readBlock(v, out.bs, i);
+		size_t n = out.bs.nrows[i] * nc;
+		std::vector<double> d(n, 0);
+		if (cells) d.resize(2 * n, NAN);
+		if (!anyvalue) {
+			if (!out.writeBlock(d, i)) return out;
+			continue;
+		}
+		for (size_t k=0; k<out.bs.nrows[i]; k++) {
+			size_t r = out.bs.row[i] + k;
+			const double *vr = &v[k * nc];
+			// the nearest in each column, and the squared distance to it in column units
+			size_t np = 0;
+			for (size_t c=0; c<nc; c++) {
+				if (!std::isnan(vr[c])) above[c] = r;
+				double b = below[grid.cell(r, c)];
+				double da = std::isnan(above[c]) ? inf : r - above[c];
+				double db = std::isnan(b) ? inf : b - r;
+				if (da <= db) {
+					nearest[c] = above[c];
+					f[c] = da * da * ratio;
+				} else {
+					nearest[c] = b;
+					f[c] = db * db * ratio;
+				}
+				if (std::isinf(f[c])) continue;
+				// add the parabola of column c to the lower envelope
+				double s = 0;
+				while (np > 0) {
+					size_t q = p[np-1];
+					s = ((f[c] + (double)c*c) - (f[q] + (double)q*q)) / (2.0 * c - 2.0 * q);
+					if (s > z[np-1]) break;
+					np--;
+				}
+				p[np] = c;
+				z[np] = np == 0 ? -inf : s;
+				np++;
+			}
+			z[np] = inf;
+			double *dr = &d[k * nc];
+			for (size_t c=0, j=0; c<nc; c++) {
+				while (z[j+1] < c) j++;
+				size_t q = p[j];
+				double h = (double)c - q;
+				dr[c] = sqrt(f[q] + h * h) * dx;
+				if (cells) dr[n + c] = nearest[q] * nc + q + 1;
 			}
 		}
+		if (!out.writeBlock(d, i)) return out;
 	}
-
-	size_t off = (nr-1) * nc;
-	above = std::vector<double>(dist.begin()+off, dist.end());
-
-	return dist;
+	out.writeStop();
+	x.readStop();
+	return out;
 }
 
 
-SpatRaster SpatRaster::gridDistance(SpatOptions &opt) {
-
+SpatRaster SpatRaster::distance(bool cells, SpatOptions &opt) {
 	SpatRaster out = geometry(1);
 	if (!hasValues()) {
-		out.setError("cannot compute distance for a raster with no values");
+		out.setError("SpatRaster has no values");
 		return out;
 	}
-
+	if (source[0].srs.wkt == "") {
+		out.setError("CRS not defined");
+		return(out);
+	}
 
 	SpatOptions ops(opt);
 	size_t nl = nlyr();
 	if (nl > 1) {
-		out.source.resize(nl);
+		std::vector<std::string> nms = getNames();
+		if (ops.names.size() == nms.size()) {
+			nms = opt.names;
+		}
+		out.source.resize(0);
 		for (unsigned i=0; i<nl; i++) {
 			std::vector<unsigned> lyr = {i};
 			SpatRaster r = subset(lyr, ops);
-			r = r.gridDistance(ops);
-			out.source[i] = r.source[0];
+			if (cells) {
+				ops.names = {nms[i], nms[i] + "_cell"};
+			} else {
+				ops.names = {nms[i]};
+			}
+			r = r.distance(cells, ops);
+			if (r.hasError()) return r;
+			out.source.insert(out.source.end(), r.source.begin(), r.source.end());
 		}
 		if (opt.get_filename() != "") {
 			out = out.writeRaster(opt);
 		}
 		return out;
 	}
-
-	bool lonlat = is_lonlat(); 
-	bool global = is_global_lonlat();
-	
-	double m = source[0].srs.to_meter();
-	m = std::isnan(m) ? 1 : m;
-	if (lonlat) {
-		m = 1;
-	}
-	std::vector<double> res = resolution();
-
-	SpatRaster first = out.geometry();
-
-	std::string tempfile = "";
-	std::vector<double> above(ncol(), std::numeric_limits<double>::infinity());
-    std::vector<double> d, v, vv;
-
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	std::string filename = opt.get_filename();
-	opt.set_filenames({""});
- 	if (!first.writeStart(opt)) { return first; }
-
-	size_t nc = ncol();
-	for (size_t i = 0; i < first.bs.n; i++) {
-        readBlock(v, first.bs, i);
-		if (lonlat) {
-			double lat = yFromRow(first.bs.row[i]);
-			if (global) {
-				d = broom_dist_geo_global(v, above, res, first.bs.nrows[i], nc, lat, -1);				
-			} else {
-				d = broom_dist_geo(v, above, res, first.bs.nrows[i], nc, lat, -1);
-			}
-		} else {
-			d = broom_dist_planar(v, above, res, first.bs.nrows[i], nc, m);
-		}
-		if (!first.writeValues(d, first.bs.row[i], first.bs.nrows[i])) return first;
-	}
-	first.writeStop();
-
-
-	if (!first.readStart()) {
-		out.setError(first.getError());
-		return(out);
-	}
-
-	opt.set_filenames({filename});
-	above = std::vector<double>(ncol(), std::numeric_limits<double>::infinity());
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
+	if (is_lonlat()) {
+		return distance_lonlat_kdtree(*this, cells, opt);
+	} else {
+		return distance_plane_edt(*this, cells, opt);
 	}
-	for (int i = out.bs.n; i>0; i--) {
-        readBlock(v, out.bs, i-1);
-		std::reverse(v.begin(), v.end());
-		if (lonlat) {
-			double lat = yFromRow(out.bs.row[i-1] + out.bs.nrows[i-1] - 1);
-			if (global) {
-				d = broom_dist_geo_global(v, above, res, out.bs.nrows[i-1], nc, lat, 1);
-			} else {
-				d = broom_dist_geo(v, above, res, out.bs.nrows[i-1], nc, lat, 1);				
-			}
-		} else {
-			d = broom_dist_planar(v, above, res, out.bs.nrows[i-1], nc, m);
-		}
-		
-		first.readBlock(vv, out.bs, i-1);
-	    std::transform (d.rbegin(), d.rend(), vv.begin(), vv.begin(), [](double a, double b) {return std::min(a,b);});
-		if (!out.writeValues(vv, out.bs.row[i-1], out.bs.nrows[i-1])) return out;
-		/*
-		std::reverse(d.begin(), d.end());
-		if (!out.writeValues(d, out.bs.row[i-1], out.bs.nrows[i-1])) return out;
-		*/
-	}	
-	out.writeStop();
-	readStop();
-	//first.readStop();
-	//first.source.push_back(out.source[0]);
-	//return first;
-	return(out);
 }
 
 
@@ -1977,430 +2054,187 @@ std::vector<std::vector<double>> SpatRaster::area_by_value(SpatOptions &opt) {
 
 
 
-void do_flowdir(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, double dx, double dy, unsigned seed, bool before, bool after) {
-
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	std::vector<double> r = {0, 0, 0, 0, 0, 0, 0, 0};
-	std::vector<double> p = {1, 2, 4, 8, 16, 32, 64, 128}; // pow(2, j)
-	double dxy = sqrt(dx * dx + dy * dy);
-
-	std::default_random_engine generator(seed);
-	std::uniform_int_distribution<> U(0, 1);
-
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			if (!std::isnan(d[i])) {
-				r[0] = (d[i] - d[i+1]) / dx;
-				r[1] = (d[i] - d[i+1+ncol]) / dxy;
-				r[2] = (d[i] - d[i+ncol]) / dy;
-				r[3] = (d[i] - d[i-1+ncol]) / dxy;
-				r[4] = (d[i] - d[i-1]) / dx;
-				r[5] = (d[i] - d[i-1-ncol]) / dxy;
-				r[6] = (d[i] - d[i-ncol]) / dy;
-				r[7] = (d[i] - d[i+1-ncol]) / dxy;
-				// using the lowest neighbor, even if it is higher than the focal cell.
-				double dmin = r[0];
-				int k = 0;
-				for (size_t j=1; j<8; j++) {
-					if (r[j] > dmin) {
-						dmin = r[j];
-						k = j;
-					} else if (r[j] == dmin) {
-						if (U(generator)) {
-							dmin = r[j];
-							k = j;
-						}
-					}
-				}
-				val.push_back( p[k] );
-			} else {
-				val.push_back( NAN );
-			}
-		}
-		val.push_back(NAN);
-	}
-
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-}
-
-
-void do_TRI(std::vector<double> &val, std::vector<double> const &d, size_t nrow, size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back( 
-				(fabs(d[i-1-ncol]-d[i]) + fabs(d[i-1]-d[i]) + fabs(d[i-1+ncol]-d[i]) +  fabs(d[i-ncol]-d[i]) + fabs(d[i+ncol]-d[i]) +  fabs(d[i+1-ncol]-d[i]) + fabs(d[i+1]-d[i]) +  fabs(d[i+1+ncol]-d[i])) / 8 
-			);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-void do_TPI(std::vector<double> &val, const std::vector<double> &d, const size_t nrow, const size_t ncol, bool before, bool after) {
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			val.push_back( d[i] - (d[i-1-ncol] + d[i-1] + d[i-1+ncol] + d[i-ncol]
-			+ d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 8 );
-		}
-		val.push_back(NAN);
-	}
-/*
-	if (expand) {
-		for (size_t i=1; i < (ncol-1); i++) {
-			val[i+add] = d[i] - (d[i-1] + d[i-1+ncol] + d[i+ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			size_t j = i+(nrow-1) * ncol;
-			val[j+add] = d[j] - (d[j-1-ncol] + d[j-1] + d[j-ncol] + d[j+1-ncol] + d[j+1]) / 5;
-		}
-		for (size_t row=1; row< (nrow-1); row++) {
-			size_t i = row * ncol;
-			val[i+add] = d[i] - (d[i-ncol] + d[i+ncol] + d[i+1-ncol] + d[i+1] + d[i+1+ncol]) / 5;
-			i += ncol - 1;
-			val[i+add] = d[i] - (d[i-ncol] + d[i] + d[i+ncol] + d[i-ncol]) / 5;
-		}
-		size_t i = 0;
-		val[i+add] = d[i] - (d[i+ncol] + d[i+1] + d[i+1+ncol]) / 3;
-		i = ncol-1;
-		val[i+add] = d[i] - (d[i+ncol] + d[i-1] + d[i-1+ncol]) / 3;
-		i = (nrow-1)*ncol;
-		val[i+add] = d[i] - (d[i-ncol] + d[i+1] + d[i+1-ncol]) / 3;
-		i = (nrow*ncol)-1;
-		val[i+add] = d[i] - (d[i-ncol] + d[i-1] + d[i-1-ncol]) / 3;
-	}
-*/
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-
-}
-
-
-
-void do_roughness(std::vector<double> &val, const std::vector<double> &d, size_t nrow, size_t ncol, bool before, bool after) {
-
-	if (!before) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	int incol = ncol;
-	int a[9] = { -1-incol, -1, -1+incol, -incol, 0, incol, 1-incol, 1, 1+incol };
-	double min, max, v;
-	for (size_t row=1; row< (nrow-1); row++) {
-		val.push_back(NAN);
-		for (size_t col=1; col< (ncol-1); col++) {
-			size_t i = row * ncol + col;
-			min = d[i + a[0]];
-			max = d[i + a[0]];
-			for (size_t j = 1; j < 9; j++) {
-				v = d[i + a[j]]; 
-				if (v > max) {
-					max = v;
-				} else if (v < min) {
-					min = v;
-				}
-			}
-			val.push_back(max - min);
-		}
-		val.push_back(NAN);
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-}
-
-
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
 #endif
 
 
-
-
-void to_degrees(std::vector<double>& x, size_t start) { 
-	double adj = 180 / M_PI;
-	for (size_t i=start; i<x.size(); i++) {
-		x[i] *= adj;
-	}
-}
-
-
-void do_slope(std::vector<double> &val, const std::vector<double> &d, unsigned ngb, unsigned nrow, unsigned ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees, bool before, bool after) {
-
-	size_t start = val.size();
-	if (!before) {
-		val.resize(start + ncol, NAN);
-	}
-	
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distHaversine(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
-	} 
-
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
-
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				val.push_back(NAN); // first col
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2) )));
-				}
-				val.push_back(NAN); // last col
-			}
-		} else { // ngb == 8
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] /= -2 * dx;
-				yw[i] /=  2 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					double zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					val.push_back(  atan( sqrt( pow(zy, 2) + pow(zx, 2)  )));
-				}
-				val.push_back(NAN); 
-			}
-		}
-	} else {
-
-		if (geo) {
-
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
-
-			for (size_t i=0; i<6; i++) {
-				yw[i] = yw[i] / (8 * dy);
-			}
-
-			for (size_t row=1; row< (nrow-1); row++) {
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (8 * ddx[row]);
-				}
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-					   + d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					   
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2))));
-				}
-				val.push_back(NAN); 
-			}
-		} else {
-
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					double zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					double zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					val.push_back( atan(sqrt( pow(zy, 2) + pow(zx, 2) )));
-				}
-				val.push_back(NAN); 
-			}
-		} 
-	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-	
-	if (degrees) {
-		to_degrees(val, start);
-	} 
-}
-
-
 double dmod(double x, double n) {
 	return(x - n * std::floor(x/n));
 }
 
 
+enum TerrainVar {TER_SLOPE, TER_ASPECT, TER_TPI, TER_TRI, TER_ROUGH, TER_FLOWDIR, TER_SHADE, TER_CURV};
+
+// the settings that are shared by all bands
+struct TerrainPars {
+	// the output layer of each variable (or -1)
+	int idx[8] = {-1,-1,-1,-1,-1,-1,-1,-1};
+	unsigned ngb = 8;
+	bool degrees = true;
+	bool lonlat = false;
+	double xres, dy;
+	// cell sizes for flowdir
+	double fdx, fdy;
+	unsigned seed = 0;
+	size_t nrow, ncol;
+};
+
+
+// All variables are computed from the same 3x3 window, that is only loaded once for each cell.
+// d has the rows of a band with one (NAN) row above and below it. The first and last row
+// and column of the raster are NAN. 
+// y (for lonlat) has the y coordinates of the rows of the band
+void terrain_band(const std::vector<double> &d, size_t row0, size_t nrows, const TerrainPars &p, const std::vector<double> &y, std::vector<double> &out) {
+
+	size_t nc = p.ncol;
+	size_t nout = nrows * nc;
+	size_t nvar = 0;
+	for (size_t k=0; k<8; k++) {
+		if (p.idx[k] >= 0) nvar++;
+	}
+	out.assign(nvar * nout, NAN);
+
+	double *slope = p.idx[TER_SLOPE] < 0 ? NULL : &out[p.idx[TER_SLOPE] * nout];
+	double *aspect = p.idx[TER_ASPECT] < 0 ? NULL : &out[p.idx[TER_ASPECT] * nout];
+	double *tpi = p.idx[TER_TPI] < 0 ? NULL : &out[p.idx[TER_TPI] * nout];
+	double *tri = p.idx[TER_TRI] < 0 ? NULL : &out[p.idx[TER_TRI] * nout];
+	double *rough = p.idx[TER_ROUGH] < 0 ? NULL : &out[p.idx[TER_ROUGH] * nout];
+	double *flowdir = p.idx[TER_FLOWDIR] < 0 ? NULL : &out[p.idx[TER_FLOWDIR] * nout];
+	double *shade = p.idx[TER_SHADE] < 0 ? NULL : &out[p.idx[TER_SHADE] * nout];
+	double *curv = p.idx[TER_CURV] < 0 ? NULL : &out[p.idx[TER_CURV] * nout];
+	bool gradient = (slope != NULL) || (aspect != NULL) || (shade != NULL);
 
-void do_aspect(std::vector<double> &val, const std::vector<double> &d, unsigned ngb, unsigned nrow, unsigned ncol, double dx, double dy, bool geo, std::vector<double> &gy, bool degrees, bool before, bool after) {
-
-	size_t start = val.size();
-	if (!before) {
-		val.resize(start + ncol, NAN);
-	}
-	std::vector<double> ddx;
-	if (geo) {
-		ddx.resize(nrow);
-		for (size_t i=0; i<nrow; i++) {
-			ddx[i] = distHaversine(-dx, gy[i], dx, gy[i]) / 2 ;
-		}
-	} 
-	double zy, zx; 
-
-	//double const pi2 = M_PI / 2;
 	double const twoPI = 2 * M_PI;
 	double const halfPI = M_PI / 2;
+	double const adj = 180 / M_PI;
+	// hillshade with the default angle (45) and direction (0) of "shade"
+	double const zenith = M_PI / 4;
+	double const cosz = cos(zenith);
+	double const sinz = sin(zenith);
+
+	double const fdxy = sqrt(p.fdx * p.fdx + p.fdy * p.fdy);
+	double const fp[8] = {1, 2, 4, 8, 16, 32, 64, 128}; // pow(2, j)
+	std::uniform_int_distribution<> U(0, 1);
 
-	if (ngb == 4) {
-		if (geo) {
-			double xwi[2] = {-1,1};
-			double xw[2] = {0,0};
-			double yw[2] = {-1,1};
+	double xw[6], yw[6];
+	if (p.ngb == 4) {
+		yw[0] = -1 / (2 * p.dy);
+		yw[1] = 1 / (2 * p.dy);
+	} else {
+		double ywi[6] = {-1,1,-2,2,-1,1};
+		for (size_t k=0; k<6; k++) {
+			yw[k] = ywi[k] / (8 * p.dy);
+		}
+	}
+	double const xwi[6] = {-1,-2,-1,1,2,1};
 
-			for (size_t i=0; i<2; i++) {
-				yw[i] = yw[i] / (2 * dy);
-			}
+	for (size_t r=0; r<nrows; r++) {
+		size_t row = row0 + r;
+		if ((row == 0) || (row >= (p.nrow - 1))) continue;
 
-			for (size_t row=1; row < (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t k=0; k<2; k++) {
-					xw[k] = xwi[k] / (-2 * ddx[row]);
-				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val.push_back( std::fmod( halfPI - zx, twoPI) );
-				}
-				val.push_back(NAN); 
-			}
+		// the width of a cell
+		double dx = p.xres;
+		if (p.lonlat) {
+			dx = distHaversine(-p.xres, y[r], p.xres, y[r]) / 2;
+		}
+		if (p.ngb == 4) {
+			xw[0] = -1 / (-2 * dx);
+			xw[1] = 1 / (-2 * dx);
 		} else {
-
-			double xw[2] = {-1,1};
-			double yw[2] = {-1,1};
-			for (size_t i=0; i<2; i++) {
-				xw[i] = xw[i] / (-2 * dx);
-				yw[i] = yw[i] / (2 * dy);
-			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1] * xw[0] + d[i+1] * xw[1];
-					zy = d[i-ncol] * yw[0] + d[i+ncol] * yw[1];
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI));
-				}
-				val.push_back(NAN); 
+			for (size_t k=0; k<6; k++) {
+				xw[k] = xwi[k] / (-8 * dx);
 			}
 		}
-	} else { //	(ngb == 8) {
+		double const dx2 = dx * dx;
+		double const dy2 = p.dy * p.dy;
 
-		if (geo) {
+		// ties are broken the same way, irrespective of the size of the blocks
+		std::default_random_engine generator(p.seed + row);
 
-			double xwi[6] = {-1,-2,-1,1,2,1};
-			double xw[6] = {0,0,0,0,0,0};
-			double yw[6] = {-1,1,-2,2,-1,1};
+		const double *a = &d[r * nc];
+		const double *b = a + nc;
+		const double *c = b + nc;
+		size_t off = r * nc;
 
-			for (size_t i=0; i<6; i++) {
-				yw[i] /= (8 * dy);
-			}
+		for (size_t col=1; col<(nc-1); col++) {
+			double z1 = a[col-1], z2 = a[col], z3 = a[col+1];
+			double z4 = b[col-1], z5 = b[col], z6 = b[col+1];
+			double z7 = c[col-1], z8 = c[col], z9 = c[col+1];
+			size_t i = off + col;
 
-			for (size_t row=1; row < (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t k=0; k<6; k++) {
-					xw[k] = xwi[k] / (-8 * ddx[row]);
+			if (gradient) {
+				double zx, zy;
+				if (p.ngb == 4) {
+					zx = z4 * xw[0] + z6 * xw[1];
+					zy = z2 * yw[0] + z8 * yw[1];
+				} else {
+					zx = z1 * xw[0] + z4 * xw[1] + z7 * xw[2] + z3 * xw[3] + z6 * xw[4] + z9 * xw[5];
+					zy = z1 * yw[0] + z7 * yw[1] + z2 * yw[2] + z8 * yw[3] + z3 * yw[4] + z9 * yw[5];
 				}
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-							+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI) );
+				double slp = atan(sqrt(pow(zy, 2) + pow(zx, 2)));
+				double asp = dmod(halfPI - atan2(zy, zx), twoPI);
+				if (slope) slope[i] = p.degrees ? slp * adj : slp;
+				if (aspect) aspect[i] = p.degrees ? asp * adj : asp;
+				if (shade) shade[i] = cos(slp) * cosz + sin(slp) * sinz * cos(-asp);
+			}
+			if (tri) {
+				tri[i] = (fabs(z1-z5) + fabs(z4-z5) + fabs(z7-z5) + fabs(z2-z5) + fabs(z8-z5) + fabs(z3-z5) + fabs(z6-z5) + fabs(z9-z5)) / 8;
+			}
+			if (tpi) {
+				tpi[i] = z5 - (z1 + z4 + z7 + z2 + z8 + z3 + z6 + z9) / 8;
+			}
+			if (rough) {
+				double w[8] = {z4, z7, z2, z5, z8, z3, z6, z9};
+				double mn = z1, mx = z1;
+				for (size_t j=0; j<8; j++) {
+					if (w[j] > mx) {
+						mx = w[j];
+					} else if (w[j] < mn) {
+						mn = w[j];
+					}
 				}
-				val.push_back(NAN); 
+				rough[i] = mx - mn;
 			}
-
-		} else {
-
-			double xw[6] = {-1,-2,-1,1,2,1};
-			double yw[6] = {-1,1,-2,2,-1,1};
-			for (size_t i=0; i<6; i++) {
-				xw[i] /= -8 * dx;
-				yw[i] /= 8 * dy;
+			if (curv) {
+				// Zevenbergen and Thorne (1987)
+				double cd = ((z4 + z6) / 2 - z5) / dx2;
+				double ce = ((z2 + z8) / 2 - z5) / dy2;
+				curv[i] = -2 * (cd + ce);
 			}
-			for (size_t row=1; row< (nrow-1); row++) {
-				val.push_back(NAN); 
-				for (size_t col=1; col< (ncol-1); col++) {
-					size_t i = row * ncol + col;
-					zx = d[i-1-ncol] * xw[0] + d[i-1] * xw[1] + d[i-1+ncol] * xw[2]
-						+ d[i+1-ncol] * xw[3] + d[i+1] * xw[4] + d[i+1+ncol] * xw[5];
-					zy = d[i-1-ncol] * yw[0] + d[i-1+ncol] * yw[1] + d[i-ncol] * yw[2] 
-							+ d[i+ncol] * yw[3] + d[i+1-ncol] * yw[4] + d[i+1+ncol] * yw[5];
-					zx = atan2(zy, zx);
-					val.push_back( dmod( halfPI - zx, twoPI) );
+			if (flowdir && (!std::isnan(z5))) {
+				double fr[8];
+				fr[0] = (z5 - z6) / p.fdx;
+				fr[1] = (z5 - z9) / fdxy;
+				fr[2] = (z5 - z8) / p.fdy;
+				fr[3] = (z5 - z7) / fdxy;
+				fr[4] = (z5 - z4) / p.fdx;
+				fr[5] = (z5 - z1) / fdxy;
+				fr[6] = (z5 - z2) / p.fdy;
+				fr[7] = (z5 - z3) / fdxy;
+				// using the lowest neighbor, even if it is higher than the focal cell.
+				double dmin = fr[0];
+				int k = 0;
+				for (size_t j=1; j<8; j++) {
+					if (fr[j] > dmin) {
+						dmin = fr[j];
+						k = j;
+					} else if (fr[j] == dmin) {
+						if (U(generator)) {
+							dmin = fr[j];
+							k = j;
+						}
+					}
 				}
-				val.push_back(NAN); 
+				flowdir[i] = fp[k];
 			}
 		}
 	}
-	if (!after) {
-		val.resize(val.size() + ncol, NAN);
-	}
-
-	if (degrees) {
-		to_degrees(val, start);
-	}
 }
 
 
 SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, bool degrees, unsigned seed, SpatOptions &opt) {
 
-//TPI, TRI, aspect, flowdir, slope, roughness
-	//std::sort(v.begin(), v.end());
-	//v.erase(std::unique(v.begin(), v.end()), v.end());
-
 	SpatRaster out = geometry(v.size());
 	out.setNames(v);
 
@@ -2409,24 +2243,42 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 		return out;
 	}
 
-	bool aspslope = false;
-	std::vector<std::string> f {"TPI", "TRI", "aspect", "flowdir", "slope", "roughness"};
+	TerrainPars p;
+	std::vector<std::string> f {"slope", "aspect", "TPI", "TRI", "roughness", "flowdir", "hillshade", "curvature"};
 	for (size_t i=0; i<v.size(); i++) {
-		if (std::find(f.begin(), f.end(), v[i]) == f.end()) {
+		auto it = std::find(f.begin(), f.end(), v[i]);
+		if (it == f.end()) {
 			out.setError("unknown terrain variable: " + v[i]);
 			return(out);
 		}
-		if (v[i] == "slope" || v[i] == "aspect") {
-			aspslope=true;
-		} 
+		size_t k = std::distance(f.begin(), it);
+		if (p.idx[k] >= 0) {
+			out.setError("duplicate terrain variable: " + v[i]);
+			return(out);
+		}
+		p.idx[k] = i;
 	}
 
 	if ((neighbors != 4) && (neighbors != 8)) {
 		out.setError("neighbors should be 4 or 8");
 		return out;
 	}
-	bool lonlat = is_lonlat();
-	double yr = yres();
+	p.ngb = neighbors;
+	p.degrees = degrees;
+	p.seed = seed;
+	p.lonlat = is_lonlat();
+	p.nrow = nrow();
+	p.ncol = ncol();
+	p.xres = xres();
+	p.dy = yres();
+	p.fdx = xres();
+	p.fdy = yres();
+	if (p.lonlat) {
+		p.dy = distHaversine(0, 0, 0, yres());
+		double yhalf = yFromRow((size_t) nrow()/2);
+		p.fdx = distHaversine(0, yhalf, p.fdx, yhalf);
+		p.fdy = p.dy;
+	}
 
 	if (!readStart()) {
 		out.setError(getError());
@@ -2434,74 +2286,80 @@ SpatRaster SpatRaster::terrain(std::vector<std::string> v, unsigned neighbors, b
 	}
 	
 	opt.minrows = 3;
+	opt.ncopies += 2;
   	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
+	size_t nr = nrow();
 	size_t nc = ncol();
 
-	if (nrow() < 3 || nc < 3) {
+	if (nr < 3 || nc < 3) {
 		for (size_t i = 0; i < out.bs.n; i++) {
-			std::vector<double> val(out.bs.nrows[i] * nc, NAN);
-			if (!out.writeBlock(val, i)) return out;
+			std::vector<double> val(out.bs.nrows[i] * nc * v.size(), NAN);
+			if (!out.writeBlock(val, i)) {
+				readStop();
+				return out;
+			}
 		}
+		out.writeStop();
+		readStop();
 		return out;
 	}
 
-
-	std::vector<double> y;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> d;
-		bool before= false;
-		bool after = false;
-		size_t rrow = out.bs.row[i];
-		size_t rnrw = out.bs.nrows[i];
-		if (i > 0) {
-			rrow--;
-			rnrw++;
-			before=true;
-		}	
-		if ((out.bs.row[i] + out.bs.nrows[i]) < nrow()) {
-			rnrw++;
-			after = true;
-		}
-		readValues(d, rrow, rnrw, 0, nc);
-		if (lonlat && aspslope) {
-			std::vector<int_64> rows(rnrw);
-			std::iota(rows.begin(), rows.end(), rrow);
-			y = yFromRow(rows);
-			yr = distHaversine(0, 0, 0, yres());
-		}
-		std::vector<double> val;
-		val.reserve(out.bs.nrows[i] * ncol() * v.size());
-		for (size_t j =0; j<v.size(); j++) {
-			if (v[j] == "slope") {
-				do_slope(val, d, neighbors, rnrw, nc, xres(), yr, lonlat, y, degrees, before, after);
-			} else if (v[j] == "aspect") {
-				do_aspect(val, d, neighbors, rnrw, nc, xres(), yr, lonlat, y, degrees, before, after);
-			} else if (v[j] == "flowdir") {
-				double dx = xres();
-				double dy = yres();
-				if (lonlat) {
-					double yhalf = yFromRow((size_t) nrow()/2);
-					dx = distHaversine(0, yhalf, dx, yhalf);
-					dy = distHaversine(0, 0, 0, dy);
+	// the rows that are needed for the current band. The last two rows
+	// are kept for the next band, so that each row is read only once
+	std::vector<double> win;
+	size_t wstart = 0, wend = 0;
+
+	bool ok = out.writeBlocks(
+		[&](std::vector<std::vector<double>> &vv, size_t i) {
+			size_t brow = out.bs.row[i];
+			size_t bnr = out.bs.nrows[i];
+			size_t a = brow > 0 ? brow - 1 : 0;
+			size_t b = std::min(nr, brow + bnr + 1);
+			if (a > wstart) {
+				size_t n = std::min(a, wend) - wstart;
+				win.erase(win.begin(), win.begin() + n * nc);
+				wstart = a;
+				wend = std::max(wend, a);
+			}
+			if (b > wend) {
+				std::vector<double> vin;
+				readValues(vin, wend, b - wend, 0, nc);
+				if (hasError()) {
+					out.setError(getError());
+					return false;
 				}
-				do_flowdir(val, d, rnrw, nc, dx, dy, seed, before, after);
-			} else if (v[j] == "roughness") {
-				do_roughness(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TPI") {
-				do_TPI(val, d, rnrw, nc, before, after);
-			} else if (v[j] == "TRI") {
-				do_TRI(val, d, rnrw, nc, before, after);
-			} else {
-				out.setError("?"); return out;
+				win.insert(win.end(), vin.begin(), vin.end());
+				wend = b;
 			}
-		}
-		if (!out.writeBlock(val, i)) return out;
-	}
-	out.writeStop();
+			vv.resize(1);
+			vv[0].resize(0);
+			vv[0].reserve((bnr + 2) * nc);
+			if (brow == 0) {
+				vv[0].resize(nc, NAN);
+			}
+			vv[0].insert(vv[0].end(), win.begin(), win.end());
+			if ((brow + bnr) == nr) {
+				vv[0].resize(vv[0].size() + nc, NAN);
+			}
+			return true;
+		},
+		[&](std::vector<std::vector<double>> &vv, size_t i) {
+			std::vector<double> y;
+			if (p.lonlat) {
+				std::vector<int_64> rows(out.bs.nrows[i]);
+				std::iota(rows.begin(), rows.end(), out.bs.row[i]);
+				y = yFromRow(rows);
+			}
+			std::vector<double> val;
+			terrain_band(vv[0], out.bs.row[i], out.bs.nrows[i], p, y, val);
+			vv[0] = std::move(val);
+		}, opt);
+
 	readStop();
+	if (!ok) return out;
+	out.writeStop();
 	return out; 
 }
-
@@ -16,6 +16,9 @@
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
 #include <functional>
+#include <list>
+#include <unordered_map>
+#include <limits>
 
 #include "spatRasterMultiple.h"
 #include "distance.h"
@@ -560,6 +563,249 @@ std::vector<double> SpatRaster::extractXYFlat(const std::vector<double> &x, cons
 */
 
 
+// The cells of the lines or polygons in v are processed one block of rows at a time,
+// and each block that has cells is read once. Geometries are rasterized (on a 
+// grid cropped to their extent) when the first block they could be in is reached,
+// and forgotten after their last block. 
+// start(i, cells, weights) is called when geometry i is rasterized
+// add(i, k, v, stride) is called for the k-th cell of geometry i. v points to the value of 
+// the first layer in the block that has the cell (layer j is at v[j*stride]); it is NULL 
+// if the cell is NA (outside the raster)
+// finish(i) is called after the last cell of geometry i.
+bool SpatRaster::extractVectorBlocks(SpatVector &v, bool touches, bool weights, bool exact, 
+		std::function<void(size_t, std::vector<double>&, std::vector<double>&)> start,
+		std::function<void(size_t, size_t, const double*, size_t)> add,
+		std::function<void(size_t)> finish, SpatOptions &opt) {
+
+	size_t ng = v.size();
+	size_t nr = nrow();
+	size_t nc = ncol();
+
+	// the first row that each geometry could touch; one row up in case
+	// the top of the geometry is on the edge between two rows 
+	SpatExtent e = getExtent();
+	std::vector<size_t> firstrow(ng);
+	for (size_t i=0; i<ng; i++) {
+		double ymax = v.geoms[i].extent.ymax;
+		if (std::isnan(ymax) || (ymax >= e.ymax)) {
+			firstrow[i] = 0;
+		} else if (ymax < e.ymin) {
+			firstrow[i] = nr;
+		} else {
+			size_t r = rowFromY(ymax);
+			firstrow[i] = r > 0 ? r - 1 : 0;
+		}
+	}
+	std::vector<size_t> order(ng);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&firstrow](size_t a, size_t b) { return firstrow[a] < firstrow[b]; });
+
+	struct ActiveGeom {
+		size_t id;
+		std::vector<double> cells;
+		std::vector<size_t> ord; // cells in sorted order
+		size_t pos = 0;
+	};
+	std::list<ActiveGeom> active;
+	double ncells = ncell();
+	bool lonlat = (weights || exact) && is_lonlat();
+
+	auto activate = [&](size_t i) {
+		std::vector<double> cells, wgt;
+		if (weights || exact) {
+			rasterizeCellsExact(cells, wgt, v.geoms[i], lonlat);
+		} else {
+			cells = rasterizeCells(v.geoms[i], touches);
+		}
+		start(i, cells, wgt);
+		ActiveGeom g;
+		g.id = i;
+		g.ord.reserve(cells.size());
+		for (size_t k=0; k<cells.size(); k++) {
+			if (std::isnan(cells[k]) || (cells[k] < 0) || (cells[k] >= ncells)) {
+				add(i, k, NULL, 0);
+			} else {
+				g.ord.push_back(k);
+			}
+		}
+		// the cells of the scanline rasterizer are already sorted
+		auto cellorder = [&cells](size_t a, size_t b) { return cells[a] < cells[b]; };
+		if (!std::is_sorted(g.ord.begin(), g.ord.end(), cellorder)) {
+			std::sort(g.ord.begin(), g.ord.end(), cellorder);
+		}
+		if (g.ord.empty()) {
+			finish(i);
+		} else {
+			g.cells = std::move(cells);
+			active.push_back(std::move(g));
+		}
+	};
+
+	if (!readStart()) return false;
+	BlockSize bs = getBlockSize(opt);
+	size_t next = 0;
+	std::vector<double> vals;
+	for (size_t b=0; b < bs.n; b++) {
+		size_t endrow = bs.row[b] + bs.nrows[b];
+		double endcell = (double) endrow * nc;
+		// rasterize the geometries that could start in this block
+		while ((next < ng) && (firstrow[order[next]] < endrow)) {
+			activate(order[next]);
+			next++;
+			if (hasError()) {
+				readStop();
+				return false;
+			}
+		}
+		if (active.empty()) continue;
+
+		bool hascells = false;
+		for (ActiveGeom &g : active) {
+			if (g.cells[g.ord[g.pos]] < endcell) {
+				hascells = true;
+				break;
+			}
+		}
+		if (!hascells) continue;
+		readValues(vals, bs.row[b], bs.nrows[b], 0, nc);
+		if (hasError()) {
+			readStop();
+			return false;
+		}
+		size_t stride = bs.nrows[b] * nc;
+		size_t offset = bs.row[b] * nc;
+		for (auto it = active.begin(); it != active.end(); ) {
+			ActiveGeom &g = *it;
+			while ((g.pos < g.ord.size()) && (g.cells[g.ord[g.pos]] < endcell)) {
+				size_t k = g.ord[g.pos];
+				add(g.id, k, &vals[(size_t)g.cells[k] - offset], stride);
+				g.pos++;
+			}
+			if (g.pos == g.ord.size()) {
+				finish(g.id);
+				it = active.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	// geometries below the raster
+	while (next < ng) {
+		activate(order[next]);
+		next++;
+		if (hasError()) {
+			readStop();
+			return false;
+		}
+	}
+	for (ActiveGeom &g : active) {
+		finish(g.id);
+	}
+	readStop();
+	return true;
+}
+
+
+// running (weighted) statistics for one geometry and layer
+class ExtractStat {
+	public:
+		double nall = 0; // cells
+		double n = 0;    // cells that are not NA
+		double w = 0;    // sum of the weights of these cells 
+		double sum = 0;  // weighted sum
+		double min = std::numeric_limits<double>::infinity();
+		double max = -std::numeric_limits<double>::infinity();
+		bool hasNA = false;
+
+		void add(double d, double wd) {
+			nall++;
+			if (std::isnan(d)) {
+				hasNA = true;
+				return;
+			}
+			n++;
+			w += wd;
+			sum += d * wd;
+			if (d < min) min = d;
+			if (d > max) max = d;
+		}
+
+		double result(const std::string &fun, bool narm, bool weighted) {
+			if (fun == "count") return weighted ? w : n;
+			if ((n == 0) || (hasNA && !narm)) return NAN;
+			if (fun == "sum") return sum;
+			if (fun == "mean") return sum / w;
+			if (fun == "min") return min;
+			if (fun == "max") return max;
+			return NAN;
+		}
+};
+
+
+// <layer<geom>>
+std::vector<std::vector<double>> SpatRaster::extractVectorSummary(SpatVector v, bool touches, std::string fun, bool narm, bool weights, bool exact, SpatOptions &opt) {
+
+	std::vector<std::string> f {"sum", "mean", "min", "max", "count"};
+	size_t nl = nlyr();
+	size_t ng = v.size();
+	std::vector<std::vector<double>> out(nl, std::vector<double>(ng, NAN));
+	if (std::find(f.begin(), f.end(), fun) == f.end()) {
+		setError("not a valid function");
+		return out;
+	}
+	if (!hasValues()) {
+		setError("raster has no value");
+		return out;
+	}
+	std::string gtype = v.type();
+	if (gtype == "points") {
+		setError("cannot summarize points");
+		return out;
+	}
+	if (gtype != "polygons") weights = false;
+	if (weights) exact = false;
+	bool weighted = weights || exact;
+
+	// only the geometries that are being processed have statistics and weights
+	std::unordered_map<size_t, std::vector<ExtractStat>> stats;
+	std::unordered_map<size_t, std::vector<double>> wgt;
+	auto start = [&](size_t i, std::vector<double> &cells, std::vector<double> &w) {
+		stats[i].resize(nl);
+		if (weighted) wgt[i] = w;
+	};
+	// cells come in runs of the same geometry
+	size_t lasti = ng;
+	std::vector<ExtractStat> *s = NULL;
+	std::vector<double> *ws = NULL;
+	auto add = [&](size_t i, size_t k, const double *d, size_t stride) {
+		if (i != lasti) {
+			s = &stats[i];
+			if (weighted) ws = &wgt[i];
+			lasti = i;
+		}
+		double w = weighted ? (*ws)[k] : 1;
+		if (std::isnan(w)) return;
+		for (size_t j=0; j<nl; j++) {
+			(*s)[j].add(d == NULL ? NAN : d[j * stride], w);
+		}
+	};
+	auto finish = [&](size_t i) {
+		std::vector<ExtractStat> &st = stats[i];
+		for (size_t j=0; j<nl; j++) {
+			out[j][i] = st[j].result(fun, narm, weighted);
+		}
+		stats.erase(i);
+		wgt.erase(i);
+		lasti = ng;
+	};
+	if (!extractVectorBlocks(v, touches, weights, exact, start, add, finish, opt)) {
+		if (!hasError()) setError("cannot read values");
+		return std::vector<std::vector<double>>();
+	}
+	return out;
+}
+
+
 // <geom<layer<values>>>
 std::vector<std::vector<std::vector<double>>> SpatRaster::extractVector(SpatVector v, bool touches, std::string method, bool cells, bool xy, bool weights, bool exact, SpatOptions &opt) {
 
@@ -628,24 +874,11 @@ std::vector<std::vector<std::vector<double>>> SpatRaster::extractVector(SpatVect
 			}
 		}
 	} else {
-	    SpatRaster r = geometry(1);
-		//std::vector<double> feats(1, 1) ;
-        for (size_t i=0; i<ng; i++) {
-            SpatGeom g = v.getGeom(i);
-            SpatVector p(g);
-			p.srs = v.srs;
-			std::vector<double> cell, wgt;
-			if (weights) {
-				rasterizeCellsWeights(cell, wgt, p, opt);
-			} else if (exact) {
-				rasterizeCellsExact(cell, wgt, p, opt);
-			} else {
-				cell = rasterizeCells(p, touches, opt);
-            }
-			srcout = extractCell(cell);
-            for (size_t j=0; j<nl; j++) {
-                out[i][j] = srcout[j];
-            }
+		// the values are read by block, see extractVectorBlocks
+		auto start = [&](size_t i, std::vector<double> &cell, std::vector<double> &wgt) {
+			for (size_t j=0; j<nl; j++) {
+				out[i][j].resize(cell.size(), NAN);
+			}
 			if (cells) {
 				out[i][nl] = cell;
 			}
@@ -657,7 +890,18 @@ std::vector<std::vector<std::vector<double>>> SpatRaster::extractVector(SpatVect
 			if (weights || exact) {
 				out[i][nl + cells + 2*xy] = wgt;
 			}
-        }
+		};
+		auto add = [&](size_t i, size_t k, const double *d, size_t stride) {
+			if (d == NULL) return;
+			for (size_t j=0; j<nl; j++) {
+				out[i][j][k] = d[j * stride];
+			}
+		};
+		auto finish = [](size_t i) {};
+		if (!extractVectorBlocks(v, touches, weights, exact, start, add, finish, opt)) {
+			if (!hasError()) setError("cannot read values");
+			return std::vector<std::vector<std::vector<double>>>();
+		}
 	}
 	return out;
 }
@@ -746,24 +990,11 @@ std::vector<double> SpatRaster::extractVectorFlat(SpatVector v, bool touches, st
 		}
 		*/
 	} else {
-	    SpatRaster r = geometry(1);
-		//std::vector<double> feats(1, 1) ;
-        for (size_t i=0; i<ng; i++) {
-            SpatGeom g = v.getGeom(i);
-            SpatVector p(g);
-			p.srs = v.srs;
-			std::vector<double> cell, wgt;
-			if (weights) {
-				rasterizeCellsWeights(cell, wgt, p, opt);
-			} else if (exact) {
-				rasterizeCellsExact(cell, wgt, p, opt);
-			} else {
-				cell = rasterizeCells(p, touches, opt);
-            }
-			srcout = extractCell(cell);
-            for (size_t j=0; j<nl; j++) {
-                out[i][j] = srcout[j];
-            }
+		// the values are read by block, see extractVectorBlocks
+		auto start = [&](size_t i, std::vector<double> &cell, std::vector<double> &wgt) {
+			for (size_t j=0; j<nl; j++) {
+				out[i][j].resize(cell.size(), NAN);
+			}
 			if (cells) {
 				out[i][nl] = cell;
 			}
@@ -775,7 +1006,18 @@ std::vector<double> SpatRaster::extractVectorFlat(SpatVector v, bool touches, st
 			if (weights || exact) {
 				out[i][nl + cells + 2*xy] = wgt;
 			}
-        }
+		};
+		auto add = [&](size_t i, size_t k, const double *d, size_t stride) {
+			if (d == NULL) return;
+			for (size_t j=0; j<nl; j++) {
+				out[i][j][k] = d[j * stride];
+			}
+		};
+		auto finish = [](size_t i) {};
+		if (!extractVectorBlocks(v, touches, weights, exact, start, add, finish, opt)) {
+			if (!hasError()) setError("cannot read values");
+			return flat;
+		}
 	}
 
 	size_t fsize = 0;
@@ -847,6 +1089,18 @@ std::vector<std::vector<double>> SpatRaster::extractCell(std::vector<double> &ce
 				}
 				lyr++;
 			}
+		} else if (source[src].lazy || (source[src].driver == "mmap")) {
+			std::vector<std::vector<double>> srcout;
+			if (source[src].lazy) {
+				srcout = readRowColLazy(src, rc[0], rc[1]);
+			} else {
+				srcout = readRowColMMap(src, rc[0], rc[1]);
+			}
+			if (hasError()) return out;
+			for (size_t i=0; i<slyrs; i++) {
+				out[lyr] = srcout[i];
+				lyr++;
+			}
 		} else {
 			std::vector<std::vector<double>> srcout;
 			//if (source[0].driver == "raster") {
@@ -926,6 +1180,17 @@ std::vector<double> SpatRaster::extractCellFlat(std::vector<double> &cell) {
 				}
 				lyr++;
 			}
+		} else if (source[src].lazy || (source[src].driver == "mmap")) {
+			std::vector<std::vector<double>> g;
+			if (source[src].lazy) {
+				g = readRowColLazy(src, rc[0], rc[1]);
+			} else {
+				g = readRowColMMap(src, rc[0], rc[1]);
+			}
+			if (hasError()) return out;
+			for (size_t i=0; i<slyrs; i++) {
+				std::copy(g[i].begin(), g[i].end(), out.begin() + off + i*n);
+			}
 		} else {
 			//if (source[0].driver == "raster") {
 			//	srcout = readCellsBinary(src, cell);
@@ -975,28 +1240,17 @@ std::vector<double> SpatRaster::vectCells(SpatVector v, bool touches, std::strin
 		unsigned ng = v.size();
 		SpatRaster r = geometry(1);
 		std::vector<double> feats(1, 1) ;
+		bool lonlat = (weights || exact) && is_lonlat();
         for (size_t i=0; i<ng; i++) {
-            SpatGeom g = v.getGeom(i);
-            SpatVector p(g);
-			p.srs = v.srs;
-			if (weights) {
-				std::vector<double> cnr, wght;
-				rasterizeCellsWeights(cnr, wght, p, opt);
-				std::vector<double> id(cnr.size(), i);
-				out.insert(out.end(), id.begin(), id.end());
-				cells.insert(cells.end(), cnr.begin(), cnr.end());
-				wghts.insert(wghts.end(), wght.begin(), wght.end());
-			} else if (exact) {
+			if (weights || exact) {
 				std::vector<double> cnr, wght;
-				rasterizeCellsExact(cnr, wght, p, opt);
-				std::vector<double> id(cnr.size(), i);
-				out.insert(out.end(), id.begin(), id.end());
+				rasterizeCellsExact(cnr, wght, v.geoms[i], lonlat);
+				out.insert(out.end(), cnr.size(), i);
 				cells.insert(cells.end(), cnr.begin(), cnr.end());
 				wghts.insert(wghts.end(), wght.begin(), wght.end());
 			} else {
-				std::vector<double> geomc = rasterizeCells(p, touches, opt);
-				std::vector<double> id(geomc.size(), i);
-				out.insert(out.end(), id.begin(), id.end());
+				std::vector<double> geomc = rasterizeCells(v.geoms[i], touches);
+				out.insert(out.end(), geomc.size(), i);
 				cells.insert(cells.end(), geomc.begin(), geomc.end());
 			}
         }
@@ -1071,6 +1325,10 @@ std::vector<std::vector<std::vector<std::vector<double>>>> SpatRasterStack::extr
 	for (size_t i=0; i<ns; i++) {
 		SpatRaster r = getsds(i);
 		out[i] = r.extractVector(v, touches, method, false, false, false, false, opt);
+		if (r.hasError()) {
+			setError(r.getError());
+			return std::vector<std::vector<std::vector<std::vector<double>>>>();
+		}
 	}
 	return out;
 }
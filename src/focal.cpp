@@ -1,4 +1,4 @@
-// Copyright (c) 2018-2021  Robert J. Hijmans
+// Copyright (c) 2018-2022  Robert J. Hijmans
 //
 // This file is part of the "spat" library.
 //
@@ -17,6 +17,8 @@
 
 #include "spatRaster.h"
 #include "vecmath.h"
+#include <map>
+#include <limits>
 
 
 std::vector<double> rcValue(std::vector<double> &d, const int& nrow, const int& ncol, const unsigned& nlyr, const int& row, const int& col) {
@@ -127,276 +129,494 @@ std::vector<double> SpatRaster::focal_values(std::vector<unsigned> w, double fil
 
 
 
-void focal_win_fun(const std::vector<double> &d, std::vector<double> &out, int nc, int srow, int nr,
-                    std::vector<double> window, int wnr, int wnc, double fill, bool narm, bool naonly, bool naomit, bool expand, bool global, std::function<double(std::vector<double>&, bool)> fun) {
+// A focal window and the settings shared by the focal kernels. The kernels
+// get a block of values that is extended with hwr rows above and below,
+// and hwc columns left and right, so that they do not need to check the 
+// borders. The top-left cell of the window of output cell (r, c) is 
+// r * nce + c, and its other cells are at the offsets in "off".
+class FocalWindow {
+	public:
+		size_t wnr, wnc, hwr, hwc;
+		size_t nce; // number of columns of the extended block
+		std::vector<size_t> off; // offsets of the cells with a weight that is not NA
+		std::vector<double> w;   // the weights of these cells
+		double abswsum = 0;      // sum of the absolute weights
+		bool ones = false;       // a rectangular window with all weights 1
+		bool narm, naonly, naomit;
+
+		FocalWindow(std::vector<unsigned> ws, std::vector<double> m, size_t nc, bool _narm, bool _naonly, bool _naomit) {
+			wnr = ws[0];
+			wnc = ws[1];
+			hwr = wnr / 2;
+			hwc = wnc / 2;
+			nce = nc + 2 * hwc;
+			narm = _narm;
+			naonly = _naonly;
+			naomit = _naomit;
+			ones = true;
+			for (size_t rr=0; rr<wnr; rr++) {
+				for (size_t cc=0; cc<wnc; cc++) {
+					double d = m[rr * wnc + cc];
+					if (d != 1) ones = false;
+					if (std::isnan(d)) continue;
+					off.push_back(rr * nce + cc);
+					w.push_back(d);
+					abswsum += std::fabs(d);
+				}
+			}
+		}
 
-	out.resize(nc * nr);
-	int hwc = wnc / 2;
-	int hwr = wnr / 2;
-	std::vector<bool> winNA(window.size(), false);
-	for (size_t i=0; i<window.size(); i++) {
-		if (std::isnan(window[i])) winNA[i] = true; 
+		// true if the value of the center cell means that the cell is not computed
+		inline bool skip(const double &center) const {
+			return (naonly && !std::isnan(center)) || (naomit && std::isnan(center));
+		}
+};
+
+typedef void (*FocalKernel)(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw);
+
+
+// extend nr rows of nc columns with hwc columns on both sides
+void focal_extend_cols(const std::vector<double> &d, std::vector<double> &e, size_t nr, size_t nc, size_t hwc, double fill, bool expand, bool global) {
+	size_t nce = nc + 2 * hwc;
+	e.resize(nr * nce);
+	for (size_t r=0; r<nr; r++) {
+		const double *in = &d[r * nc];
+		double *ex = &e[r * nce];
+		std::copy(in, in + nc, ex + hwc);
+		for (size_t c=0; c<hwc; c++) {
+			if (global) {
+				ex[c] = in[nc - hwc + c];
+				ex[hwc + nc + c] = in[c];
+			} else if (expand) {
+				ex[c] = in[0];
+				ex[hwc + nc + c] = in[nc-1];
+			} else {
+				ex[c] = fill;
+				ex[hwc + nc + c] = fill;
+			}
+		}
 	}
+}
 
-	int wr1 = wnr - 1;
-	int wc1 = wnc - 1;
-	int nc1 = nc - 1;
-	
-	bool checkNA = naonly || naomit;
-
-	for (int r=0; r < nr; r++) {
-		int rread = r+srow;
-		for (int c=0; c < nc; c++) {
-			size_t cell = r*nc + c;
-			if (checkNA) {
-				size_t readcell = rread*nc + c;
-				if (naonly) {
-					if (!std::isnan(d[readcell])) {
-						out[cell] = d[readcell];
-						continue;
-					}					
-				} else if (std::isnan(d[readcell])) {
-					out[cell] = d[readcell];						
-					continue;
+
+void focal_sum(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	size_t nw = fw.off.size();
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			double value = 0;
+			bool found = false;
+			if (fw.narm) {
+				for (size_t k=0; k<nw; k++) {
+					double v = d[cell + fw.off[k]];
+					if (!std::isnan(v)) {
+						value += v * fw.w[k];
+						found = true;
+					}
 				}
+			} else {
+				for (size_t k=0; k<nw; k++) {
+					value += d[cell + fw.off[k]] * fw.w[k];
+				}
+				found = true;
 			}
-			std::vector<double> v;
-			v.reserve(wnr * wnc);
-			for (int rr=0; rr<wnr; rr++) {
-				int offr = wr1 - rr;
-				for (int cc=0; cc < wnc; cc++)  {
-					int offc = wc1 - cc; 
-					//int wi = wnc * offr + offc;
-					int wi = wnc * rr + cc;
-					if (winNA[wi]) {
-						continue;
-					}
-					int row = rread + hwr - offr;
-					int col = c + hwc - offc;
-					if (global) {
-						col = col < 0 ? nc + col : col;
-						col = col > nc1 ? col - nc : col;
-						v.push_back(d[nc*row + col] * window[wi]);
-					} else if (expand) {
-						col = col < 0 ? 0 : col;
-						col = col > nc1 ? nc1 : col;
-						v.push_back(d[nc*row + col] * window[wi]);
-					} else {
-						if (col >= 0 && col < nc) {
-							v.push_back(d[nc*row + col] * window[wi]);
-						} else {
-							v.push_back(fill * window[wi]);
-						}
+			if (found) out[r * nc + c] = value;
+		}
+	}
+}
+
+
+void focal_mean(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	size_t nw = fw.off.size();
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			double value = 0;
+			double wsum = fw.abswsum;
+			if (fw.narm) {
+				wsum = 0;
+				for (size_t k=0; k<nw; k++) {
+					double v = d[cell + fw.off[k]];
+					if (!std::isnan(v)) {
+						value += v * fw.w[k];
+						wsum += std::fabs(fw.w[k]);
 					}
 				}
+			} else {
+				for (size_t k=0; k<nw; k++) {
+					value += d[cell + fw.off[k]] * fw.w[k];
+				}
 			}
-			out[cell] = fun(v, narm);
+			if (wsum > 0) out[r * nc + c] = value / wsum;
 		}
 	}
 }
 
 
+void focal_sd(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	size_t nw = fw.off.size();
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			double sum = 0;
+			size_t n = 0;
+			for (size_t k=0; k<nw; k++) {
+				double v = d[cell + fw.off[k]] * fw.w[k];
+				if (!std::isnan(v)) {
+					sum += v;
+					n++;
+				} else if (!fw.narm) {
+					n = 0;
+					break;
+				}
+			}
+			if (n < 2) continue;
+			double m = sum / n;
+			double ss = 0;
+			for (size_t k=0; k<nw; k++) {
+				double v = d[cell + fw.off[k]] * fw.w[k];
+				if (!std::isnan(v)) {
+					ss += (v - m) * (v - m);
+				}
+			}
+			out[r * nc + c] = std::sqrt(ss / (n - 1));
+		}
+	}
+}
 
-void focal_win_sum(const std::vector<double> &d, std::vector<double> &out, int nc, int srow, int nr,
-                    std::vector<double> window, int wnr, int wnc, double fill, bool narm, bool naonly, bool naomit, bool expand, bool global) {
 
-	out.resize(nc*nr, NAN);
-	int hwc = wnc / 2;
-	int hwr = wnr / 2;
-	bool nafill = std::isnan(fill);
-	bool dofill = !(narm && nafill);
-	std::vector<bool> winNA(window.size(), false);
-	for (size_t i=0; i<window.size(); i++) {
-		if (std::isnan(window[i])) winNA[i] = true; 
+// binary operators for min and max that either ignore or propagate NA
+struct focal_min_rm { inline double operator()(const double &a, const double &b) const { return (a < b || std::isnan(b)) ? a : b; } };
+struct focal_min_na { inline double operator()(const double &a, const double &b) const { return (a < b || std::isnan(a)) ? a : b; } };
+struct focal_max_rm { inline double operator()(const double &a, const double &b) const { return (a > b || std::isnan(b)) ? a : b; } };
+struct focal_max_na { inline double operator()(const double &a, const double &b) const { return (a > b || std::isnan(a)) ? a : b; } };
+
+
+// van Herk / Gil-Werman: min or max of a rectangular window with all weights 1
+// in about three comparisons per cell, independent of the size of the window. 
+// The window is first moved over the rows (for all columns at once) and then 
+// over the columns
+template <typename Op>
+void focal_vhgw(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw, Op op) {
+	size_t ncol = fw.nce;
+	size_t nrow = nr + 2 * fw.hwr;
+	size_t wnr = fw.wnr;
+	size_t wnc = fw.wnc;
+
+	// prefix (g) and suffix (h) within blocks of wnr rows
+	std::vector<double> g(d.begin(), d.begin() + nrow * ncol);
+	std::vector<double> h = g;
+	for (size_t r=1; r<nrow; r++) {
+		if ((r % wnr) == 0) continue;
+		double *gr = &g[r * ncol];
+		const double *gp = &g[(r-1) * ncol];
+		for (size_t c=0; c<ncol; c++) {
+			gr[c] = op(gp[c], gr[c]);
+		}
+	}
+	for (size_t r=nrow-1; r>0; r--) {
+		size_t rr = r - 1;
+		if ((rr % wnr) == (wnr - 1)) continue;
+		double *hr = &h[rr * ncol];
+		const double *hn = &h[r * ncol];
+		for (size_t c=0; c<ncol; c++) {
+			hr[c] = op(hn[c], hr[c]);
+		}
 	}
 
-	int wr1 = wnr - 1;
-	int wc1 = wnc - 1;
-	int nc1 = nc - 1;
-	bool checkNA = naonly || naomit;
+	std::vector<double> v(ncol), gc(ncol), hc(ncol);
+	for (size_t r=0; r<nr; r++) {
+		const double *hr = &h[r * ncol];
+		const double *gr = &g[(r + wnr - 1) * ncol];
+		for (size_t c=0; c<ncol; c++) {
+			v[c] = op(hr[c], gr[c]);
+		}
+		for (size_t c=0; c<ncol; c++) {
+			gc[c] = ((c % wnc) == 0) ? v[c] : op(gc[c-1], v[c]);
+		}
+		hc[ncol-1] = v[ncol-1];
+		for (size_t c=ncol-1; c>0; c--) {
+			size_t cc = c - 1;
+			hc[cc] = ((cc % wnc) == (wnc - 1)) ? v[cc] : op(hc[c], v[cc]);
+		}
+		double *o = &out[r * nc];
+		for (size_t c=0; c<nc; c++) {
+			o[c] = op(hc[c], gc[c + wnc - 1]);
+		}
+	}
 
-	for (int r=0; r < nr; r++) {
-		int rread = r+srow;
-		for (int c=0; c < nc; c++) {
-			size_t cell = r*nc + c;
-			if (checkNA) {
-				size_t readcell = rread*nc + c;
-				if (naonly) {
-					if (!std::isnan(d[readcell])) {
-						out[cell] = d[readcell];
-						continue;
-					}					
-				} else if (std::isnan(d[readcell])) {
-					continue;
-				}
+	if (fw.naonly || fw.naomit) {
+		for (size_t r=0; r<nr; r++) {
+			for (size_t c=0; c<nc; c++) {
+				if (fw.skip(d[(r + fw.hwr) * ncol + c + fw.hwc])) out[r * nc + c] = NAN;
 			}
-			double value = 0;
-			bool found = false;
-			for (int rr=0; rr<wnr; rr++) {
-				int offr = wr1 - rr;
-				for (int cc=0; cc < wnc; cc++)  {
-					int offc = wc1 - cc; 
-					//int wi = wnc * offr + offc;
-					int wi = wnc * rr + cc;
-					if (winNA[wi]) {
-						continue;
-					}
-					int row = rread + hwr - offr;
-					int col = c + hwc - offc;
-					if (global) {
-						col = col < 0 ? nc + col : col;
-						col = col > nc1 ? col - nc : col;
-						if (narm) {
-							if (!std::isnan(d[nc * row + col])) {
-								value += d[nc*row + col] * window[wi];
-								found = true;
-							}
-						} else {
-							value += d[nc*row + col] * window[wi];
-						}
-					} else if (expand) {
-						col = col < 0 ? 0 : col;
-						col = col > nc1 ? nc1 : col;
-						if (narm) {
-							if (!std::isnan(d[nc * row + col])) {
-								value += d[nc*row + col] * window[wi];
-								found = true;
-							}
-						} else {
-							value += d[nc*row + col] * window[wi];
-						}
-					} else {
-						if (col >= 0 && col < nc) {
-							if (narm) {
-								if (!std::isnan(d[nc*row + col])) {
-									value += d[nc*row + col] * window[wi];
-									found = true;
-								}
-							} else {
-								value += d[nc*row + col] * window[wi]; 
-							}
-						} else if (dofill) {
-							value += fill * window[wi];
-						}
-					}
-				}
-			}
-			if (narm) {
-				if (found) {
-					out[cell] = value;
-				}
-			} else {
-				out[cell] = value;
+		}
+	}
+}
+
+
+template <typename Op>
+void focal_minmax(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw, Op op) {
+	size_t nw = fw.off.size();
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			double value = d[cell + fw.off[0]] * fw.w[0];
+			for (size_t k=1; k<nw; k++) {
+				value = op(value, d[cell + fw.off[k]] * fw.w[k]);
 			}
+			out[r * nc + c] = value;
 		}
 	}
 }
 
-void focal_win_mean(const std::vector<double> &d, std::vector<double> &out, int nc, int srow, int nr,
-                    std::vector<double> window, int wnr, int wnc, double fill, bool narm, bool naonly, bool naomit, bool expand, bool global) {
-
-	out.resize(nc*nr, NAN);
-	int hwc = wnc / 2;
-	int hwr = wnr / 2;
-	bool nafill = std::isnan(fill);
-	bool dofill = !(narm && nafill);
-	std::vector<bool> winNA(window.size(), false);
-	double winsum = 0;
-	std::vector<double> poswin = window;
-	for (size_t i=0; i<window.size(); i++) {
-		if (std::isnan(window[i])) {
-			winNA[i] = true; 
+
+void focal_min(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	if (fw.ones) {
+		if (fw.narm) {
+			focal_vhgw(d, out, nr, nc, fw, focal_min_rm());
 		} else {
-			if (window[i] < 0) {
-				poswin[i] = -poswin[i];
-			} 
-			winsum += poswin[i]; 
+			focal_vhgw(d, out, nr, nc, fw, focal_min_na());
 		}
+	} else if (fw.narm) {
+		focal_minmax(d, out, nr, nc, fw, focal_min_rm());
+	} else {
+		focal_minmax(d, out, nr, nc, fw, focal_min_na());
 	}
+}
 
-	int wr1 = wnr - 1;
-	int wc1 = wnc - 1;
-	int nc1 = nc - 1;
+void focal_max(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	if (fw.ones) {
+		if (fw.narm) {
+			focal_vhgw(d, out, nr, nc, fw, focal_max_rm());
+		} else {
+			focal_vhgw(d, out, nr, nc, fw, focal_max_na());
+		}
+	} else if (fw.narm) {
+		focal_minmax(d, out, nr, nc, fw, focal_max_rm());
+	} else {
+		focal_minmax(d, out, nr, nc, fw, focal_max_na());
+	}
+}
 
-	bool checkNA = naonly || naomit;
 
-	for (int r=0; r<nr; r++) {
-		int rread = r+srow;
-		for (int c=0; c < nc; c++) {
-			size_t cell = r*nc + c;
-			if (checkNA) {
-				size_t readcell = rread*nc + c;				
-				if (naonly) {
-					if (!std::isnan(d[readcell])) {
-						out[cell] = d[readcell];
-						continue;
-					}					
-				} else if (std::isnan(d[readcell])) {
+// collect the (weighted) values of a window in v. Returns false if there is 
+// an NA and narm is false
+inline bool focal_window_values(const std::vector<double> &d, size_t cell, const FocalWindow &fw, std::vector<double> &v) {
+	v.clear();
+	for (size_t k=0; k<fw.off.size(); k++) {
+		double x = d[cell + fw.off[k]] * fw.w[k];
+		if (!std::isnan(x)) {
+			v.push_back(x);
+		} else if (!fw.narm) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Huang's sliding histogram, for integer values in [vmin, vmin+nbins).
+// the histogram is updated with one column of the window when moving to 
+// the next cell; the median is found by moving a pointer from its last position
+void focal_median_hist(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw, double vmin, size_t nbins) {
+	std::vector<size_t> hist(nbins);
+	size_t nce = fw.nce;
+	for (size_t r=0; r<nr; r++) {
+		std::fill(hist.begin(), hist.end(), 0);
+		size_t n = 0, nna = 0;
+		size_t m = 0, below = 0; // median bin and the number of values in lower bins
+		auto update = [&](size_t col, bool add) {
+			for (size_t rr=0; rr<fw.wnr; rr++) {
+				double x = d[(r + rr) * nce + col];
+				if (std::isnan(x)) {
+					add ? nna++ : nna--;
 					continue;
 				}
+				size_t b = x - vmin;
+				if (add) {
+					hist[b]++;
+					n++;
+					if (b < m) below++;
+				} else {
+					hist[b]--;
+					n--;
+					if (b < m) below--;
+				}
 			}
-			double value = 0;
-			if (narm) winsum = 0;
-			for (int rr=0; rr<wnr; rr++) {
-				int offr = wr1 - rr;
-				for(int cc=0; cc < wnc; cc++)  {
-					int offc = wc1 - cc; 
-					//int wi = wnc * offr + offc;
-					int wi = wnc * rr + cc;
-					if (winNA[wi]) {
-						continue;
-					}
-					int row = rread + hwr - offr;
-					int col = c + hwc - offc;
-					if (global) {
-						col = col < 0 ? nc + col : col;
-						col = col > nc1 ? col - nc : col;
-						if (narm) {
-							if (!std::isnan(d[nc * row + col])) {
-								value += d[nc * row + col] * window[wi];
-								winsum += poswin[wi];
-							}
-						} else {
-							value += d[nc * row + col] * window[wi]; 
-						}
-					} else if (expand) {
-						col = col < 0 ? 0 : col;
-						col = col > nc1 ? nc1 : col;
-						if (narm) {
-							if (!std::isnan(d[nc * row + col])) {
-								value += d[nc * row + col] * window[wi];
-								winsum += poswin[wi];
-							}
-						} else {
-							value += d[nc * row + col] * window[wi]; 
-						}
-					} else {
-						if (col >= 0 && col < nc) {
-							if (narm) {
-								if (!std::isnan(d[nc * row + col])) {
-									value += d[nc * row + col] * window[wi];
-									winsum += poswin[wi];
-								}
-							} else {
-								value += d[nc * row + col] * window[wi]; 
-							}
-						} else if (dofill) {
-							value += fill;
-							if (narm) {
-								winsum += poswin[wi];
-							}
-						}
-					}
+		};
+		// the bin with the k-th (0 based) value
+		auto kth = [&](size_t k) {
+			while (below > k) {
+				m--;
+				below -= hist[m];
+			}
+			while ((below + hist[m]) <= k) {
+				below += hist[m];
+				m++;
+			}
+			return vmin + m;
+		};
+		for (size_t cc=0; cc<fw.wnc; cc++) {
+			update(cc, true);
+		}
+		for (size_t c=0; c<nc; c++) {
+			if (c > 0) {
+				update(c - 1, false);
+				update(c + fw.wnc - 1, true);
+			}
+			if (fw.skip(d[(r + fw.hwr) * nce + c + fw.hwc])) continue;
+			if ((n == 0) || (nna > 0 && !fw.narm)) continue;
+			double lo = kth((n - 1) / 2);
+			if (n % 2) {
+				out[r * nc + c] = lo;
+			} else {
+				out[r * nc + c] = (lo + kth(n / 2)) / 2;
+			}
+		}
+	}
+}
+
+
+// a sorted window that is updated with one column when moving to the 
+// next cell, for values that are not suitable for a histogram
+void focal_median_sorted(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	std::vector<double> v;
+	v.reserve(fw.wnr * fw.wnc);
+	size_t nce = fw.nce;
+	for (size_t r=0; r<nr; r++) {
+		v.clear();
+		size_t nna = 0;
+		auto update = [&](size_t col, bool add) {
+			for (size_t rr=0; rr<fw.wnr; rr++) {
+				double x = d[(r + rr) * nce + col];
+				if (std::isnan(x)) {
+					add ? nna++ : nna--;
+				} else if (add) {
+					v.insert(std::upper_bound(v.begin(), v.end(), x), x);
+				} else {
+					v.erase(std::lower_bound(v.begin(), v.end(), x));
 				}
 			}
-			if (winsum > 0) {
-				out[cell] = value / winsum;
+		};
+		for (size_t cc=0; cc<fw.wnc; cc++) {
+			update(cc, true);
+		}
+		for (size_t c=0; c<nc; c++) {
+			if (c > 0) {
+				update(c - 1, false);
+				update(c + fw.wnc - 1, true);
 			}
+			if (fw.skip(d[(r + fw.hwr) * nce + c + fw.hwc])) continue;
+			size_t n = v.size();
+			if ((n == 0) || (nna > 0 && !fw.narm)) continue;
+			size_t h = n / 2;
+			out[r * nc + c] = (n % 2) ? v[h] : (v[h-1] + v[h]) / 2;
 		}
 	}
 }
 
 
+void focal_median(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	if (fw.ones) {
+		double vmin = std::numeric_limits<double>::infinity();
+		double vmax = -vmin;
+		bool isint = true;
+		for (size_t i=0; i<d.size(); i++) {
+			if (std::isnan(d[i])) continue;
+			if (d[i] != std::floor(d[i])) {
+				isint = false;
+				break;
+			}
+			vmin = std::min(vmin, d[i]);
+			vmax = std::max(vmax, d[i]);
+		}
+		if (isint && (vmax >= vmin) && ((vmax - vmin) < 65536)) {
+			focal_median_hist(d, out, nr, nc, fw, vmin, vmax - vmin + 1);
+		} else {
+			focal_median_sorted(d, out, nr, nc, fw);
+		}
+		return;
+	}
+	std::vector<double> v;
+	v.reserve(fw.off.size());
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			if (!focal_window_values(d, cell, fw, v)) continue;
+			size_t n = v.size();
+			if (n == 0) continue;
+			size_t h = n / 2;
+			std::nth_element(v.begin(), v.begin() + h, v.end());
+			double m = v[h];
+			if ((n % 2) == 0) {
+				m = (m + *std::max_element(v.begin(), v.begin() + h)) / 2;
+			}
+			out[r * nc + c] = m;
+		}
+	}
+}
+
+
+// the most frequent value; the lowest value if there are ties
+void focal_modal(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw) {
+	std::vector<double> v;
+	v.reserve(fw.off.size());
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			if (!focal_window_values(d, cell, fw, v)) continue;
+			if (v.empty()) continue;
+			std::sort(v.begin(), v.end());
+			double mode = v[0];
+			size_t maxcnt = 0, cnt = 0;
+			for (size_t i=0; i<v.size(); i++) {
+				cnt = ((i > 0) && (v[i] == v[i-1])) ? cnt + 1 : 1;
+				if (cnt > maxcnt) {
+					maxcnt = cnt;
+					mode = v[i];
+				}
+			}
+			out[r * nc + c] = mode;
+		}
+	}
+}
+
+
+// any other function from vecmath; the window buffer is re-used
+void focal_fun(const std::vector<double> &d, std::vector<double> &out, size_t nr, size_t nc, const FocalWindow &fw, std::function<double(std::vector<double>&, bool)> &fun) {
+	std::vector<double> v(fw.off.size());
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t cell = r * fw.nce + c;
+			if (fw.skip(d[cell + fw.hwr * fw.nce + fw.hwc])) continue;
+			v.resize(fw.off.size());
+			for (size_t k=0; k<v.size(); k++) {
+				v[k] = d[cell + fw.off[k]] * fw.w[k];
+			}
+			out[r * nc + c] = fun(v, fw.narm);
+		}
+	}
+}
+
+
+// functions with a specialized focal kernel
+FocalKernel getFocalKernel(std::string fun) {
+	static const std::map<std::string, FocalKernel> kernels {
+		{"sum", focal_sum}, {"mean", focal_mean}, {"min", focal_min}, {"max", focal_max}, 
+		{"sd", focal_sd}, {"median", focal_median}, {"modal", focal_modal}
+	};
+	std::map<std::string, FocalKernel>::const_iterator it = kernels.find(fun);
+	if (it == kernels.end()) return NULL;
+	return it->second;
+}
+
 
 
 SpatRaster SpatRaster::focal(std::vector<unsigned> w, std::vector<double> m, double fillvalue, bool narm, bool naonly, bool naomit, std::string fun, bool expand, SpatOptions &opt) {
@@ -437,6 +657,23 @@ SpatRaster SpatRaster::focal(std::vector<unsigned> w, std::vector<double> m, dou
 		return out;
 	}
 
+	FocalKernel kernel = getFocalKernel(fun);
+	std::function<double(std::vector<double>&, bool)> fFun;
+	if (kernel == NULL) {
+		if (!haveFun(fun)) {
+			out.setError("unknown function argument");
+			return out;
+		}
+		fFun = getFun(fun);
+	}
+
+	FocalWindow fw(w, m, nc, narm, naonly, naomit);
+	if (fw.off.empty()) {
+		out.setError("all weights are NA");
+		return out;
+	}
+	size_t hwr = fw.hwr;
+
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
@@ -448,113 +685,90 @@ SpatRaster SpatRaster::focal(std::vector<unsigned> w, std::vector<double> m, dou
 		readStop();
 		return out;
 	}
-	size_t hw0 = w[0]/2;
-	size_t dhw0 = hw0 * 2;
-	//size_t fsz = hw0*nc;
-	size_t fsz2 = dhw0*nc;
-
-	bool dofun = false;
-	std::function<double(std::vector<double>&, bool)> fFun;
-	if ((fun != "mean") && (fun != "sum")) {
-		if (!haveFun(fun)) {
-			out.setError("unknown function argument");
-			return out;
-		}
-		fFun = getFun(fun);
-		dofun = true;
-	}
 
-	std::vector<double> fill;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		unsigned rstart, roff;
-		unsigned rnrows = out.bs.nrows[i];
-		if (i == 0) {
-			rstart = 0;
-			roff = dhw0;
-			if (i != (out.bs.n-1)) {
-				rnrows += hw0;
-			}
-		} else {
-			rstart = out.bs.row[i] + hw0;
-			roff = hw0;
-			if (i == (out.bs.n-1)) {
-				rnrows -= hw0; 
+	// the input rows that are needed for the current block, by layer.
+	// rows that are also needed for the next block are not read again
+	std::vector<std::vector<double>> win(nl);
+	size_t wstart = 0, wend = 0;
+
+	bool ok = out.writeBlocks(
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			size_t brow = out.bs.row[i];
+			size_t bnr = out.bs.nrows[i];
+			size_t a = brow > hwr ? brow - hwr : 0;
+			size_t b = std::min(nr, brow + bnr + hwr);
+			if (a > wstart) {
+				size_t n = std::min(a, wend) - wstart;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					win[lyr].erase(win[lyr].begin(), win[lyr].begin() + n * nc);
+				}
+				wstart = a;
+				wend = std::max(wend, a);
 			}
-		}
-
-		std::vector<double> vout, voutcomb;
-		std::vector<double> vin, vincomb;
-		size_t off=0;
-		if (nl > 1) {
-			readValues(vincomb, rstart, rnrows, 0, nc);
-			off = nc * out.bs.nrows[i];
-			voutcomb.reserve(vincomb.size());
-		} else {
-			readValues(vin, rstart, rnrows, 0, nc);
-		}
-		for (size_t lyr=0; lyr<nl; lyr++) {
-			vout.clear();
-			if (nl > 1) {
-				size_t lyroff = lyr * off;
-				vin = {vincomb.begin() + lyroff, vincomb.begin() + lyroff + off}; 
+			if (b > wend) {
+				std::vector<double> vin;
+				readValues(vin, wend, b - wend, 0, nc);
+				size_t off = (b - wend) * nc;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					win[lyr].insert(win[lyr].end(), vin.begin() + lyr * off, vin.begin() + (lyr + 1) * off);
+				}
+				wend = b;
 			}
-			if (i==0) {
-				if (expand) {
-					fill = {vin.begin(), vin.begin()+nc};
-					for (size_t i=1; i<dhw0; i++) {
-						fill.insert(fill.end(), fill.begin(), fill.end());
+			// rows above and below the raster 
+			size_t ntop = hwr - (brow - a);
+			size_t nbot = brow + bnr + hwr - b;
+			v.resize(1);
+			v[0].resize(0);
+			v[0].reserve(nl * (bnr + 2 * hwr) * nc);
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				for (size_t j=0; j<ntop; j++) {
+					if (expand) {
+						v[0].insert(v[0].end(), win[lyr].begin(), win[lyr].begin() + nc);
+					} else {
+						v[0].resize(v[0].size() + nc, fillvalue);
 					}
-				} else {
-					fill.resize(fsz2, fillvalue);
 				}
-			}
-			vin.insert(vin.begin(), fill.begin(), fill.end());
-
-			if (i == (out.bs.n-1)) {
-				if (expand) {
-					fill = {vin.end()-nc, vin.end()};
-					for (size_t i=1; i<dhw0; i++) {
-						fill.insert(fill.end(), fill.begin(), fill.end());
+				v[0].insert(v[0].end(), win[lyr].begin(), win[lyr].end());
+				for (size_t j=0; j<nbot; j++) {
+					if (expand) {
+						v[0].insert(v[0].end(), win[lyr].end() - nc, win[lyr].end());
+					} else {
+						v[0].resize(v[0].size() + nc, fillvalue);
 					}
-				} else {
-					std::fill(fill.begin(), fill.end(), fillvalue);
 				}
-				vin.insert(vin.end(), fill.begin(), fill.end());
-			}
-
-			if (dofun) {
-				focal_win_fun(vin, vout, nc, roff, out.bs.nrows[i], m, w[0], w[1], fillvalue, narm, naonly, naomit, expand, global, fFun);
-			} else if (fun == "mean") {
-				focal_win_mean(vin, vout, nc, roff, out.bs.nrows[i], m, w[0], w[1], fillvalue, narm, naonly, naomit, expand, global);
-			} else {
-				focal_win_sum(vin, vout, nc, roff, out.bs.nrows[i], m, w[0], w[1], fillvalue, narm, naonly, naomit, expand, global);
-			}
-
-			if (i != (out.bs.n-1)) {
-				fill = {vin.end() - fsz2, vin.end() };  
 			}
-
-			if (naonly) {
-				for (size_t j=0; j<vout.size(); j++) {
-					size_t k = fsz2 + j;
-					if (!std::isnan(vin[k])) {
-						vout[j] = vin[k];
+			return true;
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			size_t bnr = out.bs.nrows[i];
+			size_t nrin = bnr + 2 * hwr;
+			size_t nin = nrin * nc;
+			size_t nout = bnr * nc;
+			std::vector<double> vout(nl * nout, NAN);
+			std::vector<double> d, e, lout(nout);
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				d.assign(v[0].begin() + lyr * nin, v[0].begin() + (lyr + 1) * nin);
+				focal_extend_cols(d, e, nrin, nc, fw.hwc, fillvalue, expand, global);
+				std::fill(lout.begin(), lout.end(), NAN);
+				if (kernel != NULL) {
+					kernel(e, lout, bnr, nc, fw);
+				} else {
+					focal_fun(e, lout, bnr, nc, fw, fFun);
+				}
+				if (naonly) {
+					for (size_t j=0; j<nout; j++) {
+						double center = d[hwr * nc + j];
+						if (!std::isnan(center)) lout[j] = center;
 					}
 				}
+				std::copy(lout.begin(), lout.end(), vout.begin() + lyr * nout);
 			}
-			if (nl > 1) {
-				voutcomb.insert(voutcomb.end(), vout.begin(), vout.end());
-			}
-		}
-		if (nl > 1) {
-			if (!out.writeBlock(voutcomb, i)) return out;
-		} else {
-			if (!out.writeBlock(vout, i)) return out;
-		}
-	}
+			v[0] = std::move(vout);
+		}, opt);
 
-	out.writeStop();
 	readStop();
+	if (!ok) return out;
+	out.writeStop();
 	return(out);
 }
 
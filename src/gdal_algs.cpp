@@ -280,7 +280,7 @@ bool is_valid_warp_method(const std::string &method) {
 }
 
 
-bool set_warp_options(GDALWarpOptions *psWarpOptions, GDALDatasetH &hSrcDS, GDALDatasetH &hDstDS, std::vector<unsigned> srcbands, std::vector<unsigned> dstbands, std::string method, std::string srccrs, std::string msg, bool verbose, bool threads) {
+bool set_warp_options(GDALWarpOptions *psWarpOptions, GDALDatasetH &hSrcDS, GDALDatasetH &hDstDS, std::vector<unsigned> srcbands, std::vector<unsigned> dstbands, std::string method, void *hTransformArg, std::string msg, bool verbose, bool threads) {
 
 	if (srcbands.size() != dstbands.size()) {
 		msg = "number of source bands must match number of dest bands";
@@ -350,11 +350,9 @@ bool set_warp_options(GDALWarpOptions *psWarpOptions, GDALDatasetH &hSrcDS, GDAL
 			CSLSetNameValue( psWarpOptions->papszWarpOptions, "NUM_THREADS", "ALL_CPUS");
 	}
 	
-    psWarpOptions->pTransformerArg =
-        GDALCreateGenImgProjTransformer( hSrcDS, srccrs.c_str(),
-                                        hDstDS, GDALGetProjectionRef(hDstDS),
-                                        FALSE, 0.0, 1 );
-    psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
+	// the transformer is owned by the caller (see WarpTransformer)
+    psWarpOptions->pTransformerArg = hTransformArg;
+    psWarpOptions->pfnTransformer = GDALApproxTransform;
 
 	return true;
 }
@@ -363,14 +361,68 @@ bool set_warp_options(GDALWarpOptions *psWarpOptions, GDALDatasetH &hSrcDS, GDAL
 bool gdal_warper(GDALWarpOptions *psWarpOptions, GDALDatasetH &hSrcDS, GDALDatasetH &hDstDS) {
     GDALWarpOperation oOperation;
     if (oOperation.Initialize( psWarpOptions ) != CE_None) {
+	    GDALDestroyWarpOptions( psWarpOptions );
 		return false;
 	}
-    oOperation.ChunkAndWarpImage( 0, 0, GDALGetRasterXSize( hDstDS ), GDALGetRasterYSize( hDstDS ) );
-    GDALDestroyGenImgProjTransformer( psWarpOptions->pTransformerArg );
+    CPLErr err = oOperation.ChunkAndWarpImage( 0, 0, GDALGetRasterXSize( hDstDS ), GDALGetRasterYSize( hDstDS ) );
     GDALDestroyWarpOptions( psWarpOptions );
-	return true;
+	return err == CE_None;
 }
 
+
+// The transformation from the cells of the output to the cells of the sources. Creating it
+// is expensive (it sets up the coordinate transformation, and for an in memory source it
+// needs a GDAL copy of the source), so it is created once, for the first block of the
+// output. For the other blocks only the geotransform of the output is changed. As in
+// gdalwarp, the exact transformation is approximated (linear interpolation along each row)
+// with a maximum error of 0.125 cell
+class WarpTransformer {
+	public:
+		std::vector<GDALDatasetH> hSrcDS;
+		std::vector<void*> hGenImg, hApprox;
+		double maxerror = 0.125;
+
+		virtual ~WarpTransformer() {
+			for (size_t i=0; i<hSrcDS.size(); i++) {
+				if (hApprox[i] != NULL) GDALDestroyApproxTransformer(hApprox[i]);
+				if (hGenImg[i] != NULL) GDALDestroyGenImgProjTransformer(hGenImg[i]);
+				if (hSrcDS[i] != NULL) GDALClose(hSrcDS[i]);
+			}
+		}
+
+		bool open(SpatRaster &x, SpatOptions &opt) {
+			size_t ns = x.nsrc();
+			hSrcDS.resize(ns, NULL);
+			hGenImg.resize(ns, NULL);
+			hApprox.resize(ns, NULL);
+			for (size_t i=0; i<ns; i++) {
+				if (!x.open_gdal(hSrcDS[i], i, false, opt)) {
+					hSrcDS[i] = NULL;
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// set the destination to the block in hDstDS
+		bool set_destination(GDALDatasetH &hDstDS, std::string srccrs) {
+			for (size_t i=0; i<hSrcDS.size(); i++) {
+				if (hGenImg[i] == NULL) {
+					hGenImg[i] = GDALCreateGenImgProjTransformer(hSrcDS[i], srccrs.c_str(), hDstDS, GDALGetProjectionRef(hDstDS), FALSE, 0.0, 1);
+					if (hGenImg[i] == NULL) return false;
+					hApprox[i] = GDALCreateApproxTransformer(GDALGenImgProjTransform, hGenImg[i], maxerror);
+					if (hApprox[i] == NULL) return false;
+				} else {
+					double gt[6];
+					if (GDALGetGeoTransform(hDstDS, gt) != CE_None) return false;
+					GDALSetGenImgProjTransformerDstGeoTransform(hGenImg[i], gt);
+				}
+			}
+			return true;
+		}
+};
+
+
 SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method, bool mask, bool align, SpatOptions &opt) {
 
 
@@ -469,6 +521,12 @@ SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method,
 		offset.insert(offset.end(), source[0].offset.begin(), source[0].offset.end());
 	}
 
+	WarpTransformer wt;
+	if (!wt.open(*this, sopt)) {
+		out.setError("cannot create dataset from source");
+		return out;
+	}
+
 	for (size_t i = 0; i < out.bs.n; i++) {
 		int bandstart = 0;
 		eout.ymax = out.yFromRow(out.bs.row[i]);
@@ -479,33 +537,29 @@ SpatRaster SpatRaster::warper(SpatRaster x, std::string crs, std::string method,
 		if (!crop_out.create_gdalDS(hDstDS, "", "MEM", false, NAN, has_so, scale, offset, sopt)) {
 			return crop_out;
 		}
+		if (!wt.set_destination(hDstDS, srccrs)) {
+			if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
+			out.setError("cannot create the coordinate transformation");
+			return out;
+		}
 
-		for (size_t i=0; i<ns; i++) {
-
-			GDALDatasetH hSrcDS;
+		for (size_t j=0; j<ns; j++) {
 
-			if (!open_gdal(hSrcDS, i, false, sopt)) {
-				out.setError("cannot create dataset from source");
-				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
-				return out;
-			}
-			std::vector<unsigned> srcbands = source[i].layers;
+			std::vector<unsigned> srcbands = source[j].layers;
 			std::vector<unsigned> dstbands(srcbands.size()); 
 			std::iota (dstbands.begin(), dstbands.end(), bandstart); 
 			bandstart += dstbands.size();
 
-
 			GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
-			bool ok = set_warp_options(psWarpOptions, hSrcDS, hDstDS, srcbands, dstbands, method, srccrs, errmsg, opt.get_verbose(), opt.threads);
+			bool ok = set_warp_options(psWarpOptions, wt.hSrcDS[j], hDstDS, srcbands, dstbands, method, wt.hApprox[j], errmsg, opt.get_verbose(), opt.threads);
 			if (!ok) {
+				GDALDestroyWarpOptions( psWarpOptions );
 				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
 				out.setError(errmsg);
 				return out;
 			}
 
-			//bool success = gdal_warper(hSrcDS, hDstDS, srcbands, dstbands, method, srccrs, errmsg, opt.get_verbose(), opt.threads);
-			ok = gdal_warper(psWarpOptions, hSrcDS, hDstDS);
-			if( hSrcDS != NULL ) GDALClose( (GDALDatasetH) hSrcDS );
+			ok = gdal_warper(psWarpOptions, wt.hSrcDS[j], hDstDS);
 			if (!ok) {
 				if( hDstDS != NULL ) GDALClose( (GDALDatasetH) hDstDS );
 				out.setError("warp failure");
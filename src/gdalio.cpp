@@ -501,7 +501,11 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 
 	size_t isrc = src < 0 ? 0 : src;
 
-	bool fromfile = !source[isrc].memory;
+	// lazy values are computed into the in-memory dataset, or, if they are too large, written to file first
+	if (hasLazy() && (!canProcessInMemory(opt))) {
+		if (!evaluateLazy(opt)) return false;
+	}
+	bool fromfile = !(source[isrc].memory || source[isrc].lazy);
 
 	if (fromfile & (nsrc() > 1) & (src < 0)) {
 		if (canProcessInMemory(opt)) {
@@ -524,7 +528,12 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 		//	topt.set_filenames({f});
 		//	tmp.writeRaster(topt);
 		//} else {
-		f = source[src].filename;
+		if (source[isrc].driver == "mmap") {
+			// GDAL reads the raw values through a VRT
+			f = mmapVRT(isrc);
+		} else {
+			f = source[src].filename;
+		}
 		//}
 		//hDS = GDALOpenShared(f.c_str(), GA_ReadOnly);
 
@@ -564,7 +573,8 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS, int src, bool update, SpatOptions
 		std::vector<double> vals;
 		for(size_t i=0; i<nl; i++)	{
 			size_t off = ncls * i;
-			vals = std::vector<double>(source[0].values.begin() +off, source[0].values.begin() +off+ncls);
+			vals.resize(0);
+			source[0].values.copy(vals, off, off+ncls);
 			char szPtrValue[128] = { '\0' };
 			int nRet = CPLPrintPointer( szPtrValue, reinterpret_cast<void*>(&vals[0]), sizeof(szPtrValue) );
 			szPtrValue[nRet] = 0;
@@ -690,8 +700,9 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 	}
 
 	if (get_values) {
-		source[0].values.resize(0);
-		source[0].values.reserve(ncell() * nlyr());
+		source[0].values.clear();
+		std::vector<double> &values = source[0].values.edit();
+		values.reserve(ncell() * nlyr());
 		CPLErr err = CE_None;
 		int hasNA;
 		size_t nl = nlyr();
@@ -741,7 +752,7 @@ bool SpatRaster::from_gdalMEM(GDALDatasetH hDS, bool set_geometry, bool get_valu
 			if (has_so) {
 				for (double &d : lyrout) { d = d * mscale + moffset;}
 			}
-			source[0].values.insert(source[0].values.end(), lyrout.begin(), lyrout.end());
+			values.insert(values.end(), lyrout.begin(), lyrout.end());
 		}
 
 		source[0].hasValues = true;
@@ -947,7 +958,8 @@ bool SpatRaster::setValuesMEM(GDALDatasetH hDS, bool set_geometry) {
 	}
 
 
-	source[0].values.reserve(ncell() * nlyr());
+	std::vector<double> &values = source[0].values.edit();
+	values.reserve(ncell() * nlyr());
 	CPLErr err = CE_None;
 	int hasNA;
 	for (size_t i=0; i < nlyr(); i++) {
@@ -962,7 +974,7 @@ bool SpatRaster::setValuesMEM(GDALDatasetH hDS, bool set_geometry) {
 		//double naflag = -3.4e+38;
 		double naflag = GDALGetRasterNoDataValue(hBand, &hasNA);
 		if (hasNA) std::replace(lyrout.begin(), lyrout.end(), naflag, (double) NAN);
-		source[0].values.insert(source[0].values.end(), lyrout.begin(), lyrout.end());
+		values.insert(values.end(), lyrout.begin(), lyrout.end());
 
 	}
 	source[0].hasValues = TRUE;
@@ -1095,7 +1107,8 @@ bool SpatRaster::open_gdal(GDALDatasetH &hDS) {
 			GDALSetDescription(hBand, nms[i].c_str());
 
 			size_t offset = ncls * i;
-			vals = std::vector<double>(source[0].values.begin() + offset, source[0].values.begin() + offset + ncls);
+			vals.resize(0);
+			source[0].values.copy(vals, offset, offset + ncls);
 			err = GDALRasterIO(hBand, GF_Write, 0, 0, nc, nr, &vals[0], nc, nr, GDT_Float64, 0, 0 );
 			if (err != CE_None) {
 				return false;
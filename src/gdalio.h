@@ -9,3 +9,10 @@ bool getNAvalue(GDALDataType gdt, double & naval);
 GDALDataset* openGDAL(std::string filename, unsigned OpenFlag, std::vector<std::string> open_options);
 char ** set_GDAL_options(std::string driver, double diskNeeded, bool writeRGB, std::vector<std::string> gdal_options);
 
+
+// the GDAL data type of a native (typed) buffer
+template <typename T> GDALDataType gdal_type();
+template <> inline GDALDataType gdal_type<uint8_t>() { return GDT_Byte; }
+template <> inline GDALDataType gdal_type<int16_t>() { return GDT_Int16; }
+template <> inline GDALDataType gdal_type<uint16_t>() { return GDT_UInt16; }
+template <> inline GDALDataType gdal_type<int32_t>() { return GDT_Int32; }
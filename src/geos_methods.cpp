@@ -953,9 +953,12 @@ SpatVector SpatVector::intersect(SpatVector v) {
 	if (type() == "points") {
 		//std::vector<bool> ixj(nx, false);
 		//size_t count = 0;
+		SpatIndex &index = getIndex();
 		for (size_t j = 0; j < ny; j++) {
+			std::vector<size_t> cand = index.query(v.geoms[j].extent);
+			if (cand.empty()) continue;
 			PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, y[j].get()), hGEOSCtxt);
-			for (size_t i = 0; i < nx; i++) {
+			for (size_t i : cand) {
 				if (GEOSPreparedIntersects_r(hGEOSCtxt, pr.get(), x[i].get())) {
 					//if (!ixj[i]
 					//ixj[i] = true;
@@ -975,23 +978,24 @@ SpatVector SpatVector::intersect(SpatVector v) {
 	} else {
 
 		long k = 0;
-		for (size_t i = 0; i < nx; i++) {
-			for (size_t j = 0; j < ny; j++) {
-				GEOSGeometry* geom = GEOSIntersection_r(hGEOSCtxt, x[i].get(), y[j].get());
-				if (geom == NULL) {
-					out.setError("GEOS exception");
-					geos_finish(hGEOSCtxt);
-					return(out);
-				} 
-				if (!GEOSisEmpty_r(hGEOSCtxt, geom)) {
-					result.push_back(geos_ptr(geom, hGEOSCtxt));
-					idx.push_back(i);
-					idy.push_back(j);
-					ids.push_back(k);
-					k++;
-				} else {
-					GEOSGeom_destroy_r(hGEOSCtxt, geom);
-				}
+		std::vector<std::vector<size_t>> p = index_pairs(v);
+		for (size_t m = 0; m < p[0].size(); m++) {
+			size_t i = p[0][m];
+			size_t j = p[1][m];
+			GEOSGeometry* geom = GEOSIntersection_r(hGEOSCtxt, x[i].get(), y[j].get());
+			if (geom == NULL) {
+				out.setError("GEOS exception");
+				geos_finish(hGEOSCtxt);
+				return(out);
+			} 
+			if (!GEOSisEmpty_r(hGEOSCtxt, geom)) {
+				result.push_back(geos_ptr(geom, hGEOSCtxt));
+				idx.push_back(i);
+				idy.push_back(j);
+				ids.push_back(k);
+				k++;
+			} else {
+				GEOSGeom_destroy_r(hGEOSCtxt, geom);
 			}
 		}
 	//SpatVectorCollection coll = coll_from_geos(result, hGEOSCtxt);
@@ -1122,6 +1126,22 @@ int getRel(std::string &relation) {
 	return pattern;
 }
 
+// relations that can only be true for geometries that intersect.
+// For these, pairs of geometries with extents that do not intersect are skipped
+bool needs_intersection(const std::string &relation, int pattern) {
+	if (pattern == 1) {
+		// the interior and boundary cells of the DE-9IM matrix
+		std::vector<size_t> ib = {0, 1, 3, 4};
+		for (size_t i=0; i<ib.size(); i++) {
+			char c = relation.at(ib[i]);
+			if ((c == 'T') || (c == '0') || (c == '1') || (c == '2')) return true;
+		}
+		return false;
+	}
+	return relation != "disjoint";
+}
+
+
 std::vector<int> SpatVector::relate(SpatVector v, std::string relation) {
 
 	std::vector<int> out;
@@ -1136,6 +1156,33 @@ std::vector<int> SpatVector::relate(SpatVector v, std::string relation) {
 	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
 	size_t nx = size();
 	size_t ny = v.size();
+	if (needs_intersection(relation, pattern)) {
+		out.resize(nx*ny, 0);
+		std::vector<std::vector<size_t>> p = index_pairs(v);
+		if (pattern == 1) {
+			for (size_t k=0; k<p[0].size(); k++) {
+				size_t i = p[0][k];
+				size_t j = p[1][k];
+				out[i*ny+j] = GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str());
+			}
+		} else {
+			std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
+			PrepGeomPtr pr;
+			size_t prepared = nx;
+			for (size_t k=0; k<p[0].size(); k++) {
+				size_t i = p[0][k];
+				size_t j = p[1][k];
+				if (i != prepared) {
+					pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
+					prepared = i;
+				}
+				out[i*ny+j] = relFun(hGEOSCtxt, pr.get(), y[j].get());
+			}
+		}
+		geos_finish(hGEOSCtxt);
+		return out;
+	}
+
 	out.reserve(nx*ny);
 	if (pattern == 1) {
 		for (size_t i = 0; i < nx; i++) {
@@ -1172,25 +1219,48 @@ std::vector<int> SpatVector::relateFirst(SpatVector v, std::string relation) {
 	size_t nx = size();
 	size_t ny = v.size();
 	std::vector<int> out(nx, -1);
-	if (pattern == 1) {
+	//std::function<char(GEOSContextHandle_t, const GEOSGeometry *, const GEOSGeometry *)> relFun = getRelateFun(relation);
+	std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun;
+	if (pattern == 0) relFun = getPrepRelateFun(relation);
+
+	if (needs_intersection(relation, pattern)) {
+		std::vector<std::vector<size_t>> p = index_pairs(v);
+		PrepGeomPtr pr;
+		size_t prepared = nx;
+		for (size_t k=0; k<p[0].size(); k++) {
+			size_t i = p[0][k];
+			size_t j = p[1][k];
+			if (out[i] >= 0) continue;
+			if (pattern == 1) {
+				if (GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str()) == 1) {
+					out[i] = j;
+				}
+			} else {
+				if (i != prepared) {
+					pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
+					prepared = i;
+				}
+				if (relFun(hGEOSCtxt, pr.get(), y[j].get()) == 1) {
+					out[i] = j;
+				}
+			}
+		}
+	} else if (pattern == 1) {
 		for (size_t i = 0; i < nx; i++) {
 			for (size_t j = 0; j < ny; j++) {
-				if (GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str())) {
+				if (GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str()) == 1) {
 					out[i] = j;
-					continue;
+					break;
 				}
 			}
 		}
 	} else {
-		//std::function<char(GEOSContextHandle_t, const GEOSGeometry *, const GEOSGeometry *)> relFun = getRelateFun(relation);
-		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
-
 		for (size_t i = 0; i < nx; i++) {
 			PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
 			for (size_t j = 0; j < ny; j++) {
-				if (relFun(hGEOSCtxt, pr.get(), y[j].get())) {
+				if (relFun(hGEOSCtxt, pr.get(), y[j].get()) == 1) {
 					out[i] = j;
-					continue;
+					break;
 				}
 			}
 		}
@@ -1213,7 +1283,40 @@ std::vector<int> SpatVector::relate(std::string relation, bool symmetrical) {
 	GEOSContextHandle_t hGEOSCtxt = geos_init();
 	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
 
-	if (symmetrical) {
+	if (needs_intersection(relation, pattern)) {
+		size_t s = size();
+		if (symmetrical) {
+			out.resize(s > 1 ? ((s-1) * s)/2 : 0, 0);
+		} else {
+			out.resize(s * s, 0);
+		}
+		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun;
+		if (pattern == 0) relFun = getPrepRelateFun(relation);
+		std::vector<std::vector<size_t>> p = index_pairs(*this);
+		PrepGeomPtr pr;
+		size_t prepared = s;
+		for (size_t k=0; k<p[0].size(); k++) {
+			size_t i = p[0][k];
+			size_t j = p[1][k];
+			size_t cell;
+			if (symmetrical) {
+				if (j <= i) continue;
+				// position in the lower triangle, by column
+				cell = (i * (2 * s - i - 1)) / 2 + (j - i - 1);
+			} else {
+				cell = i * s + j;
+			}
+			if (pattern == 1) {
+				out[cell] = GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), x[j].get(), relation.c_str());
+			} else {
+				if (i != prepared) {
+					pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
+					prepared = i;
+				}
+				out[cell] = relFun(hGEOSCtxt, pr.get(), x[j].get());
+			}
+		}
+	} else if (symmetrical) {
 		size_t s = size();
 		size_t n = ((s-1) * s)/2;
 		out.reserve(n);
@@ -1262,43 +1365,11 @@ std::vector<int> SpatVector::relate(std::string relation, bool symmetrical) {
 std::vector<bool> SpatVector::is_related(SpatVector v, std::string relation) {
 
 	std::vector<bool> out;
-	int pattern = getRel(relation);
-	if (pattern == 2) {
-		setError("'" + relation + "'" + " is not a valid relate name or pattern");
-		return out;
+	std::vector<int> first = relateFirst(v, relation);
+	out.resize(first.size());
+	for (size_t i=0; i<first.size(); i++) {
+		out[i] = first[i] >= 0;
 	}
-
-	GEOSContextHandle_t hGEOSCtxt = geos_init();
-	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
-	size_t nx = size();
-	size_t ny = v.size();
-	out.resize(nx, false);
-	if (pattern == 1) {
-		for (size_t i = 0; i < nx; i++) {
-			for (size_t j = 0; j < ny; j++) {
-				bool isrel = GEOSRelatePattern_r(hGEOSCtxt, x[i].get(), y[j].get(), relation.c_str());
-				if (isrel) {
-					out[i] = true;
-					continue;
-				}
-			}
-		}
-	} else {
-		std::function<char(GEOSContextHandle_t, const GEOSPreparedGeometry *, const GEOSGeometry *)> relFun = getPrepRelateFun(relation);
-		for (size_t i = 0; i < nx; i++) {
-			PrepGeomPtr pr = geos_ptr(GEOSPrepare_r(hGEOSCtxt, x[i].get()), hGEOSCtxt);
-			for (size_t j = 0; j < ny; j++) {
-				bool isrel = relFun(hGEOSCtxt, pr.get(), y[j].get());
-				if (isrel) {
-					out[i] = true;
-					continue;
-				}				
-			}
-		} 
-	}
-	geos_finish(hGEOSCtxt);
-
 	return out;
 }
 
@@ -1672,13 +1743,17 @@ SpatVector SpatVector::erase(SpatVector v) {
 	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
 	std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
 	size_t nx = size();
-	size_t ny = v.size();
 	std::vector<int> rids;
 	rids.reserve(nx);
+	// only geometries with intersecting extents can change x[i]
+	std::vector<std::vector<size_t>> p = index_pairs(v);
+	size_t k = 0;
 	
 	for (size_t i = 0; i < nx; i++) {
 		bool good=true;
-		for (size_t j = 0; j < ny; j++) {
+		for (; (k < p[0].size()) && (p[0][k] == i); k++) {
+			if (!good) continue;
+			size_t j = p[1][k];
 			GEOSGeometry* geom = GEOSDifference_r(hGEOSCtxt, x[i].get(), y[j].get());
 			if (geom == NULL) {
 				out.setError("GEOS exception");
@@ -1688,7 +1763,7 @@ SpatVector SpatVector::erase(SpatVector v) {
 			if (GEOSisEmpty_r(hGEOSCtxt, geom)) {
 				GEOSGeom_destroy_r(hGEOSCtxt, geom);
 				good = false;
-				break;
+				continue;
 			}	
 			x[i] = geos_ptr(geom, hGEOSCtxt);
 		}
@@ -1915,12 +1990,24 @@ SpatVector SpatVector::nearest_point(SpatVector v, bool parallel) {
 		out = vect_from_geos(b, hGEOSCtxt, "lines");
 
 	} else {
-		SpatVector mp = v.aggregate(false);
 		std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
-		std::vector<GeomPtr> y = geos_geoms(&mp, hGEOSCtxt);
+		std::vector<GeomPtr> y = geos_geoms(&v, hGEOSCtxt);
 		std::vector<GeomPtr> b(size());
+		SpatIndex &index = v.getIndex();
 		for (size_t i = 0; i < x.size(); i++) {
-			GEOSCoordSequence* csq = GEOSNearestPoints_r(hGEOSCtxt, x[i].get(), y[0].get());
+			// the geometry of v that is nearest to x[i]. The distance 
+			// to the extent of a geometry is a lower bound
+			double d;
+			long j = index.nearest(geoms[i].extent, [&](size_t k) -> double {
+					double dj;
+					return GEOSDistance_r(hGEOSCtxt, x[i].get(), y[k].get(), &dj) ? dj : INFINITY;
+				}, d);
+			if (j < 0) {
+				out.setError("cannot find the nearest geometry");
+				geos_finish(hGEOSCtxt);
+				return out;
+			}
+			GEOSCoordSequence* csq = GEOSNearestPoints_r(hGEOSCtxt, x[i].get(), y[j].get());
 			GEOSGeometry* geom = GEOSGeom_createLineString_r(hGEOSCtxt, csq);
 			b[i] = geos_ptr(geom, hGEOSCtxt);
 		}
@@ -1939,7 +2026,7 @@ SpatVector SpatVector::nearest_point() {
 	}
 	if ((size() == 1)) {
 		out.addWarning("single geometry");
-		//return *this;
+		return out;
 	}
 	size_t n = size();
 	out.srs = srs;
@@ -1964,11 +2051,20 @@ SpatVector SpatVector::nearest_point() {
 	GEOSContextHandle_t hGEOSCtxt = geos_init();
 	std::vector<GeomPtr> x = geos_geoms(this, hGEOSCtxt);
 	std::vector<GeomPtr> b(n);
-	for (unsigned i = 0; i < n; i++) {
-		SpatVector xa = remove_rows({i});
-		xa = xa.aggregate(false);
-		std::vector<GeomPtr> y = geos_geoms(&xa, hGEOSCtxt);
-		GEOSCoordSequence* csq = GEOSNearestPoints_r(hGEOSCtxt, x[i].get(), y[0].get());
+	SpatIndex &index = getIndex();
+	for (size_t i = 0; i < n; i++) {
+		double d;
+		long j = index.nearest(geoms[i].extent, [&](size_t k) -> double {
+				double dj;
+				if (k == i) return INFINITY;
+				return GEOSDistance_r(hGEOSCtxt, x[i].get(), x[k].get(), &dj) ? dj : INFINITY;
+			}, d);
+		if (j < 0) {
+			out.setError("cannot find the nearest geometry");
+			geos_finish(hGEOSCtxt);
+			return out;
+		}
+		GEOSCoordSequence* csq = GEOSNearestPoints_r(hGEOSCtxt, x[i].get(), x[j].get());
 		GEOSGeometry* geom = GEOSGeom_createLineString_r(hGEOSCtxt, csq);
 		b[i] = geos_ptr(geom, hGEOSCtxt);
 	}
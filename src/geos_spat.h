@@ -218,7 +218,7 @@ void getHoles(SpatPart &p, std::vector<std::vector<double>> &hx, std::vector<std
 	return;
 }
 
-GEOSGeometry* geos_polygon2(SpatPart g, GEOSContextHandle_t hGEOSCtxt) {
+GEOSGeometry* geos_polygon2(const SpatPart &g, GEOSContextHandle_t hGEOSCtxt) {
 	GEOSGeometry* shell = geos_linearRing(g.x, g.y, hGEOSCtxt);
 
 	//getHoles(svp, hx, hy);
@@ -228,7 +228,7 @@ GEOSGeometry* geos_polygon2(SpatPart g, GEOSContextHandle_t hGEOSCtxt) {
 		std::vector<GEOSGeometry*> holes;
 		holes.reserve(g.nHoles());
 		for (size_t k=0; k < g.nHoles(); k++) {
-			SpatHole h = g.getHole(k);
+			const SpatHole &h = g.holes[k];
 			GEOSGeometry* glr = geos_linearRing(h.x, h.y, hGEOSCtxt);
 			if (glr != NULL) {
 				holes.push_back(glr);
@@ -251,7 +251,7 @@ std::vector<GeomPtr> geos_geoms(SpatVector *v, GEOSContextHandle_t hGEOSCtxt) {
 	std::string vt = v->type();
 	if (vt == "points") {
 		for (size_t i=0; i<n; i++) {
-			SpatGeom svg = v->getGeom(i);
+			const SpatGeom &svg = v->geoms[i];
 			size_t np = svg.size();
 			GEOSCoordSequence *pseq;
 			std::vector<GEOSGeometry*> geoms;
@@ -274,7 +274,7 @@ std::vector<GeomPtr> geos_geoms(SpatVector *v, GEOSContextHandle_t hGEOSCtxt) {
 	} else if (vt == "lines") {
 		// gp = NULL;
 		for (size_t i=0; i<n; i++) {
-			SpatGeom svg = v->getGeom(i);
+			const SpatGeom &svg = v->geoms[i];
 			size_t np = svg.size();
 			std::vector<GEOSGeometry*> geoms;
 			geoms.reserve(np);
@@ -294,12 +294,12 @@ std::vector<GeomPtr> geos_geoms(SpatVector *v, GEOSContextHandle_t hGEOSCtxt) {
 
 		std::vector<std::vector<double>> hx, hy;
 		for (size_t i=0; i<n; i++) {
-			SpatGeom svg = v->getGeom(i);
+			const SpatGeom &svg = v->geoms[i];
 			size_t np = svg.size();
 			std::vector<GEOSGeometry*> geoms;
 			geoms.reserve(np);
 			for (size_t j=0; j < np; j++) {
-				SpatPart svp = svg.getPart(j);
+				const SpatPart &svp = svg.parts[j];
 				//getHoles(svp, hx, hy);
 				//GEOSGeometry* gp = geos_polygon(svp.x, svp.y, hx, hy, hGEOSCtxt);
 				GEOSGeometry* gp = geos_polygon2(svp, hGEOSCtxt);
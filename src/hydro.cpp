@@ -0,0 +1,384 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "tiledgrid.h"
+#include "file_utils.h"
+#include <queue>
+#include <limits>
+#include <cmath>
+
+// The flow direction codes of terrain(v="flowdir"): 1 is the cell to the
+// right, 2 the cell below that, and so on, clockwise, to 128 (upper right)
+static const int flow_dr[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int flow_dc[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+// 0 to 7 for the flow direction codes, -1 for other values (no outflow), NAN for NA
+inline double flow_index(double d) {
+	if (std::isnan(d)) return NAN;
+	for (int j=0; j<8; j++) {
+		if (d == (1 << j)) return j;
+	}
+	return -1;
+}
+
+
+// read the first layer of x (transformed with fun) into variable 0 of a new grid with nv
+// variables, and the second layer of x, if there is one, into variable 1
+bool hydro_read(SpatRaster &x, TiledGrid &grid, size_t nv, std::function<double(double)> fun, SpatOptions &opt, std::string &msg) {
+	size_t nr = x.nrow();
+	size_t nc = x.ncol();
+	SpatRaster g = x.geometry(nv);
+	SpatOptions mopt(opt);
+	mopt.ncopies = 2;
+	std::string tmpfile = tempFile(opt.get_tempdir(), opt.pid, "_hydro.bin");
+	if (!grid.init(nr, nc, nv, g.canProcessInMemory(mopt), tmpfile, msg)) {
+		return false;
+	}
+	if (!x.readStart()) {
+		msg = x.getError();
+		return false;
+	}
+	double* v0 = grid.var(0);
+	double* v1 = grid.var(1);
+	bool two = x.nlyr() > 1;
+	BlockSize bs = x.getBlockSize(opt);
+	std::vector<double> v;
+	for (size_t i=0; i<bs.n; i++) {
+		x.readBlock(v, bs, i);
+		if (x.hasError()) {
+			msg = x.getError();
+			x.readStop();
+			return false;
+		}
+		size_t n = bs.nrows[i] * nc;
+		for (size_t k=0; k<n; k++) {
+			size_t t = grid.cell(bs.row[i] + k / nc, k % nc);
+			v0[t] = fun(v[k]);
+			if (two) v1[t] = v[n+k];
+		}
+	}
+	x.readStop();
+	return true;
+}
+
+
+// write variable "var" of the grid
+bool hydro_write(SpatRaster &out, TiledGrid &grid, size_t var, SpatOptions &opt) {
+	if (!out.writeStart(opt)) {
+		return false;
+	}
+	double* p = grid.var(var);
+	size_t nc = out.ncol();
+	std::vector<double> v;
+	for (size_t i=0; i<out.bs.n; i++) {
+		size_t n = out.bs.nrows[i] * nc;
+		v.resize(n);
+		for (size_t k=0; k<n; k++) {
+			v[k] = p[grid.cell(out.bs.row[i] + k / nc, k % nc)];
+		}
+		if (!out.writeBlock(v, i)) return false;
+	}
+	out.writeStop();
+	return true;
+}
+
+
+// Priority-Flood (Barnes et al., 2014). The cells on the edge of the raster,
+// or next to an NA cell, are the outlets. Cells are visited from the lowest
+// to the highest of these, and each cell is raised to the level of the cell
+// it was reached from if it is lower. Cells in a depression are found with a
+// plain queue instead of with the priority queue.
+SpatRaster SpatRaster::fillSinks(bool epsilon, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	if (nlyr() > 1) {
+		std::vector<unsigned> lyr = {0};
+		SpatOptions ops(opt);
+		out = subset(lyr, ops);
+		out = out.fillSinks(epsilon, opt);
+		out.addWarning("only the first layer is used");
+		return out;
+	}
+	size_t nr = nrow();
+	size_t nc = ncol();
+
+	// the elevation, and whether a cell has been queued
+	TiledGrid grid;
+	std::string msg;
+	if (!hydro_read(*this, grid, 2, [](double d) { return d; }, opt, msg)) {
+		out.setError(msg);
+		return out;
+	}
+	double* z = grid.var(0);
+	double* closed = grid.var(1);
+
+	typedef std::pair<double, size_t> QItem;
+	std::priority_queue<QItem, std::vector<QItem>, std::greater<QItem>> open;
+	std::queue<size_t> pit;
+
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t t = grid.cell(r, c);
+			if (std::isnan(z[t])) {
+				closed[t] = 1;
+				continue;
+			}
+			bool edge = (r == 0) || (c == 0) || (r == (nr-1)) || (c == (nc-1));
+			for (size_t j=0; (j<8) && (!edge); j++) {
+				edge = std::isnan(z[grid.cell(r + flow_dr[j], c + flow_dc[j])]);
+			}
+			if (edge) {
+				open.push(QItem(z[t], r * nc + c));
+				closed[t] = 1;
+			} else {
+				closed[t] = 0;
+			}
+		}
+	}
+
+	double inf = std::numeric_limits<double>::infinity();
+	while (!(open.empty() && pit.empty())) {
+		size_t cell;
+		if (!pit.empty()) {
+			cell = pit.front();
+			pit.pop();
+		} else {
+			cell = open.top().second;
+			open.pop();
+		}
+		size_t r = cell / nc;
+		size_t c = cell % nc;
+		double zc = z[grid.cell(r, c)];
+		// with "epsilon", a filled cell is a little higher than the cell it drains to
+		double zfill = epsilon ? std::nextafter(zc, inf) : zc;
+		for (size_t j=0; j<8; j++) {
+			if (((r == 0) && (flow_dr[j] < 0)) || ((r == (nr-1)) && (flow_dr[j] > 0))) continue;
+			if (((c == 0) && (flow_dc[j] < 0)) || ((c == (nc-1)) && (flow_dc[j] > 0))) continue;
+			size_t r2 = r + flow_dr[j];
+			size_t c2 = c + flow_dc[j];
+			size_t t2 = grid.cell(r2, c2);
+			if (closed[t2] != 0) continue;
+			closed[t2] = 1;
+			if (z[t2] <= zfill) {
+				z[t2] = zfill;
+				pit.push(r2 * nc + c2);
+			} else {
+				open.push(QItem(z[t2], r2 * nc + c2));
+			}
+		}
+	}
+
+	hydro_write(out, grid, 0, opt);
+	return out;
+}
+
+
+// Each cell starts with its weight, and passes its accumulated value to the
+// cell it flows to once all cells that flow into it are done. Starting from
+// each cell that has no inflow, the flow path is followed until a cell is
+// reached that still has inflow from a cell that is not done.
+SpatRaster SpatRaster::flowAccumulation(SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	if (nlyr() > 2) {
+		std::vector<unsigned> lyr = {0, 1};
+		SpatOptions ops(opt);
+		out = subset(lyr, ops);
+		out = out.flowAccumulation(opt);
+		out.addWarning("only the first two layers are used");
+		return out;
+	}
+	size_t nr = nrow();
+	size_t nc = ncol();
+	bool weights = nlyr() > 1;
+
+	// the flow direction, the weights (and later the accumulation) and the number of inflowing cells
+	TiledGrid grid;
+	std::string msg;
+	if (!hydro_read(*this, grid, 3, flow_index, opt, msg)) {
+		out.setError(msg);
+		return out;
+	}
+	double* dir = grid.var(0);
+	double* acc = grid.var(1);
+	double* nin = grid.var(2);
+
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t t = grid.cell(r, c);
+			if (std::isnan(dir[t])) {
+				acc[t] = NAN;
+			} else if (!weights) {
+				acc[t] = 1;
+			} else if (std::isnan(acc[t])) {
+				acc[t] = 0;
+			}
+			nin[t] = 0;
+		}
+	}
+	// the cell that cell (r, c) flows to, if there is one
+	auto downstream = [&](size_t r, size_t c, size_t &t2) {
+		size_t t = grid.cell(r, c);
+		if (!(dir[t] >= 0)) return false;
+		int j = dir[t];
+		if (((r == 0) && (flow_dr[j] < 0)) || ((r == (nr-1)) && (flow_dr[j] > 0))) return false;
+		if (((c == 0) && (flow_dc[j] < 0)) || ((c == (nc-1)) && (flow_dc[j] > 0))) return false;
+		t2 = grid.cell(r + flow_dr[j], c + flow_dc[j]);
+		return !std::isnan(dir[t2]);
+	};
+
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t t2;
+			if (downstream(r, c, t2)) nin[t2]++;
+		}
+	}
+
+	// cells that are done have nin = -1
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t t = grid.cell(r, c);
+			if ((nin[t] != 0) || std::isnan(dir[t])) continue;
+			size_t r1 = r, c1 = c;
+			while (true) {
+				nin[t] = -1;
+				size_t t2;
+				if (!downstream(r1, c1, t2)) break;
+				acc[t2] += acc[t];
+				nin[t2]--;
+				if (nin[t2] > 0) break;
+				int j = dir[t];
+				r1 += flow_dr[j];
+				c1 += flow_dc[j];
+				t = t2;
+			}
+		}
+	}
+
+	// cells on, or downstream of, a loop
+	bool loops = false;
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			size_t t = grid.cell(r, c);
+			if (nin[t] > 0) {
+				acc[t] = NAN;
+				loops = true;
+			}
+		}
+	}
+
+	if (!hydro_write(out, grid, 1, opt)) {
+		return out;
+	}
+	if (loops) {
+		out.addWarning("the flow directions have loops. The cells on (or downstream of) a loop are NA");
+	}
+	return out;
+}
+
+
+// The cells upstream of each outlet are found by following the flow
+// directions backwards, from all outlets at once. Cells that already have a
+// basin are not visited again, so that the basin of an outlet does not include
+// the basins of the outlets upstream of it
+SpatRaster SpatRaster::watershed(std::vector<double> cells, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+	out.setNames({"basin"});
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	if (nlyr() > 1) {
+		std::vector<unsigned> lyr = {0};
+		SpatOptions ops(opt);
+		out = subset(lyr, ops);
+		out = out.watershed(cells, opt);
+		out.addWarning("only the first layer is used");
+		return out;
+	}
+	size_t nr = nrow();
+	size_t nc = ncol();
+	double ncell = nr * nc;
+
+	// the flow direction and the basin
+	TiledGrid grid;
+	std::string msg;
+	if (!hydro_read(*this, grid, 2, flow_index, opt, msg)) {
+		out.setError(msg);
+		return out;
+	}
+	double* dir = grid.var(0);
+	double* basin = grid.var(1);
+	for (size_t r=0; r<nr; r++) {
+		for (size_t c=0; c<nc; c++) {
+			basin[grid.cell(r, c)] = NAN;
+		}
+	}
+
+	std::vector<size_t> stack;
+	bool outside = false;
+	for (size_t i=0; i<cells.size(); i++) {
+		if (!((cells[i] >= 0) && (cells[i] < ncell))) {
+			outside = true;
+			continue;
+		}
+		size_t cell = cells[i];
+		size_t t = grid.cell(cell / nc, cell % nc);
+		if (std::isnan(basin[t])) {
+			basin[t] = i + 1;
+			stack.push_back(cell);
+		}
+	}
+
+	while (!stack.empty()) {
+		size_t cell = stack.back();
+		stack.pop_back();
+		size_t r = cell / nc;
+		size_t c = cell % nc;
+		double id = basin[grid.cell(r, c)];
+		for (size_t j=0; j<8; j++) {
+			if (((r == 0) && (flow_dr[j] < 0)) || ((r == (nr-1)) && (flow_dr[j] > 0))) continue;
+			if (((c == 0) && (flow_dc[j] < 0)) || ((c == (nc-1)) && (flow_dc[j] > 0))) continue;
+			size_t r2 = r + flow_dr[j];
+			size_t c2 = c + flow_dc[j];
+			size_t t2 = grid.cell(r2, c2);
+			// the neighbor in direction j flows in the opposite direction
+			if ((dir[t2] == ((j + 4) % 8)) && std::isnan(basin[t2])) {
+				basin[t2] = id;
+				stack.push_back(r2 * nc + c2);
+			}
+		}
+	}
+
+	if (!hydro_write(out, grid, 1, opt)) {
+		return out;
+	}
+	if (outside) {
+		out.addWarning("outlets outside the raster are ignored");
+	}
+	return out;
+}
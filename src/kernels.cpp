@@ -0,0 +1,604 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#include "kernels.h"
+#include "vecmath.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The kernels are simple loops without branches that the compiler can
+// vectorize. R compiles with -O2, which (with gcc) does not vectorize
+// loops, so that is requested here. On x86-64 Linux, gcc also makes
+// AVX-512, AVX2 and default versions of each kernel, and the one to use
+// is selected when the library is loaded
+#if defined(__GNUC__) && !defined(__clang__)
+# if (__GNUC__ >= 8) && defined(__x86_64__) && defined(__linux__) && defined(__GLIBC__)
+#  define SPAT_KERNEL __attribute__((target_clones("avx512f", "avx2", "default"), optimize("tree-vectorize", "vect-cost-model=dynamic")))
+# else
+#  define SPAT_KERNEL __attribute__((optimize("tree-vectorize")))
+# endif
+#else
+# define SPAT_KERNEL
+#endif
+
+
+// operators. Comparisons and logical operators return NAN if either value is NAN
+
+struct opPlus { static inline double f(double a, double b) { return a + b; } };
+struct opMinus { static inline double f(double a, double b) { return a - b; } };
+struct opTimes { static inline double f(double a, double b) { return a * b; } };
+struct opDivide { static inline double f(double a, double b) { return a / b; } };
+struct opMod { static inline double f(double a, double b) { return std::fmod(a, b); } };
+struct opPow { static inline double f(double a, double b) { return std::pow(a, b); } };
+// pow(NAN, 0) and pow(1, NAN) are 1
+struct opPowNA { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : std::pow(a, b); } };
+
+struct opEQ { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)(a == b); } };
+struct opNE { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)(a != b); } };
+struct opGT { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)(a > b); } };
+struct opLT { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)(a < b); } };
+struct opGE { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)(a >= b); } };
+struct opLE { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)(a <= b); } };
+struct opAnd { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)((a != 0) & (b != 0)); } };
+struct opOr { static inline double f(double a, double b) { return (std::isnan(a) || std::isnan(b)) ? NAN : (double)((a != 0) | (b != 0)); } };
+// with a logical scalar (b); cells that are not 1 are FALSE
+struct opAndS { static inline double f(double a, double b) { return (double)((a == 1) & (b != 0)); } };
+struct opOrS { static inline double f(double a, double b) { return (double)((a == 1) | (b != 0)); } };
+
+
+// functions
+
+struct fnAbs { static inline double f(double a) { return std::fabs(a); } };
+struct fnSqrt { static inline double f(double a) { return std::sqrt(a); } };
+struct fnCeil { static inline double f(double a) { return std::ceil(a); } };
+struct fnFloor { static inline double f(double a) { return std::floor(a); } };
+struct fnTrunc { static inline double f(double a) { return std::trunc(a); } };
+struct fnLog { static inline double f(double a) { return std::log(a); } };
+struct fnLog10 { static inline double f(double a) { return std::log10(a); } };
+struct fnLog2 { static inline double f(double a) { return std::log2(a); } };
+struct fnLog1p { static inline double f(double a) { return std::log1p(a); } };
+struct fnExp { static inline double f(double a) { return std::exp(a); } };
+struct fnExpm1 { static inline double f(double a) { return std::expm1(a); } };
+struct fnSign { static inline double f(double a) { return std::isnan(a) ? a : (double)((0 < a) - (a < 0)); } };
+
+struct fnSin { static inline double f(double a) { return std::sin(a); } };
+struct fnCos { static inline double f(double a) { return std::cos(a); } };
+struct fnTan { static inline double f(double a) { return std::tan(a); } };
+struct fnAsin { static inline double f(double a) { return std::asin(a); } };
+struct fnAcos { static inline double f(double a) { return std::acos(a); } };
+struct fnAtan { static inline double f(double a) { return std::atan(a); } };
+struct fnSinh { static inline double f(double a) { return std::sinh(a); } };
+struct fnCosh { static inline double f(double a) { return std::cosh(a); } };
+struct fnTanh { static inline double f(double a) { return std::tanh(a); } };
+struct fnAsinh { static inline double f(double a) { return std::asinh(a); } };
+struct fnAcosh { static inline double f(double a) { return std::acosh(a); } };
+struct fnAtanh { static inline double f(double a) { return std::atanh(a); } };
+struct fnSinpi { static inline double f(double a) { return std::sin(a * M_PI); } };
+struct fnCospi { static inline double f(double a) { return std::cos(a * M_PI); } };
+struct fnTanpi { static inline double f(double a) { return std::tan(a * M_PI); } };
+
+struct fnIsNA { static inline double f(double a) { return (double)std::isnan(a); } };
+struct fnNotNA { static inline double f(double a) { return (double)(!std::isnan(a)); } };
+struct fnIsFinite { static inline double f(double a) { return (double)std::isfinite(a); } };
+struct fnIsInf { static inline double f(double a) { return (double)std::isinf(a); } };
+struct fnNot { static inline double f(double a) { return std::isnan(a) ? a : (double)(a == 0); } };
+struct fnIsTrue { static inline double f(double a) { return (double)(a == 1); } };
+struct fnIsFalse { static inline double f(double a) { return (double)(a != 1); } };
+
+
+template <class Op> SPAT_KERNEL
+void kernel_vv(double * __restrict a, const double * __restrict b, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = Op::f(a[i], b[i]);
+	}
+}
+
+template <class Op> SPAT_KERNEL
+void kernel_vs(double *a, double x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = Op::f(a[i], x);
+	}
+}
+
+template <class Op> SPAT_KERNEL
+void kernel_sv(double *a, double x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = Op::f(x, a[i]);
+	}
+}
+
+template <class Fn> SPAT_KERNEL
+void kernel_v(double *a, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = Fn::f(a[i]);
+	}
+}
+
+
+BinaryKernel getBinaryKernel(const std::string &oper) {
+	static const std::map<std::string, BinaryKernel> kernels {
+		{"+", kernel_vv<opPlus>}, {"-", kernel_vv<opMinus>}, {"*", kernel_vv<opTimes>},
+		{"/", kernel_vv<opDivide>}, {"^", kernel_vv<opPowNA>}, {"%", kernel_vv<opMod>},
+		{"==", kernel_vv<opEQ>}, {"!=", kernel_vv<opNE>}, {">", kernel_vv<opGT>},
+		{"<", kernel_vv<opLT>}, {">=", kernel_vv<opGE>}, {"<=", kernel_vv<opLE>},
+		{"&", kernel_vv<opAnd>}, {"|", kernel_vv<opOr>}
+	};
+	std::map<std::string, BinaryKernel>::const_iterator it = kernels.find(oper);
+	if (it == kernels.end()) return NULL;
+	return it->second;
+}
+
+
+ScalarKernel getScalarKernel(const std::string &oper, bool reverse) {
+	static const std::map<std::string, ScalarKernel> kernels {
+		{"+", kernel_vs<opPlus>}, {"-", kernel_vs<opMinus>}, {"*", kernel_vs<opTimes>},
+		{"/", kernel_vs<opDivide>}, {"^", kernel_vs<opPow>}, {"%", kernel_vs<opMod>},
+		{"==", kernel_vs<opEQ>}, {"!=", kernel_vs<opNE>}, {">", kernel_vs<opGT>},
+		{"<", kernel_vs<opLT>}, {">=", kernel_vs<opGE>}, {"<=", kernel_vs<opLE>},
+		{"&", kernel_vs<opAndS>}, {"|", kernel_vs<opOrS>}
+	};
+	// x op a[i]; only needed for operators that are not symmetrical
+	static const std::map<std::string, ScalarKernel> rkernels {
+		{"-", kernel_sv<opMinus>}, {"/", kernel_sv<opDivide>}, {"^", kernel_sv<opPow>},
+		{"%", kernel_sv<opMod>}, {">", kernel_sv<opGT>}, {"<", kernel_sv<opLT>},
+		{">=", kernel_sv<opGE>}, {"<=", kernel_sv<opLE>}
+	};
+	std::map<std::string, ScalarKernel>::const_iterator it;
+	if (reverse) {
+		it = rkernels.find(oper);
+		if (it != rkernels.end()) return it->second;
+	}
+	it = kernels.find(oper);
+	if (it == kernels.end()) return NULL;
+	return it->second;
+}
+
+
+UnaryKernel getUnaryKernel(const std::string &fun) {
+	static const std::map<std::string, UnaryKernel> kernels {
+		{"abs", kernel_v<fnAbs>}, {"sqrt", kernel_v<fnSqrt>}, {"ceiling", kernel_v<fnCeil>},
+		{"floor", kernel_v<fnFloor>}, {"trunc", kernel_v<fnTrunc>}, {"log", kernel_v<fnLog>},
+		{"log10", kernel_v<fnLog10>}, {"log2", kernel_v<fnLog2>}, {"log1p", kernel_v<fnLog1p>},
+		{"exp", kernel_v<fnExp>}, {"expm1", kernel_v<fnExpm1>}, {"sign", kernel_v<fnSign>},
+		{"sin", kernel_v<fnSin>}, {"cos", kernel_v<fnCos>}, {"tan", kernel_v<fnTan>},
+		{"asin", kernel_v<fnAsin>}, {"acos", kernel_v<fnAcos>}, {"atan", kernel_v<fnAtan>},
+		{"sinh", kernel_v<fnSinh>}, {"cosh", kernel_v<fnCosh>}, {"tanh", kernel_v<fnTanh>},
+		{"asinh", kernel_v<fnAsinh>}, {"acosh", kernel_v<fnAcosh>}, {"atanh", kernel_v<fnAtanh>},
+		{"sinpi", kernel_v<fnSinpi>}, {"cospi", kernel_v<fnCospi>}, {"tanpi", kernel_v<fnTanpi>},
+		{"isnan", kernel_v<fnIsNA>}, {"isnotnan", kernel_v<fnNotNA>}, {"isfinite", kernel_v<fnIsFinite>},
+		{"isinfinite", kernel_v<fnIsInf>}, {"!", kernel_v<fnNot>}, {"istrue", kernel_v<fnIsTrue>},
+		{"isfalse", kernel_v<fnIsFalse>}
+	};
+	std::map<std::string, UnaryKernel>::const_iterator it = kernels.find(fun);
+	if (it == kernels.end()) return NULL;
+	return it->second;
+}
+
+
+SPAT_KERNEL
+void clamp_kernel(double *a, size_t n, double low, double high, bool usevalue) {
+	if (usevalue) {
+		for (size_t i=0; i<n; i++) {
+			a[i] = a[i] < low ? low : (a[i] > high ? high : a[i]);
+		}
+	} else {
+		for (size_t i=0; i<n; i++) {
+			a[i] = ((a[i] < low) | (a[i] > high)) ? NAN : a[i];
+		}
+	}
+}
+
+
+
+// kernels for the reductions over layers. c counts the values that are not NA
+
+SPAT_KERNEL
+void reduce_add(double *a, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) a[i] += x[i];
+}
+
+SPAT_KERNEL
+void reduce_add_narm(double *a, double *c, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		bool ok = !std::isnan(x[i]);
+		a[i] += ok ? x[i] : 0;
+		c[i] += ok;
+	}
+}
+
+SPAT_KERNEL
+void reduce_mult(double *a, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) a[i] *= x[i];
+}
+
+SPAT_KERNEL
+void reduce_mult_narm(double *a, double *c, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		bool ok = !std::isnan(x[i]);
+		a[i] *= ok ? x[i] : 1;
+		c[i] += ok;
+	}
+}
+
+// the sum of squared differences with the mean m
+SPAT_KERNEL
+void reduce_ss(double *a, const double *m, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		double d = x[i] - m[i];
+		a[i] += std::isnan(x[i]) ? 0 : d * d;
+	}
+}
+
+SPAT_KERNEL
+void reduce_min(double *a, double *c, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = x[i] < a[i] ? x[i] : a[i];
+		c[i] += !std::isnan(x[i]);
+	}
+}
+
+SPAT_KERNEL
+void reduce_max(double *a, double *c, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = x[i] > a[i] ? x[i] : a[i];
+		c[i] += !std::isnan(x[i]);
+	}
+}
+
+SPAT_KERNEL
+void reduce_minmax(double *a, double *b, double *c, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = x[i] < a[i] ? x[i] : a[i];
+		b[i] = x[i] > b[i] ? x[i] : b[i];
+		c[i] += !std::isnan(x[i]);
+	}
+}
+
+// w is the (1-based) layer k of the first minimum (0 if there is none yet)
+SPAT_KERNEL
+void reduce_whichmin(double *a, double *w, double *c, const double *x, double k, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		bool ok = !std::isnan(x[i]);
+		bool b = ok & ((x[i] < a[i]) | (w[i] == 0));
+		a[i] = b ? x[i] : a[i];
+		w[i] = b ? k : w[i];
+		c[i] += ok;
+	}
+}
+
+SPAT_KERNEL
+void reduce_whichmax(double *a, double *w, double *c, const double *x, double k, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		bool ok = !std::isnan(x[i]);
+		bool b = ok & ((x[i] > a[i]) | (w[i] == 0));
+		a[i] = b ? x[i] : a[i];
+		w[i] = b ? k : w[i];
+		c[i] += ok;
+	}
+}
+
+SPAT_KERNEL
+void reduce_which(double *a, const double *x, double k, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = (std::isnan(a[i]) & (!std::isnan(x[i])) & (x[i] != 0)) ? k : a[i];
+	}
+}
+
+SPAT_KERNEL
+void reduce_any(double *a, double *c, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		bool ok = !std::isnan(x[i]);
+		a[i] += ok & (x[i] != 0);
+		c[i] += ok;
+	}
+}
+
+// the number of zeros
+SPAT_KERNEL
+void reduce_zero(double *a, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) a[i] += x[i] == 0;
+}
+
+// a is 1 until the first value that is NA or zero
+SPAT_KERNEL
+void reduce_all(double *a, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = ((a[i] == 1) & (std::isnan(x[i]) | (x[i] == 0))) ? x[i] : a[i];
+	}
+}
+
+SPAT_KERNEL
+void reduce_first(double *a, const double *x, size_t n) {
+	for (size_t i=0; i<n; i++) {
+		a[i] = std::isnan(a[i]) ? x[i] : a[i];
+	}
+}
+
+
+enum ReduceFun {RD_SUM, RD_MEAN, RD_MIN, RD_MAX, RD_PROD, RD_SD, RD_STD, RD_RANGE, RD_WHICH, RD_WHICHMIN, RD_WHICHMAX, RD_ANY, RD_ALL, RD_FIRST, RD_CELL};
+
+
+bool LayerReducer::init(std::string f, bool na_rm, std::vector<double> addvals) {
+	std::vector<std::string> fs {"sum", "mean", "min", "max", "prod", "sd", "std", "range", "which", "which.min", "which.max", "any", "all", "first"};
+	narm = na_rm;
+	add = addvals;
+	auto it = std::find(fs.begin(), fs.end(), f);
+	if (it != fs.end()) {
+		fun = std::distance(fs.begin(), it);
+		return true;
+	}
+	if (!haveFun(f)) {
+		fun = -1;
+		return false;
+	}
+	fun = RD_CELL;
+	cellfun = getFun(f);
+	return true;
+}
+
+
+void LayerReducer::init(std::function<double(std::vector<double>&, bool)> f, bool na_rm, std::vector<double> addvals) {
+	narm = na_rm;
+	add = addvals;
+	fun = RD_CELL;
+	cellfun = f;
+}
+
+
+size_t LayerReducer::nout() const {
+	return fun == RD_RANGE ? 2 : 1;
+}
+
+
+void LayerReducer::reduce(const std::vector<double> &v, size_t n, double *out) const {
+	size_t nl = n == 0 ? 0 : v.size() / n;
+	std::vector<const double*> x(nl);
+	for (size_t k=0; k<nl; k++) {
+		x[k] = v.data() + k * n;
+	}
+	reduce(x, n, out);
+}
+
+
+void LayerReducer::reduce_cells(const std::vector<const double*> &x, size_t n, double *out) const {
+	size_t nx = x.size();
+	size_t nv = nx + add.size();
+	// tiles of about 32768 values
+	size_t T = std::max((size_t)1, (size_t)32768 / std::max((size_t)1, nv));
+	std::vector<double> tile(T * nv);
+	std::vector<double> v;
+	for (size_t c0=0; c0<n; c0+=T) {
+		size_t m = std::min(T, n - c0);
+		for (size_t k=0; k<nx; k++) {
+			const double *p = x[k] + c0;
+			for (size_t j=0; j<m; j++) {
+				tile[j*nv + k] = p[j];
+			}
+		}
+		for (size_t k=nx; k<nv; k++) {
+			for (size_t j=0; j<m; j++) {
+				tile[j*nv + k] = add[k-nx];
+			}
+		}
+		for (size_t j=0; j<m; j++) {
+			v.assign(tile.begin() + j*nv, tile.begin() + (j+1)*nv);
+			out[c0 + j] = cellfun(v, narm);
+		}
+	}
+}
+
+
+void LayerReducer::reduce(const std::vector<const double*> &x, size_t n, double *out) const {
+
+	if (fun == RD_CELL) {
+		reduce_cells(x, n, out);
+		return;
+	}
+
+	const size_t T = 256;
+	size_t nx = x.size();
+	size_t nv = nx + add.size();
+	double dnv = nv;
+	std::vector<double> cadd(add.size() * T);
+	for (size_t k=0; k<add.size(); k++) {
+		std::fill(cadd.begin() + k*T, cadd.begin() + (k+1)*T, add[k]);
+	}
+	std::vector<const double*> p(nv);
+	std::vector<double> va(T), vb(T), vc(T);
+	double *a = va.data();
+	double *b = vb.data();
+	double *c = vc.data();
+	double inf = std::numeric_limits<double>::infinity();
+
+	for (size_t c0=0; c0<n; c0+=T) {
+		size_t m = std::min(T, n - c0);
+		for (size_t k=0; k<nx; k++) p[k] = x[k] + c0;
+		for (size_t k=nx; k<nv; k++) p[k] = &cadd[(k-nx) * T];
+		double *o = out + c0;
+		std::fill(c, c+m, 0.0);
+
+		switch (fun) {
+			case RD_SUM:
+			case RD_MEAN:
+				std::fill(a, a+m, 0.0);
+				if (narm) {
+					for (size_t k=0; k<nv; k++) reduce_add_narm(a, c, p[k], m);
+					for (size_t j=0; j<m; j++) {
+						o[j] = c[j] > 0 ? (fun == RD_SUM ? a[j] : a[j] / c[j]) : NAN;
+					}
+				} else {
+					for (size_t k=0; k<nv; k++) reduce_add(a, p[k], m);
+					for (size_t j=0; j<m; j++) {
+						o[j] = fun == RD_SUM ? a[j] : a[j] / dnv;
+					}
+				}
+				break;
+			case RD_PROD:
+				std::fill(a, a+m, 1.0);
+				if (narm) {
+					for (size_t k=0; k<nv; k++) reduce_mult_narm(a, c, p[k], m);
+					for (size_t j=0; j<m; j++) o[j] = c[j] > 0 ? a[j] : NAN;
+				} else {
+					for (size_t k=0; k<nv; k++) reduce_mult(a, p[k], m);
+					std::copy(a, a+m, o);
+				}
+				break;
+			case RD_MIN:
+			case RD_MAX:
+				std::fill(a, a+m, fun == RD_MIN ? inf : -inf);
+				for (size_t k=0; k<nv; k++) {
+					if (fun == RD_MIN) {
+						reduce_min(a, c, p[k], m);
+					} else {
+						reduce_max(a, c, p[k], m);
+					}
+				}
+				for (size_t j=0; j<m; j++) {
+					o[j] = (narm ? c[j] > 0 : c[j] == dnv) ? a[j] : NAN;
+				}
+				break;
+			case RD_RANGE:
+				std::fill(a, a+m, inf);
+				std::fill(b, b+m, -inf);
+				for (size_t k=0; k<nv; k++) reduce_minmax(a, b, c, p[k], m);
+				for (size_t j=0; j<m; j++) {
+					bool ok = narm ? c[j] > 0 : c[j] == dnv;
+					o[j] = ok ? a[j] : NAN;
+					o[j+n] = ok ? b[j] : NAN;
+				}
+				break;
+			case RD_SD:
+			case RD_STD:
+				std::fill(a, a+m, 0.0);
+				for (size_t k=0; k<nv; k++) reduce_add_narm(a, c, p[k], m);
+				for (size_t j=0; j<m; j++) {
+					b[j] = ((c[j] > 0) && (narm || (c[j] == dnv))) ? a[j] / c[j] : NAN;
+				}
+				std::fill(a, a+m, 0.0);
+				for (size_t k=0; k<nv; k++) reduce_ss(a, b, p[k], m);
+				for (size_t j=0; j<m; j++) {
+					double d = fun == RD_SD ? c[j] - 1 : c[j];
+					o[j] = (std::isnan(b[j]) || (d == 0)) ? NAN : std::sqrt(a[j] / d);
+				}
+				break;
+			case RD_WHICH:
+				std::fill(a, a+m, NAN);
+				for (size_t k=0; k<nv; k++) reduce_which(a, p[k], k+1, m);
+				std::copy(a, a+m, o);
+				break;
+			case RD_WHICHMIN:
+			case RD_WHICHMAX:
+				std::fill(a, a+m, fun == RD_WHICHMIN ? inf : -inf);
+				std::fill(b, b+m, 0.0);
+				for (size_t k=0; k<nv; k++) {
+					if (fun == RD_WHICHMIN) {
+						reduce_whichmin(a, b, c, p[k], k+1, m);
+					} else {
+						reduce_whichmax(a, b, c, p[k], k+1, m);
+					}
+				}
+				for (size_t j=0; j<m; j++) {
+					o[j] = (narm ? c[j] > 0 : c[j] == dnv) ? b[j] : NAN;
+				}
+				break;
+			case RD_ANY:
+				std::fill(a, a+m, 0.0);
+				for (size_t k=0; k<nv; k++) reduce_any(a, c, p[k], m);
+				for (size_t j=0; j<m; j++) {
+					o[j] = a[j] > 0 ? 1 : ((narm || (c[j] == dnv)) ? 0 : NAN);
+				}
+				break;
+			case RD_ALL:
+				if (narm) {
+					std::fill(a, a+m, 0.0);
+					for (size_t k=0; k<nv; k++) reduce_zero(a, p[k], m);
+					for (size_t j=0; j<m; j++) o[j] = a[j] > 0 ? 0 : 1;
+				} else {
+					std::fill(a, a+m, 1.0);
+					for (size_t k=0; k<nv; k++) reduce_all(a, p[k], m);
+					std::copy(a, a+m, o);
+				}
+				break;
+			case RD_FIRST:
+				if (narm) {
+					std::fill(a, a+m, NAN);
+					for (size_t k=0; k<nv; k++) reduce_first(a, p[k], m);
+					std::copy(a, a+m, o);
+				} else {
+					std::copy(p[0], p[0]+m, o);
+				}
+				break;
+			default:
+				std::fill(o, o+m, NAN);
+		}
+	}
+}
+
+
+std::vector<double> benchmark_kernels(std::string type, std::vector<std::string> opers, size_t n, size_t reps) {
+
+	n = std::max((size_t)1, n);
+	reps = std::max((size_t)1, reps);
+	// values in (0, 1) with some NAN
+	std::vector<double> a(n), b(n), w(n);
+	for (size_t i=0; i<n; i++) {
+		a[i] = ((i % 100) + 0.5) / 100;
+		b[i] = (((i * 7) % 100) + 0.5) / 100;
+		if ((i % 97) == 0) a[i] = NAN;
+	}
+
+	std::vector<double> out(opers.size(), NAN);
+	double bytes = (type == "binary" ? 3 : 2) * sizeof(double) * (double)n * reps;
+	for (size_t k=0; k<opers.size(); k++) {
+		BinaryKernel bk = NULL;
+		ScalarKernel sk = NULL;
+		UnaryKernel uk = NULL;
+		if (type == "binary") {
+			bk = getBinaryKernel(opers[k]);
+		} else if (type == "scalar") {
+			sk = getScalarKernel(opers[k], false);
+		} else if (type == "unary") {
+			uk = getUnaryKernel(opers[k]);
+		}
+		if ((bk == NULL) && (sk == NULL) && (uk == NULL)) continue;
+
+		double secs = 0;
+		for (size_t r=0; r<reps; r++) {
+			std::copy(a.begin(), a.end(), w.begin());
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if (bk != NULL) {
+				bk(&w[0], &b[0], n);
+			} else if (sk != NULL) {
+				sk(&w[0], 0.5, n);
+			} else {
+				uk(&w[0], n);
+			}
+			std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+			secs += d.count();
+		}
+		out[k] = secs > 0 ? (bytes / secs) / 1e9 : NAN;
+	}
+	return out;
+}
+
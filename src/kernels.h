@@ -0,0 +1,82 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef KERNELS_GUARD
+#define KERNELS_GUARD
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <functional>
+
+// Cell-by-cell kernels for arith, logic, math, trig, isnan and clamp.
+// The operator is looked up once, before the blocks are processed, and
+// the kernel is then called for each block (or layer within a block).
+// A NULL kernel means that the operator is not known
+
+// a[i] = a[i] op b[i]
+typedef void (*BinaryKernel)(double *a, const double *b, size_t n);
+// a[i] = a[i] op x (or x op a[i] if the kernel was requested with reverse=true)
+typedef void (*ScalarKernel)(double *a, double x, size_t n);
+// a[i] = f(a[i])
+typedef void (*UnaryKernel)(double *a, size_t n);
+
+// "+", "-", "*", "/", "^", "%", "==", "!=", ">", "<", ">=", "<=", "&", "|"
+BinaryKernel getBinaryKernel(const std::string &oper);
+// as getBinaryKernel, but "&" and "|" combine (a == 1) with x
+ScalarKernel getScalarKernel(const std::string &oper, bool reverse);
+// the math and trig functions, and "isnan", "isnotnan", "isfinite", "isinfinite",
+// "!", "istrue", "isfalse"
+UnaryKernel getUnaryKernel(const std::string &fun);
+
+void clamp_kernel(double *a, size_t n, double low, double high, bool usevalue);
+
+// Reductions over the layers of each cell (summary, modal, range, weighted.mean
+// and mosaic). x has a pointer to n values for each layer (for the layers of a
+// block that is read these are n apart). "sum", "mean", "min", "max", "prod",
+// "sd", "std", "range", "which", "which.min", "which.max", "any", "all" and
+// "first" are updated one layer at a time, for tiles of cells, with loops over
+// contiguous values. Other functions (e.g. "median") get the values of each
+// cell from a cell-major copy of a tile. The values of "add" are treated as
+// additional layers. reduce may be called from multiple threads
+class LayerReducer {
+	public:
+		// a function of haveFun (vecmath.h), or "range"
+		bool init(std::string fun, bool narm, std::vector<double> add);
+		// any other function of the values of a cell
+		void init(std::function<double(std::vector<double>&, bool)> f, bool narm, std::vector<double> add);
+		// the number of values for each cell (2 for "range")
+		size_t nout() const;
+		// out gets nout() layers of n values
+		void reduce(const std::vector<const double*> &x, size_t n, double *out) const;
+		// the n values of each of nl layers in v (band sequential)
+		void reduce(const std::vector<double> &v, size_t n, double *out) const;
+
+	private:
+		int fun = -1;
+		bool narm = false;
+		std::vector<double> add;
+		std::function<double(std::vector<double>&, bool)> cellfun;
+		void reduce_cells(const std::vector<const double*> &x, size_t n, double *out) const;
+};
+
+// GB/s (bytes read plus bytes written) of each operator, for n cells and
+// "reps" repetitions. type is "binary", "scalar" or "unary"; NAN for
+// operators that are not known
+std::vector<double> benchmark_kernels(std::string type, std::vector<std::string> opers, size_t n, size_t reps);
+
+#endif
@@ -0,0 +1,296 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "lazy.h"
+
+// in sample.cpp
+void getSampleRowCol(std::vector<size_t> &oldrow, std::vector<size_t> &oldcol, size_t nrows, size_t ncols, size_t snrow, size_t sncol);
+
+
+SpatLazy::SpatLazy(std::vector<SpatRaster> _x, CellWorker _fun, size_t _nlyr) {
+	x = _x;
+	fun = _fun;
+	nlyr = _nlyr;
+	for (size_t i=0; i<x.size(); i++) {
+		for (size_t j=0; j<x[i].source.size(); j++) {
+			if (x[i].source[j].lazy) x[i].source[j].lazy->nuse++;
+		}
+	}
+}
+
+
+bool SpatLazy::readStart(std::string &msg) {
+	if (nopen++ > 0) return true;
+	for (size_t i=0; i<x.size(); i++) {
+		if (!x[i].readStart()) {
+			msg = x[i].getError();
+			return false;
+		}
+	}
+	return true;
+}
+
+
+void SpatLazy::readStop() {
+	if (nopen == 0) return;
+	if (--nopen > 0) return;
+	for (size_t i=0; i<x.size(); i++) {
+		x[i].readStop();
+	}
+	chunk.resize(0);
+	std::vector<double>().swap(cache);
+}
+
+
+bool SpatLazy::readOperands(std::vector<std::vector<double>> &v, size_t row, size_t nrows, size_t col, size_t ncols, std::string &msg) {
+	v.resize(x.size());
+	for (size_t i=0; i<x.size(); i++) {
+		x[i].readValues(v[i], row, nrows, col, ncols);
+		if (x[i].hasError()) {
+			msg = x[i].getError();
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool SpatLazy::readValues(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols, std::string &msg) {
+	std::vector<size_t> ch = {row, nrows, col, ncols};
+	if ((nuse > 1) && (ch == chunk)) {
+		out = cache;
+		return true;
+	}
+	std::vector<std::vector<double>> v;
+	if (!readOperands(v, row, nrows, col, ncols, msg)) {
+		return false;
+	}
+	fun(v, nrows * ncols);
+	out = std::move(v[0]);
+	if (nuse > 1) {
+		chunk = ch;
+		cache = out;
+	}
+	return true;
+}
+
+
+bool SpatRaster::hasLazy() {
+	for (size_t i=0; i<source.size(); i++) {
+		if (source[i].lazy) return true;
+	}
+	return false;
+}
+
+
+bool SpatRaster::writeCells(std::vector<SpatRaster*> x, CellWorker fun, SpatOptions &opt) {
+
+	// lazy, unless the values must be written to a file
+	if (opt.get_lazy() && (opt.get_filename() == "")) {
+		std::vector<SpatRaster> xc;
+		xc.reserve(x.size());
+		for (size_t i=0; i<x.size(); i++) {
+			xc.push_back(*x[i]);
+		}
+		SpatRasterSource &s = source[0];
+		s.lazy = std::make_shared<SpatLazy>(xc, fun, nlyr());
+		s.memory = false;
+		s.hasValues = true;
+		s.nlyrfile = s.nlyr;
+		s.driver = "lazy";
+		return true;
+	}
+
+	for (size_t i=0; i<x.size(); i++) {
+		if (!x[i]->readStart()) {
+			setError(x[i]->getError());
+			for (size_t j=0; j<i; j++) x[j]->readStop();
+			return false;
+		}
+	}
+	if (!writeStart(opt)) {
+		for (size_t i=0; i<x.size(); i++) x[i]->readStop();
+		return false;
+	}
+	size_t nc = ncol();
+	BlockReader reader = [&](std::vector<std::vector<double>> &v, size_t i) {
+		v.resize(x.size());
+		for (size_t j=0; j<x.size(); j++) {
+			x[j]->readBlock(v[j], bs, i);
+			if (x[j]->hasError()) {
+				setError(x[j]->getError());
+				return false;
+			}
+		}
+		return true;
+	};
+	BlockWorker worker = [&](std::vector<std::vector<double>> &v, size_t i) {
+		fun(v, bs.nrows[i] * nc);
+	};
+	bool ok = writeBlocks(reader, worker, opt);
+	writeStop();
+	for (size_t i=0; i<x.size(); i++) x[i]->readStop();
+	return ok;
+}
+
+
+bool SpatRaster::copyBlocks(SpatRaster &out, SpatOptions &opt) {
+
+	BlockReader reader;
+	BlockWorker worker;
+	if ((nsrc() == 1) && source[0].lazy && source[0].in_order() && (!source[0].hasWindow)) {
+		// compute the values on the worker threads
+		std::shared_ptr<SpatLazy> lz = source[0].lazy;
+		size_t nc = ncol();
+		reader = [&](std::vector<std::vector<double>> &v, size_t i) {
+			std::string msg;
+			if (!lz->readOperands(v, out.bs.row[i], out.bs.nrows[i], 0, nc, msg)) {
+				out.setError(msg);
+				return false;
+			}
+			return true;
+		};
+		worker = [&](std::vector<std::vector<double>> &v, size_t i) {
+			lz->fun(v, out.bs.nrows[i] * nc);
+		};
+	} else {
+		reader = [&](std::vector<std::vector<double>> &v, size_t i) {
+			v.resize(1);
+			readBlock(v[0], out.bs, i);
+			return !hasError();
+		};
+		worker = [](std::vector<std::vector<double>> &v, size_t i) {};
+	}
+	return out.writeBlocks(reader, worker, opt);
+}
+
+
+void SpatRaster::readChunkLazy(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+
+	SpatRasterSource &s = source[src];
+	if (s.hasWindow) {
+		row += s.window.off_row;
+		col += s.window.off_col;
+	}
+	std::vector<double> v;
+	std::string msg;
+	if (!s.lazy->readValues(v, row, nrows, col, ncols, msg)) {
+		setError(msg);
+		out.resize(out.size() + nrows * ncols * s.nlyr, NAN);
+		return;
+	}
+	if (s.in_order()) {
+		out.insert(out.end(), v.begin(), v.end());
+	} else {
+		size_t n = nrows * ncols;
+		for (size_t i=0; i<s.layers.size(); i++) {
+			size_t off = s.layers[i] * n;
+			out.insert(out.end(), v.begin()+off, v.begin()+off+n);
+		}
+	}
+}
+
+
+std::vector<std::vector<double>> SpatRaster::readRowColLazy(size_t src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+
+	size_t nl = source[src].nlyr;
+	size_t n = rows.size();
+	std::vector<std::vector<double>> out(nl, std::vector<double>(n, NAN));
+	int_64 nr = nrow();
+	int_64 nc = ncol();
+
+	// each row that has cells is computed once
+	std::vector<size_t> order;
+	order.reserve(n);
+	for (size_t i=0; i<n; i++) {
+		if ((rows[i] >= 0) && (rows[i] < nr) && (cols[i] >= 0) && (cols[i] < nc)) {
+			order.push_back(i);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&rows](size_t a, size_t b) { return rows[a] < rows[b]; });
+
+	std::string msg;
+	if (!source[src].lazy->readStart(msg)) {
+		setError(msg);
+		return out;
+	}
+	std::vector<double> v;
+	int_64 current = -1;
+	for (size_t i=0; i<order.size(); i++) {
+		size_t k = order[i];
+		if (rows[k] != current) {
+			current = rows[k];
+			v.resize(0);
+			readChunkLazy(v, src, current, 1, 0, nc);
+			if (hasError()) break;
+		}
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			out[lyr][k] = v[lyr * nc + cols[k]];
+		}
+	}
+	source[src].lazy->readStop();
+	return out;
+}
+
+
+std::vector<double> SpatRaster::readSampleLazy(size_t src, size_t srows, size_t scols) {
+
+	size_t nl = source[src].nlyr;
+	size_t nc = ncol();
+	std::vector<size_t> oldcol, oldrow;
+	getSampleRowCol(oldrow, oldcol, nrow(), nc, srows, scols);
+	std::vector<double> out(nl * srows * scols, NAN);
+	std::string msg;
+	if (!source[src].lazy->readStart(msg)) {
+		setError(msg);
+		return out;
+	}
+	std::vector<double> v;
+	for (size_t r=0; r<srows; r++) {
+		v.resize(0);
+		readChunkLazy(v, src, oldrow[r], 1, 0, nc);
+		if (hasError()) break;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			size_t off = lyr * srows * scols + r * scols;
+			for (size_t c=0; c<scols; c++) {
+				out[off + c] = v[lyr * nc + oldcol[c]];
+			}
+		}
+	}
+	source[src].lazy->readStop();
+	return out;
+}
+
+
+bool SpatRaster::evaluateLazy(SpatOptions &opt) {
+
+	for (size_t i=0; i<source.size(); i++) {
+		if (!source[i].lazy) continue;
+		SpatRaster x(source[i]);
+		SpatOptions xopt(opt);
+		xopt.set_filenames({""});
+		SpatRaster out = x.hardCopy(xopt);
+		if (out.hasError()) {
+			setError(out.getError());
+			return false;
+		}
+		std::vector<std::string> nms = source[i].names;
+		source[i] = out.source[0];
+		source[i].names = nms;
+	}
+	return true;
+}
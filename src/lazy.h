@@ -0,0 +1,56 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATLAZY_GUARD
+#define SPATLAZY_GUARD
+
+#include "spatRaster.h"
+
+// The values of a raster source that are computed, cell by cell, from
+// other rasters (the operands) when they are read. Operands can be lazy
+// themselves, such that a chain of operations is a graph that is evaluated
+// for one block of cells at a time, without intermediate rasters.
+// Like GDAL sources, a SpatLazy must be read from a single thread
+
+class SpatLazy {
+	public:
+		SpatLazy(std::vector<SpatRaster> _x, CellWorker _fun, size_t _nlyr);
+		virtual ~SpatLazy(){}
+
+		std::vector<SpatRaster> x;
+		CellWorker fun;
+		// the number of layers returned by fun
+		size_t nlyr;
+
+		// operands are opened once, also if this node is used more than once
+		bool readStart(std::string &msg);
+		void readStop();
+		// the values of each operand for a chunk, in v[0], v[1], ...
+		bool readOperands(std::vector<std::vector<double>> &v, size_t row, size_t nrows, size_t col, size_t ncols, std::string &msg);
+		// the values (all layers) for a chunk
+		bool readValues(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols, std::string &msg);
+
+	private:
+		size_t nopen = 0;
+		// number of lazy sources that use this one. If more than one, the
+		// values of the last chunk are kept to avoid computing them again
+		size_t nuse = 0;
+		std::vector<size_t> chunk;
+		std::vector<double> cache;
+};
+
+#endif
@@ -107,6 +107,11 @@ BlockSize SpatRaster::getBlockSize( SpatOptions &opt) {
 		cs = nrow() / steps;
 	} else {
 		cs = chunkSize(opt);
+		size_t nt = opt.compute_threads();
+		if (nt > 1) {
+			// writeBlocks keeps nt+1 blocks in memory
+			cs = std::max((size_t)std::max(opt.minrows, (unsigned)1), (size_t)std::ceil(cs / double(nt+1)));
+		}
 		bs.n = std::ceil(nrow() / double(cs));
 	}
 	bs.row = std::vector<size_t>(bs.n);
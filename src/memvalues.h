@@ -0,0 +1,194 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MEMVALUES_GUARD
+#define MEMVALUES_GUARD
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// The cell values of an in-memory SpatRasterSource (layer by layer). Copies of a
+// source share the same buffer, and a subset of layers is a view on the buffer of
+// the source it was taken from (a list of layers), so that neither copies any
+// values. A buffer is only copied when it is changed (edit) while it is shared.
+
+class SpatValues {
+
+	std::shared_ptr<std::vector<double>> buf;
+	// the layers of buf that are used, in order; empty for all of buf
+	std::vector<size_t> lyrs;
+	size_t lsize = 0;
+
+	static const std::vector<double> &none() {
+		static const std::vector<double> e;
+		return e;
+	}
+
+	const std::vector<double> &data() const {
+		return buf ? *buf : none();
+	}
+
+	// the offset in buf of cell i of the view
+	size_t offset(size_t i) const {
+		if (lyrs.empty()) return i;
+		return lyrs[i / lsize] * lsize + i % lsize;
+	}
+
+	public:
+
+		SpatValues() {}
+		SpatValues(std::vector<double> &&v) : buf(std::make_shared<std::vector<double>>(std::move(v))) {}
+		SpatValues(const std::vector<double> &v) : buf(std::make_shared<std::vector<double>>(v)) {}
+
+		SpatValues& operator=(std::vector<double> &&v) {
+			buf = std::make_shared<std::vector<double>>(std::move(v));
+			lyrs.clear();
+			return *this;
+		}
+		SpatValues& operator=(const std::vector<double> &v) {
+			buf = std::make_shared<std::vector<double>>(v);
+			lyrs.clear();
+			return *this;
+		}
+
+		size_t size() const {
+			return lyrs.empty() ? data().size() : lyrs.size() * lsize;
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		double operator[](size_t i) const {
+			return (*buf)[offset(i)];
+		}
+
+		// a pointer to cell i. The cells of a layer are contiguous
+		const double* ptr(size_t i) const {
+			if (!buf) return nullptr;
+			return buf->data() + offset(i);
+		}
+
+		// true if x uses the same values (copies share them)
+		bool shares(const SpatValues &x) const {
+			return buf && (buf == x.buf);
+		}
+
+		// append cells start to end (end not included) to v
+		void copy(std::vector<double> &v, size_t start, size_t end) const {
+			if (end <= start) return;
+			const std::vector<double> &d = data();
+			if (lyrs.empty()) {
+				v.insert(v.end(), d.begin()+start, d.begin()+end);
+				return;
+			}
+			v.reserve(v.size() + end - start);
+			while (start < end) {
+				size_t lyr = start / lsize;
+				size_t cell = start % lsize;
+				size_t n = std::min(lsize - cell, end - start);
+				size_t off = lyrs[lyr] * lsize + cell;
+				v.insert(v.end(), d.begin()+off, d.begin()+off+n);
+				start += n;
+			}
+		}
+
+		void copy(std::vector<double> &v) const {
+			copy(v, 0, size());
+		}
+
+		// a view on some layers (of n cells each)
+		SpatValues subset(const std::vector<unsigned> &layers, size_t n) const {
+			SpatValues out;
+			if ((n == 0) || layers.empty()) {
+				return out;
+			}
+			out.buf = buf;
+			out.lsize = n;
+			size_t nb = data().size() / n;
+			out.lyrs.reserve(layers.size());
+			for (size_t i=0; i<layers.size(); i++) {
+				out.lyrs.push_back(lyrs.empty() ? layers[i] : lyrs[layers[i]]);
+			}
+			out.whole(nb);
+			return out;
+		}
+
+		// append the layers of x (of n cells each). Without copying values if x
+		// is a view on the same buffer
+		void append(const SpatValues &x, size_t n) {
+			if (x.empty()) return;
+			if (empty()) {
+				*this = x;
+				return;
+			}
+			if (shares(x) && (n > 0)) {
+				size_t nb = data().size() / n;
+				std::vector<size_t> a = layer_list(nb);
+				std::vector<size_t> b = x.layer_list(nb);
+				a.insert(a.end(), b.begin(), b.end());
+				lyrs = a;
+				lsize = n;
+				whole(nb);
+				return;
+			}
+			std::vector<double> &v = edit();
+			x.copy(v);
+		}
+
+		// the values, for changing them. These are first copied if they are
+		// shared or if this is a view
+		std::vector<double>& edit() {
+			if (!buf) {
+				buf = std::make_shared<std::vector<double>>();
+			} else if (!lyrs.empty()) {
+				std::vector<double> v;
+				copy(v);
+				buf = std::make_shared<std::vector<double>>(std::move(v));
+				lyrs.clear();
+			} else if (buf.use_count() > 1) {
+				buf = std::make_shared<std::vector<double>>(*buf);
+			}
+			return *buf;
+		}
+
+		void clear() {
+			buf.reset();
+			lyrs.clear();
+		}
+
+	private:
+
+		std::vector<size_t> layer_list(size_t nb) const {
+			if (!lyrs.empty()) return lyrs;
+			std::vector<size_t> out(nb);
+			for (size_t i=0; i<nb; i++) out[i] = i;
+			return out;
+		}
+
+		// a view on all layers of buf, in order, is not a view
+		void whole(size_t nb) {
+			if (lyrs.size() != nb) return;
+			for (size_t i=0; i<nb; i++) {
+				if (lyrs[i] != i) return;
+			}
+			lyrs.clear();
+		}
+};
+
+#endif
@@ -0,0 +1,978 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "mmap.h"
+#include "NA.h"
+#include "file_utils.h"
+#include "string_utils.h"
+#include "math_utils.h"
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <map>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+// in sample.cpp
+void getSampleRowCol(std::vector<size_t> &oldrow, std::vector<size_t> &oldcol, size_t nrows, size_t ncols, size_t snrow, size_t sncol);
+
+
+SpatMMap::~SpatMMap() {
+	close();
+}
+
+
+#ifdef _WIN32
+
+bool SpatMMap::open(std::string filename, size_t size, bool write, std::string &msg) {
+	close();
+	DWORD access = write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+	DWORD create = (size > 0) ? CREATE_ALWAYS : OPEN_EXISTING;
+	HANDLE hf = CreateFileA(filename.c_str(), access, FILE_SHARE_READ, NULL, create, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hf == INVALID_HANDLE_VALUE) {
+		msg = "cannot open file: " + filename;
+		return false;
+	}
+	if (size == 0) {
+		LARGE_INTEGER fs;
+		if (!GetFileSizeEx(hf, &fs)) {
+			CloseHandle(hf);
+			msg = "cannot get the size of file: " + filename;
+			return false;
+		}
+		size = fs.QuadPart;
+	}
+	DWORD hi = (DWORD) ((unsigned long long) size >> 32);
+	DWORD lo = (DWORD) ((unsigned long long) size & 0xFFFFFFFF);
+	HANDLE hm = CreateFileMappingA(hf, NULL, write ? PAGE_READWRITE : PAGE_READONLY, hi, lo, NULL);
+	if (hm == NULL) {
+		CloseHandle(hf);
+		msg = "cannot map file: " + filename;
+		return false;
+	}
+	void *p = MapViewOfFile(hm, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if (p == NULL) {
+		CloseHandle(hm);
+		CloseHandle(hf);
+		msg = "cannot map file: " + filename;
+		return false;
+	}
+	hfile = hf;
+	hmap = hm;
+	addr = (char*) p;
+	len = size;
+	writable = write;
+	return true;
+}
+
+bool SpatMMap::sync() {
+	if ((addr == NULL) || (!writable)) return true;
+	return FlushViewOfFile(addr, 0) && FlushFileBuffers((HANDLE) hfile);
+}
+
+void SpatMMap::close() {
+	if (addr != NULL) {
+		sync();
+		UnmapViewOfFile(addr);
+		CloseHandle((HANDLE) hmap);
+		CloseHandle((HANDLE) hfile);
+	}
+	addr = NULL;
+	hfile = NULL;
+	hmap = NULL;
+	len = 0;
+}
+
+#else
+
+bool SpatMMap::open(std::string filename, size_t size, bool write, std::string &msg) {
+	close();
+	int fd;
+	if (size > 0) {
+		fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	} else {
+		fd = ::open(filename.c_str(), write ? O_RDWR : O_RDONLY);
+	}
+	if (fd < 0) {
+		msg = "cannot open file: " + filename;
+		return false;
+	}
+	if (size > 0) {
+		if (ftruncate(fd, size) != 0) {
+			::close(fd);
+			msg = "cannot create file (insufficient disk space?): " + filename;
+			return false;
+		}
+	} else {
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			msg = "cannot get the size of file: " + filename;
+			return false;
+		}
+		size = st.st_size;
+	}
+	void *p = mmap(NULL, size, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	// the map remains valid after closing the file descriptor
+	::close(fd);
+	if (p == MAP_FAILED) {
+		msg = "cannot map file: " + filename;
+		return false;
+	}
+	addr = (char*) p;
+	len = size;
+	writable = write;
+	return true;
+}
+
+bool SpatMMap::sync() {
+	if ((addr == NULL) || (!writable)) return true;
+	return msync(addr, len, MS_SYNC) == 0;
+}
+
+void SpatMMap::close() {
+	if (addr != NULL) {
+		sync();
+		munmap(addr, len);
+	}
+	addr = NULL;
+	len = 0;
+}
+
+#endif
+
+
+size_t mmap_type_size(const std::string &datatype) {
+	if (datatype == "INT1U") return 1;
+	if ((datatype == "INT2S") || (datatype == "INT2U")) return 2;
+	if ((datatype == "INT4S") || (datatype == "FLT4S")) return 4;
+	if (datatype == "FLT8S") return 8;
+	return 0;
+}
+
+static const std::string mmap_magic = "{\"format\": \"terra-mmap\"";
+
+bool is_mmap_file(const std::string &filename) {
+	std::ifstream f(filename, std::ios::binary);
+	if (!f) return false;
+	std::string s(mmap_magic.size(), ' ');
+	f.read(&s[0], s.size());
+	return f && (s == mmap_magic);
+}
+
+
+// a minimal JSON reader and writer for the header
+
+class JsonValue {
+	public:
+		// 0: null, 1: number, 2: string, 3: array, 4: object, 5: boolean
+		int type = 0;
+		double num = NAN;
+		std::string str;
+		std::vector<JsonValue> arr;
+		std::vector<std::pair<std::string, JsonValue>> obj;
+
+		const JsonValue* get(const std::string &key) const {
+			for (size_t i=0; i<obj.size(); i++) {
+				if (obj[i].first == key) return &obj[i].second;
+			}
+			return NULL;
+		}
+};
+
+
+static void json_space(const char* &p, const char* end) {
+	while ((p < end) && ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t'))) p++;
+}
+
+static bool json_string(const char* &p, const char* end, std::string &s) {
+	if ((p >= end) || (*p != '"')) return false;
+	p++;
+	s.clear();
+	while (p < end) {
+		char c = *p++;
+		if (c == '"') return true;
+		if (c == '\\') {
+			if (p >= end) return false;
+			c = *p++;
+			switch (c) {
+				case 'n': s.push_back('\n'); break;
+				case 't': s.push_back('\t'); break;
+				case 'r': s.push_back('\r'); break;
+				case 'b': s.push_back('\b'); break;
+				case 'f': s.push_back('\f'); break;
+				case 'u': {
+					if ((end - p) < 4) return false;
+					unsigned code = std::stoul(std::string(p, 4), NULL, 16);
+					p += 4;
+					// UTF-8 (surrogate pairs are not combined)
+					if (code < 0x80) {
+						s.push_back(code);
+					} else if (code < 0x800) {
+						s.push_back(0xC0 | (code >> 6));
+						s.push_back(0x80 | (code & 0x3F));
+					} else {
+						s.push_back(0xE0 | (code >> 12));
+						s.push_back(0x80 | ((code >> 6) & 0x3F));
+						s.push_back(0x80 | (code & 0x3F));
+					}
+					break;
+				}
+				default: s.push_back(c);
+			}
+		} else {
+			s.push_back(c);
+		}
+	}
+	return false;
+}
+
+static bool json_parse(const char* &p, const char* end, JsonValue &v) {
+	json_space(p, end);
+	if (p >= end) return false;
+	if (*p == '{') {
+		v.type = 4;
+		p++;
+		json_space(p, end);
+		if ((p < end) && (*p == '}')) { p++; return true; }
+		while (p < end) {
+			std::string key;
+			json_space(p, end);
+			if (!json_string(p, end, key)) return false;
+			json_space(p, end);
+			if ((p >= end) || (*p != ':')) return false;
+			p++;
+			JsonValue x;
+			if (!json_parse(p, end, x)) return false;
+			v.obj.push_back(std::make_pair(key, x));
+			json_space(p, end);
+			if (p >= end) return false;
+			if (*p == ',') { p++; continue; }
+			if (*p == '}') { p++; return true; }
+			return false;
+		}
+		return false;
+	} else if (*p == '[') {
+		v.type = 3;
+		p++;
+		json_space(p, end);
+		if ((p < end) && (*p == ']')) { p++; return true; }
+		while (p < end) {
+			JsonValue x;
+			if (!json_parse(p, end, x)) return false;
+			v.arr.push_back(x);
+			json_space(p, end);
+			if (p >= end) return false;
+			if (*p == ',') { p++; continue; }
+			if (*p == ']') { p++; return true; }
+			return false;
+		}
+		return false;
+	} else if (*p == '"') {
+		v.type = 2;
+		return json_string(p, end, v.str);
+	} else if ((end - p >= 4) && (strncmp(p, "null", 4) == 0)) {
+		p += 4;
+		return true;
+	} else if ((end - p >= 4) && (strncmp(p, "true", 4) == 0)) {
+		v.type = 5; v.num = 1; p += 4;
+		return true;
+	} else if ((end - p >= 5) && (strncmp(p, "false", 5) == 0)) {
+		v.type = 5; v.num = 0; p += 5;
+		return true;
+	}
+	std::string s;
+	while ((p < end) && (strchr("+-0123456789.eE", *p) != NULL)) s.push_back(*p++);
+	if (s.empty()) return false;
+	v.type = 1;
+	v.num = std::strtod(s.c_str(), NULL);
+	return true;
+}
+
+static std::string json_quote(const std::string &s) {
+	std::string out = "\"";
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"') out += "\\\"";
+		else if (c == '\\') out += "\\\\";
+		else if (c == '\n') out += "\\n";
+		else if (c == '\r') out += "\\r";
+		else if (c == '\t') out += "\\t";
+		else if (c < 0x20) {
+			char b[8];
+			snprintf(b, 8, "\\u%04x", c);
+			out += b;
+		} else out.push_back(c);
+	}
+	return out + "\"";
+}
+
+static std::string json_number(double d) {
+	if (!std::isfinite(d)) return "null";
+	char b[32];
+	snprintf(b, 32, "%.17g", d);
+	return b;
+}
+
+static std::string json_numbers(const std::vector<double> &v) {
+	std::string s = "[";
+	for (size_t i=0; i<v.size(); i++) {
+		if (i > 0) s += ", ";
+		s += json_number(v[i]);
+	}
+	return s + "]";
+}
+
+
+// the header of source s, without padding. If "wide" is true, the ranges
+// are replaced by the longest possible numbers (to reserve space for them)
+static std::string mmap_header(SpatRasterSource &s, size_t offset, bool wide) {
+	std::string h = mmap_magic + ", \"version\": 1, \"offset\": " + std::to_string(offset);
+	h += ", \"byteorder\": \"little\"";
+	h += ", \"nrow\": " + std::to_string(s.nrow) + ", \"ncol\": " + std::to_string(s.ncol);
+	h += ", \"nlyr\": " + std::to_string(s.nlyr) + ", \"datatype\": " + json_quote(s.datatype);
+	h += ",\n \"extent\": " + json_numbers({s.extent.xmin, s.extent.xmax, s.extent.ymin, s.extent.ymax});
+	h += ",\n \"crs\": {\"wkt\": " + json_quote(s.srs.wkt) + ", \"proj4\": " + json_quote(s.srs.proj4) + "}";
+	h += ",\n \"names\": [";
+	for (size_t i=0; i<s.names.size(); i++) {
+		if (i > 0) h += ", ";
+		h += json_quote(s.names[i]);
+	}
+	h += "]";
+	std::vector<double> mn = s.range_min;
+	std::vector<double> mx = s.range_max;
+	for (size_t i=0; i<s.nlyr; i++) {
+		if (wide || !s.hasRange[i]) {
+			mn[i] = wide ? -1.2345678901234567e+300 : NAN;
+			mx[i] = mn[i];
+		}
+	}
+	h += ",\n \"range_min\": " + json_numbers(mn) + ",\n \"range_max\": " + json_numbers(mx) + "}";
+	return h;
+}
+
+
+static size_t file_size(const std::string &filename) {
+	std::ifstream f(filename, std::ios::binary | std::ios::ate);
+	if (!f) return 0;
+	return f.tellg();
+}
+
+
+static bool is_little_endian() {
+	uint16_t x = 1;
+	return *((uint8_t*) &x) == 1;
+}
+
+
+bool SpatRaster::constructFromMMap(std::string fname) {
+
+	std::ifstream f(fname, std::ios::binary);
+	if (!f) {
+		setError("cannot open file: " + fname);
+		return false;
+	}
+	std::string h(4096, ' ');
+	f.read(&h[0], h.size());
+	h.resize(f.gcount());
+	size_t pos = h.find("\"offset\":");
+	if ((h.compare(0, mmap_magic.size(), mmap_magic) != 0) || (pos == std::string::npos)) {
+		setError("not a valid MMAP file: " + fname);
+		return false;
+	}
+	size_t offset = std::strtoul(h.c_str() + pos + 9, NULL, 10);
+	if (offset > h.size()) {
+		h.resize(offset, ' ');
+		f.seekg(0);
+		f.read(&h[0], offset);
+	}
+	f.close();
+
+	JsonValue j;
+	const char *p = h.c_str();
+	if (!json_parse(p, p + h.size(), j) || (j.type != 4)) {
+		setError("cannot read the header of " + fname);
+		return false;
+	}
+	const JsonValue *bo = j.get("byteorder");
+	if ((bo == NULL) || ((bo->str == "little") != is_little_endian())) {
+		setError("the byte order of " + fname + " is not supported");
+		return false;
+	}
+	const JsonValue *nr = j.get("nrow");
+	const JsonValue *nc = j.get("ncol");
+	const JsonValue *nl = j.get("nlyr");
+	const JsonValue *dt = j.get("datatype");
+	const JsonValue *ex = j.get("extent");
+	if ((nr == NULL) || (nc == NULL) || (nl == NULL) || (dt == NULL) || (ex == NULL) || (ex->arr.size() != 4)) {
+		setError("incomplete header in " + fname);
+		return false;
+	}
+
+	SpatRasterSource s;
+	s.nrow = nr->num;
+	s.ncol = nc->num;
+	s.nlyr = nl->num;
+	s.nlyrfile = s.nlyr;
+	s.resize(s.nlyr);
+	s.extent = SpatExtent(ex->arr[0].num, ex->arr[1].num, ex->arr[2].num, ex->arr[3].num);
+	s.datatype = dt->str;
+	size_t tsize = mmap_type_size(s.datatype);
+	if (tsize == 0) {
+		setError("unsupported datatype in " + fname + ": " + s.datatype);
+		return false;
+	}
+	const JsonValue *crs = j.get("crs");
+	if ((crs != NULL) && (crs->type == 4)) {
+		const JsonValue *w = crs->get("wkt");
+		const JsonValue *p4 = crs->get("proj4");
+		if (w != NULL) s.srs.wkt = w->str;
+		if (p4 != NULL) s.srs.proj4 = p4->str;
+	}
+	const JsonValue *nms = j.get("names");
+	if ((nms != NULL) && (nms->arr.size() == s.nlyr)) {
+		for (size_t i=0; i<s.nlyr; i++) s.names[i] = nms->arr[i].str;
+	} else {
+		std::string bn = basename_noext(fname);
+		for (size_t i=0; i<s.nlyr; i++) s.names[i] = bn + "_" + std::to_string(i+1);
+	}
+	const JsonValue *rmn = j.get("range_min");
+	const JsonValue *rmx = j.get("range_max");
+	if ((rmn != NULL) && (rmx != NULL) && (rmn->arr.size() == s.nlyr) && (rmx->arr.size() == s.nlyr)) {
+		for (size_t i=0; i<s.nlyr; i++) {
+			s.hasRange[i] = (rmn->arr[i].type == 1) && (rmx->arr[i].type == 1);
+			s.range_min[i] = rmn->arr[i].num;
+			s.range_max[i] = rmx->arr[i].num;
+		}
+	}
+	bool isint = s.datatype.substr(0, 3) == "INT";
+	for (size_t i=0; i<s.nlyr; i++) {
+		s.valueType[i] = isint ? 1 : 0;
+	}
+	if (s.datatype == "INT1U") s.fileNAflag = NA<uint8_t>::value;
+	else if (s.datatype == "INT2S") s.fileNAflag = NA<int16_t>::value;
+	else if (s.datatype == "INT2U") s.fileNAflag = NA<uint16_t>::value;
+	else if (s.datatype == "INT4S") s.fileNAflag = NA<int32_t>::value;
+
+	if (file_size(fname) < (offset + tsize * s.nrow * s.ncol * s.nlyr)) {
+		setError("file is too small (truncated?): " + fname);
+		return false;
+	}
+	s.mmapoffset = offset;
+	s.memory = false;
+	s.hasValues = true;
+	s.filename = fname;
+	s.driver = "mmap";
+	setSource(s);
+	return true;
+}
+
+
+bool SpatRaster::readStartMMap(size_t src) {
+	SpatRasterSource &s = source[src];
+	if (!s.mmap) {
+		std::string msg;
+		std::shared_ptr<SpatMMap> m = std::make_shared<SpatMMap>();
+		if (!m->open(s.filename, 0, false, msg)) {
+			setError(msg);
+			return false;
+		}
+		s.mmap = m;
+	}
+	s.open_read = true;
+	return true;
+}
+
+
+// the first value of layer "lyr" (a layer in the file) of a MMAP source
+static const char* mmap_layer(SpatRasterSource &s, size_t lyr) {
+	size_t nr = s.hasWindow ? s.window.full_nrow : s.nrow;
+	size_t nc = s.hasWindow ? s.window.full_ncol : s.ncol;
+	return s.mmap->data() + s.mmapoffset + lyr * nr * nc * mmap_type_size(s.datatype);
+}
+
+
+template <typename T>
+static void mmap_rows(const char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, std::vector<double> &out) {
+	const T* p = (const T*) base;
+	T na = NA<T>::value;
+	for (size_t r=row; r<(row+nrows); r++) {
+		const T* q = p + r * nc + col;
+		for (size_t c=0; c<ncols; c++) {
+			out.push_back(q[c] == na ? NAN : (double) q[c]);
+		}
+	}
+}
+
+template <>
+void mmap_rows<float>(const char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, std::vector<double> &out) {
+	const float* p = (const float*) base;
+	for (size_t r=row; r<(row+nrows); r++) {
+		const float* q = p + r * nc + col;
+		out.insert(out.end(), q, q + ncols);
+	}
+}
+
+template <>
+void mmap_rows<double>(const char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, std::vector<double> &out) {
+	const double* p = (const double*) base;
+	if (ncols == nc) {
+		// a single copy from the map
+		out.insert(out.end(), p + row * nc, p + (row + nrows) * nc);
+		return;
+	}
+	for (size_t r=row; r<(row+nrows); r++) {
+		const double* q = p + r * nc + col;
+		out.insert(out.end(), q, q + ncols);
+	}
+}
+
+
+// user set NA flag and scale/offset of a layer, for the values from "start"
+static void mmap_adjust(SpatRasterSource &s, size_t lyr, std::vector<double> &v, size_t start) {
+	if (s.hasNAflag) {
+		std::replace(v.begin()+start, v.end(), s.NAflag, (double)NAN);
+	}
+	if (s.has_scale_offset[lyr]) {
+		for (size_t i=start; i<v.size(); i++) {
+			v[i] = v[i] * s.scale[lyr] + s.offset[lyr];
+		}
+	}
+}
+
+
+void SpatRaster::readChunkMMap(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+
+	SpatRasterSource &s = source[src];
+	if (!s.mmap) {
+		if (!readStartMMap(src)) return;
+	}
+	size_t nc = s.ncol;
+	if (s.hasWindow) {
+		row += s.window.off_row;
+		col += s.window.off_col;
+		nc = s.window.full_ncol;
+	}
+	out.reserve(out.size() + nrows * ncols * s.layers.size());
+	for (size_t i=0; i<s.layers.size(); i++) {
+		size_t start = out.size();
+		const char *base = mmap_layer(s, s.layers[i]);
+		if (s.datatype == "FLT8S") {
+			mmap_rows<double>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "FLT4S") {
+			mmap_rows<float>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "INT4S") {
+			mmap_rows<int32_t>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "INT2S") {
+			mmap_rows<int16_t>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "INT2U") {
+			mmap_rows<uint16_t>(base, nc, row, nrows, col, ncols, out);
+		} else {
+			mmap_rows<uint8_t>(base, nc, row, nrows, col, ncols, out);
+		}
+		mmap_adjust(s, i, out, start);
+	}
+}
+
+
+template <typename F, typename T>
+static void mmap_rows_typed(const char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, std::vector<T> &out) {
+	const F* p = (const F*) base;
+	F fna = NA<F>::value;
+	T tna = NA<T>::value;
+	for (size_t r=row; r<(row+nrows); r++) {
+		const F* q = p + r * nc + col;
+		for (size_t c=0; c<ncols; c++) {
+			out.push_back(q[c] == fna ? tna : (T) q[c]);
+		}
+	}
+}
+
+
+template <typename T>
+void SpatRaster::readChunkMMapTyped(std::vector<T> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols) {
+
+	SpatRasterSource &s = source[src];
+	if (!s.mmap) {
+		if (!readStartMMap(src)) return;
+	}
+	size_t nc = s.ncol;
+	if (s.hasWindow) {
+		row += s.window.off_row;
+		col += s.window.off_col;
+		nc = s.window.full_ncol;
+	}
+	for (size_t i=0; i<s.layers.size(); i++) {
+		size_t start = out.size();
+		const char *base = mmap_layer(s, s.layers[i]);
+		if (s.datatype == "INT4S") {
+			mmap_rows_typed<int32_t, T>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "INT2S") {
+			mmap_rows_typed<int16_t, T>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "INT2U") {
+			mmap_rows_typed<uint16_t, T>(base, nc, row, nrows, col, ncols, out);
+		} else if (s.datatype == "INT1U") {
+			mmap_rows_typed<uint8_t, T>(base, nc, row, nrows, col, ncols, out);
+		} else {
+			setError("not an integer file");
+			return;
+		}
+		if (s.hasNAflag) {
+			std::replace(out.begin()+start, out.end(), (T) s.NAflag, NA<T>::value);
+		}
+	}
+}
+
+template void SpatRaster::readChunkMMapTyped(std::vector<uint8_t> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readChunkMMapTyped(std::vector<int16_t> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readChunkMMapTyped(std::vector<uint16_t> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readChunkMMapTyped(std::vector<int32_t> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+
+
+const double* SpatRaster::mmapView(size_t src, size_t lyr) {
+	SpatRasterSource &s = source[src];
+	if ((s.driver != "mmap") || (s.datatype != "FLT8S") || s.hasWindow || s.hasNAflag || s.has_scale_offset[lyr]) {
+		return NULL;
+	}
+	if (!s.mmap) {
+		if (!readStartMMap(src)) return NULL;
+	}
+	return (const double*) mmap_layer(s, s.layers[lyr]);
+}
+
+
+template <typename T>
+static void mmap_cells(const char *base, const std::vector<size_t> &cells, const std::vector<size_t> &idx, std::vector<double> &out) {
+	const T* p = (const T*) base;
+	T na = NA<T>::value;
+	bool isflt = std::is_floating_point<T>::value;
+	for (size_t i=0; i<idx.size(); i++) {
+		T v = p[cells[i]];
+		out[idx[i]] = ((!isflt) && (v == na)) ? NAN : (double) v;
+	}
+}
+
+
+// cells (in the file) are read directly from the map; out has one vector of size n for each layer
+void SpatRaster::readCellsMMap(std::vector<std::vector<double>> &out, size_t src, const std::vector<size_t> &cells, const std::vector<size_t> &idx, size_t n) {
+
+	SpatRasterSource &s = source[src];
+	out.resize(s.layers.size());
+	if (!s.mmap) {
+		if (!readStartMMap(src)) return;
+	}
+	for (size_t i=0; i<s.layers.size(); i++) {
+		out[i].resize(0);
+		out[i].resize(n, NAN);
+		const char *base = mmap_layer(s, s.layers[i]);
+		if (s.datatype == "FLT8S") {
+			mmap_cells<double>(base, cells, idx, out[i]);
+		} else if (s.datatype == "FLT4S") {
+			mmap_cells<float>(base, cells, idx, out[i]);
+		} else if (s.datatype == "INT4S") {
+			mmap_cells<int32_t>(base, cells, idx, out[i]);
+		} else if (s.datatype == "INT2S") {
+			mmap_cells<int16_t>(base, cells, idx, out[i]);
+		} else if (s.datatype == "INT2U") {
+			mmap_cells<uint16_t>(base, cells, idx, out[i]);
+		} else {
+			mmap_cells<uint8_t>(base, cells, idx, out[i]);
+		}
+		mmap_adjust(s, i, out[i], 0);
+	}
+}
+
+
+std::vector<std::vector<double>> SpatRaster::readRowColMMap(size_t src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
+
+	SpatRasterSource &s = source[src];
+	int_64 nr = nrow();
+	int_64 nc = ncol();
+	size_t fnc = s.hasWindow ? s.window.full_ncol : s.ncol;
+	size_t offr = s.hasWindow ? s.window.off_row : 0;
+	size_t offc = s.hasWindow ? s.window.off_col : 0;
+	std::vector<size_t> cells, idx;
+	cells.reserve(rows.size());
+	idx.reserve(rows.size());
+	for (size_t i=0; i<rows.size(); i++) {
+		if ((rows[i] >= 0) && (rows[i] < nr) && (cols[i] >= 0) && (cols[i] < nc)) {
+			cells.push_back((rows[i] + offr) * fnc + cols[i] + offc);
+			idx.push_back(i);
+		}
+	}
+	std::vector<std::vector<double>> out;
+	readCellsMMap(out, src, cells, idx, rows.size());
+	return out;
+}
+
+
+std::vector<double> SpatRaster::readSampleMMap(size_t src, size_t srows, size_t scols) {
+
+	SpatRasterSource &s = source[src];
+	std::vector<size_t> oldcol, oldrow;
+	getSampleRowCol(oldrow, oldcol, nrow(), ncol(), srows, scols);
+	size_t fnc = s.hasWindow ? s.window.full_ncol : s.ncol;
+	size_t offr = s.hasWindow ? s.window.off_row : 0;
+	size_t offc = s.hasWindow ? s.window.off_col : 0;
+	std::vector<size_t> cells, idx;
+	cells.reserve(srows * scols);
+	for (size_t r=0; r<srows; r++) {
+		for (size_t c=0; c<scols; c++) {
+			cells.push_back((oldrow[r] + offr) * fnc + oldcol[c] + offc);
+		}
+	}
+	idx.resize(cells.size());
+	std::iota(idx.begin(), idx.end(), 0);
+	std::vector<std::vector<double>> v;
+	readCellsMMap(v, src, cells, idx, cells.size());
+	std::vector<double> out;
+	out.reserve(cells.size() * v.size());
+	for (size_t i=0; i<v.size(); i++) {
+		out.insert(out.end(), v[i].begin(), v[i].end());
+	}
+	return out;
+}
+
+
+bool SpatRaster::writeStartMMap(SpatOptions &opt) {
+
+	std::string filename = opt.get_filename();
+	if (filename == "") {
+		setError("empty filename");
+		return false;
+	}
+	// make sure filename won't be used again
+	opt.set_filenames({""});
+
+	if (file_exists(filename) && (!opt.get_overwrite())) {
+		setError("file exists. You can use 'overwrite=TRUE' to overwrite it");
+		return false;
+	}
+	std::string datatype = opt.get_datatype();
+	size_t tsize = mmap_type_size(datatype);
+	if (tsize == 0) {
+		setError("invalid datatype for a MMAP file: " + datatype);
+		return false;
+	}
+
+	SpatRasterSource &s = source[0];
+	s.resize(nlyr());
+	s.nlyrfile = nlyr();
+	s.datatype = datatype;
+	for (size_t i=0; i<nlyr(); i++) {
+		s.hasRange[i] = false;
+		s.range_min[i] = NAN;
+		s.range_max[i] = NAN;
+	}
+	// room for the header with the value ranges
+	size_t offset = mmap_header(s, 0, true).size() + 32;
+	offset = ((offset / 4096) + 1) * 4096;
+	size_t size = offset + tsize * ncell() * nlyr();
+
+	// readers of an existing file keep their (unlinked) copy
+	remove(filename.c_str());
+	std::shared_ptr<SpatMMap> m = std::make_shared<SpatMMap>();
+	std::string msg;
+	if (!m->open(filename, size, true, msg)) {
+		setError(msg);
+		return false;
+	}
+	std::string h = mmap_header(s, offset, false);
+	h.resize(offset - 1, ' ');
+	h += "\n";
+	memcpy(m->data(), h.data(), offset);
+
+	s.mmap = m;
+	s.mmapoffset = offset;
+	s.driver = "mmap";
+	s.filename = filename;
+	s.memory = false;
+	if (datatype == "INT1U") s.fileNAflag = NA<uint8_t>::value;
+	else if (datatype == "INT2S") s.fileNAflag = NA<int16_t>::value;
+	else if (datatype == "INT2U") s.fileNAflag = NA<uint16_t>::value;
+	else if (datatype == "INT4S") s.fileNAflag = NA<int32_t>::value;
+	else s.fileNAflag = NAN;
+	return true;
+}
+
+
+template <typename T>
+static void mmap_write_rows(char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, const double *v) {
+	T* p = (T*) base;
+	T na = NA<T>::value;
+	double lo = std::numeric_limits<T>::lowest();
+	double hi = std::numeric_limits<T>::max();
+	for (size_t r=0; r<nrows; r++) {
+		T* q = p + (row + r) * nc + col;
+		const double *w = v + r * ncols;
+		for (size_t c=0; c<ncols; c++) {
+			double d = w[c];
+			if (std::isnan(d)) {
+				q[c] = na;
+			} else {
+				d = std::round(d);
+				q[c] = (T) (d < lo ? lo : (d > hi ? hi : d));
+			}
+		}
+	}
+}
+
+template <>
+void mmap_write_rows<float>(char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, const double *v) {
+	float* p = (float*) base;
+	for (size_t r=0; r<nrows; r++) {
+		float* q = p + (row + r) * nc + col;
+		const double *w = v + r * ncols;
+		for (size_t c=0; c<ncols; c++) q[c] = w[c];
+	}
+}
+
+template <>
+void mmap_write_rows<double>(char *base, size_t nc, size_t row, size_t nrows, size_t col, size_t ncols, const double *v) {
+	double* p = (double*) base;
+	for (size_t r=0; r<nrows; r++) {
+		memcpy(p + (row + r) * nc + col, v + r * ncols, ncols * sizeof(double));
+	}
+}
+
+
+bool SpatRaster::writeValuesMMap(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
+
+	SpatRasterSource &s = source[0];
+	size_t n = nrows * ncols;
+	if (vals.size() != (n * nlyr())) {
+		setError("incorrect number of values");
+		return false;
+	}
+	bool isint = s.datatype.substr(0, 3) == "INT";
+	for (size_t i=0; i<nlyr(); i++) {
+		char *base = (char*) mmap_layer(s, i);
+		const double *v = vals.data() + i * n;
+		if (s.datatype == "FLT8S") {
+			mmap_write_rows<double>(base, s.ncol, startrow, nrows, startcol, ncols, v);
+		} else if (s.datatype == "FLT4S") {
+			mmap_write_rows<float>(base, s.ncol, startrow, nrows, startcol, ncols, v);
+		} else if (s.datatype == "INT4S") {
+			mmap_write_rows<int32_t>(base, s.ncol, startrow, nrows, startcol, ncols, v);
+		} else if (s.datatype == "INT2S") {
+			mmap_write_rows<int16_t>(base, s.ncol, startrow, nrows, startcol, ncols, v);
+		} else if (s.datatype == "INT2U") {
+			mmap_write_rows<uint16_t>(base, s.ncol, startrow, nrows, startcol, ncols, v);
+		} else {
+			mmap_write_rows<uint8_t>(base, s.ncol, startrow, nrows, startcol, ncols, v);
+		}
+		double mn, mx;
+		minmax(vals.begin() + i * n, vals.begin() + (i+1) * n, mn, mx);
+		if (isint) {
+			mn = std::round(mn);
+			mx = std::round(mx);
+		}
+		if (!std::isnan(mn)) {
+			if (s.hasRange[i]) {
+				s.range_min[i] = std::min(s.range_min[i], mn);
+				s.range_max[i] = std::max(s.range_max[i], mx);
+			} else {
+				s.range_min[i] = mn;
+				s.range_max[i] = mx;
+				s.hasRange[i] = true;
+			}
+		}
+	}
+	return true;
+}
+
+
+bool SpatRaster::writeStopMMap() {
+	SpatRasterSource &s = source[0];
+	size_t offset = s.mmapoffset;
+	std::string h = mmap_header(s, offset, false);
+	h.resize(offset - 1, ' ');
+	h += "\n";
+	memcpy(s.mmap->data(), h.data(), offset);
+	bool ok = s.mmap->sync();
+	// values are read from a new (read-only) map
+	s.mmap = nullptr;
+	s.hasValues = true;
+	if (!ok) {
+		setError("cannot write file: " + s.filename);
+	}
+	return ok;
+}
+
+
+std::string SpatRaster::mmapVRT(size_t src) {
+	SpatRasterSource &s = source[src];
+	std::map<std::string, std::string> types = {{"INT1U", "Byte"}, {"INT2S", "Int16"}, {"INT2U", "UInt16"}, {"INT4S", "Int32"}, {"FLT4S", "Float32"}, {"FLT8S", "Float64"}};
+	size_t tsize = mmap_type_size(s.datatype);
+	size_t nr = s.hasWindow ? s.window.full_nrow : s.nrow;
+	size_t nc = s.hasWindow ? s.window.full_ncol : s.ncol;
+	size_t offset = s.mmapoffset;
+
+	SpatExtent e = s.extent;
+	double xres = (e.xmax - e.xmin) / s.ncol;
+	double yres = (e.ymax - e.ymin) / s.nrow;
+	double xmin = e.xmin;
+	double ymax = e.ymax;
+	if (s.hasWindow) {
+		xmin -= s.window.off_col * xres;
+		ymax += s.window.off_row * yres;
+	}
+	std::ostringstream x;
+	x.precision(17);
+	x << "<VRTDataset rasterXSize=\"" << nc << "\" rasterYSize=\"" << nr << "\">";
+	std::string wkt = s.srs.wkt;
+	if (wkt != "") {
+		std::string esc;
+		for (size_t i=0; i<wkt.size(); i++) {
+			if (wkt[i] == '&') esc += "&amp;";
+			else if (wkt[i] == '<') esc += "&lt;";
+			else if (wkt[i] == '>') esc += "&gt;";
+			else if (wkt[i] == '"') esc += "&quot;";
+			else esc.push_back(wkt[i]);
+		}
+		x << "<SRS>" << esc << "</SRS>";
+	}
+	x << "<GeoTransform>" << xmin << ", " << xres << ", 0, " << ymax << ", 0, " << -yres << "</GeoTransform>";
+	// all layers in the file, as for GDAL sources
+	for (size_t i=0; i<s.nlyrfile; i++) {
+		size_t off = offset + i * nr * nc * tsize;
+		x << "<VRTRasterBand dataType=\"" << types[s.datatype] << "\" band=\"" << i+1 << "\" subClass=\"VRTRawRasterBand\">";
+		x << "<SourceFilename relativetoVRT=\"0\">" << s.filename << "</SourceFilename>";
+		x << "<ImageOffset>" << off << "</ImageOffset><PixelOffset>" << tsize << "</PixelOffset>";
+		x << "<LineOffset>" << nc * tsize << "</LineOffset><ByteOrder>LSB</ByteOrder>";
+		if (!std::isnan(s.fileNAflag)) {
+			x << "<NoDataValue>" << s.fileNAflag << "</NoDataValue>";
+		} else {
+			x << "<NoDataValue>nan</NoDataValue>";
+		}
+		x << "</VRTRasterBand>";
+	}
+	x << "</VRTDataset>";
+	return x.str();
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATMMAP_GUARD
+#define SPATMMAP_GUARD
+
+#include <string>
+#include <cstddef>
+
+// The "MMAP" raster file format: a JSON header, padded with spaces to a
+// multiple of 4096 bytes, followed by the cell values of each layer (band
+// sequential, rows from top to bottom), uncompressed, in the native
+// (little-endian) byte order. Datatypes are those of writeRaster (INT1U,
+// INT2S, INT2U, INT4S, FLT4S, FLT8S); NA is stored as NA<T>::value for the
+// integer types and as NaN for the floating point types. For example
+//
+// {"format": "terra-mmap", "version": 1, "offset": 4096, "byteorder": "little",
+//  "nrow": 10, "ncol": 20, "nlyr": 1, "datatype": "FLT8S",
+//  "extent": [0, 20, 0, 10], "crs": {"wkt": "", "proj4": ""},
+//  "names": ["lyr1"], "range_min": [1], "range_max": [200]}
+//
+// A file is read through a memory map of the whole file, which is shared by
+// all copies of the source, and remains open as long as it is used. The
+// operating system caches the pages, such that re-reading a file does not
+// copy its values again.
+
+class SpatMMap {
+	public:
+		SpatMMap(){}
+		virtual ~SpatMMap();
+
+		// open an existing file (size=0) or create a new file of "size" bytes
+		bool open(std::string filename, size_t size, bool write, std::string &msg);
+		void close();
+		// flush the pages of a writable map to the file
+		bool sync();
+
+		char* data() { return addr; }
+		size_t size() { return len; }
+
+	private:
+		char* addr = NULL;
+		size_t len = 0;
+		bool writable = false;
+#ifdef _WIN32
+		void* hfile = NULL;
+		void* hmap = NULL;
+#endif
+};
+
+// the size of a cell value, or zero for an unsupported datatype
+size_t mmap_type_size(const std::string &datatype);
+// is this a file in the MMAP format?
+bool is_mmap_file(const std::string &filename);
+
+#endif
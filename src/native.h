@@ -0,0 +1,147 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef NATIVE_GUARD
+#define NATIVE_GUARD
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <limits>
+#include <cmath>
+#include "NA.h"
+#include "valuetable.h"
+
+// Helpers for values read with SpatRaster::readValuesTyped.
+// Types of 8 or 16 bits use a dense table with one element for each
+// possible value; other types use a hash table
+
+
+// a value of type double as type T; false if it cannot be represented
+template <typename T>
+bool as_native(const double &d, T &v) {
+	if (std::isnan(d) || (d != std::trunc(d))) return false;
+	if ((d < std::numeric_limits<T>::lowest()) || (d > std::numeric_limits<T>::max())) return false;
+	v = d;
+	return v != NA<T>::value;
+}
+
+
+// the number of cells for each value
+template <typename T>
+class NativeTable {
+	public:
+		NativeTable() {
+			if (dense_type) dense.resize(1 << (8 * sizeof(T)), 0);
+		}
+
+		void add(const T *v, size_t n) {
+			T na = NA<T>::value;
+			if (dense_type) {
+				for (size_t i=0; i<n; i++) {
+					if (v[i] != na) dense[index(v[i])]++;
+				}
+			} else {
+				for (size_t i=0; i<n; i++) {
+					if (v[i] != na) hash.add(v[i], 1);
+				}
+			}
+		}
+
+		void add_to(ValueTable &x) {
+			if (dense_type) {
+				for (size_t i=0; i<dense.size(); i++) {
+					if (dense[i] > 0) x.add(value(i), dense[i]);
+				}
+			} else {
+				x.merge(hash);
+			}
+		}
+
+		// the values that occur, sorted
+		std::vector<double> values() {
+			ValueTable x;
+			add_to(x);
+			std::vector<double> out, n;
+			x.get(out, n);
+			return out;
+		}
+
+	private:
+		static constexpr bool dense_type = sizeof(T) <= 2;
+		std::vector<unsigned long long int> dense;
+		ValueTable hash;
+		inline size_t index(const T &v) { return (size_t)((long)v - (long)std::numeric_limits<T>::lowest()); }
+		inline double value(const size_t &i) { return (double)((long)i + (long)std::numeric_limits<T>::lowest()); }
+};
+
+
+// a value (or NAN) for each value of type T. Values that were not set
+// return "other"
+template <typename T>
+class NativeLookup {
+	public:
+		NativeLookup(double _other) {
+			other = _other;
+			if (dense_type) {
+				dense.resize(1 << (8 * sizeof(T)), other);
+				isset.resize(dense.size(), false);
+			}
+		}
+
+		void set(const T &v, double x) {
+			if (dense_type) {
+				dense[index(v)] = x;
+				isset[index(v)] = true;
+			} else {
+				hash[v] = x;
+			}
+		}
+
+		inline double get(const T &v) {
+			if (dense_type) {
+				return dense[index(v)];
+			}
+			typename std::unordered_map<T, double>::const_iterator it = hash.find(v);
+			return it == hash.end() ? other : it->second;
+		}
+
+		// false if the value was not set
+		inline bool find(const T &v, double &x) {
+			if (dense_type) {
+				size_t i = index(v);
+				if (!isset[i]) return false;
+				x = dense[i];
+				return true;
+			}
+			typename std::unordered_map<T, double>::const_iterator it = hash.find(v);
+			if (it == hash.end()) return false;
+			x = it->second;
+			return true;
+		}
+
+	private:
+		static constexpr bool dense_type = sizeof(T) <= 2;
+		double other;
+		std::vector<double> dense;
+		std::vector<bool> isset;
+		std::unordered_map<T, double> hash;
+		inline size_t index(const T &v) { return (size_t)((long)v - (long)std::numeric_limits<T>::lowest()); }
+};
+
+
+#endif
@@ -0,0 +1,511 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "distance.h"
+#include "geodesic.h"
+#include "file_utils.h"
+#include "native.h"
+#include <cmath>
+#include <limits>
+
+// Connected component labelling (patches, clumps). Each block of rows is
+// labelled by a worker thread with a union-find of its own. The collector
+// (on the calling thread, in block order) gives these labels a global
+// offset and joins the labels of the cells on both sides of the border
+// with the previous block. The global labels are then resolved to patch
+// numbers, that are consecutive and in the order of the first cell of
+// each patch, and the cells are relabelled in a second pass.
+
+
+inline size_t uf_find(std::vector<size_t> &p, size_t i) {
+	while (p[i] != i) {
+		p[i] = p[p[i]];
+		i = p[i];
+	}
+	return i;
+}
+
+// the root is the lowest label, which is the label of the first cell
+inline void uf_union(std::vector<size_t> &p, size_t a, size_t b) {
+	a = uf_find(p, a);
+	b = uf_find(p, b);
+	if (a < b) {
+		p[b] = a;
+	} else if (b < a) {
+		p[a] = b;
+	}
+}
+
+
+class PatchStats {
+	public:
+		double ncells = 0;
+		double area = 0;
+		double perimeter = 0;
+		size_t rmin = std::numeric_limits<size_t>::max(), rmax = 0;
+		size_t cmin = std::numeric_limits<size_t>::max(), cmax = 0;
+
+		void add(size_t row, size_t col, double a) {
+			ncells++;
+			area += a;
+			rmin = std::min(rmin, row);
+			rmax = std::max(rmax, row);
+			cmin = std::min(cmin, col);
+			cmax = std::max(cmax, col);
+		}
+
+		void merge(const PatchStats &x) {
+			ncells += x.ncells;
+			area += x.area;
+			perimeter += x.perimeter;
+			rmin = std::min(rmin, x.rmin);
+			rmax = std::max(rmax, x.rmax);
+			cmin = std::min(cmin, x.cmin);
+			cmax = std::max(cmax, x.cmax);
+		}
+};
+
+
+// the size of the cells of each row, in m (planar: in map units if the unit is not known)
+// hedge[r] is the length of the top edge of the cells in row r (hedge[nr] that of the
+// bottom edge of the last row), vedge[r] the length of their sides
+void patch_cell_sizes(SpatRaster &x, std::vector<double> &hedge, std::vector<double> &vedge, std::vector<double> &area) {
+	size_t nr = x.nrow();
+	double xr = x.xres();
+	double yr = x.yres();
+	if (x.is_lonlat()) {
+		struct geod_geodesic g;
+		geod_init(&g, 6378137, 1 / 298.257223563);
+		double ymax = x.getExtent().ymax;
+		hedge.resize(nr+1);
+		vedge.resize(nr);
+		area.resize(nr);
+		for (size_t r=0; r<=nr; r++) {
+			double lat = ymax - r * yr;
+			hedge[r] = distance_lonlat(0, lat, xr, lat);
+		}
+		for (size_t r=0; r<nr; r++) {
+			double top = ymax - r * yr;
+			double bottom = top - yr;
+			vedge[r] = distance_lonlat(0, top, 0, bottom);
+			double lats[4] = {top, top, bottom, bottom};
+			double lons[4] = {0, xr, xr, 0};
+			double a, p;
+			geod_polygonarea(&g, lats, lons, 4, &a, &p);
+			area[r] = std::fabs(a);
+		}
+	} else {
+		double m = x.source[0].srs.to_meter();
+		m = std::isnan(m) ? 1 : m;
+		hedge.resize(nr+1, xr * m);
+		vedge.resize(nr, yr * m);
+		area.resize(nr, xr * yr * m * m);
+	}
+}
+
+
+class PatchLabeller {
+	public:
+		size_t nr, nc;
+		bool d8, global, dostats;
+		std::vector<double> hedge, vedge, area;
+		// global union-find and, if dostats, the statistics of each label. 0 is not used
+		std::vector<size_t> parent = {0};
+		std::vector<PatchStats> stats = {PatchStats()};
+		// the global labels of the last row of the previous block (0 for NA)
+		std::vector<size_t> prev;
+
+		PatchLabeller(SpatRaster &x, int directions, bool _dostats) {
+			nr = x.nrow();
+			nc = x.ncol();
+			d8 = directions == 8;
+			global = x.is_global_lonlat() && (nc > 1);
+			dostats = _dostats;
+			if (dostats) patch_cell_sizes(x, hedge, vedge, area);
+		}
+
+		// label the cells of a block that starts at "row". v has NAN for cells that
+		// are not in a patch. It gets the label of each cell (1 to n), and the
+		// number of labels is returned
+		size_t label(std::vector<double> &v, size_t row, std::vector<PatchStats> &st) {
+			size_t n = v.size();
+			size_t bnr = n / nc;
+			std::vector<size_t> lab(n, 0);
+			std::vector<size_t> p = {0};
+			for (size_t r=0; r<bnr; r++) {
+				size_t start = r * nc;
+				for (size_t c=0; c<nc; c++) {
+					size_t k = start + c;
+					if (std::isnan(v[k])) continue;
+					size_t l = 0;
+					auto link = [&](size_t j) {
+						size_t lj = lab[j];
+						if (lj == 0) return;
+						if (l == 0) {
+							l = lj;
+						} else {
+							uf_union(p, l, lj);
+						}
+					};
+					if (c > 0) link(k-1);
+					if (r > 0) {
+						link(k-nc);
+						if (d8) {
+							if (c > 0) link(k-nc-1);
+							if (c < (nc-1)) link(k-nc+1);
+						}
+					}
+					if (global && (c == (nc-1))) {
+						link(start);
+						if (d8 && (r > 0)) link(start-nc);
+					} else if (global && d8 && (c == 0) && (r > 0)) {
+						link(start-1);
+					}
+					if (l == 0) {
+						l = p.size();
+						p.push_back(l);
+					}
+					lab[k] = l;
+				}
+			}
+
+			// consecutive labels in order of the first cell
+			std::vector<size_t> comp(p.size(), 0);
+			size_t nlab = 0;
+			for (size_t l=1; l<p.size(); l++) {
+				size_t root = uf_find(p, l);
+				comp[l] = (root == l) ? ++nlab : comp[root];
+			}
+			for (size_t k=0; k<n; k++) {
+				lab[k] = comp[lab[k]];
+			}
+
+			if (dostats) {
+				st.resize(nlab + 1);
+				for (size_t r=0; r<bnr; r++) {
+					size_t rr = row + r;
+					size_t start = r * nc;
+					for (size_t c=0; c<nc; c++) {
+						size_t k = start + c;
+						size_t l = lab[k];
+						if (l == 0) continue;
+						PatchStats &s = st[l];
+						s.add(rr, c, area[rr]);
+						// the edges with the previous and next block are done by the collector
+						if ((r > 0) && (lab[k-nc] == 0)) s.perimeter += hedge[rr];
+						if ((r == 0) && (rr == 0)) s.perimeter += hedge[rr];
+						if ((r < (bnr-1)) && (lab[k+nc] == 0)) s.perimeter += hedge[rr+1];
+						if ((r == (bnr-1)) && (rr == (nr-1))) s.perimeter += hedge[rr+1];
+						if (c > 0) {
+							if (lab[k-1] == 0) s.perimeter += vedge[rr];
+						} else if (!global || (lab[start+nc-1] == 0)) {
+							s.perimeter += vedge[rr];
+						}
+						if (c < (nc-1)) {
+							if (lab[k+1] == 0) s.perimeter += vedge[rr];
+						} else if (!global || (lab[start] == 0)) {
+							s.perimeter += vedge[rr];
+						}
+					}
+				}
+			}
+			for (size_t k=0; k<n; k++) {
+				v[k] = lab[k] == 0 ? NAN : lab[k];
+			}
+			return nlab;
+		}
+
+		// add the labels of a block, and join them with those of the previous block.
+		// The values of v become the global labels
+		void collect(std::vector<double> &v, size_t row, size_t nlab, std::vector<PatchStats> &st) {
+			size_t off = parent.size() - 1;
+			parent.resize(parent.size() + nlab);
+			for (size_t l=off+1; l<parent.size(); l++) {
+				parent[l] = l;
+			}
+			if (dostats) {
+				stats.insert(stats.end(), st.begin() + 1, st.end());
+			}
+			for (size_t k=0; k<v.size(); k++) {
+				if (!std::isnan(v[k])) v[k] += off;
+			}
+			if (!prev.empty()) {
+				for (size_t c=0; c<nc; c++) {
+					size_t cur = std::isnan(v[c]) ? 0 : v[c];
+					size_t up = prev[c];
+					if (cur == 0) {
+						if (dostats && (up > 0)) stats[up].perimeter += hedge[row];
+						continue;
+					}
+					if (up > 0) {
+						uf_union(parent, cur, up);
+					} else if (dostats) {
+						stats[cur].perimeter += hedge[row];
+					}
+					if (d8) {
+						size_t left = c > 0 ? prev[c-1] : (global ? prev[nc-1] : 0);
+						size_t right = c < (nc-1) ? prev[c+1] : (global ? prev[0] : 0);
+						if (left > 0) uf_union(parent, cur, left);
+						if (right > 0) uf_union(parent, cur, right);
+					}
+				}
+			}
+			prev.resize(nc);
+			size_t last = v.size() - nc;
+			for (size_t c=0; c<nc; c++) {
+				prev[c] = std::isnan(v[last+c]) ? 0 : v[last+c];
+			}
+		}
+
+		// the patch number of each label, and the number of patches.
+		// If dostats, the statistics of the labels are merged into those of the patches
+		size_t resolve(std::vector<double> &id) {
+			id.resize(parent.size());
+			id[0] = NAN;
+			size_t np = 0;
+			for (size_t l=1; l<parent.size(); l++) {
+				size_t root = uf_find(parent, l);
+				if (root == l) {
+					id[l] = ++np;
+				} else {
+					id[l] = id[root];
+					if (dostats) stats[root].merge(stats[l]);
+				}
+			}
+			return np;
+		}
+};
+
+
+// labels of the first layer in "out" (with a label for each cell), or only the statistics
+bool patch_labels(SpatRaster &x, PatchLabeller &pl, bool zeroAsNA, SpatRaster *out, SpatOptions &opt) {
+
+	if (!x.readStart()) {
+		return false;
+	}
+	BlockSize bs;
+	if (out != NULL) {
+		if (!out->writeStart(opt)) {
+			x.readStop();
+			return false;
+		}
+		bs = out->bs;
+	} else {
+		bs = x.getBlockSize(opt);
+	}
+	size_t nc = x.ncol();
+	// only NA or not matters; integer cells are read in their native type
+	bool xint = x.getNativeIntType() != "";
+	std::vector<std::vector<int32_t>> xi(bs.n);
+	std::vector<std::vector<PatchStats>> st(bs.n);
+	std::vector<size_t> nlab(bs.n);
+
+	bool ok = x.processBlocks(bs.n,
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			v.resize(1);
+			if (xint) {
+				x.readValuesTyped(xi[i], bs.row[i], bs.nrows[i], 0, nc);
+			} else {
+				x.readValues(v[0], bs.row[i], bs.nrows[i], 0, nc);
+			}
+			return !x.hasError();
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			if (xint) {
+				std::vector<int32_t> &m = xi[i];
+				int32_t na = NA<int32_t>::value;
+				v[0].resize(m.size());
+				for (size_t j=0; j<m.size(); j++) {
+					v[0][j] = ((m[j] == na) || (zeroAsNA && (m[j] == 0))) ? NAN : 1;
+				}
+				std::vector<int32_t>().swap(m);
+			} else if (zeroAsNA) {
+				std::replace(v[0].begin(), v[0].end(), 0.0, (double)NAN);
+			}
+			nlab[i] = pl.label(v[0], bs.row[i], st[i]);
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			pl.collect(v[0], bs.row[i], nlab[i], st[i]);
+			std::vector<PatchStats>().swap(st[i]);
+			if (out != NULL) {
+				return out->writeBlock(v[0], i);
+			}
+			return true;
+		}, opt);
+
+	x.readStop();
+	if (out != NULL) {
+		out->writeStop();
+	}
+	if (!ok && (out != NULL) && !out->hasError()) {
+		out->setError(x.getError());
+	}
+	return ok;
+}
+
+
+SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
+
+	SpatRaster out = geometry(1);
+
+	if (nlyr() > 1) {
+		SpatOptions ops(opt);
+		std::vector<std::string> nms = getNames();
+		if (ops.names.size() == nms.size()) {
+			nms = opt.names;
+		}
+		for (size_t i=0; i<nlyr(); i++) {
+			std::vector<unsigned> lyr = {(unsigned)i};
+			ops.names = {nms[i]};
+			SpatRaster x = subset(lyr, ops);
+			x = x.clumps(directions, zeroAsNA, ops);
+			out.addSource(x, false, ops);
+		}
+		if (opt.get_filename() != "") {
+			out = out.writeRaster(opt);
+		}
+		return out;
+	}
+
+	if (!(directions == 4 || directions == 8)) {
+		out.setError("directions must be 4 or 8");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("cannot compute clumps for a raster with no values");
+		return out;
+	}
+
+	std::string filename = opt.get_filename();
+	if (filename != "") {
+		bool overwrite = opt.get_overwrite();
+		std::string errmsg;
+		if (!can_write(filename, overwrite, errmsg)) {
+			out.setError(errmsg + " (" + filename +")");
+			return(out);
+		}
+	}
+	if (opt.names.size() == 0) {
+		opt.names = {"patches"};
+	}
+
+	// the global labels; in double precision to represent more than 2^24 labels
+	SpatOptions topt(opt);
+	topt.set_filenames({""});
+	topt.set_datatype("FLT8S");
+	SpatRaster tmp = geometry(1);
+	PatchLabeller pl(*this, directions, false);
+	if (!patch_labels(*this, pl, zeroAsNA, &tmp, topt)) {
+		out.setError(tmp.hasError() ? tmp.getError() : getError());
+		return out;
+	}
+	std::vector<double> id;
+	size_t np = pl.resolve(id);
+	if ((!opt.datatype_set) && (np > 16777216)) {
+		opt.set_datatype(np < 2147483647 ? "INT4S" : "FLT8S");
+	}
+
+	if (np == (id.size() - 1)) {
+		// no labels were joined
+		if (filename == "") return tmp;
+		return tmp.writeRaster(opt);
+	}
+
+	if (!tmp.readStart()) {
+		out.setError(tmp.getError());
+		return(out);
+	}
+ 	if (!out.writeStart(opt)) {
+		tmp.readStop();
+		return out;
+	}
+	size_t nc = ncol();
+	BlockReader reader = [&](std::vector<std::vector<double>> &v, size_t i) {
+		v.resize(1);
+		tmp.readValues(v[0], out.bs.row[i], out.bs.nrows[i], 0, nc);
+		if (tmp.hasError()) {
+			out.setError(tmp.getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [&](std::vector<std::vector<double>> &v, size_t i) {
+		for (double &d : v[0]) {
+			if (!std::isnan(d)) d = id[(size_t)d];
+		}
+	};
+	bool ok = out.writeBlocks(reader, worker, opt);
+	tmp.readStop();
+	if (!ok) return out;
+	out.writeStop();
+	return out;
+}
+
+
+SpatDataFrame SpatRaster::patch_stats(int directions, bool zeroAsNA, SpatOptions &opt) {
+
+	SpatDataFrame out;
+	if (!(directions == 4 || directions == 8)) {
+		out.setError("directions must be 4 or 8");
+		return out;
+	}
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	SpatRaster x = *this;
+	if (nlyr() > 1) {
+		std::vector<unsigned> lyr = {0};
+		x = subset(lyr, opt);
+	}
+	PatchLabeller pl(x, directions, true);
+	if (!patch_labels(x, pl, zeroAsNA, NULL, opt)) {
+		out.setError(x.getError());
+		return out;
+	}
+	std::vector<double> id;
+	size_t np = pl.resolve(id);
+
+	std::vector<double> patch(np), ncells(np), area(np), perimeter(np);
+	std::vector<double> xmin(np), xmax(np), ymin(np), ymax(np);
+	SpatExtent e = getExtent();
+	double xr = xres();
+	double yr = yres();
+	for (size_t l=1; l<id.size(); l++) {
+		if (uf_find(pl.parent, l) != l) continue;
+		size_t j = id[l] - 1;
+		PatchStats &s = pl.stats[l];
+		patch[j] = j + 1;
+		ncells[j] = s.ncells;
+		area[j] = s.area;
+		perimeter[j] = s.perimeter;
+		xmin[j] = e.xmin + s.cmin * xr;
+		xmax[j] = e.xmin + (s.cmax + 1) * xr;
+		ymax[j] = e.ymax - s.rmin * yr;
+		ymin[j] = e.ymax - (s.rmax + 1) * yr;
+	}
+	out.add_column(patch, "patch");
+	out.add_column(ncells, "ncells");
+	out.add_column(area, "area");
+	out.add_column(perimeter, "perimeter");
+	out.add_column(xmin, "xmin");
+	out.add_column(xmax, "xmax");
+	out.add_column(ymin, "ymin");
+	out.add_column(ymax, "ymax");
+	return out;
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRasterMultiple.h"
+#include "pyramid.h"
+
+
+// all levels are written while the source is read once, from top to bottom
+SpatRasterCollection SpatRaster::pyramid(std::vector<unsigned> fact, std::string method, SpatOptions &opt) {
+
+	SpatRasterCollection out;
+	if (!hasValues()) {
+		out.setError("raster has no values");
+		return out;
+	}
+	int m;
+	if (!pyramid_method(method, m)) {
+		out.setError("unknown method: " + method);
+		return out;
+	}
+	for (size_t i=0; i<fact.size(); i++) {
+		if (pyramid_level(fact[i]) == 0) {
+			out.setError("factors must be powers of two (2, 4, 8, ...)");
+			return out;
+		}
+	}
+	SpatPyramid pyr;
+	std::vector<size_t> sfact(fact.begin(), fact.end());
+	if (!pyr.init(nrow(), ncol(), nlyr(), sfact, method)) {
+		out.setError("no factors");
+		return out;
+	}
+	size_t n = pyr.factors.size();
+
+	std::vector<std::string> fnames = opt.get_filenames();
+	if ((fnames.size() == 1) && (fnames[0] == "")) {
+		fnames.resize(n, "");
+	} else if (fnames.size() != n) {
+		out.setError("provide one filename for each level");
+		return out;
+	}
+
+	SpatExtent e = getExtent();
+	bool cats = ((method == "mode") || (method == "nearest"));
+	std::vector<SpatRaster> levels(n);
+	for (size_t i=0; i<n; i++) {
+		double f = pyr.factors[i];
+		double xmax = e.xmin + pyr.ncol(i) * f * xres();
+		double ymin = e.ymax - pyr.nrow(i) * f * yres();
+		levels[i] = SpatRaster(pyr.nrow(i), pyr.ncol(i), nlyr(), SpatExtent(e.xmin, xmax, ymin, e.ymax), "");
+		levels[i].source[0].srs = source[0].srs;
+		levels[i].setNames(getNames());
+		if (cats) {
+			levels[i].source[0].hasColors = hasColors();
+			levels[i].source[0].cols = getColors();
+			levels[i].source[0].hasCategories = hasCategories();
+			levels[i].source[0].cats = getCategories();
+		}
+		SpatOptions lopt(opt);
+		lopt.set_filenames({fnames[i]});
+		lopt.progressbar = false;
+		if (!levels[i].writeStart(lopt)) {
+			out.setError(levels[i].getError());
+			for (size_t j=0; j<i; j++) levels[j].writeStop();
+			return out;
+		}
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		for (size_t j=0; j<n; j++) levels[j].writeStop();
+		return out;
+	}
+	BlockSize bs = getBlockSize(opt);
+	std::vector<double> v, lv;
+	for (size_t i=0; i<bs.n; i++) {
+		readBlock(v, bs, i);
+		pyr.add(v, bs.nrows[i]);
+		if (i == (bs.n - 1)) {
+			pyr.finish();
+		}
+		for (size_t j=0; j<n; j++) {
+			size_t row, nrows;
+			if (pyr.take(j, lv, row, nrows)) {
+				if (!levels[j].writeValues(lv, row, nrows)) {
+					out.setError(levels[j].getError());
+					readStop();
+					return out;
+				}
+			}
+		}
+	}
+	readStop();
+	for (size_t j=0; j<n; j++) {
+		levels[j].writeStop();
+		out.push_back(levels[j]);
+	}
+	return out;
+}
+
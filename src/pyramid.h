@@ -0,0 +1,269 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PYRAMID_GUARD
+#define PYRAMID_GUARD
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+// Builds all levels of an overview pyramid (factors 2, 4, 8, ...) in a single
+// pass over the rows of a raster. Each level combines 2x2 cells of the level
+// below it, and gets a row each time the level below has two new rows, so that
+// only one pending row is kept for each level. For "mean" the number of cells
+// that are not NA is carried along, so that the mean is that of all cells of
+// the source, not a mean of means. Level sizes are ceil(n/f), as for GDAL overviews
+
+enum PyramidMethod {PYR_MEAN, PYR_MIN, PYR_MAX, PYR_NEAREST, PYR_MODE};
+
+inline bool pyramid_method(std::string method, int &m) {
+	std::vector<std::string> f {"mean", "min", "max", "nearest", "mode"};
+	auto it = std::find(f.begin(), f.end(), method);
+	if (it == f.end()) return false;
+	m = std::distance(f.begin(), it);
+	return true;
+}
+
+// the corresponding resampling method of GDALDataset::BuildOverviews
+inline std::string pyramid_gdal_method(std::string method) {
+	if (method == "mean") return "AVERAGE";
+	if (method == "nearest") return "NEAREST";
+	if (method == "min") return "MIN";
+	if (method == "max") return "MAX";
+	return "MODE";
+}
+
+// the level (1 for 2, 2 for 4, ...) of a factor, or 0 if it is not a power of two
+inline size_t pyramid_level(size_t f) {
+	if ((f < 2) || (f & (f - 1))) return 0;
+	size_t k = 0;
+	while (f > 1) {
+		f >>= 1;
+		k++;
+	}
+	return k;
+}
+
+
+class SpatPyramid {
+
+	struct Level {
+		size_t nr, nc;
+		bool keep = false;
+		// the pending (even) row of the level below, and its cell counts
+		std::vector<double> pv, pn;
+		bool pending = false;
+		// rows ready to be taken (for each row, nl rows of nc values)
+		std::vector<double> out;
+		size_t outrow = 0;
+		size_t nout = 0;
+	};
+
+	int method = PYR_MEAN;
+	size_t nl = 0;
+	std::vector<Level> levels; // levels[0] is the source
+
+	template <int M>
+	void combine(const std::vector<double> &a, const std::vector<double> &an, const double *b, const double *bn, size_t ncp, size_t nc, std::vector<double> &v, std::vector<double> &n) {
+		double x[4], w[4];
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			size_t offp = lyr * ncp;
+			size_t off = lyr * nc;
+			for (size_t c=0; c<nc; c++) {
+				size_t c0 = offp + 2 * c;
+				bool two = (2 * c + 1) < ncp;
+				size_t k = 0;
+				x[k] = a[c0]; if (M == PYR_MEAN) w[k] = an[c0]; k++;
+				if (two) { x[k] = a[c0+1]; if (M == PYR_MEAN) w[k] = an[c0+1]; k++; }
+				if (b != nullptr) {
+					x[k] = b[c0]; if (M == PYR_MEAN) w[k] = bn[c0]; k++;
+					if (two) { x[k] = b[c0+1]; if (M == PYR_MEAN) w[k] = bn[c0+1]; k++; }
+				}
+				double r = NAN;
+				if (M == PYR_MEAN) {
+					double s = 0, cnt = 0;
+					for (size_t j=0; j<k; j++) {
+						if (std::isnan(x[j])) continue;
+						s += x[j] * w[j];
+						cnt += w[j];
+					}
+					if (cnt > 0) r = s / cnt;
+					n[off+c] = cnt;
+				} else if (M == PYR_MIN) {
+					for (size_t j=0; j<k; j++) {
+						if (std::isnan(x[j])) continue;
+						if (std::isnan(r) || (x[j] < r)) r = x[j];
+					}
+				} else if (M == PYR_MAX) {
+					for (size_t j=0; j<k; j++) {
+						if (std::isnan(x[j])) continue;
+						if (std::isnan(r) || (x[j] > r)) r = x[j];
+					}
+				} else if (M == PYR_NEAREST) {
+					r = x[0];
+				} else {
+					// ties go to the value that comes first
+					size_t best = 0;
+					for (size_t j=0; j<k; j++) {
+						if (std::isnan(x[j])) continue;
+						size_t m = 0;
+						for (size_t i=j; i<k; i++) {
+							m += x[i] == x[j];
+						}
+						if (m > best) {
+							best = m;
+							r = x[j];
+						}
+					}
+				}
+				v[off+c] = r;
+			}
+		}
+	}
+
+	// combine the pending row of level k with b (the second row, or nullptr)
+	void combine_rows(size_t k, const double *b, const double *bn, std::vector<double> &v, std::vector<double> &n) {
+		size_t ncp = levels[k-1].nc;
+		size_t nc = levels[k].nc;
+		Level &lv = levels[k];
+		v.resize(nl * nc);
+		if (method == PYR_MEAN) n.resize(nl * nc);
+		switch (method) {
+			case PYR_MEAN: combine<PYR_MEAN>(lv.pv, lv.pn, b, bn, ncp, nc, v, n); break;
+			case PYR_MIN: combine<PYR_MIN>(lv.pv, lv.pn, b, bn, ncp, nc, v, n); break;
+			case PYR_MAX: combine<PYR_MAX>(lv.pv, lv.pn, b, bn, ncp, nc, v, n); break;
+			case PYR_NEAREST: combine<PYR_NEAREST>(lv.pv, lv.pn, b, bn, ncp, nc, v, n); break;
+			default: combine<PYR_MODE>(lv.pv, lv.pn, b, bn, ncp, nc, v, n);
+		}
+	}
+
+	void emit(size_t k, std::vector<double> &v, std::vector<double> &n) {
+		Level &lv = levels[k];
+		if (lv.keep) {
+			lv.out.insert(lv.out.end(), v.begin(), v.end());
+			lv.nout++;
+		}
+		if ((k+1) < levels.size()) {
+			push(k+1, v, n);
+		}
+	}
+
+	// a row of level k-1 for level k
+	void push(size_t k, std::vector<double> &v, std::vector<double> &n) {
+		Level &lv = levels[k];
+		if (!lv.pending) {
+			lv.pv.swap(v);
+			lv.pn.swap(n);
+			lv.pending = true;
+			return;
+		}
+		std::vector<double> rv, rn;
+		combine_rows(k, v.data(), n.data(), rv, rn);
+		lv.pending = false;
+		emit(k, rv, rn);
+	}
+
+	public:
+
+		std::vector<size_t> factors;
+
+		// nr, nc, nl are the dimensions of the source. The factors must be powers of two
+		bool init(size_t nrows, size_t ncols, size_t nlyrs, std::vector<size_t> fact, std::string fun) {
+			if (!pyramid_method(fun, method)) return false;
+			std::sort(fact.begin(), fact.end());
+			fact.erase(std::unique(fact.begin(), fact.end()), fact.end());
+			if (fact.empty()) return false;
+			for (size_t i=0; i<fact.size(); i++) {
+				if (pyramid_level(fact[i]) == 0) return false;
+			}
+			factors = fact;
+			nl = nlyrs;
+			size_t n = pyramid_level(factors.back()) + 1;
+			levels.resize(n);
+			levels[0].nr = nrows;
+			levels[0].nc = ncols;
+			for (size_t k=1; k<n; k++) {
+				levels[k].nr = (levels[k-1].nr + 1) / 2;
+				levels[k].nc = (levels[k-1].nc + 1) / 2;
+			}
+			for (size_t i=0; i<factors.size(); i++) {
+				levels[pyramid_level(factors[i])].keep = true;
+			}
+			return true;
+		}
+
+		size_t nrow(size_t i) { return levels[pyramid_level(factors[i])].nr; }
+		size_t ncol(size_t i) { return levels[pyramid_level(factors[i])].nc; }
+
+		// nrows full rows of the source, with all layers (as returned by readValues)
+		void add(const std::vector<double> &v, size_t nrows) {
+			if (levels.size() < 2) return;
+			size_t nc = levels[0].nc;
+			size_t lyrsize = nrows * nc;
+			for (size_t r=0; r<nrows; r++) {
+				std::vector<double> rv(nl * nc), rn;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					std::copy(v.begin() + lyr*lyrsize + r*nc, v.begin() + lyr*lyrsize + (r+1)*nc, rv.begin() + lyr*nc);
+				}
+				if (method == PYR_MEAN) {
+					rn.resize(rv.size());
+					for (size_t j=0; j<rv.size(); j++) {
+						rn[j] = std::isnan(rv[j]) ? 0 : 1;
+					}
+				}
+				push(1, rv, rn);
+			}
+		}
+
+		// a last odd row is combined on its own
+		void finish() {
+			for (size_t k=1; k<levels.size(); k++) {
+				if (levels[k].pending) {
+					std::vector<double> rv, rn;
+					combine_rows(k, nullptr, nullptr, rv, rn);
+					levels[k].pending = false;
+					emit(k, rv, rn);
+				}
+			}
+		}
+
+		// the rows of factors[i] that are ready, with all layers (as used by writeValues)
+		bool take(size_t i, std::vector<double> &v, size_t &row, size_t &nrows) {
+			Level &lv = levels[pyramid_level(factors[i])];
+			if (lv.nout == 0) return false;
+			size_t nc = lv.nc;
+			nrows = lv.nout;
+			row = lv.outrow;
+			v.resize(lv.out.size());
+			size_t lyrsize = nrows * nc;
+			for (size_t r=0; r<nrows; r++) {
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					size_t from = (r * nl + lyr) * nc;
+					std::copy(lv.out.begin() + from, lv.out.begin() + from + nc, v.begin() + lyr*lyrsize + r*nc);
+				}
+			}
+			lv.outrow += nrows;
+			lv.nout = 0;
+			lv.out.clear();
+			return true;
+		}
+
+};
+
+#endif
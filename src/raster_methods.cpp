@@ -24,6 +24,8 @@
 #include "math_utils.h"
 #include "file_utils.h"
 #include "string_utils.h"
+#include "native.h"
+#include "kernels.h"
 
 
 /*
@@ -111,6 +113,12 @@ SpatExtent SpatRaster::ext_from_cell(double cell) {
 	return ext_from_rc(rc[0][0], rc[0][0], rc[1][0], rc[1][0]); 
 }
 
+// The source is read once, in bands of rows, and the values of each band are
+// written to all tiles that intersect it. A tile is opened when it gets its
+// first values (if narm, its first values that are not all NA) and closed after
+// its last row, such that only the tiles in one row of tiles are open at the
+// same time. If there are many columns of tiles, the source is processed in
+// strips of at most "maxopen" columns of tiles.
 std::vector<std::string> SpatRaster::make_tiles(SpatRaster x, bool expand, bool narm, std::string filename, SpatOptions &opt) {
 
 	std::vector<std::string> ff;
@@ -124,36 +132,140 @@ std::vector<std::string> SpatRaster::make_tiles(SpatRaster x, bool expand, bool
 		x = x.extend(e, "out", opt);
 	}
 	x = x.crop(e, "out", opt);
-	
-	std::vector<size_t> d(x.ncell());
-	std::iota(d.begin(), d.end(), 1);
 
 	std::string fext = getFileExt(filename);
 	std::string f = noext(filename);
-	ff.reserve(d.size());
 	size_t nl = nlyr();
-	for (size_t i=0; i<d.size(); i++) {
-		std::string fout = f + std::to_string(d[i]) + fext;
-		SpatExtent exi = x.ext_from_cell(i); 
-		opt.set_filenames({fout});
-		SpatRaster out = crop(exi, "near", opt);
-		if (out.hasError()) {
-			setError(out.getError());
+	size_t ntr = x.nrow();
+	size_t ntc = x.ncol();
+	size_t n = ntr * ntc;
+
+	// the geometry of each tile (as for crop with snap="near"), and its rows and columns in this raster
+	std::vector<SpatRaster> tiles(n);
+	std::vector<size_t> row1(n), col1(n);
+	double xr = xres();
+	double yr = yres();
+	for (size_t i=0; i<n; i++) {
+		SpatExtent exi = x.ext_from_cell(i).intersect(e);
+		if (!exi.valid()) {
+			setError("extents do not overlap");
 			return ff;
 		}
-		if ( out.hasValues() ) {
-			if (narm) {
-				std::vector<double> rmin = out.range_min();
-				size_t cnt = 0;
-				for (double &v : rmin) {
-					if (std::isnan(v)) cnt++;
-				}
-				if (cnt == nl) {
-					remove(fout.c_str());
-					continue;
+		tiles[i] = geometry(nl, true, true, true);
+		tiles[i].setExtent(exi, true, "near");
+		SpatExtent te = tiles[i].getExtent();
+		col1[i] = colFromX(te.xmin + 0.5 * xr);
+		row1[i] = rowFromY(te.ymax - 0.5 * yr);
+	}
+
+	// 0: not opened yet, 1: open, 2: done (written, or skipped)
+	std::vector<int> status(n, 0);
+	std::vector<bool> written(n, false);
+	auto closeall = [&]() {
+		for (size_t i=0; i<n; i++) {
+			if (status[i] == 1) tiles[i].writeStop();
+		}
+	};
+
+	if (!readStart()) {
+		return ff;
+	}
+	size_t maxopen = 128;
+	BlockSize bs = getBlockSize(opt);
+	std::vector<double> v, tv;
+	for (size_t tc0=0; tc0<ntc; tc0+=maxopen) {
+		size_t tc1 = std::min(ntc, tc0 + maxopen);
+		// the columns of this strip
+		size_t sc1 = ncol(), sc2 = 0;
+		for (size_t r=0; r<ntr; r++) {
+			for (size_t c=tc0; c<tc1; c++) {
+				size_t i = r * ntc + c;
+				sc1 = std::min(sc1, col1[i]);
+				sc2 = std::max(sc2, col1[i] + tiles[i].ncol());
+			}
+		}
+		size_t snc = sc2 - sc1;
+		for (size_t b=0; b<bs.n; b++) {
+			size_t brow = bs.row[b];
+			size_t bnr = bs.nrows[b];
+			readValues(v, brow, bnr, sc1, snc);
+			if (hasError()) {
+				closeall();
+				readStop();
+				return ff;
+			}
+			for (size_t r=0; r<ntr; r++) {
+				for (size_t c=tc0; c<tc1; c++) {
+					size_t i = r * ntc + c;
+					if (status[i] == 2) continue;
+					size_t tnr = tiles[i].nrow();
+					size_t tnc = tiles[i].ncol();
+					size_t a = std::max(brow, row1[i]);
+					size_t z = std::min(brow + bnr, row1[i] + tnr);
+					if (a >= z) continue;
+					size_t m = z - a;
+					tv.resize(nl * m * tnc);
+					bool allna = true;
+					size_t k = 0;
+					for (size_t lyr=0; lyr<nl; lyr++) {
+						for (size_t j=a; j<z; j++) {
+							size_t off = (lyr * bnr + (j - brow)) * snc + (col1[i] - sc1);
+							for (size_t q=0; q<tnc; q++) {
+								tv[k] = v[off + q];
+								allna = allna && std::isnan(tv[k]);
+								k++;
+							}
+						}
+					}
+					bool last = z == (row1[i] + tnr);
+					if (status[i] == 0) {
+						if (narm && allna) {
+							// nothing has to be written yet
+							if (last) status[i] = 2;
+							continue;
+						}
+						SpatOptions topt(opt);
+						topt.set_filenames({f + std::to_string(i+1) + fext});
+						topt.progressbar = false;
+						if (!tiles[i].writeStart(topt)) {
+							setError(tiles[i].getError());
+							closeall();
+							readStop();
+							return ff;
+						}
+						status[i] = 1;
+						written[i] = true;
+						// the rows above these values are all NA
+						size_t skip = a - row1[i];
+						for (size_t j=0; j<skip; j+=bnr) {
+							size_t jn = std::min(bnr, skip - j);
+							std::vector<double> na(nl * jn * tnc, NAN);
+							if (!tiles[i].writeValues(na, j, jn)) {
+								setError(tiles[i].getError());
+								closeall();
+								readStop();
+								return ff;
+							}
+						}
+					}
+					if (!tiles[i].writeValues(tv, a - row1[i], m)) {
+						setError(tiles[i].getError());
+						closeall();
+						readStop();
+						return ff;
+					}
+					if (last) {
+						tiles[i].writeStop();
+						status[i] = 2;
+					}
 				}
 			}
-			ff.push_back(fout);
+		}
+	}
+	readStop();
+	for (size_t i=0; i<n; i++) {
+		if (written[i]) {
+			ff.push_back(f + std::to_string(i+1) + fext);
 		}
 	}
 	return ff;
@@ -266,6 +378,8 @@ std::vector<std::vector<double>> SpatRaster::get_aggregates(std::vector<double>
 }
 
 
+// aggregates with a function of all values of each block of cells (e.g. median, modal).
+// The values of a block are copied to a buffer that is reused for each block
 void compute_aggregates(const std::vector<double> &in, std::vector<double> &out, size_t nr, size_t nc, size_t nl, std::vector<unsigned> dim, std::function<double(std::vector<double>&, bool)> fun, bool narm) {
 
 // dim 0, 1, 2, are the aggregations factors dy, dx, dz
@@ -299,6 +413,7 @@ void compute_aggregates(const std::vector<double> &in, std::vector<double> &out,
     size_t ncells = nr * nc;
     size_t lstart, rstart, cstart, lmax, rmax, cmax, f, lj, cell;
 
+	std::vector<double> a(blockcells);
 	for (size_t b = 0; b < nblocks; b++) {
 		lstart = dz * (b / bpL);
 		rstart = (dy * (b / bpR)) % adjnr;
@@ -309,7 +424,7 @@ void compute_aggregates(const std::vector<double> &in, std::vector<double> &out,
 		cmax = std::min(nc, (cstart + dx));
 
 		f = 0;
-		std::vector<double> a(blockcells, NAN);
+		std::fill(a.begin(), a.end(), NAN);
 		for (size_t j = lstart; j < lmax; j++) {
 			lj = j * ncells;
 			for (size_t r = rstart; r < rmax; r++) {
@@ -325,6 +440,84 @@ void compute_aggregates(const std::vector<double> &in, std::vector<double> &out,
 }
 
 
+enum AggregateFun { AGG_SUM=0, AGG_MEAN=1, AGG_MIN=2, AGG_MAX=3, AGG_SD=4, AGG_SDPOP=5 };
+
+// aggregates that can be updated one value at a time. The values are
+// visited once, in the order in which they are stored (layer, row, column), 
+// and each updates the accumulator of its output cell. Blocks of cells 
+// that extend beyond the raster are NA if !narm (as with compute_aggregates)
+template <int F>
+void stream_aggregates(const std::vector<double> &in, std::vector<double> &out, size_t nr, size_t nc, size_t nl, const std::vector<unsigned> &dim, bool narm) {
+
+	size_t dy = dim[0], dx = dim[1], dz = dim[2];
+	size_t onr = (nr + dy - 1) / dy;
+	size_t onc = dim[4];
+	size_t n = onr * onc * dim[5];
+
+	double init = F == AGG_MIN ? std::numeric_limits<double>::infinity() : 
+			F == AGG_MAX ? -std::numeric_limits<double>::infinity() : 0;
+	std::vector<double> a(n, init);
+	// for sd, the sum of squares and a shift (the first value) for numerical stability
+	std::vector<double> ss, shift;
+	if ((F == AGG_SD) || (F == AGG_SDPOP)) {
+		ss.resize(n, 0);
+		shift.resize(n, 0);
+	}
+	// the number of values that are not NA
+	std::vector<size_t> cnt(n, 0);
+
+	size_t ncells = nr * nc;
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		size_t lout = (lyr / dz) * onr * onc;
+		for (size_t r=0; r<nr; r++) {
+			const double *v = &in[lyr * ncells + r * nc];
+			size_t k = lout + (r / dy) * onc;
+			for (size_t c=0; c<nc; k++) {
+				size_t cend = std::min(nc, c + dx);
+				for (; c<cend; c++) {
+					const double x = v[c];
+					if (std::isnan(x)) continue;
+					if ((F == AGG_SUM) || (F == AGG_MEAN)) {
+						a[k] += x;
+					} else if (F == AGG_MIN) {
+						if (x < a[k]) a[k] = x;
+					} else if (F == AGG_MAX) {
+						if (x > a[k]) a[k] = x;
+					} else {
+						if (cnt[k] == 0) shift[k] = x;
+						double d = x - shift[k];
+						a[k] += d;
+						ss[k] += d * d;
+					}
+					cnt[k]++;
+				}
+			}
+		}
+	}
+
+	size_t blockcells = dx * dy * dz;
+	out.resize(n);
+	for (size_t k=0; k<n; k++) {
+		size_t m = cnt[k];
+		if ((m == 0) || ((!narm) && (m < blockcells))) {
+			out[k] = NAN;
+		} else if (F == AGG_MEAN) {
+			out[k] = a[k] / m;
+		} else if ((F == AGG_SD) || (F == AGG_SDPOP)) {
+			size_t d = F == AGG_SD ? m - 1 : m;
+			if (d == 0) {
+				out[k] = NAN;
+			} else {
+				double var = (ss[k] - a[k] * a[k] / m) / d;
+				out[k] = var > 0 ? std::sqrt(var) : 0;
+			}
+		} else {
+			out[k] = a[k];
+		}
+	}
+}
+
+
 
 SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bool narm, SpatOptions &opt) {
 
@@ -379,32 +572,17 @@ SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bo
 */
 
 	std::function<double(std::vector<double>&, bool)> agFun = getFun(fun);
+	std::vector<std::string> sfuns = {"sum", "mean", "min", "max", "sd", "std"};
+	int sfun = std::distance(sfuns.begin(), std::find(sfuns.begin(), sfuns.end(), fun));
 
-	//BlockSize bs = getBlockSize(4, opt.get_memfrac());
-	opt.progress *= 300;
-	BlockSize bs = getBlockSize(opt);
-	//bs.n = floor(nrow() / fact[0]); # ambiguous on solaris
-	bs.n = std::floor(static_cast <double> (nrow() / fact[0]));
-
-	bs.nrows = std::vector<size_t>(bs.n, fact[0]);
-	bs.row.resize(bs.n);
-	for (size_t i =0; i<bs.n; i++) {
-		bs.row[i] = i * fact[0];
-	}
-	size_t lastrow = bs.row[bs.n - 1] + bs.nrows[bs.n - 1]; // + 1;
-	if (lastrow < nrow()) {
-		
-		bs.row.push_back(lastrow);
-		bs.nrows.push_back(std::min(bs.nrows[bs.n-1], nrow()-lastrow));
-		bs.n += 1;
-	}
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
 	}
 
-	opt.steps = bs.n;
-	opt.minrows = fact[0];
+	// the input for a block of output rows
+	opt.ncopies = std::max(opt.ncopies, fact[0] * fact[1] * fact[2] + 1);
+	opt.minrows = 1;
 
 	if (fun == "modal") {
 		if (nlyr() == out.nlyr()) {
@@ -420,15 +598,30 @@ SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bo
 		return out;
 	}
 
+	size_t nr = nrow();
 	size_t nc = ncol();
-	//size_t outnc = out.ncol();
-	for (size_t i = 0; i < bs.n; i++) {
-        std::vector<double> vin, v;
-		readValues(vin, bs.row[i], bs.nrows[i], 0, nc);
-		compute_aggregates(vin, v, bs.nrows[i], nc, nlyr(), fact, agFun, narm);
-		if (!out.writeValues(v, i, 1)) return out;
-		//if (!out.writeValuesRect(v, i, 1, 0, outnc)) return out;		
-	}
+	size_t nl = nlyr();
+	BlockReader reader = [&](std::vector<std::vector<double>> &v, size_t i) {
+		v.resize(2);
+		size_t row = out.bs.row[i] * fact[0];
+		size_t nrows = std::min(nr, (out.bs.row[i] + out.bs.nrows[i]) * fact[0]) - row;
+		readValues(v[1], row, nrows, 0, nc);
+		return true;
+	};
+	BlockWorker worker = [&](std::vector<std::vector<double>> &v, size_t i) {
+		size_t nrows = v[1].size() / (nc * nl);
+		switch (sfun) {
+			case AGG_SUM: stream_aggregates<AGG_SUM>(v[1], v[0], nrows, nc, nl, fact, narm); break;
+			case AGG_MEAN: stream_aggregates<AGG_MEAN>(v[1], v[0], nrows, nc, nl, fact, narm); break;
+			case AGG_MIN: stream_aggregates<AGG_MIN>(v[1], v[0], nrows, nc, nl, fact, narm); break;
+			case AGG_MAX: stream_aggregates<AGG_MAX>(v[1], v[0], nrows, nc, nl, fact, narm); break;
+			case AGG_SD: stream_aggregates<AGG_SD>(v[1], v[0], nrows, nc, nl, fact, narm); break;
+			case AGG_SDPOP: stream_aggregates<AGG_SDPOP>(v[1], v[0], nrows, nc, nl, fact, narm); break;
+			default: compute_aggregates(v[1], v[0], nrows, nc, nl, fact, agFun, narm);
+		}
+		std::vector<double>().swap(v[1]);
+	};
+	if (!out.writeBlocks(reader, worker, opt)) return out;
 	out.writeStop();
 	readStop();
 	return(out);
@@ -438,28 +631,53 @@ SpatRaster SpatRaster::aggregate(std::vector<unsigned> fact, std::string fun, bo
 
 
 SpatRaster SpatRaster::weighted_mean(SpatRaster w, bool narm, SpatOptions &opt) {
-	SpatRaster out;
+	SpatRaster out = geometry(1);
+	out.source[0].names[0] = "weighted.mean";
 	if (nlyr() != w.nlyr()) {
 		out.setError("nlyr of data and weights are different");
 		return out;
 	}
+	if (!hasValues()) return out;
 
-	SpatOptions topt(opt);
-	out = arith(w, "*", topt);
-	out = out.summary("sum", narm, topt);
-	SpatRaster wsum = w.summary("sum", narm, topt);
-	return out.arith(wsum, "/", opt);
-
+	// sum(x * w) / sum(w)
+	LayerReducer sum;
+	sum.init("sum", narm, {});
+	CellWorker fun = [sum](std::vector<std::vector<double>> &v, size_t n) {
+		std::vector<double> &x = v[0];
+		std::vector<double> &wv = v[1];
+		std::vector<double> a(n), b(n);
+		sum.reduce(wv, n, b.data());
+		for (size_t i=0; i<x.size(); i++) x[i] *= wv[i];
+		sum.reduce(x, n, a.data());
+		for (size_t i=0; i<n; i++) a[i] /= b[i];
+		v[0] = std::move(a);
+	};
+	out.writeCells({this, &w}, fun, opt);
+	return out;
 }
 
 
 SpatRaster SpatRaster::weighted_mean(std::vector<double> w, bool narm, SpatOptions &opt) {
-	SpatOptions topt(opt);
+	SpatRaster out = geometry(1);
+	out.source[0].names[0] = "weighted.mean";
+	if (!hasValues()) return out;
+
 	recycle(w, nlyr());
-	SpatRaster out = arith(w, "*", false, topt);
-	out = out.summary("sum", narm, topt);
 	double wsum = vsum(w, narm);
-	return out.arith(wsum, "/", false, opt);
+	LayerReducer sum;
+	sum.init("sum", narm, {});
+	CellWorker fun = [sum, w, wsum](std::vector<std::vector<double>> &v, size_t n) {
+		std::vector<double> &x = v[0];
+		for (size_t k=0; k<w.size(); k++) {
+			for (size_t i=k*n; i<(k+1)*n; i++) x[i] *= w[k];
+		}
+		std::vector<double> a(n);
+		sum.reduce(x, n, a.data());
+		for (double &d : a) d /= wsum;
+		v[0] = std::move(a);
+	};
+	out.writeCells({this}, fun, opt);
+	return out;
 }
 
 
@@ -536,6 +754,30 @@ SpatRaster SpatRaster::separate(std::vector<double> classes, double keepvalue, d
 }
 
 
+template <typename T>
+void is_in_native(SpatRaster &x, SpatRaster &out, std::vector<double> &m, int hasNAN) {
+	NativeLookup<T> lut(0);
+	for (size_t k=0; k<m.size(); k++) {
+		T v;
+		if (as_native(m[k], v)) lut.set(v, 1);
+	}
+	T na = NA<T>::value;
+	for (size_t i = 0; i < out.bs.n; i++) {
+		std::vector<T> v;
+		x.readValuesTyped(v, out.bs.row[i], out.bs.nrows[i], 0, x.ncol());
+		if (x.hasError()) {
+			out.setError(x.getError());
+			return;
+		}
+		std::vector<uint8_t> vv(v.size());
+		for (size_t j=0; j<v.size(); j++) {
+			vv[j] = (v[j] == na) ? hasNAN : lut.get(v[j]);
+		}
+		if (!out.writeValuesTyped(vv, out.bs.row[i], out.bs.nrows[i])) return;
+	}
+}
+
+
 SpatRaster SpatRaster::is_in(std::vector<double> m, SpatOptions &opt) {
 
 	SpatRaster out = geometry();
@@ -573,6 +815,21 @@ SpatRaster SpatRaster::is_in(std::vector<double> m, SpatOptions &opt) {
 		readStop();
 		return out;
 	}
+	std::string itype = getNativeIntType();
+	if (itype != "") {
+		if (itype == "INT1U") {
+			is_in_native<uint8_t>(*this, out, m, hasNAN);
+		} else if (itype == "INT2S") {
+			is_in_native<int16_t>(*this, out, m, hasNAN);
+		} else if (itype == "INT2U") {
+			is_in_native<uint16_t>(*this, out, m, hasNAN);
+		} else {
+			is_in_native<int32_t>(*this, out, m, hasNAN);
+		}
+		readStop();
+		if (!out.hasError()) out.writeStop();
+		return(out);
+	}
 	for (size_t i = 0; i < out.bs.n; i++) {
 		std::vector<double> v; 
 		readBlock(v, out.bs, i);
@@ -817,22 +1074,9 @@ SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, double maskvalue, double
 		return(out);
 	}
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!x.readStart()) {
-		out.setError(x.getError());
-		return(out);
-	}
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	std::vector<double> v, m;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		readValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol());
-		x.readValues(m, out.bs.row[i], out.bs.nrows[i], 0, ncol());
+	CellWorker fun = [inverse, maskvalue, updatevalue](std::vector<std::vector<double>> &vm, size_t n) {
+		std::vector<double> &v = vm[0];
+		std::vector<double> &m = vm[1];
 		recycle(v, m);
 		if (inverse) {
 			if (std::isnan(maskvalue)) {
@@ -863,12 +1107,8 @@ SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, double maskvalue, double
 				}
 			}
 		}
-		if (!out.writeBlock(v, i)) return out;
-
-	}
-	out.writeStop();
-	readStop();
-	x.readStop();
+	};
+	out.writeCells({this, &x}, fun, opt);
 	return(out);
 }
 
@@ -888,15 +1128,6 @@ SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, std::vector<double> mask
 		return(out);
 	}
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	if (!x.readStart()) {
-		out.setError(x.getError());
-		return(out);
-	}
-
 	bool maskNA = false;
 	for (int i = maskvalues.size()-1; i>=0; i--) {
 		if (std::isnan(maskvalues[i])) {
@@ -904,75 +1135,146 @@ SpatRaster SpatRaster::mask(SpatRaster x, bool inverse, std::vector<double> mask
 			maskvalues.erase(maskvalues.begin()+i);
 		}
 	}
+	std::sort(maskvalues.begin(), maskvalues.end());
 
+	// an integer mask is read as such, with a lookup table for the mask values
+	bool xint = x.getNativeIntType() != "";
+	if (!xint) {
+		CellWorker fun = [inverse, maskvalues, maskNA, updatevalue](std::vector<std::vector<double>> &vm, size_t n) {
+			std::vector<double> &v = vm[0];
+			std::vector<double> &m = vm[1];
+			recycle(v, m);
+			for (size_t j=0; j < v.size(); j++) {
+				bool inside = std::isnan(m[j]) ? maskNA : std::binary_search(maskvalues.begin(), maskvalues.end(), m[j]);
+				if (inside != inverse) v[j] = updatevalue;
+			}
+		};
+		out.writeCells({this, &x}, fun, opt);
+		return(out);
+	}
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+	if (!x.readStart()) {
+		out.setError(x.getError());
+		return(out);
+	}
   	if (!out.writeStart(opt)) {
 		readStop();
 		return out;
 	}
-	std::vector<double> v, m;
-	for (size_t i = 0; i < out.bs.n; i++) {
-		readValues(v, out.bs.row[i], out.bs.nrows[i], 0, ncol());
-		x.readValues(m, out.bs.row[i], out.bs.nrows[i], 0, ncol());
+	std::vector<std::vector<int32_t>> xi(out.bs.n);
+	NativeLookup<int32_t> lut(0);
+	for (size_t j=0; j<maskvalues.size(); j++) {
+		int32_t d;
+		if (as_native(maskvalues[j], d)) lut.set(d, 1);
+	}
+	BlockReader reader = [&](std::vector<std::vector<double>> &vm, size_t i) {
+		vm.resize(1);
+		readValues(vm[0], out.bs.row[i], out.bs.nrows[i], 0, ncol());
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		x.readValuesTyped(xi[i], out.bs.row[i], out.bs.nrows[i], 0, ncol());
+		if (x.hasError()) {
+			out.setError(x.getError());
+			return false;
+		}
+		return true;
+	};
+	// cells that have a mask value are updated; or, if inverse is true, the other cells
+	BlockWorker worker = [&](std::vector<std::vector<double>> &vm, size_t i) {
+		std::vector<double> &v = vm[0];
+		std::vector<int32_t> &m = xi[i];
 		recycle(v, m);
-		if (inverse) {
-			for (size_t i=0; i < v.size(); i++) {
-				if (maskNA && std::isnan(m[i])) {
-					v[i] = updatevalue;
-				} else {
-					for (size_t j=0; j < maskvalues.size(); j++) {
-						if (m[i] != maskvalues[j]) {
-							v[i] = updatevalue;
-							break;
-						}
-					}
-				}
-			}
-		} else {
-			for (size_t i=0; i < v.size(); i++) {
-				if (maskNA && std::isnan(m[i])) {
-					v[i] = updatevalue;
-				} else {
-					for (size_t j=0; j < maskvalues.size(); j++) {
-						if (m[i] == maskvalues[j]) {
-							v[i] = updatevalue;
-							break;
-						}
-					}
-				}
-			}
-		}
-		if (!out.writeBlock(v, i)) return out;
-
-	}
-	out.writeStop();
+		int32_t na = NA<int32_t>::value;
+		for (size_t j=0; j < v.size(); j++) {
+			bool inside = (m[j] == na) ? maskNA : (lut.get(m[j]) == 1);
+			if (inside != inverse) v[j] = updatevalue;
+		}
+		std::vector<int32_t>().swap(m);
+	};
+	bool ok = out.writeBlocks(reader, worker, opt);
 	readStop();
 	x.readStop();
+	if (!ok) return out;
+	out.writeStop();
 	return(out);
 }
 
 
 SpatRaster SpatRaster::mask(SpatVector x, bool inverse, double updatevalue, bool touches, SpatOptions &opt) {
 
-	SpatRaster out;
+	SpatRaster out = geometry(nlyr(), true, true, true);
 	if (!hasValues()) {
 		out.setError("SpatRaster has no values");
 		return out;
 	}
-	if (inverse) {
-		out = rasterize(x, "", {updatevalue}, NAN, touches, false, false, false, false, opt);
-	} else {
-		SpatOptions topt(opt);
-		out = rasterize(x, "", {1.0}, 0, touches, false, false, false, false, opt);
-		if (out.hasError()) {
-			return out;
-		}
-		if (std::isnan(updatevalue)) {
-			out = mask(out, false, 0, updatevalue, opt);
-		} else {
-			out = mask(out, false, 0, updatevalue, topt);
-			out = out.mask(*this, false, NAN, NAN, opt);
-		}
+
+	// the cells covered by x, sorted by row
+	std::vector<CellRun> runs;
+	for (size_t i=0; i<x.size(); i++) {
+		std::vector<CellRun> r = rasterizeRuns(x.geoms[i], touches);
+		runs.insert(runs.end(), r.begin(), r.end());
 	}
+	merge_runs(runs);
+
+	if (!readStart()) {
+		out.setError(getError());
+		return(out);
+	}
+  	if (!out.writeStart(opt)) {
+		readStop();
+		return out;
+	}
+	// the first run in each block
+	std::vector<size_t> first(out.bs.n + 1, runs.size());
+	for (size_t i=0, k=0; i<out.bs.n; i++) {
+		while ((k < runs.size()) && (runs[k].row < out.bs.row[i])) k++;
+		first[i] = k;
+	}
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	BlockReader reader = [&](std::vector<std::vector<double>> &vm, size_t i) {
+		vm.resize(1);
+		readValues(vm[0], out.bs.row[i], out.bs.nrows[i], 0, nc);
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	// cells outside the runs are updated; or, if inverse is true, the cells inside them
+	BlockWorker worker = [&](std::vector<std::vector<double>> &vm, size_t i) {
+		std::vector<double> &v = vm[0];
+		size_t startrow = out.bs.row[i];
+		size_t nr = out.bs.nrows[i];
+		size_t off = nr * nc;
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			double *d = &v[lyr * off];
+			size_t k = first[i];
+			for (size_t r=0; r<nr; r++) {
+				double *dr = d + r * nc;
+				size_t col = 0;
+				for (; (k < first[i+1]) && (runs[k].row == (startrow + r)); k++) {
+					if (inverse) {
+						std::fill(dr + runs[k].col_start, dr + runs[k].col_end + 1, updatevalue);
+					} else {
+						std::fill(dr + col, dr + runs[k].col_start, updatevalue);
+						col = runs[k].col_end + 1;
+					}
+				}
+				if (!inverse) std::fill(dr + col, dr + nc, updatevalue);
+			}
+		}
+	};
+	bool ok = out.writeBlocks(reader, worker, opt);
+	readStop();
+	if (!ok) return out;
+	out.writeStop();
 	return(out);
 }
 
@@ -1151,27 +1453,6 @@ SpatRaster SpatRaster::trim(double value, unsigned padding, SpatOptions &opt) {
 
 
 
-void clamp_vector(std::vector<double> &v, double low, double high, bool usevalue) {
-	size_t n = v.size();
-	if (usevalue) {
-		for (size_t i=0; i<n; i++) {
-			if ( v[i] < low ) {
-				v[i] = low;
-			} else if ( v[i] > high ) {
-				v[i] = high;
-			}
-		}
-	} else {
-		for (size_t i=0; i<n; i++) {
-			if ( (v[i] < low )| (v[i] > high)) {
-				v[i] = NAN;
-			}
-		}
-	}
-}
-
-
-
 SpatRaster SpatRaster::clamp(double low, double high, bool usevalue, SpatOptions &opt) {
 
 	SpatRaster out = geometry(nlyr(), true);
@@ -1184,23 +1465,10 @@ SpatRaster SpatRaster::clamp(double low, double high, bool usevalue, SpatOptions
 		return out;
 	}
 
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-
-  	if (!out.writeStart(opt)) {
-		readStop();
-		return out;
-	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		clamp_vector(v, low, high, usevalue);
-		if (!out.writeBlock(v, i)) return out;
-	}
-	readStop();
-	out.writeStop();
+	CellWorker fun = [low, high, usevalue](std::vector<std::vector<double>> &v, size_t n) {
+		clamp_kernel(v[0].data(), v[0].size(), low, high, usevalue);
+	};
+	out.writeCells({this}, fun, opt);
 	return(out);
 }
 
@@ -1518,10 +1786,9 @@ SpatRaster SpatRaster::disaggregate(std::vector<unsigned> fact, SpatOptions &opt
 
 	opt.ncopies = 2*fact[0]*fact[1]*fact[2];
 	BlockSize bs = getBlockSize(opt);
-	//opt.set_blocksizemp();
-	unsigned nc = ncol();
-	unsigned nl = nlyr();
-	std::vector<double> newrow(nc*fact[1]);
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	size_t fy = fact[0], fx = fact[1];
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
@@ -1531,33 +1798,41 @@ SpatRaster SpatRaster::disaggregate(std::vector<unsigned> fact, SpatOptions &opt
 		readStop();
 		return out;
 	}
-	for (size_t i = 0; i < bs.n; i++) {
-		std::vector<double> v, vout;
-		readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-		vout.reserve(v.size() * fact[0] * fact[1] * fact[2]);
-
-		for (size_t lyr=0; lyr<nl; lyr++) {
-			for (size_t row=0; row<bs.nrows[i]; row++) {
-				unsigned rowoff = row*nc + lyr*nc*bs.nrows[i];
-				// for each new column
-				unsigned jfact = 0;
+	// each input row is expanded once, in place in the output, 
+	// and then copied for the other new rows
+	bool ok = processBlocks(bs.n,
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			v.resize(2);
+			readValues(v[1], bs.row[i], bs.nrows[i], 0, nc);
+			return true;
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			const std::vector<double> &in = v[1];
+			std::vector<double> &vout = v[0];
+			size_t onc = nc * fx;
+			vout.resize(in.size() * fy * fx);
+			size_t nrows = bs.nrows[i] * nl;
+			for (size_t row=0; row<nrows; row++) {
+				const double *rin = &in[row * nc];
+				double *rout = &vout[row * fy * onc];
 				for (size_t j=0; j<nc; j++) {
-					unsigned coloff = rowoff + j;
-					for (size_t k=0; k<fact[1]; k++) {
-						newrow[jfact+k] = v[coloff];
-					}
-					jfact += fact[1];
+					std::fill(rout + j * fx, rout + (j+1) * fx, rin[j]);
 				}
-				// for each new row
-				for (size_t j=0; j<fact[0]; j++) {
-					vout.insert(vout.end(), newrow.begin(), newrow.end());
+				for (size_t k=1; k<fy; k++) {
+					std::copy(rout, rout + onc, rout + k * onc);
 				}
 			}
-		}
-		if (!out.writeValues(vout, bs.row[i]*fact[0], bs.nrows[i]*fact[0])) return out;
+			std::vector<double>().swap(v[1]);
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			return out.writeValues(v[0], bs.row[i]*fy, bs.nrows[i]*fy);
+		}, opt);
+	readStop();
+	if (!ok) {
+		if (!out.hasError()) out.setError(getError());
+		return out;
 	}
 	out.writeStop();
-	readStop();
 	return(out);
 }
 
@@ -2292,45 +2567,42 @@ SpatRaster SpatRasterCollection::mosaic(std::string fun, SpatOptions &opt) {
 	}
 	if (warn != "") out.addWarning(warn);
 
- 	if (!out.writeStart(opt)) { return out; }
+ 	LayerReducer reducer;
+	reducer.init(fun, true, {});
+
+	if (!out.writeStart(opt)) { return out; }
 	SpatOptions sopt(opt);
 	sopt.progressbar = false;
 	std::vector<double> v;
 	for (size_t i=0; i < out.bs.n; i++) {
 		eout.ymax = out.yFromRow(out.bs.row[i]) + hyr;
 		eout.ymin = out.yFromRow(out.bs.row[i] + out.bs.nrows[i] - 1) - hyr;
-		SpatRasterStack s;
+		size_t ncls = out.bs.nrows[i] * out.ncol() * nl;
+		// the values of the rasters that overlap with the block
+		std::vector<std::vector<double>> sv;
 		for (size_t j=0; j<n; j++) {
 			e = ds[j].getExtent();
 			e = e.intersect(eout);
 			if ( e.valid_notequal() ) {
 				SpatRaster r = ds[j].crop(eout, "near", sopt);
-				//SpatExtent ec = r.getExtent();
 				r = r.extend(eout, "near", sopt);
-				//SpatExtent ee = r.getExtent();
-				if (!s.push_back(r, "", "", "", false)) {
-					out.setError("internal error: " + s.getError());
+				std::vector<double> rv = r.getValues(-1, sopt);
+				if (r.hasError()) {
+					out.setError("internal error: " + r.getError());
 					out.writeStop();
 					return out;
 				}
+				recycle(rv, ncls);
+				sv.push_back(std::move(rv));
 			}
 		} 
-		size_t ncls = out.bs.nrows[i] * out.ncol() * nl;
-		if (s.size() > 0) {
-			SpatRaster r = s.summary(fun, true, sopt);
-			if (r.hasError()) {
-				out.setError("internal error: " + r.getError());
-				out.writeStop();
-				return out;
-			}
-			if (!r.getValuesSource(0, v)) {
-				out.setError("internal error: " + r.getError());
-				out.writeStop();
-				return out;
-			}
-			recycle(v, ncls);
+		v.resize(ncls);
+		if (sv.size() > 0) {
+			std::vector<const double*> p(sv.size());
+			for (size_t j=0; j<sv.size(); j++) p[j] = sv[j].data();
+			reducer.reduce(p, ncls, v.data());
 		} else {
-			v = std::vector<double>(ncls, NAN); 
+			std::fill(v.begin(), v.end(), NAN);
 		}
 		if (!out.writeBlock(v, i)) return out;
 	}
@@ -3143,6 +3415,34 @@ SpatRaster SpatRaster::reclassify(std::vector<std::vector<double>> rcl, unsigned
 		}
 	}
 
+	// "is - becomes" for integer values can use a lookup table
+	bool xint = (!bylayer) && (rcldim == 2) && (getNativeIntType() != "");
+	if (!xint) {
+		CellWorker fun;
+		if (bylayer) {
+			fun = [rcl, rcldim, nl, right, leftright, lowest, others, othersValue](std::vector<std::vector<double>> &vv, size_t n) {
+				std::vector<double> &v = vv[0];
+				std::vector<std::vector<double>> lyrrcl(rcldim+1);
+				for (size_t j=0; j<rcldim; j++) {
+					lyrrcl[j] = rcl[j];
+				}
+				for (size_t lyr = 0; lyr < nl; lyr++) {
+					size_t offset = lyr * n;
+					lyrrcl[rcldim] = rcl[rcldim+lyr];
+					std::vector<double> vx(v.begin()+offset, v.begin()+offset+n);
+					reclass_vector(vx, lyrrcl, right, leftright, lowest, others, othersValue);
+					std::copy(vx.begin(), vx.end(), v.begin()+offset);
+				}
+			};
+		} else {
+			fun = [rcl, right, leftright, lowest, others, othersValue](std::vector<std::vector<double>> &v, size_t n) {
+				reclass_vector(v[0], rcl, right, leftright, lowest, others, othersValue);
+			};
+		}
+		out.writeCells({this}, fun, opt);
+		return(out);
+	}
+
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
@@ -3153,34 +3453,47 @@ SpatRaster SpatRaster::reclassify(std::vector<std::vector<double>> rcl, unsigned
 		return out;
 	}
 
-	if (bylayer) {
-		std::vector<std::vector<double>> lyrrcl(rcldim+1);
-		for (size_t i=0; i<rcldim; i++) {
-			lyrrcl[i] = rcl[i];
-		}
-		for (size_t i = 0; i < out.bs.n; i++) {
-			unsigned off = bs.nrows[i] * ncol() ;
-			std::vector<double> v; 
-			readBlock(v, out.bs, i);
-			for (size_t lyr = 0; lyr < nl; lyr++) {
-				unsigned offset = lyr * off;
-				lyrrcl[rcldim] = rcl[rcldim+lyr];
-				std::vector<double> vx(v.begin()+offset, v.begin()+offset+off);
-				reclass_vector(vx, lyrrcl, right, leftright, lowest, others, othersValue);
-				std::copy(vx.begin(), vx.end(), v.begin()+offset);
-			}
-			if (!out.writeBlock(v, i)) return out;
-		}
-	} else {
-		for (size_t i = 0; i < out.bs.n; i++) {
-			std::vector<double> v; 
-			readBlock(v, out.bs, i);
-			reclass_vector(v, rcl, right, leftright, lowest, others, othersValue);
-			if (!out.writeBlock(v, i)) return out;
-		}
-	}
-
+	std::vector<std::vector<int32_t>> xi(out.bs.n);
+	NativeLookup<int32_t> lut(NAN);
+	bool hasNAN = false;
+	double replaceNAN = NAN;
+	// the first match is used
+	for (long j=rcl[0].size()-1; j>=0; j--) {
+		int32_t d;
+		if (std::isnan(rcl[0][j])) {
+			hasNAN = true;
+			replaceNAN = rcl[1][j];
+		} else if (as_native(rcl[0][j], d)) {
+			lut.set(d, rcl[1][j]);
+		}
+	}
+
+	BlockReader reader = [&](std::vector<std::vector<double>> &v, size_t i) {
+		v.resize(1);
+		readValuesTyped(xi[i], out.bs.row[i], out.bs.nrows[i], 0, ncol());
+		if (hasError()) {
+			out.setError(getError());
+			return false;
+		}
+		return true;
+	};
+	BlockWorker worker = [&](std::vector<std::vector<double>> &vv, size_t i) {
+		std::vector<int32_t> &m = xi[i];
+		std::vector<double> &v = vv[0];
+		v.resize(m.size());
+		int32_t na = NA<int32_t>::value;
+		for (size_t j=0; j<m.size(); j++) {
+			if (m[j] == na) {
+				v[j] = hasNAN ? replaceNAN : NAN;
+			} else if (!lut.find(m[j], v[j])) {
+				v[j] = others ? othersValue : m[j];
+			}
+		}
+		std::vector<int32_t>().swap(m);
+	};
+	bool ok = out.writeBlocks(reader, worker, opt);
 	readStop();
+	if (!ok) return out;
 	out.writeStop();
 	return(out);
 
@@ -3212,314 +3525,6 @@ SpatRaster SpatRaster::reclassify(std::vector<double> rcl, unsigned nc, unsigned
 
 
 
-std::vector<std::vector<double>> clump_getRCL(std::vector<std::vector<size_t>> rcl, size_t n) {
-	std::vector<std::vector<size_t>> rcl2(rcl[0].size());
-	for (size_t i=0; i<rcl[0].size(); i++) {
-		rcl2[i].push_back(rcl[0][i]);
-		rcl2[i].push_back(rcl[1][i]);
-	}
-    std::sort(rcl2.begin(), rcl2.end());
-    rcl2.erase(std::unique(rcl2.begin(), rcl2.end()), rcl2.end());
-	std::vector<std::vector<double>> out(2);
-	for (size_t i=0; i<rcl2.size(); i++) {
-		out[0].push_back(rcl2[i][1]);
-		out[1].push_back(rcl2[i][0]);
-	}
-	// from - to 
-	// 3 - 1
-	// 4 - 3
-    // becomes
-    // 3 - 1
-    // 4 - 1
-	for (size_t i=1; i<out[0].size(); i++) {
-		for (size_t j=0; j<i; j++) {
-			if (out[0][i] == out[1][j]) {
-				out[1][j] = out[0][i];
-			}
-		}
-	}
-
-	std::vector<double> lost = out[0];
-	lost.push_back(n);
-	size_t sub = 0;
-	for (size_t i=0; i<lost.size(); i++) {
-		sub++;
-		for (size_t j=lost[i]+1; j<lost[i+1]; j++) {
-			out[0].push_back(j);
-			out[1].push_back(j-sub);
-		}
-	}
-	return out;
-}
-
-
-void clump_replace(std::vector<double> &v, size_t n, std::vector<double>& d, size_t cstart, std::vector<std::vector<size_t>>& rcl, size_t &ncps) {
-
-	d.erase(std::remove_if(d.begin(), d.end(),
-		[](const double& v) { return std::isnan(v); }), d.end());
-	std::sort(d.begin(), d.end());
-	d.erase(std::unique(d.begin(), d.end()), d.end());
-
-	size_t nd = d.size();
-
-	if (nd == 0) {
-		v[n] = ncps;
-		ncps++;
-		return;
-	} else if (nd == 1) {
-		v[n] = d[0];
-		return;
-	}
-	v[n] = d[0];
-	for (size_t i=0; i<n; i++) {
-		for (size_t j=1; j<nd; j++) {
-			if (v[i] == d[j]) {
-				v[i] = d[0];
-			}
-		}
-	}
-	if (d[0] < cstart) {
-		for (size_t j=1; j<d.size(); j++) {
-			rcl[0].push_back(d[0]);
-			rcl[1].push_back(d[j]);
-		}
-	} else if (d[nd-1] == (ncps-1)) {  // or just "if" ?
-		ncps--;
-	}
-}
-
-
-
-
-void broom_clumps(std::vector<double> &v, std::vector<double>& above, const size_t &dirs, size_t &ncps, const size_t &nr, const size_t &nc, std::vector<std::vector<size_t>> &rcl, bool is_global) {
-
-	size_t nstart = ncps;
-
-	bool d4 = dirs == 4;
-	size_t stopnc = nc-1;
-	std::vector<double> d;
-	
-	//first row, no row above it, use "above"
-	//first cell
-	//Rcpp::Rcout << "r  x i v[i] nc v[i] nc" << std::endl; 
-	if ( !std::isnan(v[0]) ) { 
-		//Rcpp::Rcout << 0 << " ff " << 0 << " " << v[0] << " " << ncps << " " ; 
-		if (d4) {
-			if (std::isnan(above[0])) {
-				v[0] = ncps; // new patch
-				ncps++;
-			} else {
-				v[0] = above[0]; // same as above
-			}
-		} else if (is_global) { //d8 global
-			d = {above[0], above[1], above[stopnc]} ;
-			clump_replace(v, 0, d, nstart, rcl, ncps);
-		} else { //d8
-			d = {above[0], above[1]} ;
-			clump_replace(v, 0, d, nstart, rcl, ncps);
-		}
-		//Rcpp::Rcout << v[0] << " " << ncps << std::endl; 				
-	}
-	// other cells
-	for (size_t i=1; i<stopnc; i++) { 
-
-		if (!std::isnan(v[i])) {
-			//Rcpp::Rcout << 0 << " fm " << i << " " << v[i] << " " << ncps << " " ; 
-			if (d4) {
-				d = {above[i], v[i-1]} ;
-			} else {
-				d = {above[i], above[i-1], above[i+1], v[i-1]} ;
-			}
-			clump_replace(v, i, d, nstart, rcl, ncps);
-			//Rcpp::Rcout << v[i] << " " << ncps << std::endl; 				
-		}
-	}
-	// last cell
-	size_t i = stopnc;
-	if (!std::isnan(v[i])) {
-		//Rcpp::Rcout << 0 << " fl " << i << " " << v[i] << " " << ncps << " " ; 
-		
-		if (is_global) {
-			if (d4) {
-				d = {above[i], v[i-1], v[0]} ;
-			} else {
-				d = {above[i], above[i-1], v[i-1], v[0], above[0]} ;
-			}
-		} else {
-			if (d4) {
-				d = {above[i], v[i-1]} ;
-			} else {
-				d = {above[i], above[i-1], v[i-1]} ;
-			}
-		}
-		clump_replace(v, i, d, nstart, rcl, ncps);
-		//Rcpp::Rcout << v[i] << " " << ncps << std::endl; 				
-	}
-
-	////////
-	//other rows
-	for (size_t r=1; r<nr; r++) {
-		size_t start = r*nc;
-		size_t i=start;	
-		// first cell
-		if (!std::isnan(v[i])) { 
-			//Rcpp::Rcout << r << " f " << i << " " << v[i] << " " << ncps << " " ; 
-			if (is_global) {
-				if (d4) {
-					if (std::isnan(v[i-nc])) {
-						v[i] = ncps;
-						ncps++;
-					} else {
-						v[i] = v[i-nc];
-					}
-				} else {
-					d = {v[i-1], v[i-nc], v[i-nc+1]}; //above and left-above
-					clump_replace(v, i, d, nstart, rcl, ncps);
-				}
-			} else {
-				if (d4) {
-					if (std::isnan(v[i-nc])) {
-						v[i] = ncps;
-						ncps++;
-					} else {
-						v[i] = v[i-nc];
-					}
-				} else {
-					d = {v[i-nc], v[i-nc+1]}; //above and left-above
-					clump_replace(v, i, d, nstart, rcl, ncps);
-				}
-			}
-			//Rcpp::Rcout << v[i] << " " << ncps << std::endl; 			
-		}
-
-		size_t stop = start + stopnc;
-
-		// other cells
-		for (size_t i=(start+1); i<stop; i++) {
-			if (!std::isnan(v[i])) {
-				//Rcpp::Rcout << r << " m " << i << " " << v[i] << " " << ncps << " " ; 
-				if (d4) {
-					d = {v[i-nc], v[i-1]} ;
-				} else {
-					d = {v[i-nc], v[i-nc-1], v[i-nc+1], v[i-1]} ;
-				}
-				clump_replace(v, i, d, nstart, rcl, ncps);
-				//Rcpp::Rcout << v[i] << " " << ncps << std::endl; 
-			}
-		}
-		
-		// last cell
-		i = stop;
-		if (!std::isnan(v[i])) {
-			//Rcpp::Rcout << r << " l " << i << " " << v[i] << " " << ncps << " " ; 
-			if (is_global) {
-				if (d4) {
-					d = {v[i-nc], v[i-1], v[start]} ;
-				} else {
-					d = {v[i-nc], v[i-nc-1], v[i-1], v[start], v[start-nc]} ;
-				}
-			} else if (!std::isnan(v[i])) {
-				if (d4) {
-					d = {v[i-nc], v[i-1]} ;
-				} else {
-					d = {v[i-nc], v[i-nc-1], v[i-1]} ;
-				}
-			}	
-			clump_replace(v, i, d, nstart, rcl, ncps);
-			//Rcpp::Rcout << v[i] << " " << ncps << std::endl; 
-		}
-	}
-	size_t off = (nr-1) * nc;
-	above = std::vector<double>(v.begin()+off, v.end());
-}
-
-
-
-SpatRaster SpatRaster::clumps(int directions, bool zeroAsNA, SpatOptions &opt) {
-
-	SpatRaster out = geometry(1);
-	
-	if (nlyr() > 1) {
-		SpatOptions ops(opt);
-		std::vector<std::string> nms = getNames();
-		if (ops.names.size() == nms.size()) {
-			nms = opt.names;
-		}
-		for (size_t i=0; i<nlyr(); i++) {
-			std::vector<unsigned> lyr = {(unsigned)i};
-			ops.names = {nms[i]};
-			SpatRaster x = subset(lyr, ops);
-			x = x.clumps(directions, zeroAsNA, ops);
-			out.addSource(x, false, ops);
-		}
-		if (opt.get_filename() != "") {
-			out = out.writeRaster(opt);
-		}
-		return out;
-	}
-
-	if (!(directions == 4 || directions == 8)) {
-		out.setError("directions must be 4 or 8");
-		return out;
-	}
-	if (!hasValues()) {
-		out.setError("cannot compute clumps for a raster with no values");
-		return out;
-	}
-
-	std::vector<size_t> dim = {nrow(), ncol()};
-
-	std::string tempfile = "";
-    std::vector<double> d, v, vv;
-	if (!readStart()) {
-		out.setError(getError());
-		return(out);
-	}
-	std::string filename = opt.get_filename();
-	if (filename != "") {
-		bool overwrite = opt.get_overwrite();
-		std::string errmsg;
-		if (!can_write(filename, overwrite, errmsg)) {
-			out.setError(errmsg + " (" + filename +")");
-			return(out);
-		}
-	}
-	if (opt.names.size() == 0) {
-		opt.names = {"patches"};
-	}
-		
-	opt.set_filenames({""});
- 	if (!out.writeStart(opt)) { return out; }
-	size_t nc = ncol();
-	size_t ncps = 1;
-	std::vector<double> above(nc, NAN);
-	std::vector<std::vector<size_t>> rcl(2);
-
-	bool is_global = is_global_lonlat();
-	for (size_t i = 0; i < out.bs.n; i++) {
-		readBlock(v, out.bs, i);
-		if (zeroAsNA) {
-			std::replace(v.begin(), v.end(), 0.0, (double)NAN);
-		}
-		broom_clumps(v, above, directions, ncps, out.bs.nrows[i], nc, rcl, is_global);
-		if (!out.writeBlock(v, i)) return out;
-		// perhaps here keep track of unique values, so that gaps can be removed
-	}
-	out.writeStop();
-	readStop();
-
-	opt.set_filenames({filename});
-	if (rcl[0].size() > 0) {
-		std::vector<std::vector<double>> rc = clump_getRCL(rcl, ncps);
-		out = out.reclassify(rc, 3, true, false, 0.0, false, false, false, opt);
-	} else if (filename != "") {
-		out = out.writeRaster(opt);
-	}
-	return out;
-}
-
-
-
 bool SpatRaster::replaceCellValues(std::vector<double> &cells, std::vector<double> &v, bool bylyr, SpatOptions &opt) {
 	size_t cs = cells.size();
 	size_t vs = v.size();
@@ -3558,11 +3563,12 @@ bool SpatRaster::replaceCellValues(std::vector<double> &cells, std::vector<doubl
 	if (bylyr) {
 		for (size_t i=0; i<ns; i++) {
 			size_t nl = source[i].nlyr;
+			std::vector<double> &sv = source[i].values.edit();
 			for (size_t j=0; j<nl; j++) {
 				size_t off = nc * j;
 				size_t koff = cs * j;
 				for (size_t k=0; k<cs; k++) {
-					source[i].values[off + cells[k]] = v[koff + k];
+					sv[off + cells[k]] = v[koff + k];
 				}
 			}
 			source[i].setRange();
@@ -3572,10 +3578,11 @@ bool SpatRaster::replaceCellValues(std::vector<double> &cells, std::vector<doubl
 		//double maxv = vmax(v, true);
 		for (size_t i=0; i<ns; i++) {
 			size_t nl = source[i].nlyr;
+			std::vector<double> &sv = source[i].values.edit();
 			for (size_t j=0; j<nl; j++) {
 				size_t off = nc * j;
 				for (size_t k=0; k<cs; k++) {
-					source[i].values[off + cells[k]] = v[k];
+					sv[off + cells[k]] = v[k];
 				}
 			}
 			source[i].setRange();
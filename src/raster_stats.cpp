@@ -1,4 +1,4 @@
-// Copyright (c) 2018-2021  Robert J. Hijmans
+// Copyright (c) 2018-2022  Robert J. Hijmans
 //
 // This file is part of the "spat" library.
 //
@@ -21,86 +21,120 @@
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <numeric>
 
 #include "vecmath.h"
 #include "math_utils.h"
 #include "string_utils.h"
-
-std::map<double, unsigned long long> table(std::vector<double> &v) {
-	std::map<double, unsigned long long> count;
-	for_each( v.begin(), v.end(), [&count]( double val ){
-			if(!std::isnan(val)) count[val]++;
-		}
-	);
-	return count;
+#include "native.h"
+#include "valuetable.h"
+
+// the values followed by their counts
+std::vector<double> vtable(ValueTable &x) {
+	std::vector<double> v, n;
+	x.get(v, n);
+	v.insert(v.end(), n.begin(), n.end());
+	return v;
 }
 
 
-std::map<double, unsigned long long int> ctable(std::map<double, unsigned long long int> &x, std::map<double, unsigned long long int> &y) {
-	for(auto p : y) {
-		x[p.first] += p.second;
+template <typename T>
+std::vector<std::vector<double>> freq_native(SpatRaster &x, bool bylayer, SpatOptions &opt) {
+	std::vector<std::vector<double>> out;
+	BlockSize bs = x.getBlockSize(opt);
+	size_t nc = x.ncol();
+	size_t nl = x.nlyr();
+	if (!x.readStart()) {
+		return(out);
 	}
-	return(x);
-}
-
-
-std::vector<double> vtable(std::map<double, unsigned long long int> &x) {
-	std::vector<std::vector<double>> out(2);
-	for( auto p : x ) {
-		out[0].push_back(p.first);
-		out[1].push_back(p.second);
+	size_t ntab = bylayer ? nl : 1;
+	std::vector<NativeTable<T>> tabs(ntab);
+	for (size_t i = 0; i < bs.n; i++) {
+		size_t nrc = bs.nrows[i] * nc;
+		std::vector<T> v;
+		x.readValuesTyped(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (x.hasError()) {
+			x.readStop();
+			return(out);
+		}
+		if (bylayer) {
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				tabs[lyr].add(&v[lyr*nrc], nrc);
+			}
+		} else {
+			tabs[0].add(&v[0], v.size());
+		}
+	}
+	x.readStop();
+	out.resize(ntab);
+	for (size_t j=0; j<ntab; j++) {
+		ValueTable m;
+		tabs[j].add_to(m);
+		out[j] = vtable(m);
 	}
-	out[0].insert(out[0].end(), out[1].begin(), out[1].end());
-	return out[0];
+	return(out);
 }
 
 
-
 std::vector<std::vector<double>> SpatRaster::freq(bool bylayer, bool round, int digits, SpatOptions &opt) {
 	std::vector<std::vector<double>> out;
 	if (!hasValues()) return out;
+
+	// rounding to zero or more digits does not change integers
+	if ((!round) || (digits >= 0)) {
+		std::string itype = getNativeIntType();
+		if (itype == "INT1U") {
+			return freq_native<uint8_t>(*this, bylayer, opt);
+		} else if (itype == "INT2S") {
+			return freq_native<int16_t>(*this, bylayer, opt);
+		} else if (itype == "INT2U") {
+			return freq_native<uint16_t>(*this, bylayer, opt);
+		} else if (itype == "INT4S") {
+			return freq_native<int32_t>(*this, bylayer, opt);
+		}
+	}
 	BlockSize bs = getBlockSize(opt);
-	unsigned nc = ncol();
-	unsigned nl = nlyr();
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	size_t ntab = bylayer ? nl : 1;
 	if (!readStart()) {
 		return(out);
 	}
 
-	if (bylayer) {
-		out.resize(nl);
-		std::vector<std::map<double, unsigned long long int>> tabs(nl);
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned nrc = bs.nrows[i] * nc;
-			std::vector<double> v; 
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+	// each block is counted in its own tables, that are merged in block order
+	std::vector<ValueTable> tabs(ntab);
+	std::vector<std::vector<ValueTable>> part(bs.n);
+	bool ok = processBlocks(bs.n, 
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			v.resize(1);
+			readValues(v[0], bs.row[i], bs.nrows[i], 0, nc);
+			return true;
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
 			if (round) {
-				for(double& d : v) d = roundn(d, digits);
+				for (double& d : v[0]) d = roundn(d, digits);
 			}
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*nrc;
-				std::vector<double> vv(v.begin()+off, v.begin() + off + nrc);
-				std::map<double, unsigned long long int> tab = table(vv);
-				tabs[lyr] = ctable(tabs[lyr], tab);
+			part[i].resize(ntab);
+			size_t n = v[0].size() / ntab;
+			for (size_t j=0; j<ntab; j++) {
+				part[i][j].add(&v[0][j*n], n);
 			}
-		}
-		for (size_t lyr=0; lyr<nl; lyr++) {
-			out[lyr] = vtable(tabs[lyr]);
-		}
-	} else {
-		out.resize(1);
-		std::map<double, long long unsigned> tabs;
-		for (size_t i = 0; i < bs.n; i++) {
-			std::vector<double> v;
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-			if (round) {
-				for (double& d : v) d = roundn(d, digits);
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			for (size_t j=0; j<ntab; j++) {
+				tabs[j].merge(part[i][j]);
 			}
-			std::map<double, long long unsigned> tab = table(v);
-			tabs = ctable(tabs, tab);
-		}
-		out[0] = vtable(tabs);
-	}
+			std::vector<ValueTable>().swap(part[i]);
+			return true;
+		}, opt);
 	readStop();
+	if (!ok) return out;
+
+	out.resize(ntab);
+	for (size_t j=0; j<ntab; j++) {
+		out[j] = vtable(tabs[j]);
+	}
 	return(out);
 }
 
@@ -109,51 +143,45 @@ std::vector<size_t> SpatRaster::count(double value, bool bylayer, bool round, in
 	std::vector<size_t> out;
 	if (!hasValues()) return out;
 	BlockSize bs = getBlockSize(opt);
-	unsigned nc = ncol();
-	unsigned nl = nlyr();
+	size_t nc = ncol();
+	size_t nl = nlyr();
+	size_t ntab = bylayer ? nl : 1;
 	if (!readStart()) {
 		return(out);
 	}
 
-	if (bylayer) {
-		out.resize(nl);
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned nrc = bs.nrows[i] * nc;
-			std::vector<double> v;
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
+	bool isna = std::isnan(value);
+	std::vector<std::vector<size_t>> part(bs.n);
+	out.resize(ntab, 0);
+	bool ok = processBlocks(bs.n, 
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			v.resize(1);
+			readValues(v[0], bs.row[i], bs.nrows[i], 0, nc);
+			return true;
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
 			if (round) {
-				for(double& d : v) d = roundn(d, digits);
-			}
-			if (std::isnan(value)) {
-				for (size_t lyr=0; lyr<nl; lyr++) {
-					unsigned off = lyr*nrc;
-					out[lyr] += count_if(v.begin()+off, v.begin()+off+nrc, 
-							[](double d){return std::isnan(d);});
-				}
-			} else {
-				for (size_t lyr=0; lyr<nl; lyr++) {
-					unsigned off = lyr*nrc;
-					out[lyr] += std::count(v.begin()+off, v.begin()+off+nrc, value);
+				for (double& d : v[0]) d = roundn(d, digits);
+			}
+			part[i].resize(ntab, 0);
+			size_t n = v[0].size() / ntab;
+			for (size_t j=0; j<ntab; j++) {
+				std::vector<double>::iterator first = v[0].begin() + j*n;
+				if (isna) {
+					part[i][j] = std::count_if(first, first+n, [](double d){return std::isnan(d);});
+				} else {
+					part[i][j] = std::count(first, first+n, value);
 				}
 			}
-		}
-	} else {
-		out.resize(1);
-		for (size_t i = 0; i < bs.n; i++) {
-			std::vector<double> v;
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-			if (round) {
-				for (double& d : v) d = roundn(d, digits);
-			}
-			if (std::isnan(value)) {
-				out[0] += count_if(v.begin(), v.end(), 
-								[](double d){return std::isnan(d);});
-			} else {
-				out[0] += std::count(v.begin(), v.end(), value);
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			for (size_t j=0; j<ntab; j++) {
+				out[j] += part[i][j];
 			}
-		}
-	}
+			return true;
+		}, opt);
 	readStop();
+	if (!ok) out.resize(0);
 	return(out);
 }
 
@@ -219,20 +247,34 @@ SpatRaster SpatRaster::quantile(std::vector<double> probs, bool narm, SpatOption
 
 
 
-void unique_values_alt(std::vector<double> &d) {
-	d.erase(std::remove_if(d.begin(), d.end(),
-            [](const double& value) { return std::isnan(value); }), d.end());
-	std::sort(d.begin(), d.end());
-	d.erase(std::unique(d.begin(), d.end()), d.end());
-}
-
-
-void unique_values(std::vector<double> &d) {
-	d.erase(std::remove_if(d.begin(), d.end(),
-            [](const double& value) { return std::isnan(value); }), d.end());
-	std::set<double> u { d.begin(), d.end()};
-	std::copy(u.begin(), u.end(), d.begin());
-	d.erase(d.begin()+u.size(), d.end());
+template <typename T>
+std::vector<std::vector<double>> unique_native(SpatRaster &x, SpatOptions &opt) {
+	std::vector<std::vector<double>> out;
+	BlockSize bs = x.getBlockSize(opt);
+	size_t nc = x.ncol();
+	size_t nl = x.nlyr();
+	if (!x.readStart()) {
+		return(out);
+	}
+	std::vector<NativeTable<T>> tabs(nl);
+	for (size_t i = 0; i < bs.n; i++) {
+		size_t nrc = bs.nrows[i] * nc;
+		std::vector<T> v;
+		x.readValuesTyped(v, bs.row[i], bs.nrows[i], 0, nc);
+		if (x.hasError()) {
+			x.readStop();
+			return(out);
+		}
+		for (size_t lyr=0; lyr<nl; lyr++) {
+			tabs[lyr].add(&v[lyr*nrc], nrc);
+		}
+	}
+	x.readStop();
+	out.resize(nl);
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		out[lyr] = tabs[lyr].values();
+	}
+	return(out);
 }
 
 
@@ -241,144 +283,283 @@ std::vector<std::vector<double>> SpatRaster::unique(bool bylayer, SpatOptions &o
 	std::vector<std::vector<double>> out;
 	if (!hasValues()) return out;
 
-	constexpr double lowest_double = std::numeric_limits<double>::lowest();
+	if (bylayer || (nlyr() == 1)) {
+		std::string itype = getNativeIntType();
+		if (itype == "INT1U") {
+			return unique_native<uint8_t>(*this, opt);
+		} else if (itype == "INT2S") {
+			return unique_native<int16_t>(*this, opt);
+		} else if (itype == "INT2U") {
+			return unique_native<uint16_t>(*this, opt);
+		} else if (itype == "INT4S") {
+			return unique_native<int32_t>(*this, opt);
+		}
+	}
 
 	BlockSize bs = getBlockSize(opt);
-	unsigned nc = ncol();
-	unsigned nl = nlyr();
+	size_t nc = ncol();
+	size_t nl = nlyr();
 	if (!readStart()) {
 		return(out);
 	}
-	out.resize(nl);
 
+	// the values of each block go in their own tables, that are merged 
+	// in block order. Combinations of layers are packed rows in a RowTable
 	if (nl == 1) bylayer = true;
+	bool ok;
 	if (bylayer) {
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned n = bs.nrows[i] * nc;
-			std::vector<double> v;
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*n;
-				out[lyr].insert(out[lyr].end(), v.begin()+off, v.begin()+off+n);
-				unique_values(out[lyr]);
-			}
-		}
-	} else {
-		std::vector<std::vector<double>> temp;
-		for (size_t i = 0; i < bs.n; i++) {
-			unsigned n = bs.nrows[i] * nc;
-			std::vector<std::vector<double>> m(n, std::vector<double>(nl));
-			std::vector<double> v;
-			readValues(v, bs.row[i], bs.nrows[i], 0, nc);
-			for (size_t j = 0; j < v.size(); j++) {
-				if (std::isnan(v[j])) v[j] = lowest_double;
-			}
-
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned off = lyr*n;
-				for (size_t j=0; j<n; j++) {
-					m[j][lyr] = v[off+j];
+		std::vector<ValueTable> tabs(nl);
+		std::vector<std::vector<ValueTable>> part(bs.n);
+		ok = processBlocks(bs.n, 
+			[&](std::vector<std::vector<double>> &v, size_t i) {
+				v.resize(1);
+				readValues(v[0], bs.row[i], bs.nrows[i], 0, nc);
+				return true;
+			},
+			[&](std::vector<std::vector<double>> &v, size_t i) {
+				part[i].resize(nl);
+				size_t n = bs.nrows[i] * nc;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					part[i][lyr].add(&v[0][lyr*n], n);
 				}
-			}
-			std::sort(m.begin(), m.end());
-			m.erase(std::unique(m.begin(), m.end()), m.end());
-			for (size_t j=0; j<m.size(); j++) {
-				temp.insert(temp.end(), m[j]);
-			}
-		}
-		std::sort(temp.begin(), temp.end());
-		temp.erase(std::unique(temp.begin(), temp.end()), temp.end());
-		for (size_t i = 0; i < temp.size(); i++) {
-			for (size_t j = 0; j < temp[0].size(); j++) {
-				out[j].resize(temp.size());
-				if (temp[i][j] == lowest_double) {
-					out[j][i] = NAN;
-				} else {
-					out[j][i] = temp[i][j];
+			},
+			[&](std::vector<std::vector<double>> &v, size_t i) {
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					tabs[lyr].merge(part[i][lyr]);
 				}
+				std::vector<ValueTable>().swap(part[i]);
+				return true;
+			}, opt);
+		if (ok) {
+			out.resize(nl);
+			std::vector<double> n;
+			for (size_t lyr=0; lyr<nl; lyr++) {
+				tabs[lyr].get(out[lyr], n);
 			}
 		}
+	} else {
+		RowTable rows(nl);
+		std::vector<RowTable> part(bs.n, RowTable(0));
+		ok = processBlocks(bs.n, 
+			[&](std::vector<std::vector<double>> &v, size_t i) {
+				v.resize(1);
+				readValues(v[0], bs.row[i], bs.nrows[i], 0, nc);
+				return true;
+			},
+			[&](std::vector<std::vector<double>> &v, size_t i) {
+				size_t n = bs.nrows[i] * nc;
+				part[i] = RowTable(nl);
+				part[i].add(v[0], n, 0, n);
+			},
+			[&](std::vector<std::vector<double>> &v, size_t i) {
+				rows.merge(part[i]);
+				part[i] = RowTable(0);
+				return true;
+			}, opt);
+		if (ok) out = rows.values();
 	}
 	readStop();
-
+	if (!ok) out.resize(0);
 	return(out);
 }
 
 
 
-void jointstats(const std::vector<double> &u, const std::vector<double> &v, const std::vector<double> &z, std::string fun, bool narm, std::vector<double>& out, std::vector<double> &cnt) {
+// map zone values to consecutive indices (in order of appearance). 
+// Integer zones within [dmin, dmin + dense.size()) use a direct lookup
+// table; other values go through a hash table
+class ZoneIndex {
+	public:
+		std::vector<double> zones;
+		double dmin = 0;
+		std::vector<size_t> dense; // index + 1, 0 if not seen
+		std::unordered_map<double, size_t> hash;
 
-	if (fun=="sum") {
-		if (narm) {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i])) && (!std::isnan(v[i]))) {
-					out[z[i]] += v[i];
-				}
-			}
-		} else {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i]))) {
-					out[z[i]] += v[i];
-				}
+		void set_dense(double zmin, double zmax, double maxsize) {
+			if (std::isnan(zmin) || std::isnan(zmax) || (zmax < zmin)) return;
+			zmin = std::floor(zmin);
+			double n = std::floor(zmax) - zmin + 1;
+			if (n <= maxsize) {
+				dmin = zmin;
+				dense.resize(n, 0);
 			}
 		}
-	} else if (fun=="mean") {
-		if (narm) {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i])) && (!std::isnan(v[i]))) {
-					out[z[i]] += v[i];
-					cnt[z[i]]++;
-				}
-			}
-		} else {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i]))) {
-					out[z[i]] += v[i];
-					cnt[z[i]]++;
+
+		size_t get(const double &z) {
+			if (!dense.empty()) {
+				double d = z - dmin;
+				if ((d >= 0) && (d < dense.size()) && (d == std::floor(d))) {
+					size_t k = d;
+					if (dense[k] == 0) {
+						zones.push_back(z);
+						dense[k] = zones.size();
+					}
+					return dense[k] - 1;
 				}
 			}
+			std::unordered_map<double, size_t>::iterator it = hash.find(z);
+			if (it != hash.end()) return it->second;
+			size_t k = zones.size();
+			hash[z] = k;
+			zones.push_back(z);
+			return k;
+		}
+};
+
+
+enum ZonalFun {zSUM, zMEAN, zMIN, zMAX, zCOUNT, zSD, zMEDIAN};
+
+// running statistics for one zone and layer
+class ZoneStat {
+	public:
+		double nall = 0; // all cells
+		double n = 0;    // cells that are not NA
+		double sum = 0;
+		double mean = 0;
+		double m2 = 0;
+		double min = std::numeric_limits<double>::infinity();
+		double max = -std::numeric_limits<double>::infinity();
+		bool hasNA = false;
+};
+
+
+// zonal statistics for the zones seen in one or more blocks
+class ZonalAccumulator {
+	public:
+		ZonalAccumulator(size_t _nl, ZonalFun _fun) : nl(_nl), fun(_fun) {}
+
+		size_t nl;
+		ZonalFun fun;
+		ZoneIndex index;
+		std::vector<ZoneStat> stats; // zone * nl + layer
+		std::vector<std::vector<double>> values; // for the median
+
+		size_t zone(const double &z) {
+			size_t k = index.get(z);
+			if (k == (stats.size() / nl)) {
+				stats.resize(stats.size() + nl);
+				if (fun == zMEDIAN) values.resize(stats.size());
+			}
+			return k;
 		}
-	} else if (fun=="min") {
-		if (narm) {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i])) && (!std::isnan(v[i]))) {
-					out[z[i]] = std::min(out[z[i]], v[i]);
+
+		// v has nl layers of zv.size() cells. The zones are double or native integers
+		template <typename Z>
+		void add(const std::vector<double> &v, const std::vector<Z> &zv) {
+			size_t nc = zv.size();
+			size_t k = 0;
+			bool first = true;
+			Z prev = 0;
+			for (size_t j=0; j<nc; j++) {
+				if (is_NA(zv[j])) continue;
+				// zones tend to come in runs
+				if (first || (zv[j] != prev)) {
+					k = zone(zv[j]);
+					prev = zv[j];
+					first = false;
 				}
-			}
-		} else {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i]))) {
-					out[z[i]] = std::min(out[z[i]], v[i]);
+				size_t off = k * nl;
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					double d = v[lyr*nc + j];
+					ZoneStat &s = stats[off + lyr];
+					s.nall++;
+					if (std::isnan(d)) {
+						s.hasNA = true;
+						continue;
+					}
+					s.n++;
+					switch (fun) {
+						case zSUM: 
+						case zMEAN: 
+							s.sum += d; 
+							break;
+						case zMIN: 
+							if (d < s.min) s.min = d; 
+							break;
+						case zMAX: 
+							if (d > s.max) s.max = d; 
+							break;
+						case zSD: {
+							double delta = d - s.mean;
+							s.mean += delta / s.n;
+							s.m2 += delta * (d - s.mean);
+							break;
+						}
+						case zMEDIAN: 
+							values[off + lyr].push_back(d); 
+							break;
+						default: 
+							break;
+					}
 				}
 			}
 		}
-	} else if (fun=="max") {
-		if (narm) {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i])) && (!std::isnan(v[i]))) {
-					out[z[i]] = std::max(out[z[i]], v[i]);
+
+		void merge(ZonalAccumulator &x) {
+			for (size_t i=0; i<x.index.zones.size(); i++) {
+				size_t k = zone(x.index.zones[i]);
+				for (size_t lyr=0; lyr<nl; lyr++) {
+					ZoneStat &s = stats[k*nl + lyr];
+					ZoneStat &xs = x.stats[i*nl + lyr];
+					if (xs.n > 0) {
+						if (fun == zSD) {
+							double n = s.n + xs.n;
+							double delta = xs.mean - s.mean;
+							s.m2 += xs.m2 + delta * delta * s.n * xs.n / n;
+							s.mean += delta * xs.n / n;
+						} else if (fun == zMEDIAN) {
+							std::vector<double> &sv = values[k*nl + lyr];
+							std::vector<double> &xv = x.values[i*nl + lyr];
+							sv.insert(sv.end(), xv.begin(), xv.end());
+						}
+					}
+					s.nall += xs.nall;
+					s.n += xs.n;
+					s.sum += xs.sum;
+					s.min = std::min(s.min, xs.min);
+					s.max = std::max(s.max, xs.max);
+					s.hasNA = s.hasNA || xs.hasNA;
 				}
 			}
-		} else {
-			for (size_t i=0; i<z.size(); i++) {
-				if ((!std::isnan(z[i]))) {
-					out[z[i]] = std::max(out[z[i]], v[i]);
+		}
+
+		double result(size_t k, size_t lyr, bool narm) {
+			ZoneStat &s = stats[k*nl + lyr];
+			if (fun == zCOUNT) return narm ? s.n : s.nall;
+			if ((s.n == 0) || (s.hasNA && !narm)) return NAN;
+			switch (fun) {
+				case zSUM: return s.sum;
+				case zMEAN: return s.sum / s.n;
+				case zMIN: return s.min;
+				case zMAX: return s.max;
+				case zSD: return s.n > 1 ? std::sqrt(s.m2 / (s.n - 1)) : NAN;
+				case zMEDIAN: {
+					std::vector<double> &v = values[k*nl + lyr];
+					size_t n = v.size();
+					size_t h = n / 2;
+					std::nth_element(v.begin(), v.begin()+h, v.end());
+					double m = v[h];
+					if ((n % 2) == 0) {
+						m = (m + *std::max_element(v.begin(), v.begin()+h)) / 2;
+					}
+					return m;
 				}
+				default: return NAN;
 			}
 		}
-	}
-}
-
+};
 
 
 SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOptions &opt) {
 
 	SpatDataFrame out;
-	std::vector<std::string> f {"sum", "mean", "min", "max"};
-	if (std::find(f.begin(), f.end(), fun) == f.end()) {
+	std::vector<std::string> f {"sum", "mean", "min", "max", "count", "sd", "median"};
+	std::vector<std::string>::iterator fit = std::find(f.begin(), f.end(), fun);
+	if (fit == f.end()) {
 		out.setError("not a valid function");
 		return(out);
 	}
+	ZonalFun zfun = static_cast<ZonalFun>(fit - f.begin());
 	if (!hasValues()) {
 		out.setError("SpatRaster has no values");
 		return(out);
@@ -400,15 +581,12 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 	}
 
 	size_t nl = nlyr();
-	std::vector<std::vector<double>> uq = z.unique(true, opt);
-	std::vector<double> u = uq[0];
-	double initv = 0;
-	double posinf = std::numeric_limits<double>::infinity();
-	double neginf = -posinf;
-	if (fun == "max") initv = neginf;
-	if (fun == "min") initv = posinf;
-	std::vector<std::vector<double>> stats(nl, std::vector<double>(u.size(), initv));
-	std::vector<std::vector<double>> cnt(nl, std::vector<double>(u.size(), 0));
+	size_t nc = ncol();
+	ZonalAccumulator zstats(nl, zfun);
+	if (z.hasRange()[0]) {
+		zstats.index.set_dense(z.range_min()[0], z.range_max()[0], 16777216);
+	}
+
 	if (!readStart()) {
 		out.setError(getError());
 		return(out);
@@ -419,73 +597,62 @@ SpatDataFrame SpatRaster::zonal(SpatRaster z, std::string fun, bool narm, SpatOp
 	}
 	opt.ncopies = 6;
 	BlockSize bs = getBlockSize(opt);
-	for (size_t i=0; i<bs.n; i++) {
-		std::vector<double> v, zv;
-		readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
-		z.readValues(zv, bs.row[i], bs.nrows[i], 0, ncol());
-		std::vector<double> zvr(zv.size());
-		for (size_t j=0; j<zvr.size(); j++)	 {
-			if (std::isnan(zv[j])) {
-				zvr[j] = NAN;
+	// partial statistics by block, merged in block order
+	std::vector<ZonalAccumulator> part(bs.n, ZonalAccumulator(nl, zfun));
+	// integer zones are read as such
+	bool zint = z.getNativeIntType() != "";
+	std::vector<std::vector<int32_t>> zi(zint ? bs.n : 0);
+	bool ok = processBlocks(bs.n, 
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			v.resize(2);
+			readValues(v[0], bs.row[i], bs.nrows[i], 0, nc);
+			if (zint) {
+				z.readValuesTyped(zi[i], bs.row[i], bs.nrows[i], 0, nc);
 			} else {
-				for (size_t k=0; k<u.size(); k++) {
-					if (zv[j] == u[k]) {
-						zvr[j] = k;
-						continue;
-					}
-				}
-			}
-		}
-		zv.resize(0);
-		unsigned off = bs.nrows[i] * ncol() ;
-		if (nl > 1) {
-			for (size_t lyr=0; lyr<nl; lyr++) {
-				unsigned offset = lyr * off;
-				std::vector<double> vx( v.begin()+offset,  v.begin()+offset+off);
-				jointstats(u, vx, zvr, fun, narm, stats[lyr], cnt[lyr]);
-			}
-		} else {
-			jointstats(u, v, zvr, fun, narm, stats[0], cnt[0]);
-		}
-	}
+				z.readValues(v[1], bs.row[i], bs.nrows[i], 0, nc);
+			}
+			if (z.hasError()) {
+				setError(z.getError());
+			}
+			return !hasError();
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			part[i].index.set_dense(zstats.index.dmin, zstats.index.dmin + zstats.index.dense.size() - 1, 65536);
+			if (zint) {
+				part[i].add(v[0], zi[i]);
+				std::vector<int32_t>().swap(zi[i]);
+			} else {
+				part[i].add(v[0], v[1]);
+			}
+		},
+		[&](std::vector<std::vector<double>> &v, size_t i) {
+			zstats.merge(part[i]);
+			part[i] = ZonalAccumulator(nl, zfun);
+			return true;
+		}, opt);
 	readStop();
 	z.readStop();
-
-
-	if (fun=="mean") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			for (size_t j=0; j<u.size(); j++) {
-				if (cnt[lyr][j] > 0) {
-					stats[lyr][j] = stats[lyr][j] / cnt[lyr][j];
-				} else {
-					stats[lyr][j] = NAN;
-				}
-			}
-		}
-	} 
-
-	else if (fun == "min") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			for (size_t j=0; j<u.size(); j++) {
-				if (stats[lyr][j] == posinf) {
-					stats[lyr][j] = NAN;
-				}
-			}
-		}
-	} else if (fun == "max") {
-		for (size_t lyr=0; lyr<nlyr(); lyr++) {
-			for (size_t j=0; j<u.size(); j++) {
-				if (stats[lyr][j] == neginf) {
-					stats[lyr][j] = NAN;
-				}
-			}
-		}
+	if (!ok) {
+		out.setError(getError());
+		return(out);
 	}
 
+	std::vector<double> &zones = zstats.index.zones;
+	std::vector<size_t> ord(zones.size());
+	std::iota(ord.begin(), ord.end(), 0);
+	std::sort(ord.begin(), ord.end(), [&zones](size_t i, size_t j) { return zones[i] < zones[j]; });
+	std::vector<double> u(zones.size());
+	for (size_t j=0; j<ord.size(); j++) {
+		u[j] = zones[ord[j]];
+	}
 	out.add_column(u, "zone");
 	std::vector<std::string> nms = getNames();
-	for (size_t i=0; i<nlyr(); i++) {
-		out.add_column(stats[i], nms[i]);
+	for (size_t lyr=0; lyr<nl; lyr++) {
+		std::vector<double> stat(zones.size());
+		for (size_t j=0; j<ord.size(); j++) {
+			stat[j] = zstats.result(ord[j], lyr, narm);
+		}
+		out.add_column(stat, nms[lyr]);
 	}
 	return(out);
 }
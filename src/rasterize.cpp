@@ -31,10 +31,9 @@ SpatRaster SpatRaster::hardCopy(SpatOptions &opt) {
 		readStop();
 		return out;
 	}
-	for (size_t i = 0; i < out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		if (!out.writeBlock(v, i)) return out;
+	if (!copyBlocks(out, opt)) {
+		readStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -391,160 +390,3 @@ SpatRaster SpatRaster::rasterize(SpatVector x, std::string field, std::vector<do
 	return out;
 }
 
-
-std::vector<double> SpatRaster::rasterizeCells(SpatVector &v, bool touches, SpatOptions &opt) { 
-// note that this is only for lines and polygons
-    SpatOptions ropt(opt);
-	SpatRaster r = geometry(1);
-	SpatExtent e = getExtent();
-	e = e.intersect(v.getExtent());
-	if ( !e.valid() ) {
-		std::vector<double> out(1, NAN);
-		return out;
-	}
-
-	SpatRaster rc = r.crop(e, "out", ropt);
-	std::vector<double> feats(1, 1) ;
-    SpatRaster rcr = rc.rasterize(v, "", feats, NAN, touches, false, false, false, false, ropt); 
-	SpatVector pts = rcr.as_points(false, true, ropt);
-	std::vector<double> cells;
-	if (pts.size() == 0) {
-		pts = v.as_points(false, true);
-		SpatDataFrame vd = pts.getGeometryDF();
-		std::vector<double> x = vd.getD(0);
-		std::vector<double> y = vd.getD(1);
-		cells = r.cellFromXY(x, y);
-		cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
-		if (cells.size() == 0) {
-			cells.resize(1, NAN);
-		}
-	} else {
-		SpatDataFrame vd = pts.getGeometryDF();
-		std::vector<double> x = vd.getD(0);
-		std::vector<double> y = vd.getD(1);
-		cells = r.cellFromXY(x, y);
-	}
-	return cells;
-}
-
-void SpatRaster::rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt) { 
-// note that this is only for polygons
-    SpatOptions ropt(opt);
-	opt.progress = nrow()+1;
-	SpatRaster rr = geometry(1);
-	std::vector<unsigned> fact = {10, 10};
-	SpatExtent e = getExtent();
-	SpatExtent ve = v.getExtent();
-	e = e.intersect(ve);
-	if ( !e.valid() ) {
-		return;
-	}
-	SpatRaster r = rr.crop(v.extent, "out", ropt);
-	r = r.disaggregate(fact, ropt);
-	std::vector<double> feats(1, 1) ;
-	r = r.rasterize(v, "", feats, NAN, true, false, false, false, false, ropt); 
-	r = r.arith(100.0, "/", false, ropt);
-	r = r.aggregate(fact, "sum", true, ropt);
-	SpatVector pts = r.as_points(true, true, ropt);
-	if (pts.size() == 0) {
-		weights.resize(1);
-		weights[0] = NAN;
-		cells.resize(1);
-		cells[0] = NAN;
-	} else {
-		SpatDataFrame vd = pts.getGeometryDF();
-		std::vector<double> x = vd.getD(0);
-		std::vector<double> y = vd.getD(1);
-		cells = rr.cellFromXY(x, y);
-		weights = pts.df.dv[0];
-	}
-	return;
-}
-
-void SpatRaster::rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt) { 
-    
-	SpatOptions ropt(opt);
-	opt.progress = nrow()+1;
-	SpatRaster r = geometry(1);
-	r = r.crop(v.extent, "out", ropt);
-
-//	if (r.ncell() < 1000) {
-		std::vector<double> feats(1, 1) ;
-		r = r.rasterize(v, "", feats, NAN, true, false, false, false, false, ropt); 
-
-		SpatVector pts = r.as_points(true, true, ropt);
-		if (pts.size() == 0) {
-			weights.resize(1);
-			weights[0] = NAN;
-			cells.resize(1);
-			cells[0] = NAN;
-		} else {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			cells = cellFromXY(x, y);
-
-			SpatVector rv = r.as_polygons(false, false, false, true, ropt);
-			std::vector<double> csize = rv.area("m", true, {});
-			rv.df.add_column(csize, "area");
-			rv.df.add_column(cells, "cells");
-			rv = rv.crop(v);
-			weights = rv.area("m", true, {});
-			for (size_t i=0; i<weights.size(); i++) {
-				weights[i] /= rv.df.dv[0][i];
-			}
-			cells = rv.df.dv[1];
-		}
-//	}
-
-/*
-// the below would need to remove all cells already included in the above
-// because touches=false includes partly overlapped cells [#346]
-
-	else {
-		std::vector<double> feats(1, 1) ;
-		SpatVector vv = v.as_lines();
-		SpatRaster b = r.rasterize(vv, "", feats, NAN, true, false, false, false, false, opt); 
-		SpatVector pts = b.as_points(true, true, opt);
-		if (pts.nrow() > 0) {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			cells = cellFromXY(x, y);
-
-			SpatVector bv = b.as_polygons(false, false, false, true, opt);
-			std::vector<double> csize = bv.area("m", true, {});
-			bv.df.add_column(csize, "cellsize");
-			bv.df.add_column(cells, "cellnr");
-			bv = bv.crop(v);
-			weights = bv.area("m", true, {});
-			for (size_t i=0; i<weights.size(); i++) {
-				weights[i] /= bv.df.dv[0][i];
-			}
-			cells = bv.df.dv[1];
-		}
-		// touches = false
-		r = r.rasterize(v, "", feats, NAN, false, false, false, false, false, opt); 
-		pts = r.as_points(true, true, opt);
-		if (pts.nrow() > 0) {
-			SpatDataFrame vd = pts.getGeometryDF();
-			std::vector<double> x = vd.getD(0);
-			std::vector<double> y = vd.getD(1);
-			std::vector<double> cells2 = cellFromXY(x, y);
-			cells.insert(cells.end(), cells2.begin(), cells2.end());
-			weights.resize(weights.size() + cells2.size(), 1);
-		}
-
-		if (cells.size() == 0) {
-			weights.resize(1);
-			weights[0] = NAN;
-			cells.resize(1);
-			cells[0] = NAN;
-		}
-	}
-*/
-
-}
-
-
-
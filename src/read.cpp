@@ -15,7 +15,10 @@
 // You should have received a copy of the GNU General Public License
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
-#include "spatRaster.h"
+#include "lazy.h"
+#include "mmap.h"
+#include "thread_pool.h"
+#include "NA.h"
 
 bool SpatRaster::readStart() {
 
@@ -28,8 +31,19 @@ bool SpatRaster::readStart() {
 			addWarning("source already open for reading");
 			continue;
 		}
-		if (source[i].memory) {
+		if (source[i].lazy) {
+			std::string msg;
+			if (!source[i].lazy->readStart(msg)) {
+				setError(msg);
+				return false;
+			}
+			source[i].open_read = true;
+		} else if (source[i].memory) {
 			source[i].open_read = true;
+		} else if (source[i].driver == "mmap") {
+			if (!readStartMMap(i)) {
+				return false;
+			}
 		} else if (source[i].multidim) {
 			if (!readStartMulti(i)) {
 				return false;
@@ -46,7 +60,10 @@ bool SpatRaster::readStart() {
 bool SpatRaster::readStop() {
 	for (size_t i=0; i<nsrc(); i++) {
 		if (source[i].open_read) {
-			if (source[i].memory) {
+			if (source[i].lazy) {
+				source[i].lazy->readStop();
+				source[i].open_read = false;
+			} else if (source[i].memory || (source[i].driver == "mmap")) {
 				source[i].open_read = false;
 			} else if (source[i].multidim) {
 				readStopMulti(i);
@@ -104,7 +121,7 @@ void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row,
 			size_t add = ncells * lyr;
 			for (size_t r = row; r < endrow; r++) {
 				size_t off = add + r * nc;
-				out.insert(out.end(), source[src].values.begin()+off+col, source[src].values.begin()+off+endcol);
+				source[src].values.copy(out, off+col, off+endcol);
 			}
 		}
 			/*
@@ -128,7 +145,7 @@ void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row,
 	} else { //	no window
 		size_t nc = ncol();
 		if (row==0 && nrows==nrow() && col==0 && ncols==nc) {
-			out.insert(out.end(), source[src].values.begin(), source[src].values.end());
+			source[src].values.copy(out);
 		} else {
 			double ncells = ncell();
 			if (col==0 && ncols==nc) {
@@ -136,7 +153,7 @@ void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row,
 					size_t add = ncells * lyr;
 					size_t a = add + row * nc;
 					size_t b = a + nrows * nc;
-					out.insert(out.end(), source[src].values.begin()+a, source[src].values.begin()+b);
+					source[src].values.copy(out, a, b);
 				}
 			} else {
 				size_t endrow = row + nrows;
@@ -145,7 +162,7 @@ void SpatRaster::readChunkMEM(std::vector<double> &out, size_t src, size_t row,
 					size_t add = ncells * lyr;
 					for (size_t r = row; r < endrow; r++) {
 						size_t a = add + r * nc;
-						out.insert(out.end(), source[src].values.begin()+a+col, source[src].values.begin()+a+endcol);
+						source[src].values.copy(out, a+col, a+endcol);
 					}
 				}
 			}
@@ -186,6 +203,10 @@ std::vector<double> SpatRaster::readValuesR(size_t row, size_t nrows, size_t col
 	for (size_t src=0; src<n; src++) {
 		if (source[src].memory) {
 			readChunkMEM(out, src, row, nrows, col, ncols);
+		} else if (source[src].lazy) {
+			readChunkLazy(out, src, row, nrows, col, ncols);
+		} else if (source[src].driver == "mmap") {
+			readChunkMMap(out, src, row, nrows, col, ncols);
 		} else {
 			// read from file
 			#ifdef useGDAL
@@ -251,6 +272,10 @@ void SpatRaster::readValues(std::vector<double> &out, size_t row, size_t nrows,
 	for (size_t src=0; src<n; src++) {
 		if (source[src].memory) {
 			readChunkMEM(out, src, row, nrows, col, ncols);
+		} else if (source[src].lazy) {
+			readChunkLazy(out, src, row, nrows, col, ncols);
+		} else if (source[src].driver == "mmap") {
+			readChunkMMap(out, src, row, nrows, col, ncols);
 		} else {
 			// read from file
 			#ifdef useGDAL
@@ -263,17 +288,140 @@ void SpatRaster::readValues(std::vector<double> &out, size_t row, size_t nrows,
 
 
 
+// the range of values (excluding NA) that can be stored in an integer type
+bool int_type_range(const std::string &type, double &lo, double &hi) {
+	if (type == "INT1U") {
+		lo = 0; hi = 254;
+	} else if (type == "INT2S") {
+		lo = INT16_MIN + 1; hi = INT16_MAX;
+	} else if (type == "INT2U") {
+		lo = 0; hi = UINT16_MAX - 1;
+	} else if (type == "INT4S") {
+		lo = INT32_MIN + 1.0; hi = INT32_MAX;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
+std::string SpatRaster::getNativeIntType() {
+
+	std::vector<std::string> types {"INT1U", "INT2S", "INT2U", "INT4S"};
+	// a wider type if the file may have valid values equal to NA<T>
+	std::vector<std::string> wider {"INT2S", "INT4S", "INT4S", ""};
+	std::vector<double> na {255, INT16_MIN, UINT16_MAX, INT32_MIN};
+
+	double lo = std::numeric_limits<double>::max();
+	double hi = std::numeric_limits<double>::lowest();
+	for (size_t i=0; i<source.size(); i++) {
+		SpatRasterSource &s = source[i];
+		if (s.memory || s.multidim || s.rotated) return "";
+		for (size_t j=0; j<s.nlyr; j++) {
+			if (s.has_scale_offset[j]) return "";
+		}
+		std::vector<std::string>::iterator it = std::find(types.begin(), types.end(), s.datatype);
+		if (it == types.end()) return "";
+		size_t k = it - types.begin();
+		std::string type = types[k];
+		if (s.fileNAflag != na[k]) {
+			bool inrange = true;
+			for (size_t j=0; j<s.nlyr; j++) {
+				if (!s.hasRange[j] || (s.range_min[j] == na[k]) || (s.range_max[j] == na[k])) {
+					inrange = false;
+				}
+			}
+			if (!inrange) type = wider[k];
+		}
+		double tlo, thi;
+		if (!int_type_range(type, tlo, thi)) return "";
+		lo = std::min(lo, tlo);
+		hi = std::max(hi, thi);
+	}
+	for (size_t k=0; k<types.size(); k++) {
+		double tlo, thi;
+		int_type_range(types[k], tlo, thi);
+		if ((lo >= tlo) && (hi <= thi)) return types[k];
+	}
+	return "";
+}
+
+
+template <typename T>
+void SpatRaster::readValuesTyped(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols) {
+
+	if (((row + nrows) > nrow()) || ((col + ncols) > ncol())) {
+		setError("invalid rows/columns");
+		return;
+	}
+	if ((nrows==0) | (ncols==0)) {
+		return;
+	}
+	T na = NA<T>::value;
+	if (!hasValues()) {
+		out.resize(nrows * ncols * nlyr(), na);
+		addWarning("raster has no values");
+		return;
+	}
+
+	out.resize(0);
+	out.reserve(nrows * ncols * nlyr());
+	for (size_t src=0; src<nsrc(); src++) {
+		if (source[src].driver == "mmap") {
+			if (getNativeIntType() != "") {
+				readChunkMMapTyped(out, src, row, nrows, col, ncols);
+				continue;
+			}
+		}
+		if (source[src].memory || source[src].lazy || (source[src].driver == "mmap")) {
+			std::vector<double> v;
+			if (source[src].memory) {
+				readChunkMEM(v, src, row, nrows, col, ncols);
+			} else if (source[src].lazy) {
+				readChunkLazy(v, src, row, nrows, col, ncols);
+			} else {
+				readChunkMMap(v, src, row, nrows, col, ncols);
+			}
+			for (size_t j=0; j<v.size(); j++) {
+				out.push_back(std::isnan(v[j]) ? na : (T) v[j]);
+			}
+		} else {
+			#ifdef useGDAL
+			readChunkGDALTyped(out, src, row, nrows, col, ncols);
+			#endif
+		}
+	}
+}
+
+template void SpatRaster::readValuesTyped(std::vector<uint8_t> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readValuesTyped(std::vector<int16_t> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readValuesTyped(std::vector<uint16_t> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readValuesTyped(std::vector<int32_t> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+
+
+
 bool SpatRaster::readAll() {
 	if (!hasValues()) {
 		return true; 
 	}
 
+	if (hasLazy()) {
+		SpatOptions opt;
+		if (!evaluateLazy(opt)) return false;
+	}
+
 	size_t row =0, col=0, nrows=nrow(), ncols=ncol();
 	readStart();
 	size_t n = nsrc();
 	for (size_t src=0; src<n; src++) {
-		if (!source[src].memory) {
-			readChunkGDAL(source[src].values, src, row, nrows, col, ncols);
+		if (source[src].driver == "mmap") {
+			readChunkMMap(source[src].values.edit(), src, row, nrows, col, ncols);
+			source[src].mmap = nullptr;
+			source[src].memory = true;
+			source[src].filename = "";
+			std::iota(source[src].layers.begin(), source[src].layers.end(), 0);
+		} else if (!source[src].memory) {
+			readChunkGDAL(source[src].values.edit(), src, row, nrows, col, ncols);
 			source[src].memory = true;
 			source[src].filename = "";
 			std::iota(source[src].layers.begin(), source[src].layers.end(), 0);			
@@ -283,7 +431,7 @@ bool SpatRaster::readAll() {
 				setError("could not combine sources");
 				return false;
 			}
-			source[src].values.resize(0);
+			source[src].values.clear();
 		}
 	}
 	readStop();
@@ -298,7 +446,7 @@ std::vector<double> SpatRaster::getValues(long lyr, SpatOptions &opt) {
 
 	bool hw = false;
 	for (size_t i=0; i<source.size(); i++) {
-		if (source[i].hasWindow) {
+		if (source[i].hasWindow || source[i].lazy || (source[i].driver == "mmap")) {
 			hw = true;
 			break;
 		}
@@ -320,7 +468,7 @@ std::vector<double> SpatRaster::getValues(long lyr, SpatOptions &opt) {
 		unsigned n = nsrc();
 		for (size_t src=0; src<n; src++) {
 			if (source[src].memory) {
-				out.insert(out.end(), source[src].values.begin(), source[src].values.end());
+				source[src].values.copy(out);
 			} else {
 				#ifdef useGDAL
 				std::vector<double> fvals = readValuesGDAL(src, 0, nrow(), 0, ncol());
@@ -333,7 +481,7 @@ std::vector<double> SpatRaster::getValues(long lyr, SpatOptions &opt) {
 		unsigned src=sl[0];
 		if (source[src].memory) {
 			size_t start = sl[1] * ncell();
-			out = std::vector<double>(source[src].values.begin()+start, source[src].values.begin()+start+ncell());
+			source[src].values.copy(out, start, start+ncell());
 		} else {
 			#ifdef useGDAL
 			out = readValuesGDAL(src, 0, nrow(), 0, ncol(), sl[1]);
@@ -353,7 +501,7 @@ bool SpatRaster::getValuesSource(size_t src, std::vector<double> &out) {
 
 	bool hw = false;
 	for (size_t i=0; i<source.size(); i++) {
-		if (source[i].hasWindow) {
+		if (source[i].hasWindow || source[i].lazy || (source[i].driver == "mmap")) {
 			hw = true;
 			break;
 		}
@@ -368,7 +516,8 @@ bool SpatRaster::getValuesSource(size_t src, std::vector<double> &out) {
 
 
 	if (source[src].memory) {
-		out = std::vector<double>(source[src].values.begin(), source[src].values.end());
+		out.clear();
+		source[src].values.copy(out);
 	} else {
 		#ifdef useGDAL
 		out = readValuesGDAL(src, 0, nrow(), 0, ncol());
@@ -377,3 +526,50 @@ bool SpatRaster::getValuesSource(size_t src, std::vector<double> &out) {
 	return true;
 }
 
+
+
+// Block pipeline for n blocks. Reading and collecting (e.g. writing) stay 
+// on the calling thread (GDAL and R are not thread-safe), while the worker 
+// computes up to nthreads blocks at the same time. Block i+1 is read while 
+// block i is computed and collected. 
+bool SpatRaster::processBlocks(size_t n, BlockReader reader, BlockWorker worker, BlockCollector collector, SpatOptions &opt) {
+
+	size_t nthreads = std::min((size_t)opt.compute_threads(), n);
+
+	if (nthreads < 2) {
+		std::vector<std::vector<double>> v;
+		for (size_t i = 0; i < n; i++) {
+			if (!reader(v, i)) return false;
+			worker(v, i);
+			if (!collector(v, i)) return false;
+		}
+		return true;
+	}
+
+	// blocks in flight; the buffers must outlive the pool
+	size_t depth = nthreads + 1;
+	std::vector<std::vector<std::vector<double>>> bufs(depth);
+	std::vector<std::future<void>> done(depth);
+	SpatThreadPool pool(nthreads);
+
+	size_t next = 0;
+	for (size_t i = 0; i < n; i++) {
+		while ((next < n) && (next < (i + depth))) {
+			size_t k = next % depth;
+			if (!reader(bufs[k], next)) return false;
+			size_t j = next;
+			done[k] = pool.submit([&worker, &bufs, k, j]() { worker(bufs[k], j); });
+			next++;
+		}
+		size_t k = i % depth;
+		try {
+			done[k].get();
+		} catch (std::exception &e) {
+			setError(std::string("block computation failed: ") + e.what());
+			return false;
+		}
+		if (!collector(bufs[k], i)) return false;
+		bufs[k].resize(0);
+	}
+	return true;
+}
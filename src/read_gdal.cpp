@@ -625,6 +625,18 @@ SpatRaster SpatRaster::fromFiles(std::vector<std::string> fname, std::vector<int
 
 
 
+std::string terra_datatype(GDALDataType gdt) {
+	if (gdt == GDT_Byte) return "INT1U";
+	if (gdt == GDT_Int16) return "INT2S";
+	if (gdt == GDT_UInt16) return "INT2U";
+	if (gdt == GDT_Int32) return "INT4S";
+	if (gdt == GDT_UInt32) return "INT4U";
+	if (gdt == GDT_Float32) return "FLT4S";
+	if (gdt == GDT_Float64) return "FLT8S";
+	return "";
+}
+
+
 bool SpatRaster::constructFromFile(std::string fname, std::vector<int> subds, std::vector<std::string> subdsname, std::vector<std::string> options) {
 
     GDALDataset *poDataset = openGDAL(fname, GDAL_OF_RASTER | GDAL_OF_READONLY | GDAL_OF_VERBOSE_ERROR, options);
@@ -904,6 +916,17 @@ bool SpatRaster::constructFromFile(std::string fname, std::vector<int> subds, st
 		if ((!s.has_scale_offset[i]) && (in_string(dtype, "Int") || (dtype == "Byte"))) {
 			s.valueType[i] = 1;
 		}
+		std::string ftype = terra_datatype(poBand->GetRasterDataType());
+		int hasNA;
+		double naflag = poBand->GetNoDataValue(&hasNA);
+		if (!hasNA) naflag = NAN;
+		if (i == 0) {
+			s.datatype = ftype;
+			s.fileNAflag = naflag;
+		} else {
+			if (s.datatype != ftype) s.datatype = "";
+			if (naflag != s.fileNAflag) s.fileNAflag = NAN;
+		}
 		s.names[i] = nm;
 	}
 
@@ -986,14 +1009,15 @@ void NAso(std::vector<double> &d, size_t n, const std::vector<double> &flags, co
 }
 
 
-void vflip(std::vector<double> &v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl) {
+template <typename T>
+void vflip(std::vector<T> &v, const size_t &ncell, const size_t &nrows, const size_t &ncols, const size_t &nl) {
 	for (size_t i=0; i<nl; i++) {
 		size_t off = i*ncell;
 		size_t nr = nrows/2;
 		for (size_t j=0; j<nr; j++) {
 			size_t d1 = off + j * ncols;
 			size_t d2 = off + (nrows-j-1) * ncols;
-			std::vector<double> r(v.begin()+d1, v.begin()+d1+ncols);
+			std::vector<T> r(v.begin()+d1, v.begin()+d1+ncols);
 			std::copy(v.begin()+d2, v.begin()+d2+ncols, v.begin()+d1);
 			std::copy(r.begin(), r.end(), v.begin()+d2);
 		}
@@ -1087,6 +1111,88 @@ void SpatRaster::readChunkGDAL(std::vector<double> &data, unsigned src, size_t r
 }
 
 
+// replace a file NA flag with NA<T>, if the flag can occur in T
+template <typename T>
+void typed_NA(std::vector<T> &v, size_t start, size_t end, double flag) {
+	if (std::isnan(flag)) return;
+	if ((flag < std::numeric_limits<T>::lowest()) || (flag > std::numeric_limits<T>::max()) || (flag != std::trunc(flag))) return;
+	T tflag = flag;
+	T na = NA<T>::value;
+	if (tflag == na) return;
+	std::replace(v.begin()+start, v.begin()+end, tflag, na);
+}
+
+
+template <typename T>
+void SpatRaster::readChunkGDALTyped(std::vector<T> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols) {
+
+	bool so = false;
+	for (size_t i=0; i<source[src].nlyr; i++) {
+		if (source[src].has_scale_offset[i]) so = true;
+	}
+	if (so || source[src].multidim) {
+		std::vector<double> v;
+		readChunkGDAL(v, src, row, nrows, col, ncols);
+		T na = NA<T>::value;
+		for (size_t i=0; i<v.size(); i++) {
+			data.push_back(std::isnan(v[i]) ? na : (T) v[i]);
+		}
+		return;
+	}
+
+	if (source[src].flipped) {
+		row = nrow() - row - nrows;
+	}
+	if (source[src].hasWindow) {
+		row = row + source[src].window.off_row;
+		col = col + source[src].window.off_col;
+	}
+	if (source[src].rotated) {
+		setError("cannot read from rotated files. First use 'rectify'");
+		return;
+	}
+	if (!source[src].open_read) {
+		setError("the file is not open for reading");
+		return;
+	}
+
+	size_t ncell = ncols * nrows;
+	size_t nl = source[src].nlyr;
+	std::vector<T> out(ncell * nl);
+
+	std::vector<int> panBandMap;
+	if (!source[src].in_order()) {
+		panBandMap.reserve(nl);
+		for (size_t i=0; i < nl; i++) {
+			panBandMap.push_back(source[src].layers[i]+1);
+		}
+	}
+	CPLErr err = source[src].gdalconnection->RasterIO(GF_Read, col, row, ncols, nrows, &out[0], ncols, nrows, gdal_type<T>(), nl, panBandMap.empty() ? NULL : &panBandMap[0], 0, 0, 0, NULL);
+	if (err != CE_None ) {
+		setError("cannot read values");
+		return;
+	}
+
+	for (size_t i=0; i<nl; i++) {
+		GDALRasterBand *poBand = source[src].gdalconnection->GetRasterBand(source[src].layers[i]+1);
+		int hasNA;
+		double naflag = poBand->GetNoDataValue(&hasNA);
+		if (hasNA) typed_NA(out, i*ncell, (i+1)*ncell, naflag);
+		if (source[src].hasNAflag) typed_NA(out, i*ncell, (i+1)*ncell, source[src].NAflag);
+	}
+	if (source[src].flipped) {
+		vflip(out, ncell, nrows, ncols, nl);
+	}
+	data.insert(data.end(), out.begin(), out.end());
+}
+
+template void SpatRaster::readChunkGDALTyped(std::vector<uint8_t> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readChunkGDALTyped(std::vector<int16_t> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readChunkGDALTyped(std::vector<uint16_t> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
+template void SpatRaster::readChunkGDALTyped(std::vector<int32_t> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
+
+
+
 
 
 std::vector<double> SpatRaster::readValuesGDAL(unsigned src, size_t row, size_t nrows, size_t col, size_t ncols, int lyr) {
@@ -1249,87 +1355,122 @@ std::vector<double> SpatRaster::readGDALsample(unsigned src, size_t srows, size_
 
 
 
-std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
-
-	std::vector<std::vector<double>> errout;
-	if (source[src].rotated) {
-		setError("cannot read from rotated files. First use 'rectify'");
-		return errout;
+// The order in which to read cells (rows, cols) such that the cells in the same block of
+// the file (of br rows and bc columns) are adjacent; "idx" has the index of the cells
+// (outside the file are skipped) and "key" the block of each of these cells
+static void block_order(const std::vector<int_64> &rows, const std::vector<int_64> &cols, size_t fnr, size_t fnc, size_t br, size_t bc, std::vector<size_t> &idx, std::vector<size_t> &key) {
+	size_t n = rows.size();
+	size_t nbc = (fnc + bc - 1) / bc;
+	std::vector<size_t> k(n);
+	idx.resize(0);
+	idx.reserve(n);
+	for (size_t i=0; i<n; i++) {
+		if ((rows[i] < 0) || (cols[i] < 0) || (rows[i] >= (int_64)fnr) || (cols[i] >= (int_64)fnc)) continue;
+		k[i] = (rows[i] / br) * nbc + (cols[i] / bc);
+		idx.push_back(i);
 	}
-
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
-
-	GDALRasterBand *poBand;
-
-    if( poDataset == NULL )  {
-		return errout;
+	// cells are often (partly) in order already
+	auto before = [&k](size_t a, size_t b) { return k[a] < k[b]; };
+	if (!std::is_sorted(idx.begin(), idx.end(), before)) {
+		std::stable_sort(idx.begin(), idx.end(), before);
 	}
+	key.resize(idx.size());
+	for (size_t i=0; i<idx.size(); i++) {
+		key[i] = k[idx[i]];
+	}
+}
 
-	std::vector<unsigned> lyrs = source[src].layers;
-	unsigned nl = lyrs.size();
-	unsigned n = rows.size();
 
-	size_t fnr = nrow() - 1;
-	if (source[src].flipped) {
-		for (size_t i=0; i<n; i++) {
-			rows[i] = fnr - rows[i];
-		}
-	}
+// Read the values of cells (rows and cols of the file) for all layers of a source into "out"
+// (band sequential, NAN for cells outside the file). Instead of reading the cells one by one,
+// in the order given, the cells are grouped by the (native) block of the file they are in,
+// and each block is read once. Reading a block is as expensive as reading a single cell from
+// it, as GDAL reads the whole block anyway. Blocks with few cells are read cell by cell.
+static bool readCellsGDAL(GDALDataset *poDataset, SpatRasterSource &s, size_t fnr, size_t fnc, const std::vector<int_64> &rows, const std::vector<int_64> &cols, std::vector<double> &out) {
+
+	size_t nl = s.layers.size();
+	size_t n = rows.size();
+	out.resize(0);
+	out.resize(n * nl, NAN);
 
 	std::vector<int> panBandMap;
-	if (!source[src].in_order()) {
+	if (!s.in_order()) {
 		panBandMap.reserve(nl);
 		for (size_t i=0; i < nl; i++) {
-			panBandMap.push_back(lyrs[i]+1);
+			panBandMap.push_back(s.layers[i]+1);
 		}
 	}
+	int *bandmap = panBandMap.empty() ? NULL : &panBandMap[0];
 
-	std::vector<double> out(n * nl, NAN);
-	CPLErr err = CE_None;
-	for (size_t j=0; j < n; j++) {
-		if ((cols[j] < 0) || (rows[j] < 0)) continue;
-		if (panBandMap.size() > 0) {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
+	size_t br = 1, bc = fnc;
+	if ((!s.blockrows.empty()) && (s.blockrows[0] > 0) && (s.blockcols[0] > 0)) {
+		br = std::min(fnr, (size_t)s.blockrows[0]);
+		bc = std::min(fnc, (size_t)s.blockcols[0]);
+	}
+	// not too much memory for files that are a single block
+	size_t maxcells = std::max((size_t)1, (size_t)2097152 / nl);
+	if ((br * bc) > maxcells) {
+		if (bc > maxcells) {
+			bc = maxcells;
+			br = 1;
 		} else {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
-		}
-		if (err != CE_None ) { 
-			break;
+			br = maxcells / bc;
 		}
 	}
+	size_t nbc = (fnc + bc - 1) / bc;
 
-	if (err == CE_None ) { 
-		std::vector<double> naflags(nl, NAN);
-		int hasNA;
-		for (size_t i=0; i<nl; i++) {
-			poBand = poDataset->GetRasterBand(lyrs[i]+1);
-			double naflag = poBand->GetNoDataValue(&hasNA);
-			if (hasNA)  naflags[i] = naflag;
-		}
-		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
-	}
+	std::vector<size_t> idx, key;
+	block_order(rows, cols, fnr, fnc, br, bc, idx, key);
 
-	GDALClose((GDALDatasetH) poDataset);
-	if (err != CE_None ) {
-		setError("cannot read values");
-		return errout;
+	std::vector<double> v;
+	CPLErr err = CE_None;
+	for (size_t i=0; i<idx.size(); ) {
+		size_t j = i + 1;
+		while ((j < idx.size()) && (key[j] == key[i])) j++;
+		size_t r0 = (key[i] / nbc) * br;
+		size_t c0 = (key[i] % nbc) * bc;
+		size_t nr = std::min(br, fnr - r0);
+		size_t nc = std::min(bc, fnc - c0);
+		size_t ncell = nr * nc;
+		if (((j - i) * 64) < ncell) {
+			v.resize(nl);
+			for (size_t k=i; k<j; k++) {
+				size_t m = idx[k];
+				err = poDataset->RasterIO(GF_Read, cols[m], rows[m], 1, 1, &v[0], 1, 1, GDT_Float64, nl, bandmap, 0, 0, 0, NULL);
+				if (err != CE_None) return false;
+				for (size_t b=0; b<nl; b++) {
+					out[b*n + m] = v[b];
+				}
+			}
+		} else {
+			v.resize(ncell * nl);
+			err = poDataset->RasterIO(GF_Read, c0, r0, nc, nr, &v[0], nc, nr, GDT_Float64, nl, bandmap, 0, 0, 0, NULL);
+			if (err != CE_None) return false;
+			for (size_t k=i; k<j; k++) {
+				size_t m = idx[k];
+				size_t cell = (rows[m] - r0) * nc + (cols[m] - c0);
+				for (size_t b=0; b<nl; b++) {
+					out[b*n + m] = v[b*ncell + cell];
+				}
+			}
+		}
+		i = j;
 	}
 
-
-	size_t nr = rows.size();
-	std::vector<std::vector<double>> r(nl, std::vector<double> (nr));
-	for (size_t i=0; i<nr; i++) {
-		for (size_t j=0; j<nl; j++) {
-			size_t k = (i*nl) + j;
-			r[j][i] = out[k];  
-		}
+	std::vector<double> naflags(nl, NAN);
+	int hasNA;
+	for (size_t i=0; i<nl; i++) {
+		GDALRasterBand *poBand = poDataset->GetRasterBand(s.layers[i]+1);
+		double naflag = poBand->GetNoDataValue(&hasNA);
+		if (hasNA)  naflags[i] = naflag;
 	}
-	return r;
+	NAso(out, n, naflags, s.scale, s.offset, s.has_scale_offset, s.hasNAflag, s.NAflag);
+	return true;
 }
 
 
-
-
+// The values of cells (rows and cols) of a source, band sequential. The file is read with
+// the connection opened by readStart, if there is one
 std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
 
 	std::vector<double> errout;
@@ -1338,64 +1479,52 @@ std::vector<double> SpatRaster::readRowColGDALFlat(unsigned src, std::vector<int
 		return errout;
 	}
 
-    GDALDataset *poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
-
-	GDALRasterBand *poBand;
-
-    if( poDataset == NULL )  {
-		return errout;
+	bool isopen = source[src].open_read && (source[src].gdalconnection != NULL);
+	GDALDataset *poDataset;
+	if (isopen) {
+		poDataset = source[src].gdalconnection;
+	} else {
+		poDataset = openGDAL(source[src].filename, GDAL_OF_RASTER | GDAL_OF_READONLY, source[src].open_ops);
+		if( poDataset == NULL )  {
+			setError("cannot read from " + source[src].filename);
+			return errout;
+		}
 	}
 
-	std::vector<unsigned> lyrs = source[src].layers;
-	unsigned nl = lyrs.size();
-	unsigned n = rows.size();
-
-	size_t fnr = nrow() - 1;
+	size_t fnr = source[src].hasWindow ? source[src].window.full_nrow : nrow();
+	size_t fnc = source[src].hasWindow ? source[src].window.full_ncol : ncol();
+	size_t n = rows.size();
 	if (source[src].flipped) {
 		for (size_t i=0; i<n; i++) {
-			rows[i] = fnr - rows[i];
+			if (rows[i] >= 0) rows[i] = fnr - 1 - rows[i];
 		}
 	}
 
-	std::vector<int> panBandMap;
-	if (!source[src].in_order()) {
-		panBandMap.reserve(nl);
-		for (size_t i=0; i < nl; i++) {
-			panBandMap.push_back(lyrs[i]+1);
-		}
+	std::vector<double> out;
+	bool ok = readCellsGDAL(poDataset, source[src], fnr, fnc, rows, cols, out);
+	if (!isopen) {
+		GDALClose((GDALDatasetH) poDataset);
 	}
-
-	std::vector<double> out(n * nl, NAN);
-	CPLErr err = CE_None;
-	for (size_t j=0; j < n; j++) {
-		if ((cols[j] < 0) || (rows[j] < 0)) continue;
-		if (panBandMap.size() > 0) {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, &panBandMap[0], 0, 0, 0, NULL);
-		} else {
-			err = poDataset->RasterIO(GF_Read, cols[j], rows[j], 1, 1, &out[j*nl], 1, 1, GDT_Float64, nl, NULL, 0, 0, 0, NULL);
-		}
-		if (err != CE_None ) { 
-			break;
-		}
-	}
-
-	if (err == CE_None ) { 
-		std::vector<double> naflags(nl, NAN);
-		int hasNA;
-		for (size_t i=0; i<nl; i++) {
-			poBand = poDataset->GetRasterBand(lyrs[i]+1);
-			double naflag = poBand->GetNoDataValue(&hasNA);
-			if (hasNA)  naflags[i] = naflag;
-		}
-		NAso(out, n, naflags, source[src].scale, source[src].offset, source[src].has_scale_offset, source[src].hasNAflag, source[src].NAflag);
-	}
-
-	GDALClose((GDALDatasetH) poDataset);
-	if (err != CE_None ) {
+	if (!ok) {
 		setError("cannot read values");
 		return errout;
 	}
+	return out;
+}
+
+
+std::vector<std::vector<double>> SpatRaster::readRowColGDAL(unsigned src, std::vector<int_64> &rows, const std::vector<int_64> &cols) {
 
+	std::vector<std::vector<double>> errout;
+	std::vector<double> v = readRowColGDALFlat(src, rows, cols);
+	if (hasError()) return errout;
+
+	size_t nl = source[src].layers.size();
+	size_t n = rows.size();
+	std::vector<std::vector<double>> out(nl);
+	for (size_t i=0; i<nl; i++) {
+		out[i] = std::vector<double>(v.begin() + i*n, v.begin() + (i+1)*n);
+	}
 	return out;
 }
 
@@ -42,8 +42,8 @@ void recycle(std::vector<T> &v, unsigned n) {
 }
 */
 
-template <typename T>
-void recycle(std::vector<T> &x, std::vector<T> &y) {
+template <typename T, typename U>
+void recycle(std::vector<T> &x, std::vector<U> &y) {
 	size_t xsize = x.size();
 	size_t ysize = y.size();
 	if (xsize != ysize) {
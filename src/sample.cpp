@@ -105,6 +105,10 @@ SpatRaster SpatRaster::sampleRegularRaster(unsigned size) {
 	for (size_t src=0; src<nsrc(); src++) {
 		if (source[src].memory) {
 			v = readSample(src, nr, nc);
+		} else if (source[src].lazy) {
+			v = readSampleLazy(src, nr, nc);
+		} else if (source[src].driver == "mmap") {
+			v = readSampleMMap(src, nr, nc);
 		//} else if (source[src].driver == "raster") {
 		//	v = readSampleBinary(src, nr, nc);
 		} else {
@@ -113,7 +117,8 @@ SpatRaster SpatRaster::sampleRegularRaster(unsigned size) {
 			#endif
 		}
 		if (hasError()) return out;
-		out.source[0].values.insert(out.source[0].values.end(), v.begin(), v.end());
+		std::vector<double> &ov = out.source[0].values.edit();
+		ov.insert(ov.end(), v.begin(), v.end());
 	}
 	out.source[0].memory = true;
 	out.source[0].hasValues = true;
@@ -144,6 +149,10 @@ SpatRaster SpatRaster::sampleRowColRaster(size_t nr, size_t nc) {
 	for (size_t src=0; src<nsrc(); src++) {
 		if (source[src].memory) {
 			v = readSample(src, nr, nc);
+		} else if (source[src].lazy) {
+			v = readSampleLazy(src, nr, nc);
+		} else if (source[src].driver == "mmap") {
+			v = readSampleMMap(src, nr, nc);
 		//} else if (source[src].driver == "raster") {
 		//	v = readSampleBinary(src, nr, nc);
 		} else {
@@ -152,7 +161,8 @@ SpatRaster SpatRaster::sampleRowColRaster(size_t nr, size_t nc) {
 			#endif
 		}
 		if (hasError()) return out;
-		out.source[0].values.insert(out.source[0].values.end(), v.begin(), v.end());
+		std::vector<double> &ov = out.source[0].values.edit();
+		ov.insert(ov.end(), v.begin(), v.end());
 	}
 	out.source[0].memory = true;
 	out.source[0].hasValues = true;
@@ -191,6 +201,10 @@ std::vector<std::vector<double>> SpatRaster::sampleRegularValues(unsigned size,
 	for (size_t src=0; src<nsrc(); src++) {
 		if (source[src].memory) {
 			v = readSample(src, nr, nc);
+		} else if (source[src].lazy) {
+			v = readSampleLazy(src, nr, nc);
+		} else if (source[src].driver == "mmap") {
+			v = readSampleMMap(src, nr, nc);
 		//} else if (source[src].driver == "raster") {
 		//	v = readSampleBinary(src, nr, nc);
 		} else {
@@ -237,6 +251,10 @@ std::vector<std::vector<double>> SpatRaster::sampleRowColValues(size_t nr, size_
 	for (size_t src=0; src<nsrc(); src++) {
 		if (source[src].memory) {
 			v = readSample(src, nr, nc);
+		} else if (source[src].lazy) {
+			v = readSampleLazy(src, nr, nc);
+		} else if (source[src].driver == "mmap") {
+			v = readSampleMMap(src, nr, nc);
 		} else {
 		    #ifdef useGDAL
 			v = readGDALsample(src, nr, nc);
@@ -491,8 +509,9 @@ SpatRaster SpatRaster::sampleRandomRaster(unsigned size, bool replace, unsigned
 	nsize = nr * nc;
 	std::vector<std::vector<double>> vv = sampleRandomValues(nsize, replace, seed);
 
+	std::vector<double> &ov = out.source[0].values.edit();
 	for (size_t i=0; i<vv.size(); i++) {
-		out.source[0].values.insert(out.source[0].values.end(), vv[i].begin(), vv[i].end());
+		ov.insert(ov.end(), vv[i].begin(), vv[i].end());
 	}
 	out.source[0].memory = true;
 	out.source[0].hasValues = true;
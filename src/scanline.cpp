@@ -0,0 +1,492 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include "spatRaster.h"
+#include "scanline.h"
+#include <algorithm>
+#include <cmath>
+
+
+void merge_runs(std::vector<CellRun> &runs) {
+	if (runs.size() < 2) return;
+	auto before = [](const CellRun &a, const CellRun &b) {
+		return (a.row < b.row) || ((a.row == b.row) && (a.col_start < b.col_start));
+	};
+	if (!std::is_sorted(runs.begin(), runs.end(), before)) {
+		std::sort(runs.begin(), runs.end(), before);
+	}
+	size_t j = 0;
+	for (size_t i=1; i<runs.size(); i++) {
+		if ((runs[i].row == runs[j].row) && (runs[i].col_start <= (runs[j].col_end + 1))) {
+			runs[j].col_end = std::max(runs[j].col_end, runs[i].col_end);
+		} else {
+			j++;
+			runs[j] = runs[i];
+		}
+	}
+	runs.resize(j+1);
+}
+
+
+size_t run_cells(const std::vector<CellRun> &runs) {
+	size_t n = 0;
+	for (const CellRun &r : runs) {
+		n += r.col_end - r.col_start + 1;
+	}
+	return n;
+}
+
+
+// the cells i (the interval [i, i+1]) out of n that have their interior in [a, b].
+// If a == b is on the edge between two cells, there is no such cell, unless
+// closed is true; then it is the cell that starts at a.
+static bool cell_span(double a, double b, size_t n, bool closed, size_t &i0, size_t &i1) {
+	if (!(std::isfinite(a) && std::isfinite(b))) return false;
+	double f = std::floor(a);
+	double e;
+	if (a < b) {
+		e = std::ceil(b) - 1;
+	} else {
+		e = ((f == a) && (!closed)) ? f - 1 : f;
+	}
+	if ((e < f) || (e < 0) || (f >= n)) return false;
+	i0 = f < 0 ? 0 : f;
+	i1 = e >= n ? n - 1 : e;
+	return true;
+}
+
+
+void ScanlineRasterizer::segmentCells(double u0, double v0, double u1, double v1, bool closed, std::vector<CellRun> &out) {
+	if (v0 > v1) {
+		std::swap(u0, u1);
+		std::swap(v0, v1);
+	}
+	size_t r0, r1;
+	if (!cell_span(v0, v1, nr, closed, r0, r1)) return;
+	bool flat = !(v1 > v0);
+	double dudv = flat ? 0 : (u1 - u0) / (v1 - v0);
+	for (size_t r=r0; r<=r1; r++) {
+		double ua, ub;
+		if (flat) {
+			ua = u0;
+			ub = u1;
+		} else {
+			// the part of the segment in this row
+			ua = u0 + (std::max(v0, (double)r) - v0) * dudv;
+			ub = u0 + (std::min(v1, (double)(r+1)) - v0) * dudv;
+		}
+		if (ua > ub) std::swap(ua, ub);
+		size_t c0, c1;
+		if (cell_span(ua, ub, nc, closed, c0, c1)) {
+			out.push_back({r, c0, c1});
+		}
+	}
+}
+
+
+void ScanlineRasterizer::addRing(const std::vector<double> &x, const std::vector<double> &y, double xmin, double xres, double ymax, double yres) {
+	size_t n = x.size();
+	if (n < 2) return;
+	bool isclosed = (x[0] == x[n-1]) && (y[0] == y[n-1]);
+	size_t ne = isclosed ? n-1 : n;
+	edges.reserve(edges.size() + ne);
+	for (size_t i=0; i<ne; i++) {
+		size_t j = (i+1) < n ? i+1 : 0;
+		edges.push_back({(x[i] - xmin) / xres, (ymax - y[i]) / yres, (x[j] - xmin) / xres, (ymax - y[j]) / yres});
+	}
+}
+
+
+void ScanlineRasterizer::addLine(const std::vector<double> &x, const std::vector<double> &y, double xmin, double xres, double ymax, double yres) {
+	size_t n = x.size();
+	if (n == 1) {
+		addPoints(x, y, xmin, xres, ymax, yres);
+		return;
+	}
+	for (size_t i=1; i<n; i++) {
+		segmentCells((x[i-1] - xmin) / xres, (ymax - y[i-1]) / yres, (x[i] - xmin) / xres, (ymax - y[i]) / yres, true, lines);
+	}
+}
+
+
+void ScanlineRasterizer::addPoints(const std::vector<double> &x, const std::vector<double> &y, double xmin, double xres, double ymax, double yres) {
+	size_t r, c;
+	for (size_t i=0; i<x.size(); i++) {
+		double u = (x[i] - xmin) / xres;
+		double v = (ymax - y[i]) / yres;
+		if (cell_span(u, u, nc, true, c, c) && cell_span(v, v, nr, true, r, r)) {
+			lines.push_back({r, c, c});
+		}
+	}
+}
+
+
+std::vector<CellRun> ScanlineRasterizer::runs(bool touches) {
+
+	std::vector<CellRun> out;
+	out.swap(lines);
+	if (touches) {
+		for (const Edge &e : edges) {
+			segmentCells(e.u0, e.v0, e.u1, e.v1, false, out);
+		}
+	}
+
+	// The center of the cells in row r is on the line v = r + 0.5. An edge crosses
+	// that line if v0 <= r + 0.5 < v1; that is, in rows "first" to "last".
+	// Horizontal edges cross no line and are ignored.
+	struct ScanEdge {
+		size_t first, last;
+		double u0, v0, dudv;
+	};
+	std::vector<ScanEdge> se;
+	se.reserve(edges.size());
+	for (const Edge &e : edges) {
+		double u0 = e.u0, v0 = e.v0, u1 = e.u1, v1 = e.v1;
+		if (v0 > v1) {
+			std::swap(u0, u1);
+			std::swap(v0, v1);
+		}
+		if (!(v1 > v0)) continue;
+		double first = std::ceil(v0 - 0.5);
+		double last = std::ceil(v1 - 0.5) - 1;
+		if ((last < first) || (last < 0) || (first >= nr)) continue;
+		se.push_back({first < 0 ? 0 : (size_t)first, last >= nr ? nr - 1 : (size_t)last, u0, v0, (u1 - u0) / (v1 - v0)});
+	}
+	std::vector<Edge>().swap(edges);
+	if (se.empty()) {
+		merge_runs(out);
+		return out;
+	}
+	std::sort(se.begin(), se.end(), [](const ScanEdge &a, const ScanEdge &b) { return a.first < b.first; });
+
+	std::vector<size_t> active;
+	std::vector<double> u;
+	size_t next = 0;
+	size_t r = se[0].first;
+	while ((next < se.size()) || (!active.empty())) {
+		if (active.empty() && (se[next].first > r)) {
+			r = se[next].first;
+		}
+		while ((next < se.size()) && (se[next].first <= r)) {
+			active.push_back(next);
+			next++;
+		}
+		double vc = r + 0.5;
+		u.resize(0);
+		for (size_t i=0; i<active.size(); ) {
+			const ScanEdge &e = se[active[i]];
+			u.push_back(e.u0 + (vc - e.v0) * e.dudv);
+			if (e.last == r) {
+				active[i] = active.back();
+				active.pop_back();
+			} else {
+				i++;
+			}
+		}
+		std::sort(u.begin(), u.end());
+		// even-odd: cells with their center (c + 0.5) in [u[i], u[i+1])
+		for (size_t i=1; i<u.size(); i+=2) {
+			double c0 = std::ceil(u[i-1] - 0.5);
+			double c1 = std::ceil(u[i] - 0.5) - 1;
+			if ((c1 < c0) || (c1 < 0) || (c0 >= nc)) continue;
+			out.push_back({r, c0 < 0 ? 0 : (size_t)c0, c1 >= nc ? nc - 1 : (size_t)c1});
+		}
+		r++;
+	}
+	merge_runs(out);
+	return out;
+}
+
+
+std::vector<CellRun> SpatRaster::rasterizeRuns(const SpatGeom &g, bool touches) {
+	std::vector<CellRun> out;
+	SpatExtent e = getExtent();
+	if ((g.extent.xmin > e.xmax) || (g.extent.xmax < e.xmin) || (g.extent.ymin > e.ymax) || (g.extent.ymax < e.ymin)) {
+		return out;
+	}
+	double xr = xres();
+	double yr = yres();
+	ScanlineRasterizer s(nrow(), ncol());
+	for (const SpatPart &p : g.parts) {
+		if (g.gtype == polygons) {
+			s.addRing(p.x, p.y, e.xmin, xr, e.ymax, yr);
+			for (const SpatHole &h : p.holes) {
+				s.addRing(h.x, h.y, e.xmin, xr, e.ymax, yr);
+			}
+		} else if (g.gtype == lines) {
+			s.addLine(p.x, p.y, e.xmin, xr, e.ymax, yr);
+		} else {
+			s.addPoints(p.x, p.y, e.xmin, xr, e.ymax, yr);
+		}
+	}
+	return s.runs(touches);
+}
+
+
+// the cell numbers of runs; or, if there are none, the cells with a node of
+// the geometries (a polygon may be too small to cover the center of a cell)
+static std::vector<double> cells_from_runs(SpatRaster &x, const std::vector<CellRun> &runs, const SpatGeom *geoms, size_t ng) {
+	std::vector<double> cells;
+	cells.reserve(run_cells(runs));
+	double nc = x.ncol();
+	for (const CellRun &r : runs) {
+		double off = r.row * nc;
+		for (size_t c=r.col_start; c<=r.col_end; c++) {
+			cells.push_back(off + c);
+		}
+	}
+	if (cells.empty()) {
+		for (size_t i=0; i<ng; i++) {
+			for (const SpatPart &p : geoms[i].parts) {
+				std::vector<double> pc = x.cellFromXY(p.x, p.y);
+				for (double &d : pc) {
+					if (!std::isnan(d)) cells.push_back(d);
+				}
+			}
+		}
+		std::sort(cells.begin(), cells.end());
+		cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+		if (cells.empty()) {
+			cells.resize(1, NAN);
+		}
+	}
+	return cells;
+}
+
+
+std::vector<double> SpatRaster::rasterizeCells(const SpatGeom &g, bool touches) {
+	std::vector<CellRun> runs = rasterizeRuns(g, touches);
+	return cells_from_runs(*this, runs, &g, 1);
+}
+
+
+std::vector<double> SpatRaster::rasterizeCells(SpatVector &v, bool touches, SpatOptions &opt) {
+	if (v.size() == 1) {
+		return rasterizeCells(v.geoms[0], touches);
+	}
+	std::vector<CellRun> runs;
+	for (size_t i=0; i<v.size(); i++) {
+		std::vector<CellRun> r = rasterizeRuns(v.geoms[i], touches);
+		runs.insert(runs.end(), r.begin(), r.end());
+	}
+	merge_runs(runs);
+	return cells_from_runs(*this, runs, v.geoms.data(), v.size());
+}
+
+
+CoverageFraction::CoverageFraction(size_t nrow, size_t ncol, double _xmin, double _xres, double _ymax, double _yres, bool _lonlat) :
+	nr(nrow), nc(ncol), xmin(_xmin), xres(_xres), ymax(_ymax), yres(_yres), lonlat(_lonlat) {}
+
+
+void CoverageFraction::addRing(const std::vector<double> &x, const std::vector<double> &y, bool hole) {
+	size_t n = x.size();
+	if (n < 3) return;
+	bool isclosed = (x[0] == x[n-1]) && (y[0] == y[n-1]);
+	size_t ne = isclosed ? n-1 : n;
+	// twice the signed area, positive if the ring is counter-clockwise
+	double a = 0;
+	for (size_t i=0; i<ne; i++) {
+		size_t j = (i+1) < n ? i+1 : 0;
+		a += (x[i] - x[0]) * (y[j] - y[0]) - (x[j] - x[0]) * (y[i] - y[0]);
+	}
+	if (!(std::fabs(a) > 0)) return;
+	// with v pointing down, a clockwise ring adds a positive area
+	double f = a > 0 ? -1 : 1;
+	if (hole) f = -f;
+	for (size_t i=0; i<ne; i++) {
+		size_t j = (i+1) < n ? i+1 : 0;
+		addSegment((x[i] - xmin) / xres, (ymax - y[i]) / yres, (x[j] - xmin) / xres, (ymax - y[j]) / yres, f);
+	}
+}
+
+
+void CoverageFraction::addSegment(double u0, double v0, double u1, double v1, double f) {
+	double du = u1 - u0;
+	// vertical segments add no area
+	if (!(std::fabs(du) > 0)) return;
+	double dv = v1 - v0;
+	if (std::isnan(dv)) return;
+	// only the part of the segment within the columns of the raster matters
+	double ta = (0 - u0) / du;
+	double tb = (nc - u0) / du;
+	if (ta > tb) std::swap(ta, tb);
+	ta = std::max(ta, 0.0);
+	tb = std::min(tb, 1.0);
+	if (!(ta < tb)) return;
+
+	// split the segment where it crosses a column or a row
+	std::vector<double> t {ta, tb};
+	double ua = u0 + ta * du;
+	double ub = u0 + tb * du;
+	double umax = std::max(ua, ub);
+	for (double k = std::floor(std::min(ua, ub)) + 1; k < umax; k++) {
+		t.push_back((k - u0) / du);
+	}
+	if (dv != 0) {
+		double va = v0 + ta * dv;
+		double vb = v0 + tb * dv;
+		double vmax = std::max(va, vb);
+		for (double k = std::max(0.0, std::floor(std::min(va, vb)) + 1); (k < vmax) && (k <= nr); k++) {
+			t.push_back((k - v0) / dv);
+		}
+	}
+	std::sort(t.begin(), t.end());
+
+	double d2r = M_PI / 180;
+	for (size_t i=1; i<t.size(); i++) {
+		if (!(t[i] > t[i-1])) continue;
+		double w = (t[i] - t[i-1]) * du * f;
+		double um = u0 + 0.5 * (t[i-1] + t[i]) * du;
+		size_t c = um < 0 ? 0 : (um >= nc ? nc - 1 : (size_t)um);
+		double vm = v0 + 0.5 * (t[i-1] + t[i]) * dv;
+		if (vm < 0) {
+			// above the raster: the piece covers all rows of the column
+			carry.push_back({0, c, w});
+		} else if (vm >= nr) {
+			below = true;
+		} else {
+			size_t r = vm;
+			// the fraction of the height of the cell that is below the piece
+			double h;
+			if (lonlat) {
+				// area on the sphere is proportional to the difference in the sine of the latitude;
+				// the mean of sin(y) along the piece is sin(ym) * sinc(dy/2)
+				double yt = (ymax - r * yres) * d2r;
+				double yb = yt - yres * d2r;
+				double ym = (ymax - vm * yres) * d2r;
+				double hd = 0.5 * std::fabs((t[i] - t[i-1]) * dv) * yres * d2r;
+				double sinc = hd > 0 ? std::sin(hd) / hd : 1;
+				h = (std::sin(ym) * sinc - std::sin(yb)) / (std::sin(yt) - std::sin(yb));
+			} else {
+				h = r + 1 - vm;
+			}
+			local.push_back({r, c, w * h});
+			if ((r + 1) < nr) {
+				carry.push_back({r+1, c, w});
+			}
+		}
+	}
+}
+
+
+void CoverageFraction::fractions(std::vector<double> &cells, std::vector<double> &weights) {
+	cells.resize(0);
+	weights.resize(0);
+	if (local.empty() && carry.empty()) {
+		below = false;
+		return;
+	}
+	auto before = [](const CellValue &a, const CellValue &b) {
+		return (a.row < b.row) || ((a.row == b.row) && (a.col < b.col));
+	};
+	std::sort(local.begin(), local.end(), before);
+	std::sort(carry.begin(), carry.end(), before);
+	// one value per cell
+	size_t j = 0;
+	for (size_t i=1; i<local.size(); i++) {
+		if ((local[i].row == local[j].row) && (local[i].col == local[j].col)) {
+			local[j].value += local[i].value;
+		} else {
+			j++;
+			local[j] = local[i];
+		}
+	}
+	if (!local.empty()) local.resize(j+1);
+
+	size_t r0 = nr, r1 = 0, c0 = nc, c1 = 0;
+	for (const std::vector<CellValue> *cv : {&local, &carry}) {
+		if (cv->empty()) continue;
+		r0 = std::min(r0, cv->front().row);
+		r1 = std::max(r1, cv->back().row);
+		for (const CellValue &d : *cv) {
+			c0 = std::min(c0, d.col);
+			c1 = std::max(c1, d.col);
+		}
+	}
+	// a polygon that extends below the raster covers cells up to the last row
+	if (below) r1 = nr - 1;
+
+	double dnc = nc;
+	std::vector<double> cc(c1 - c0 + 1, 0);
+	size_t ic = 0, il = 0;
+	for (size_t r=r0; r<=r1; r++) {
+		for (; (ic < carry.size()) && (carry[ic].row <= r); ic++) {
+			cc[carry[ic].col - c0] += carry[ic].value;
+		}
+		for (size_t k=0; k<cc.size(); k++) {
+			size_t c = c0 + k;
+			double w = cc[k];
+			if ((il < local.size()) && (local[il].row == r) && (local[il].col == c)) {
+				w += local[il].value;
+				il++;
+			}
+			// rounding errors in the carry are removed such that covered cells get 1
+			if (w > 1e-9) {
+				cells.push_back(r * dnc + c);
+				weights.push_back(w > (1 - 1e-9) ? 1 : w);
+			}
+		}
+	}
+	std::vector<CellValue>().swap(local);
+	std::vector<CellValue>().swap(carry);
+	below = false;
+}
+
+
+void SpatRaster::rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, const SpatGeom &g, bool lonlat) {
+	SpatExtent e = getExtent();
+	CoverageFraction cf(nrow(), ncol(), e.xmin, xres(), e.ymax, yres(), lonlat);
+	if (g.gtype == polygons) {
+		for (const SpatPart &p : g.parts) {
+			cf.addRing(p.x, p.y, false);
+			for (const SpatHole &h : p.holes) {
+				cf.addRing(h.x, h.y, true);
+			}
+		}
+	}
+	cf.fractions(cells, weights);
+	if (cells.empty()) {
+		cells.resize(1, NAN);
+		weights.resize(1, NAN);
+	}
+}
+
+
+void SpatRaster::rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt) {
+	SpatExtent e = getExtent();
+	CoverageFraction cf(nrow(), ncol(), e.xmin, xres(), e.ymax, yres(), is_lonlat());
+	for (size_t i=0; i<v.size(); i++) {
+		if (v.geoms[i].gtype != polygons) continue;
+		for (const SpatPart &p : v.geoms[i].parts) {
+			cf.addRing(p.x, p.y, false);
+			for (const SpatHole &h : p.holes) {
+				cf.addRing(h.x, h.y, true);
+			}
+		}
+	}
+	cf.fractions(cells, weights);
+	if (cells.empty()) {
+		cells.resize(1, NAN);
+		weights.resize(1, NAN);
+	}
+}
+
+
+void SpatRaster::rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt) {
+	rasterizeCellsExact(cells, weights, v, opt);
+}
+
@@ -0,0 +1,100 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATSCANLINE_GUARD
+#define SPATSCANLINE_GUARD
+
+#include <vector>
+#include <cstddef>
+
+// the cells col_start to col_end (inclusive) of a row of a raster
+struct CellRun {
+	size_t row;
+	size_t col_start;
+	size_t col_end;
+};
+
+// sort runs by row and column, and merge the runs that overlap or are adjacent
+void merge_runs(std::vector<CellRun> &runs);
+
+// the number of cells in a set of runs
+size_t run_cells(const std::vector<CellRun> &runs);
+
+// A polygon rasterizer that works on coordinates in cell units: u = (x - xmin) / xres
+// and v = (ymax - y) / yres, such that cell (row, col) is the square [col, col+1] x [row, row+1].
+// Rings are added one by one; the interior of all rings together is found with the
+// even-odd rule, such that holes (and overlapping parts) are excluded.
+class ScanlineRasterizer {
+	public:
+		ScanlineRasterizer(size_t nrow, size_t ncol) : nr(nrow), nc(ncol) {}
+		virtual ~ScanlineRasterizer(){}
+
+		// add a polygon ring (closed or not)
+		void addRing(const std::vector<double> &x, const std::vector<double> &y, double xmin, double xres, double ymax, double yres);
+		// add a line; its cells are the cells it passes through
+		void addLine(const std::vector<double> &x, const std::vector<double> &y, double xmin, double xres, double ymax, double yres);
+		// add points; each point covers the cell that it is in
+		void addPoints(const std::vector<double> &x, const std::vector<double> &y, double xmin, double xres, double ymax, double yres);
+
+		// The cells covered. For polygons, these are the cells with their center inside,
+		// or, if touches is true, also the cells with their interior crossed by the boundary.
+		// The object is emptied such that it can be reused
+		std::vector<CellRun> runs(bool touches);
+
+	private:
+		struct Edge {
+			double u0, v0, u1, v1;
+		};
+		size_t nr, nc;
+		std::vector<Edge> edges;
+		std::vector<CellRun> lines;
+		void segmentCells(double u0, double v0, double u1, double v1, bool closed, std::vector<CellRun> &out);
+};
+
+
+// The exact fraction of each cell that is covered by polygons. The boundary of each ring is
+// split where it crosses the rows and columns of the raster. A piece of the boundary in cell
+// (row, col) adds the area between the piece and the bottom of the cell to that cell, and its
+// width to all cells below it in that column (the "carry" of the column). That is Green's
+// theorem applied to each cell, such that the cost is proportional to the number of cells on
+// the boundary plus the number of cells in the extent of the polygon. For lon/lat rasters, the
+// areas are computed on the sphere (cells get narrower towards the poles).
+class CoverageFraction {
+	public:
+		CoverageFraction(size_t nrow, size_t ncol, double xmin, double xres, double ymax, double yres, bool lonlat);
+		virtual ~CoverageFraction(){}
+
+		// add a polygon ring (closed or not). The orientation of the ring does not matter
+		void addRing(const std::vector<double> &x, const std::vector<double> &y, bool hole);
+		// the cells that are covered (in cell order), and the fraction of each that is covered.
+		// The object is emptied such that it can be reused
+		void fractions(std::vector<double> &cells, std::vector<double> &weights);
+
+	private:
+		struct CellValue {
+			size_t row, col;
+			double value;
+		};
+		size_t nr, nc;
+		double xmin, xres, ymax, yres;
+		bool lonlat;
+		bool below = false;
+		std::vector<CellValue> local, carry;
+		void addSegment(double u0, double v0, double u1, double v1, double f);
+};
+
+#endif
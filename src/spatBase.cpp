@@ -18,6 +18,7 @@
 #include "spatRaster.h"
 #include "string_utils.h"
 #include "math_utils.h"
+#include <thread>
 
 
 SpatOptions::SpatOptions() {}
@@ -29,6 +30,10 @@ SpatOptions::SpatOptions(const SpatOptions &opt) {
 	memmax = opt.memmax;
 	todisk = opt.todisk;
 	tolerance = opt.tolerance;
+	threads = opt.threads;
+	nthreads = opt.nthreads;
+	lazy = opt.lazy;
+	tempfiletype = opt.tempfiletype;
 
 	def_datatype = opt.def_datatype;
 	def_filetype = opt.def_filetype; 
@@ -210,6 +215,28 @@ size_t SpatOptions::get_steps(){ return steps; }
 void SpatOptions::set_ncopies(size_t n) { ncopies = std::max((size_t)1, n); }
 size_t SpatOptions::get_ncopies(){ return ncopies; }
 
+void SpatOptions::set_nthreads(unsigned n) { nthreads = n; }
+unsigned SpatOptions::get_nthreads(){ return nthreads; }
+
+unsigned SpatOptions::compute_threads() {
+	if (!threads) return 1;
+	unsigned n = nthreads;
+	if (n == 0) {
+		n = std::thread::hardware_concurrency();
+	}
+	return std::max((unsigned)1, n);
+}
+
+void SpatOptions::set_lazy(bool b) { lazy = b; }
+bool SpatOptions::get_lazy(){ return lazy; }
+
+void SpatOptions::set_tempfiletype(std::string d) {
+	if ((d == "GTiff") || (d == "MMAP")) {
+		tempfiletype = d;
+	}
+}
+std::string SpatOptions::get_tempfiletype(){ return tempfiletype; }
+
 
 bool extent_operator(std::string oper) {
 	std::vector<std::string> f {"==", "!=", ">", "<", ">=", "<="};
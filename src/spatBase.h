@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU General Public License
 // along with spat. If not, see <http://www.gnu.org/licenses/>.
 
+#ifndef SPATBASE_GUARD
+#define SPATBASE_GUARD
+
 #include <vector>
 #include <algorithm>
 #include <string>
@@ -108,6 +111,9 @@ class SpatOptions {
 		double memmin = 134217728; // 1024^3 / 8
 		double memfrac = 0.6;
 		double tolerance = 0.1;
+		unsigned nthreads = 0;
+		bool lazy = false;
+		std::string tempfiletype = "GTiff";
 		
 	public:
 		SpatOptions();
@@ -141,6 +147,9 @@ class SpatOptions {
 		std::vector<std::string> filenames = {""};
 		std::vector<std::string> gdal_options;
 		std::vector<std::string> names;
+		// overview factors (and method, see pyramid.h) for a GDAL file that is written
+		std::vector<int> overviews;
+		std::string overview_method = "mean";
 
 		// permanent
 		bool get_todisk();
@@ -198,6 +207,16 @@ class SpatOptions {
 		size_t get_steps();
 		void set_ncopies(size_t n);
 		size_t get_ncopies();
+		void set_nthreads(unsigned n);
+		unsigned get_nthreads();
+		// number of compute threads to use (1 if threads is false)
+		unsigned compute_threads();
+		// if true, cell-by-cell methods return a raster that is computed when its values are read
+		void set_lazy(bool b);
+		bool get_lazy();
+		// the file format of temporary files; "GTiff" or "MMAP" (see mmap.h)
+		void set_tempfiletype(std::string d);
+		std::string get_tempfiletype();
 
 		SpatMessages msg;
 };
@@ -340,3 +359,4 @@ class SpatSRS {
 		}
 };
 
+#endif
@@ -0,0 +1,159 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#include <numeric>
+#include <queue>
+#include <limits>
+#include "spatIndex.h"
+
+
+inline bool box_overlaps(const SpatExtent &a, const SpatExtent &b) {
+	return (a.xmin <= b.xmax) && (a.xmax >= b.xmin) && (a.ymin <= b.ymax) && (a.ymax >= b.ymin);
+}
+
+inline double box_distance(const SpatExtent &a, const SpatExtent &b) {
+	double dx = std::max(0.0, std::max(a.xmin - b.xmax, b.xmin - a.xmax));
+	double dy = std::max(0.0, std::max(a.ymin - b.ymax, b.ymin - a.ymax));
+	return sqrt(dx * dx + dy * dy);
+}
+
+
+SpatIndex::SpatIndex(const std::vector<SpatExtent> &_boxes, size_t _nodesize) {
+
+	boxes = _boxes;
+	nodesize = std::max((size_t)2, _nodesize);
+	order.reserve(boxes.size());
+	for (size_t i=0; i<boxes.size(); i++) {
+		const SpatExtent &b = boxes[i];
+		if (!(std::isnan(b.xmin) || std::isnan(b.xmax) || std::isnan(b.ymin) || std::isnan(b.ymax))) {
+			order.push_back(i);
+		}
+	}
+	size_t n = order.size();
+	if (n == 0) return;
+
+	// sort by x, cut into vertical slices, and sort each slice by y
+	std::vector<double> cx(boxes.size()), cy(boxes.size());
+	for (size_t i=0; i<boxes.size(); i++) {
+		cx[i] = boxes[i].xmin + boxes[i].xmax;
+		cy[i] = boxes[i].ymin + boxes[i].ymax;
+	}
+	std::sort(order.begin(), order.end(), [&cx](size_t a, size_t b) { return cx[a] < cx[b]; });
+	size_t nleaves = (n + nodesize - 1) / nodesize;
+	size_t nslices = std::ceil(std::sqrt((double)nleaves));
+	size_t slicesize = nodesize * ((nleaves + nslices - 1) / nslices);
+	for (size_t i=0; i<n; i+=slicesize) {
+		size_t end = std::min(n, i + slicesize);
+		std::sort(order.begin()+i, order.begin()+end, [&cy](size_t a, size_t b) { return cy[a] < cy[b]; });
+	}
+
+	std::vector<SpatExtent> level(n);
+	for (size_t i=0; i<n; i++) {
+		level[i] = boxes[order[i]];
+	}
+	levels.push_back(std::move(level));
+	while (levels.back().size() > 1) {
+		std::vector<SpatExtent> &below = levels.back();
+		size_t m = (below.size() + nodesize - 1) / nodesize;
+		std::vector<SpatExtent> above(m);
+		for (size_t k=0; k<m; k++) {
+			size_t start = k * nodesize;
+			size_t end = std::min(below.size(), start + nodesize);
+			SpatExtent e = below[start];
+			for (size_t j=start+1; j<end; j++) {
+				e.xmin = std::min(e.xmin, below[j].xmin);
+				e.xmax = std::max(e.xmax, below[j].xmax);
+				e.ymin = std::min(e.ymin, below[j].ymin);
+				e.ymax = std::max(e.ymax, below[j].ymax);
+			}
+			above[k] = e;
+		}
+		levels.push_back(std::move(above));
+	}
+}
+
+
+void SpatIndex::query(const SpatExtent &e, std::vector<size_t> &hits) {
+	if (levels.empty()) return;
+	// (level, node) pairs that still need to be visited
+	std::vector<std::pair<size_t, size_t>> stack;
+	stack.push_back({levels.size()-1, 0});
+	while (!stack.empty()) {
+		size_t lev = stack.back().first;
+		size_t k = stack.back().second;
+		stack.pop_back();
+		if (!box_overlaps(levels[lev][k], e)) continue;
+		if (lev == 0) {
+			hits.push_back(order[k]);
+		} else {
+			size_t start = k * nodesize;
+			size_t end = std::min(levels[lev-1].size(), start + nodesize);
+			for (size_t j=start; j<end; j++) {
+				stack.push_back({lev-1, j});
+			}
+		}
+	}
+}
+
+
+std::vector<size_t> SpatIndex::query(const SpatExtent &e) {
+	std::vector<size_t> hits;
+	query(e, hits);
+	std::sort(hits.begin(), hits.end());
+	return hits;
+}
+
+
+long SpatIndex::nearest(const SpatExtent &e, std::function<double(size_t)> dist, double &d) {
+
+	d = std::numeric_limits<double>::infinity();
+	long best = -1;
+	if (levels.empty()) return best;
+
+	// best-first search; nodes are visited in order of their distance to e
+	struct Node {
+		double d;
+		size_t lev, k;
+		bool operator<(const Node &other) const { return d > other.d; }
+	};
+	std::priority_queue<Node> pq;
+	size_t top = levels.size()-1;
+	pq.push({box_distance(levels[top][0], e), top, 0});
+	while (!pq.empty()) {
+		Node nd = pq.top();
+		pq.pop();
+		if (nd.d > d) break;
+		if (nd.lev == 0) {
+			size_t i = order[nd.k];
+			double di = dist(i);
+			if ((di < d) || ((di == d) && ((long)i < best))) {
+				d = di;
+				best = i;
+			}
+		} else {
+			size_t start = nd.k * nodesize;
+			std::vector<SpatExtent> &below = levels[nd.lev-1];
+			size_t end = std::min(below.size(), start + nodesize);
+			for (size_t j=start; j<end; j++) {
+				double bd = box_distance(below[j], e);
+				if (bd <= d) pq.push({bd, nd.lev-1, j});
+			}
+		}
+	}
+	return best;
+}
+
@@ -0,0 +1,60 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPATINDEX_GUARD
+#define SPATINDEX_GUARD
+
+#include <vector>
+#include <functional>
+#include "spatBase.h"
+
+// A static R-tree of bounding boxes, bulk loaded with the
+// Sort-Tile-Recursive (STR) algorithm. Items are identified by their
+// position in the vector of boxes that was used to build the tree.
+// Boxes with NAN coordinates are not indexed
+
+class SpatIndex {
+	public:
+		SpatIndex() {};
+		SpatIndex(const std::vector<SpatExtent> &boxes, size_t nodesize=16);
+		virtual ~SpatIndex(){}
+
+		// the number of items (including those that are not indexed)
+		size_t size() { return boxes.size(); }
+		SpatExtent &box(size_t i) { return boxes[i]; }
+
+		// the items with a box that intersects e (touching counts), sorted
+		std::vector<size_t> query(const SpatExtent &e);
+		// appends the items that intersect e to hits, not sorted
+		void query(const SpatExtent &e, std::vector<size_t> &hits);
+
+		// the item with the smallest distance to e. dist(i) must return the
+		// distance of item i, which cannot be smaller than the distance between
+		// e and its box. Returns -1 if there are no items
+		long nearest(const SpatExtent &e, std::function<double(size_t)> dist, double &d);
+
+	private:
+		size_t nodesize = 16;
+		std::vector<SpatExtent> boxes;
+		// levels[0] has the indexed boxes, in STR order, with their ids in "order"
+		// levels[l][k] covers levels[l-1][k*nodesize] ... levels[l-1][(k+1)*nodesize-1]
+		std::vector<std::vector<SpatExtent>> levels;
+		std::vector<size_t> order;
+};
+
+
+#endif
@@ -21,6 +21,7 @@
 #include "spatTime.h"
 #include "recycle.h"
 #include "vecmath.h"
+#include "mmap.h"
 
 #include <set>
 
@@ -30,29 +31,28 @@
 
 
 SpatRaster::SpatRaster(std::string fname, std::vector<int> subds, std::vector<std::string> subdsname, std::vector<std::string> options) {
-#ifdef useGDAL
-	constructFromFile(fname, subds, subdsname, options);
-#endif
+	constructFromAnyFile(fname, subds, subdsname, options);
 }
 
 
 SpatRaster::SpatRaster(std::vector<std::string> fname, std::vector<int> subds, std::vector<std::string> subdsname, bool multi, std::vector<std::string> options, std::vector<size_t> x) {
 // argument "x" is ignored. It is only there to have four arguments such that the  module
 // can distinguish this constructor from another with three arguments. 
-#ifdef useGDAL
 	if (multi) {
+#ifdef useGDAL
 		constructFromFileMulti(fname[0], subdsname[0], x);
+#endif
 		return;
 	}
 
-	if (!constructFromFile(fname[0], subds, subdsname, options)) {
+	if (!constructFromAnyFile(fname[0], subds, subdsname, options)) {
 		setError("cannot open file: " + fname[0]);
 		return;
 	}
 	SpatOptions opt;
 	for (size_t i=1; i<fname.size(); i++) {
 		SpatRaster r;
-		bool ok = r.constructFromFile(fname[i], subds, subdsname, options);
+		bool ok = r.constructFromAnyFile(fname[i], subds, subdsname, options);
 		if (r.msg.has_warning) {
 			addWarning(r.msg.warnings[0]);
 		}
@@ -70,6 +70,18 @@ SpatRaster::SpatRaster(std::vector<std::string> fname, std::vector<int> subds, s
 			return;
 		}
 	}
+}
+
+
+bool SpatRaster::constructFromAnyFile(std::string fname, std::vector<int> subds, std::vector<std::string> subdsname, std::vector<std::string> options) {
+	if (is_mmap_file(fname)) {
+		return constructFromMMap(fname);
+	}
+#ifdef useGDAL
+	return constructFromFile(fname, subds, subdsname, options);
+#else
+	setError("GDAL is not available");
+	return false;
 #endif
 }
 
@@ -435,7 +447,7 @@ SpatRaster SpatRaster::sources_to_disk(std::vector<std::string> &tmpfs, bool uni
 	SpatOptions ops(opt);
 	for (size_t i=0; i<nsrc; i++) {
 		bool write = false;
-		if (!source[i].in_order() || source[i].memory) {
+		if (!source[i].in_order() || source[i].memory || source[i].lazy) {
 			write = true;
 		} else if (unique) {
 			ufs.insert(source[i].filename);
@@ -447,7 +459,8 @@ SpatRaster SpatRaster::sources_to_disk(std::vector<std::string> &tmpfs, bool uni
 		}
 		SpatRaster rs(source[i]);
 		if (write) {
-			std::string fname = tmpbasename + std::to_string(i) + ".tif";
+			std::string ext = opt.get_tempfiletype() == "MMAP" ? ".mmap" : ".tif";
+			std::string fname = tmpbasename + std::to_string(i) + ext;
 			opt.set_filenames({fname});
 			tmpfs.push_back(fname);
 			rs = rs.writeRaster(opt);
@@ -600,7 +613,8 @@ bool SpatRaster::setNAflag(std::vector<double> flag) {
 
 			if (source[i].memory) {
 				source[i].hasNAflag = false;
-				std::replace(source[i].values.begin(), source[i].values.end(), flag[i], na);
+				std::vector<double> &v = source[i].values.edit();
+				std::replace(v.begin(), v.end(), flag[i], na);
 				source[i].setRange();
 			} else {
 				source[i].hasNAflag = true;
@@ -17,7 +17,11 @@
 
 #include <fstream>
 #include <numeric>
+#include <functional>
+#include <memory>
 #include "spatVector.h"
+#include "scanline.h"
+#include "memvalues.h"
 
 #ifdef useGDAL
 #include "gdal_priv.h"
@@ -54,6 +58,11 @@ class SpatWindow {
 
 
 
+class SpatLazy;
+class SpatPyramid;
+class SpatRasterCollection;
+class SpatMMap;
+
 class SpatRasterSource {
     private:
 //		std::ofstream ofs;
@@ -114,7 +123,7 @@ class SpatRasterSource {
 		bool hasUnit = false;
 
 		//std::vector< std::vector<double> values;
-        std::vector<double> values;
+        SpatValues values;
         //std::vector<int64_t> ivalues;
         //std::vector<bool> bvalues;
 
@@ -138,9 +147,17 @@ class SpatRasterSource {
 
 		bool memory=true;
 		bool hasValues=false;
+		// values that are computed from other rasters when they are read (see lazy.h)
+		std::shared_ptr<SpatLazy> lazy;
+		// the memory map of a file in the "MMAP" format (see mmap.h)
+		std::shared_ptr<SpatMMap> mmap;
+		// the position of the first value in the file (after the header)
+		size_t mmapoffset = 0;
 		std::string filename;
 		std::string driver;
 		std::string datatype; 
+		// the NA flag of the file, if it is the same for all layers
+		double fileNAflag = NAN;
 		std::vector<std::string> open_ops;
 		
 		// user set for reading:
@@ -154,6 +171,7 @@ class SpatRasterSource {
 //		std::vector<SpatRasterSource> subset(std::vector<unsigned> lyrs);
 		SpatRasterSource subset(std::vector<unsigned> lyrs);
 //		void getValues(std::vector<double> &v, unsigned lyr, SpatOptions &opt);
+		size_t layerSize();
 		void appendValues(std::vector<double> &v, unsigned lyr);
 		
 		void setRange();
@@ -178,6 +196,17 @@ class BlockSize {
 		unsigned n;
 };
 
+// used by SpatRaster::processBlocks and writeBlocks. The reader is called on the calling thread 
+// and reads the input values of block i; the worker may run on another thread
+// and must leave the output values of block i in v[0]. The collector is called
+// on the calling thread, in block order (writeBlocks uses it to write v[0])
+typedef std::function<bool(std::vector<std::vector<double>> &v, size_t i)> BlockReader;
+typedef std::function<void(std::vector<std::vector<double>> &v, size_t i)> BlockWorker;
+typedef std::function<bool(std::vector<std::vector<double>> &v, size_t i)> BlockCollector;
+// a cell-by-cell function of v (one vector for each input raster, with n cells for each layer)
+// that must leave the output values in v[0]. Used by writeCells
+typedef std::function<void(std::vector<std::vector<double>> &v, size_t n)> CellWorker;
+
 class SpatRaster {
 
     private:
@@ -188,6 +217,12 @@ class SpatRaster {
 		bool gdal_stats = false;
 		bool gdal_approx = true;
 		bool gdal_minmax = true;
+		// overviews that are computed while the values are written (see pyramid.h)
+		std::shared_ptr<SpatPyramid> overview_builder;
+		std::vector<int> overview_factors;
+		std::string overview_method = "mean";
+		size_t overview_nextrow = 0;
+		bool overview_fallback = false;
 
 	protected:
 		SpatExtent window;
@@ -439,6 +474,15 @@ class SpatRaster {
 		void readValues(std::vector<double> &out, size_t row, size_t nrows, size_t col, size_t ncols);
 		void readChunkMEM(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
 
+		// Native integer values. getNativeIntType returns the smallest of "INT1U", "INT2S", 
+		// "INT2U" and "INT4S" that can hold the values and NA of all layers, or "" if 
+		// the values must be read as double (in memory, floating point, or scale/offset). 
+		// readValuesTyped and writeValuesTyped use NA<T>::value for NA. 
+		// They are instantiated for uint8_t, int16_t, uint16_t and int32_t
+		std::string getNativeIntType();
+		template <typename T> void readValuesTyped(std::vector<T> &out, size_t row, size_t nrows, size_t col, size_t ncols);
+		template <typename T> bool writeValuesTyped(std::vector<T> &vals, size_t startrow, size_t nrows);
+
 		void readBlock(std::vector<double> &v, BlockSize bs, unsigned i){ // inline
 			readValues(v, bs.row[i], bs.nrows[i], 0, ncol());
 		}
@@ -458,6 +502,38 @@ class SpatRaster {
 			// }
 			return writeValues(v, bs.row[i], bs.nrows[i]);
 		}
+		bool writeBlocks(BlockReader reader, BlockWorker worker, SpatOptions &opt);
+		bool processBlocks(size_t n, BlockReader reader, BlockWorker worker, BlockCollector collector, SpatOptions &opt);
+
+		// lazy evaluation (lazy.cpp). writeCells computes the values of this raster from x with fun;
+		// block by block, or, if opt.get_lazy(), only when the values are read
+		bool writeCells(std::vector<SpatRaster*> x, CellWorker fun, SpatOptions &opt);
+		bool hasLazy();
+		bool evaluateLazy(SpatOptions &opt);
+		void readChunkLazy(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+		std::vector<std::vector<double>> readRowColLazy(size_t src, std::vector<int_64> &rows, const std::vector<int_64> &cols);
+		std::vector<double> readSampleLazy(size_t src, size_t srows, size_t scols);
+		// write all values to out (after out.writeStart); lazy values are computed on the worker threads
+		bool copyBlocks(SpatRaster &out, SpatOptions &opt);
+
+		// memory mapped files (mmap.cpp)
+		bool constructFromMMap(std::string fname);
+		// a file in the MMAP format, or else a file that GDAL can read
+		bool constructFromAnyFile(std::string fname, std::vector<int> subds, std::vector<std::string> subdsname, std::vector<std::string> options);
+		bool readStartMMap(size_t src);
+		void readChunkMMap(std::vector<double> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+		template <typename T>
+		void readChunkMMapTyped(std::vector<T> &out, size_t src, size_t row, size_t nrows, size_t col, size_t ncols);
+		void readCellsMMap(std::vector<std::vector<double>> &out, size_t src, const std::vector<size_t> &cells, const std::vector<size_t> &idx, size_t n);
+		std::vector<std::vector<double>> readRowColMMap(size_t src, std::vector<int_64> &rows, const std::vector<int_64> &cols);
+		std::vector<double> readSampleMMap(size_t src, size_t srows, size_t scols);
+		// the values of a layer of a FLT8S source, without a copy (or NULL)
+		const double* mmapView(size_t src, size_t lyr);
+		bool writeStartMMap(SpatOptions &opt);
+		bool writeValuesMMap(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		bool writeStopMMap();
+		// a VRT (raw) description of a MMAP source, for GDAL
+		std::string mmapVRT(size_t src);
 
 		bool writeValues(std::vector<double> &vals, size_t startrow, size_t nrows);
 		bool writeValuesRect(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
@@ -471,6 +547,8 @@ class SpatRaster {
 		bool writeStartGDAL(SpatOptions &opt);		
 		bool fillValuesGDAL(double fillvalue);
 		bool writeValuesGDAL(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		void writeOverviewsGDAL(const std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols);
+		template <typename T> bool writeValuesGDALTyped(std::vector<T> &vals, size_t startrow, size_t nrows);
 		bool writeStopGDAL();
 
 
@@ -500,6 +578,7 @@ class SpatRaster {
 		bool readStartGDAL(unsigned src);
 		bool readStopGDAL(unsigned src);
 		void readChunkGDAL(std::vector<double> &data, unsigned src, size_t row, unsigned nrows, size_t col, unsigned ncols);
+		template <typename T> void readChunkGDALTyped(std::vector<T> &data, unsigned src, size_t row, size_t nrows, size_t col, size_t ncols);
 
 		bool setWindow(SpatExtent x);
 		bool removeWindow();
@@ -536,6 +615,9 @@ class SpatRaster {
         std::vector<double> adjacent(std::vector<double> cells, std::string directions, bool include);
         std::vector<double> adjacentMat(std::vector<double> cells, std::vector<bool> mat, std::vector<unsigned> dim, bool include);
  		SpatRaster aggregate(std::vector<unsigned> fact, std::string fun, bool narm, SpatOptions &opt);
+		// aggregates with factors 2, 4, 8, ... ("mean", "min", "max", "nearest" or "mode"),
+		// one raster for each factor, from a single pass over the values
+		SpatRasterCollection pyramid(std::vector<unsigned> fact, std::string method, SpatOptions &opt);
 		SpatExtent align(SpatExtent e, std::string snap);
 		SpatRaster rst_area(bool mask, std::string unit, bool transform, SpatOptions &opt);
 		std::vector<double> sum_area(std::string unit, bool transform, SpatOptions &opt);
@@ -567,7 +649,7 @@ class SpatRaster {
 		SpatRaster cropmask(SpatVector v, std::string snap, SpatOptions &opt);
 		SpatRaster cum(std::string fun, bool narm, SpatOptions &opt);
         SpatRaster disaggregate(std::vector<unsigned> fact, SpatOptions &opt);
-		SpatRaster distance(SpatOptions &opt);
+		SpatRaster distance(bool cells, SpatOptions &opt);
 		SpatRaster disdir_vector_rasterize(SpatVector p, bool align_points, bool distance, bool from, bool degrees, SpatOptions &opt);
 		
 		SpatRaster distance_vector(SpatVector p, SpatOptions &opt);
@@ -576,11 +658,17 @@ class SpatRaster {
 		SpatRaster direction_vector(SpatVector p, bool from, bool degrees, SpatOptions &opt);
 		
 		SpatRaster clumps(int directions, bool zeroAsNA, SpatOptions &opt);
+		SpatDataFrame patch_stats(int directions, bool zeroAsNA, SpatOptions &opt);
 
 		SpatRaster edges(bool classes, std::string type, unsigned directions, double falseval, SpatOptions &opt);
 		SpatRaster extend(SpatExtent e, std::string snap, SpatOptions &opt);
 		std::vector<std::vector<std::vector<double>>> extractVector(SpatVector v, bool touches, std::string method, bool cells, bool xy, bool weights, bool exact, SpatOptions &opt);
 		std::vector<double> extractVectorFlat(SpatVector v, bool touches, std::string method, bool cells, bool xy, bool weights, bool exact, SpatOptions &opt);
+		std::vector<std::vector<double>> extractVectorSummary(SpatVector v, bool touches, std::string fun, bool narm, bool weights, bool exact, SpatOptions &opt);
+		bool extractVectorBlocks(SpatVector &v, bool touches, bool weights, bool exact, 
+			std::function<void(size_t, std::vector<double>&, std::vector<double>&)> start,
+			std::function<void(size_t, size_t, const double*, size_t)> add,
+			std::function<void(size_t)> finish, SpatOptions &opt);
 		
 		
 		std::vector<double> vectCells(SpatVector v, bool touches, std::string method, bool weights, bool exact, SpatOptions &opt);
@@ -608,8 +696,21 @@ class SpatRaster {
 		SpatDataFrame global(std::string fun, bool narm, SpatOptions &opt);
 		SpatDataFrame global_weighted_mean(SpatRaster &weights, std::string fun, bool narm, SpatOptions &opt);
 
-		SpatRaster gridDistance(SpatOptions &opt);
-		SpatRaster costDistance(double source, SpatOptions &opt);
+		// shortest paths over the grid (cells connected to their 8 neighbors), from the
+		// origin values (or, if empty, all cells that are not NA). If allocation, the
+		// value of the nearest origin is returned as a second layer
+		SpatRaster gridDistance(std::vector<double> origin, std::vector<double> omit, bool allocation, SpatOptions &opt);
+		// as gridDistance, through the cost values in the first layer (NA cells cannot be passed).
+		// The origins are the cells with value target, or the cells that are not NA in the second layer
+		SpatRaster costDistance(double target, bool allocation, SpatOptions &opt);
+
+		// hydrology (hydro.cpp). fillSinks raises the cells in depressions to the level at which they
+		// drain (if epsilon, a little higher, such that all cells drain). flowAccumulation and
+		// watershed use the flow direction codes of terrain (flowAccumulation is weighted by the
+		// second layer, if there is one). watershed labels the cells upstream of each outlet cell
+		SpatRaster fillSinks(bool epsilon, SpatOptions &opt);
+		SpatRaster flowAccumulation(SpatOptions &opt);
+		SpatRaster watershed(std::vector<double> cells, SpatOptions &opt);
 
 		SpatRaster init(std::string value, bool plusone, SpatOptions &opt);
 		SpatRaster init(std::vector<double> values, SpatOptions &opt);
@@ -656,10 +757,15 @@ class SpatRaster {
 
 		SpatRaster rasterize(SpatVector x, std::string field, std::vector<double> values, double background, bool touches, bool add, bool weights, bool update, bool minmax, SpatOptions &opt);
 		std::vector<double> rasterizeCells(SpatVector &v, bool touches, SpatOptions &opt);
+		std::vector<double> rasterizeCells(const SpatGeom &g, bool touches);
+		// the cells covered by a geometry, as runs of cells in a row (see scanline.h)
+		std::vector<CellRun> rasterizeRuns(const SpatGeom &g, bool touches);
 		//std::vector<std::vector<double>> rasterizeCellsWeights(SpatVector &v, bool touches);
 
 		void rasterizeCellsWeights(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt); 
 		void rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, SpatVector &v, SpatOptions &opt); 
+		// the cells covered by a polygon and the exact fraction covered (see scanline.h)
+		void rasterizeCellsExact(std::vector<double> &cells, std::vector<double> &weights, const SpatGeom &g, bool lonlat);
 
 
 		SpatRaster replaceValues(std::vector<double> from, std::vector<double> to, long nl, bool keepcats, SpatOptions &opt);
@@ -233,15 +233,19 @@ void SpatRasterSource::getValues(std::vector<double> &v, unsigned lyr) {
 */
 
 
-void SpatRasterSource::appendValues(std::vector<double> &v, unsigned lyr) {
-	size_t nc ;
+// the number of cells of a layer of the values (of the full raster if there is a window)
+size_t SpatRasterSource::layerSize() {
 	if (hasWindow) {
-		nc = window.full_ncol * window.full_nrow;
-	} else {
-		nc = nrow * ncol;
+		return window.full_ncol * window.full_nrow;
 	}
+	return nrow * ncol;
+}
+
+
+void SpatRasterSource::appendValues(std::vector<double> &v, unsigned lyr) {
+	size_t nc = layerSize();
 	size_t start = lyr * nc;
-	v.insert(v.end(), values.begin()+start, values.begin()+start+nc);
+	values.copy(v, start, start+nc);
 }
 
 
@@ -356,15 +360,16 @@ SpatRasterSource SpatRasterSource::subset(std::vector<unsigned> lyrs) {
 
 		if (memory) {
 			out.layers.push_back(i);
-			if (hasValues) {
-				appendValues(out.values, j);
-			}
 		} else {
 			out.layers.push_back(layers[j]);
 		}
     }
     out.nlyr = nl;
 	out.hasValues = hasValues;
+	if (memory && hasValues) {
+		// a view on the values of this source; these are not copied
+		out.values = values.subset(lyrs, layerSize());
+	}
     return out;
 }
 
@@ -440,14 +445,10 @@ SpatRaster SpatRaster::subset(std::vector<unsigned> lyrs, SpatOptions &opt) {
 
 bool SpatRasterSource::combine_sources(const SpatRasterSource &x) {
 	if (memory & x.memory) {
-		if ((values.size() + x.values.size()) < (values.max_size()/8) ) {
-			values.insert(values.end(), x.values.begin(), x.values.end());
-			layers.resize(nlyr + x.nlyr);
-			std::iota(layers.begin(), layers.end(), 0);
-		} else {
-			return false;
-		}
-	} else if (filename == x.filename) {
+		values.append(x.values, layerSize());
+		layers.resize(nlyr + x.nlyr);
+		std::iota(layers.begin(), layers.end(), 0);
+	} else if ((filename == x.filename) && (lazy == x.lazy)) {
 		layers.insert(layers.end(), x.layers.begin(), x.layers.end());
 	} else {
 		return false;
@@ -486,15 +487,11 @@ bool SpatRasterSource::combine_sources(const SpatRasterSource &x) {
 
 bool SpatRasterSource::combine(SpatRasterSource &x) {
 	if (memory & x.memory) {
-		if ((values.size() + x.values.size()) < (values.max_size()/8) ) {
-			values.insert(values.end(), x.values.begin(), x.values.end());
-			layers.resize(nlyr + x.nlyr);
-			std::iota(layers.begin(), layers.end(), 0);
-			x.values.resize(0);
-		} else {
-			return false;
-		}
-	} else if (filename == x.filename) {
+		values.append(x.values, layerSize());
+		layers.resize(nlyr + x.nlyr);
+		std::iota(layers.begin(), layers.end(), 0);
+		x.values.clear();
+	} else if ((filename == x.filename) && (lazy == x.lazy)) {
 		layers.insert(layers.end(), x.layers.begin(), x.layers.end());
 	} else {
 		return false;
@@ -274,6 +274,57 @@ size_t SpatVector::size() {
 	return geoms.size();
 }
 
+
+bool same_extent(const SpatExtent &a, const SpatExtent &b) {
+	return ((a.xmin == b.xmin) || (std::isnan(a.xmin) && std::isnan(b.xmin))) &&
+		((a.xmax == b.xmax) || (std::isnan(a.xmax) && std::isnan(b.xmax))) &&
+		((a.ymin == b.ymin) || (std::isnan(a.ymin) && std::isnan(b.ymin))) &&
+		((a.ymax == b.ymax) || (std::isnan(a.ymax) && std::isnan(b.ymax)));
+}
+
+
+SpatIndex& SpatVector::getIndex() {
+	size_t n = size();
+	bool valid = (geom_index != nullptr) && (geom_index->size() == n);
+	for (size_t i=0; valid && (i<n); i++) {
+		valid = same_extent(geom_index->box(i), geoms[i].extent);
+	}
+	if (!valid) {
+		std::vector<SpatExtent> e(n);
+		for (size_t i=0; i<n; i++) {
+			e[i] = geoms[i].extent;
+		}
+		geom_index = std::make_shared<SpatIndex>(e);
+	}
+	return *geom_index;
+}
+
+
+std::vector<std::vector<size_t>> SpatVector::index_pairs(SpatVector v) {
+	SpatIndex &idx = getIndex();
+	std::vector<size_t> ix, iy;
+	std::vector<size_t> hits;
+	for (size_t j=0; j<v.size(); j++) {
+		hits.resize(0);
+		idx.query(v.geoms[j].extent, hits);
+		ix.insert(ix.end(), hits.begin(), hits.end());
+		iy.resize(ix.size(), j);
+	}
+	// counting sort by x; y is already sorted within x
+	std::vector<size_t> start(size()+1, 0);
+	for (size_t k=0; k<ix.size(); k++) {
+		start[ix[k]+1]++;
+	}
+	std::partial_sum(start.begin(), start.end(), start.begin());
+	std::vector<std::vector<size_t>> out(2, std::vector<size_t>(ix.size()));
+	for (size_t k=0; k<ix.size(); k++) {
+		size_t p = start[ix[k]]++;
+		out[0][p] = ix[k];
+		out[1][p] = iy[k];
+	}
+	return out;
+}
+
 bool SpatVector::is_lonlat() {
 	return srs.is_lonlat();
 }
@@ -368,16 +419,16 @@ bool SpatVector::replaceGeom(SpatGeom p, unsigned i) {
 unsigned SpatVector::nxy() {
 	unsigned n = 0;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = geoms[i];
 		if (g.size() == 0) {
 			n++; // empty
 		}
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.parts[j];
 			n += p.x.size();
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.holes[k];
 					n += h.x.size();
 				}
 			}
@@ -390,16 +441,16 @@ unsigned SpatVector::nxy() {
 std::vector<std::vector<double>> SpatVector::coordinates() {
 	std::vector<std::vector<double>> out(2);
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = geoms[i];
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.parts[j];
 			for (size_t q=0; q < p.x.size(); q++) {
 				out[0].push_back( p.x[q] );
 				out[1].push_back( p.y[q] );
 			}
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.holes[k];
 					for (size_t q=0; q < h.x.size(); q++) {
 						out[0].push_back( h.x[q] );
 						out[1].push_back( h.y[q] );
@@ -469,7 +520,7 @@ SpatDataFrame SpatVector::getGeometryDF() {
 
 	size_t idx = 0;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = geoms[i];
 		if (g.size() == 0) { // empty
 			out.iv[0][idx] = i+1;
 			out.iv[1][idx] = 1;
@@ -480,7 +531,7 @@ SpatDataFrame SpatVector::getGeometryDF() {
 		}
 
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.parts[j];
 			for (size_t q=0; q < p.x.size(); q++) {
 				out.iv[0][idx] = i+1;
 				out.iv[1][idx] = j+1;
@@ -491,7 +542,7 @@ SpatDataFrame SpatVector::getGeometryDF() {
 			}
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.holes[k];
 					for (size_t q=0; q < h.x.size(); q++) {
 						out.iv[0][idx] = i+1;
 						out.iv[1][idx] = j+1;
@@ -513,11 +564,11 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 
 	unsigned n = nxy();
 	std::vector<std::vector<double>> out(5);
-	for (size_t i=0; i>out.size(); i++) {
+	for (size_t i=0; i<out.size(); i++) {
 		out[i].reserve(n);
 	}
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = geoms[i];
 		if (g.size() == 0) { // empty
 			out[0].push_back(i+1);
 			out[1].push_back(1);
@@ -527,7 +578,7 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 		}
 
 		for (size_t j=0; j < g.size(); j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.parts[j];
 			for (size_t q=0; q < p.x.size(); q++) {
 				out[0].push_back(i+1);
 				out[1].push_back(j+1);
@@ -537,7 +588,7 @@ std::vector<std::vector<double>> SpatVector::getGeometry() {
 			}
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.holes[k];
 					for (size_t q=0; q < h.x.size(); q++) {
 						out[0].push_back(i+1);
 						out[1].push_back(j+1);
@@ -564,7 +615,7 @@ std::vector<std::string> SpatVector::getGeometryWKT() {
 	std::vector<std::string> out(size());
 	std::string wkt;
 	for (size_t i=0; i < size(); i++) {
-		SpatGeom g = getGeom(i);
+		const SpatGeom &g = geoms[i];
 		size_t n = g.size();
 		if (g.gtype == points) {
 			if (n > 1) {
@@ -597,7 +648,7 @@ std::vector<std::string> SpatVector::getGeometryWKT() {
 		}
 
 		for (size_t j=0; j < n; j++) {
-			SpatPart p = g.getPart(j);
+			const SpatPart &p = g.parts[j];
 			if (j>0) wkt += ",";
 
 			if ((g.gtype == polygons) & (n > 1)) { 
@@ -611,7 +662,7 @@ std::vector<std::string> SpatVector::getGeometryWKT() {
 			wkt += ")";
 			if (p.hasHoles()) {
 				for (size_t k=0; k < p.nHoles(); k++) {
-					SpatHole h = p.getHole(k);
+					const SpatHole &h = p.holes[k];
 					wkt += ",(" + nice_string(h.x[0]) + " " + nice_string(h.y[0]);
 					for (size_t q=1; q < h.x.size(); q++) {
 						wkt += ", " + nice_string(h.x[q]) + " " + nice_string(h.y[q]);
@@ -17,6 +17,8 @@
 
 //#include "spatBase.h"
 #include "spatDataframe.h"
+#include "spatIndex.h"
+#include <memory>
 //#include "spatMessages.h"
 
 #ifdef useGDAL
@@ -37,7 +39,7 @@ class SpatHole {
 		SpatHole();
 		SpatHole(std::vector<double> X, std::vector<double> Y);
 		//methods
-		size_t size() { return x.size(); }	
+		size_t size() const { return x.size(); }	
 };
 
 class SpatPart {
@@ -53,13 +55,13 @@ class SpatPart {
 		SpatPart(double X, double Y);
 
 		//methods
-		size_t size() { return x.size(); }
+		size_t size() const { return x.size(); }
 		//holes, polygons only
 		bool addHole(std::vector<double> X, std::vector<double> Y);
 		bool addHole(SpatHole h);
 		SpatHole getHole(unsigned i) { return( holes[i] ) ; }
-		bool hasHoles() { return holes.size() > 0;}
-		unsigned nHoles() { return holes.size();}
+		bool hasHoles() const { return holes.size() > 0;}
+		unsigned nHoles() const { return holes.size();}
 };
 
 
@@ -86,7 +88,7 @@ class SpatGeom {
 		//double area_lonlat(double a, double f);
 		//double length_plane();
 		//double length_lonlat(double a, double f);
-		unsigned size() { return parts.size(); };
+		unsigned size() const { return parts.size(); };
 		void remove_duplicate_nodes(int digits);
 		size_t ncoords();
 		std::vector<std::vector<double>> coordinates();
@@ -189,6 +191,13 @@ class SpatVector {
 
 		std::vector<std::vector<size_t>> knearest(size_t k);
 
+		// index of the extents of the geometries. It is built when first needed,
+		// kept with the object (and its copies), and rebuilt if the geometries change
+		std::shared_ptr<SpatIndex> geom_index;
+		SpatIndex& getIndex();
+		// pairs of geometries (this, v) with intersecting extents, ordered by this and v
+		std::vector<std::vector<size_t>> index_pairs(SpatVector v);
+
 		size_t size();
 		SpatVector as_lines();
 		SpatVector as_points(bool multi, bool skiplast=false);
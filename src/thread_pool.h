@@ -0,0 +1,89 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef THREADPOOL_GUARD
+#define THREADPOOL_GUARD
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+
+// A fixed set of worker threads that run submitted tasks in FIFO order.
+// Tasks must not call R or GDAL; they should only compute on buffers
+// that are owned by the caller. The destructor finishes all queued tasks.
+
+class SpatThreadPool {
+	public:
+		SpatThreadPool(size_t n) {
+			n = std::max((size_t)1, n);
+			for (size_t i=0; i<n; i++) {
+				workers.push_back(std::thread([this] { work(); }));
+			}
+		}
+
+		virtual ~SpatThreadPool() {
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				stopping = true;
+			}
+			cv.notify_all();
+			for (size_t i=0; i<workers.size(); i++) {
+				workers[i].join();
+			}
+		}
+
+		std::future<void> submit(std::function<void()> f) {
+			std::packaged_task<void()> task(f);
+			std::future<void> fut = task.get_future();
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				tasks.push(std::move(task));
+			}
+			cv.notify_one();
+			return fut;
+		}
+
+		size_t size() { return workers.size(); }
+
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::packaged_task<void()>> tasks;
+		std::mutex mtx;
+		std::condition_variable cv;
+		bool stopping = false;
+
+		void work() {
+			while (true) {
+				std::packaged_task<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+					if (tasks.empty()) return;
+					task = std::move(tasks.front());
+					tasks.pop();
+				}
+				task();
+			}
+		}
+};
+
+
+#endif
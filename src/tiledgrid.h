@@ -0,0 +1,74 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef TILEDGRID_GUARD
+#define TILEDGRID_GUARD
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include "mmap.h"
+
+// Working arrays with "nv" values for each cell (used for shortest paths,
+// the distance transform and the hydrology functions). The cells are stored
+// in square tiles, such that cells that are near each other on the grid are
+// also near each other in memory. If the arrays are too large for memory they
+// are stored in a memory mapped temporary file, and the operating system keeps
+// the active tiles in memory
+class TiledGrid {
+	public:
+		virtual ~TiledGrid() {
+			map.close();
+			if (filename != "") remove(filename.c_str());
+		}
+
+		bool init(size_t nr, size_t nc, size_t nv, bool inmemory, std::string tmpfile, std::string &msg) {
+			ntc = (nc + 63) >> 6;
+			size_t ntr = (nr + 63) >> 6;
+			n = ntr * ntc * 4096;
+			if (inmemory) {
+				mem.resize(n * nv);
+				p = mem.data();
+			} else {
+				if (!map.open(tmpfile, n * nv * sizeof(double), true, msg)) {
+					return false;
+				}
+				filename = tmpfile;
+				p = (double*) map.data();
+			}
+			return true;
+		}
+
+		// the index of the cell in row r and column c
+		inline size_t cell(size_t r, size_t c) {
+			return (((r >> 6) * ntc + (c >> 6)) << 12) + ((r & 63) << 6) + (c & 63);
+		}
+		// the values of variable i
+		double* var(size_t i) {
+			return p + i * n;
+		}
+
+	private:
+		size_t ntc = 0;
+		size_t n = 0;
+		double* p = NULL;
+		std::vector<double> mem;
+		SpatMMap map;
+		std::string filename;
+};
+
+#endif
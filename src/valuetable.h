@@ -0,0 +1,258 @@
+// Copyright (c) 2018-2022  Robert J. Hijmans
+//
+// This file is part of the "spat" library.
+//
+// spat is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 2 of the License, or
+// (at your option) any later version.
+//
+// spat is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with spat. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VALUETABLE_GUARD
+#define VALUETABLE_GUARD
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+// Hash tables for freq and unique. They use open addressing (linear probing)
+// in a single array, that is much faster than std::map for values of type
+// double (see NativeTable in native.h for values read as integers)
+
+
+inline uint64_t hash_bits(uint64_t b) {
+	b ^= b >> 33;
+	b *= 0xff51afd7ed558ccdULL;
+	b ^= b >> 33;
+	b *= 0xc4ceb9fe1a85ec53ULL;
+	b ^= b >> 33;
+	return b;
+}
+
+inline uint64_t double_bits(const double &d) {
+	uint64_t b;
+	std::memcpy(&b, &d, sizeof(double));
+	return b;
+}
+
+
+// the number of cells for each value. NAN is not counted.
+// Integers from 0 to 65535 are counted in an array
+class ValueTable {
+	public:
+
+		void add(const double *v, size_t n) {
+			for (size_t i=0; i<n; i++) {
+				add(v[i], 1);
+			}
+		}
+
+		inline void add(const double &d, const unsigned long long &k) {
+			if (std::isnan(d)) return;
+			if ((d >= 0) && (d < 65536)) {
+				size_t j = d;
+				if (j == d) {
+					if (j >= dense.size()) {
+						size_t m = std::max((size_t)256, dense.size());
+						while (m <= j) m *= 2;
+						dense.resize(m, 0);
+					}
+					dense[j] += k;
+					return;
+				}
+			}
+			insert(d, k);
+		}
+
+		void merge(const ValueTable &x) {
+			if (x.dense.size() > dense.size()) {
+				dense.resize(x.dense.size(), 0);
+			}
+			for (size_t i=0; i<x.dense.size(); i++) {
+				dense[i] += x.dense[i];
+			}
+			for (size_t i=0; i<x.keys.size(); i++) {
+				if (x.counts[i] > 0) insert(x.keys[i], x.counts[i]);
+			}
+		}
+
+		// the values (sorted) and the number of cells with each value
+		void get(std::vector<double> &values, std::vector<double> &n) {
+			std::vector<std::pair<double, unsigned long long>> p;
+			for (size_t i=0; i<keys.size(); i++) {
+				if (counts[i] > 0) p.push_back({keys[i], counts[i]});
+			}
+			std::sort(p.begin(), p.end());
+			values.resize(0);
+			n.resize(0);
+			values.reserve(p.size());
+			n.reserve(p.size());
+			// negative values are in the hash table, 0 to 65535 in the array
+			size_t j = 0;
+			for (; (j < p.size()) && (p[j].first < 0); j++) {
+				values.push_back(p[j].first);
+				n.push_back(p[j].second);
+			}
+			for (size_t i=0; i<dense.size(); i++) {
+				if (dense[i] == 0) continue;
+				for (; (j < p.size()) && (p[j].first < i); j++) {
+					values.push_back(p[j].first);
+					n.push_back(p[j].second);
+				}
+				values.push_back(i);
+				n.push_back(dense[i]);
+			}
+			for (; j < p.size(); j++) {
+				values.push_back(p[j].first);
+				n.push_back(p[j].second);
+			}
+		}
+
+	private:
+		std::vector<unsigned long long> dense;
+		std::vector<double> keys;
+		std::vector<unsigned long long> counts; // 0 for an empty slot
+		size_t used = 0;
+
+		void insert(double d, const unsigned long long &k) {
+			if (d == 0) d = 0; // -0
+			if (((used + 1) * 2) > keys.size()) grow();
+			size_t mask = keys.size() - 1;
+			size_t i = hash_bits(double_bits(d)) & mask;
+			while (counts[i] > 0) {
+				if (keys[i] == d) {
+					counts[i] += k;
+					return;
+				}
+				i = (i + 1) & mask;
+			}
+			keys[i] = d;
+			counts[i] = k;
+			used++;
+		}
+
+		void grow() {
+			std::vector<double> oldkeys(std::max((size_t)64, 2 * keys.size()));
+			std::vector<unsigned long long> oldcounts(oldkeys.size(), 0);
+			oldkeys.swap(keys);
+			oldcounts.swap(counts);
+			used = 0;
+			for (size_t i=0; i<oldkeys.size(); i++) {
+				if (oldcounts[i] > 0) insert(oldkeys[i], oldcounts[i]);
+			}
+		}
+};
+
+
+// The unique combinations of the values of nl layers. Each combination (row) is
+// stored once, in "rows"; the hash table has the index (+1) of the rows
+class RowTable {
+	public:
+		RowTable(size_t _nl) : nl(_nl), row(_nl) {}
+
+		// add the cells start to end of a block with n cells (layers are band sequential)
+		void add(const std::vector<double> &v, size_t n, size_t start, size_t end) {
+			for (size_t i=start; i<end; i++) {
+				for (size_t j=0; j<nl; j++) {
+					row[j] = v[j*n + i];
+				}
+				insert(&row[0]);
+			}
+		}
+
+		void merge(const RowTable &x) {
+			for (size_t i=0; i<x.nrows; i++) {
+				insert(&x.rows[i*nl]);
+			}
+		}
+
+		size_t size() { return nrows; }
+
+		// the unique rows, sorted, with NAN before all other values; one vector for each layer
+		std::vector<std::vector<double>> values() {
+			std::vector<size_t> ord(nrows);
+			std::iota(ord.begin(), ord.end(), 0);
+			std::sort(ord.begin(), ord.end(), [this](size_t a, size_t b) {
+				for (size_t j=0; j<nl; j++) {
+					double x = rows[a*nl+j], y = rows[b*nl+j];
+					bool xna = std::isnan(x), yna = std::isnan(y);
+					if (xna && yna) continue;
+					if (xna) return true;
+					if (yna) return false;
+					if (x != y) return x < y;
+				}
+				return false;
+			});
+			std::vector<std::vector<double>> out(nl, std::vector<double>(nrows));
+			for (size_t i=0; i<nrows; i++) {
+				for (size_t j=0; j<nl; j++) {
+					out[j][i] = rows[ord[i]*nl + j];
+				}
+			}
+			return out;
+		}
+
+	private:
+		size_t nl;
+		size_t nrows = 0;
+		std::vector<double> row;
+		std::vector<double> rows;
+		std::vector<size_t> slots;
+
+		// the values are made comparable by their bits (one NAN, no -0)
+		uint64_t hash_row(const double *r) {
+			uint64_t h = 0;
+			for (size_t j=0; j<nl; j++) {
+				h = hash_bits(h ^ double_bits(r[j]));
+			}
+			return h;
+		}
+
+		void insert(const double *r) {
+			size_t k = rows.size();
+			rows.insert(rows.end(), r, r + nl);
+			double *c = &rows[k];
+			for (size_t j=0; j<nl; j++) {
+				if (std::isnan(c[j])) {
+					c[j] = std::numeric_limits<double>::quiet_NaN();
+				} else if (c[j] == 0) {
+					c[j] = 0;
+				}
+			}
+			if (((nrows + 1) * 2) > slots.size()) grow();
+			size_t mask = slots.size() - 1;
+			size_t i = hash_row(c) & mask;
+			while (slots[i] > 0) {
+				if (std::memcmp(&rows[(slots[i] - 1) * nl], c, nl * sizeof(double)) == 0) {
+					rows.resize(k);
+					return;
+				}
+				i = (i + 1) & mask;
+			}
+			nrows++;
+			slots[i] = nrows;
+		}
+
+		void grow() {
+			slots.assign(std::max((size_t)64, 2 * slots.size()), 0);
+			size_t mask = slots.size() - 1;
+			for (size_t r=0; r<nrows; r++) {
+				size_t i = hash_row(&rows[r*nl]) & mask;
+				while (slots[i] > 0) i = (i + 1) & mask;
+				slots[i] = r + 1;
+			}
+		}
+};
+
+#endif
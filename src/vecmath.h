@@ -134,7 +134,8 @@ T vmedian(std::vector<T>& v, bool narm) {
 	if (n % 2) {
 		return vv[n2];
 	} else {
-		return (vv[n2] + vv[n2-1]) / 2;
+		// the values before n2 are not sorted
+		return (vv[n2] + *std::max_element(vv.begin(), vv.begin()+n2)) / 2;
 	}
 }
 
@@ -279,7 +280,7 @@ template <typename T>
 double vsdpop(std::vector<T>& v, bool narm) {
 	double m = vmean(v, narm);
 	if (std::isnan(m)) return m;
-	double x = v[0];
+	double x = 0;
 	size_t n = 0;
 	for (size_t i=0; i<v.size(); i++) {
 		if (!is_NA(v[i])) {
@@ -19,6 +19,8 @@
 #include "file_utils.h"
 #include "string_utils.h"
 #include "math_utils.h"
+#include "NA.h"
+#include "mmap.h"
 
 
 bool SpatRaster::writeValuesMem(std::vector<double> &vals, size_t startrow, size_t nrows) {
@@ -29,7 +31,8 @@ bool SpatRaster::writeValuesMem(std::vector<double> &vals, size_t startrow, size
 	} 
 
 	if (nlyr() == 1) {
-		source[0].values.insert(source[0].values.end(), vals.begin(), vals.end());
+		std::vector<double> &v = source[0].values.edit();
+		v.insert(v.end(), vals.begin(), vals.end());
 		return true;
 	}
 
@@ -37,13 +40,14 @@ bool SpatRaster::writeValuesMem(std::vector<double> &vals, size_t startrow, size
 		source[0].values = std::vector<double>(size(), NAN);
 	}
 
+	std::vector<double> &v = source[0].values.edit();
 	size_t nc = ncell();
 	size_t ncols = ncol();
 	size_t chunk = nrows * ncols;
 	for (size_t i=0; i<nlyr(); i++) {
 		size_t off1 = i * chunk; 
 		size_t off2 = startrow * ncols + i * nc; 
-		std::copy( vals.begin()+off1, vals.begin()+off1+chunk, source[0].values.begin()+off2 );
+		std::copy( vals.begin()+off1, vals.begin()+off1+chunk, v.begin()+off2 );
 	}
 	return true;
 }
@@ -54,6 +58,7 @@ bool SpatRaster::writeValuesMemRect(std::vector<double> &vals, size_t startrow,
 		source[0].values = std::vector<double>(size(), NAN);
 	}
 
+	std::vector<double> &v = source[0].values.edit();
 	size_t nc = ncell();
 	size_t chunk = nrows * ncols;
 
@@ -62,7 +67,7 @@ bool SpatRaster::writeValuesMemRect(std::vector<double> &vals, size_t startrow,
 		for (size_t r=0; r<nrows; r++) {
 			size_t start1 = r * ncols + off;
 			size_t start2 = (startrow+r)*ncol() + i*nc + startcol;
-			std::copy(vals.begin()+start1, vals.begin()+start1+ncols, source[0].values.begin()+start2);
+			std::copy(vals.begin()+start1, vals.begin()+start1+ncols, v.begin()+start2);
 		}
 	}
 	return true;
@@ -75,8 +80,13 @@ void SpatRaster::fill(double x) {
 		#ifdef useGDAL
 		fillValuesGDAL(x);
 		#endif
+	} else if (source[0].driver == "mmap") {
+		std::vector<double> v(ncol() * nlyr(), x);
+		for (size_t i=0; i<nrow(); i++) {
+			writeValuesMMap(v, i, 1, 0, ncol());
+		}
 	} else {
-		source[0].values.resize(size(), x);
+		source[0].values.edit().resize(size(), x);
 	}
 
 }
@@ -207,14 +217,10 @@ SpatRaster SpatRaster::writeRaster(SpatOptions &opt) {
 		readStop();
 		return out; 
 	}
-	for (size_t i=0; i<out.bs.n; i++) {
-		std::vector<double> v; 
-		readBlock(v, out.bs, i);
-		if (!out.writeBlock(v, i)) {
-			readStop();
-			out.writeStop();
-			return out;
-		}
+	if (!copyBlocks(out, opt)) {
+		readStop();
+		out.writeStop();
+		return out;
 	}
 	out.writeStop();
 	readStop();
@@ -237,7 +243,7 @@ bool SpatRaster::writeStart(SpatOptions &opt) {
 	std::string filename = fnames[0];
 	if (filename == "") {
 		if (!canProcessInMemory(opt)) {
-			std::string extension = ".tif";
+			std::string extension = opt.get_tempfiletype() == "MMAP" ? ".mmap" : ".tif";
 			filename = tempFile(opt.get_tempdir(), opt.pid, extension);
 			opt.set_filenames({filename});
 			//opt.gdal_options = {"COMPRESS=NONE"};
@@ -245,7 +251,13 @@ bool SpatRaster::writeStart(SpatOptions &opt) {
 	}
 
 	bs = getBlockSize(opt);
-	if (filename != "") {
+	std::string ext = getFileExt(filename);
+	lowercase(ext);
+	if ((filename != "") && ((opt.get_filetype() == "MMAP") || (ext == ".mmap"))) {
+		if (!writeStartMMap(opt)) {
+			return false;
+		}
+	} else if (filename != "") {
 		// open GDAL filestream
 		#ifdef useGDAL
 		if (! writeStartGDAL(opt) ) {
@@ -256,9 +268,13 @@ bool SpatRaster::writeStart(SpatOptions &opt) {
 		return false;
 		#endif
 	} else if ((nlyr() == 1) && (bs.n > 1)) {
-		source[0].values.reserve(ncell());
+		source[0].values.edit().reserve(ncell());
 	}
 
+	if (!opt.overviews.empty()) {
+		addWarning("overviews are only written to GDAL files");
+		opt.overviews.clear();
+	}
 	if (source[0].open_write) {
 		addWarning("file was already open");
 	}
@@ -317,6 +333,8 @@ bool SpatRaster::writeValues(std::vector<double> &vals, size_t startrow, size_t
 		setError("GDAL is not available");
 		return false;
 		#endif
+	} else if (source[0].driver == "mmap") {
+		success = writeValuesMMap(vals, startrow, nrows, 0, ncol());
 	} else {
 		success = writeValuesMem(vals, startrow, nrows);
 	}
@@ -336,6 +354,64 @@ bool SpatRaster::writeValues(std::vector<double> &vals, size_t startrow, size_t
 }
 
 
+template <typename T>
+bool SpatRaster::writeValuesTyped(std::vector<T> &vals, size_t startrow, size_t nrows) {
+
+	if (source[0].driver != "gdal") {
+		T na = NA<T>::value;
+		std::vector<double> v;
+		v.reserve(vals.size());
+		for (size_t i=0; i<vals.size(); i++) {
+			v.push_back(vals[i] == na ? NAN : (double) vals[i]);
+		}
+		return writeValues(v, startrow, nrows);
+	}
+
+	if (!source[0].open_write) {
+		setError("cannot write (no open file)");
+		return false;
+	}
+	if ((startrow + nrows) > nrow()) {
+		setError("incorrect start and/or nrows value");
+		return false;
+	}
+
+	bool success = true;
+	#ifdef useGDAL
+	success = writeValuesGDALTyped(vals, startrow, nrows);
+	#else
+	setError("GDAL is not available");
+	return false;
+	#endif
+
+#ifdef useRcpp
+	if (progressbar) {
+		if (Progress::check_abort()) {
+			pbar->cleanup();
+			delete pbar;
+			setError("aborted");
+			return(false);
+		}
+		pbar->increment();
+	}
+#endif
+	return success;
+}
+
+template bool SpatRaster::writeValuesTyped(std::vector<uint8_t> &vals, size_t startrow, size_t nrows);
+template bool SpatRaster::writeValuesTyped(std::vector<int16_t> &vals, size_t startrow, size_t nrows);
+template bool SpatRaster::writeValuesTyped(std::vector<uint16_t> &vals, size_t startrow, size_t nrows);
+template bool SpatRaster::writeValuesTyped(std::vector<int32_t> &vals, size_t startrow, size_t nrows);
+
+
+// Block pipeline, to be called between writeStart and writeStop.
+// See processBlocks (read.cpp)
+bool SpatRaster::writeBlocks(BlockReader reader, BlockWorker worker, SpatOptions &opt) {
+	return processBlocks(bs.n, reader, worker, 
+		[this](std::vector<std::vector<double>> &v, size_t i) { return writeBlock(v[0], i); }, opt);
+}
+
+
 bool SpatRaster::writeValuesRect(std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
 	bool success = true;
 
@@ -357,6 +433,8 @@ bool SpatRaster::writeValuesRect(std::vector<double> &vals, size_t startrow, siz
 		setError("GDAL is not available");
 		return false;
 		#endif
+	} else if (source[0].driver == "mmap") {
+		success = writeValuesMMap(vals, startrow, nrows, startcol, ncols);
 	} else {
 		success = writeValuesMemRect(vals, startrow, nrows, startcol, ncols);
 	}
@@ -400,6 +478,8 @@ bool SpatRaster::writeStop(){
 		#else
 		return false;
 		#endif
+	} else if (source[0].driver == "mmap") {
+		success = writeStopMMap();
 	} else {
    		source[0].setRange();
 		//source[0].driver = "memory";
@@ -490,7 +570,7 @@ void SpatRasterSource::setRange() {
 	range_max.resize(nlyr);
 	hasRange.resize(nlyr);
 	if (nlyr==1) {
-		minmax(values.begin(), values.end(), range_min[0], range_max[0]);
+		minmax(values.ptr(0), values.ptr(0)+values.size(), range_min[0], range_max[0]);
 		hasRange[0] = true;
 		return;
 	}
@@ -498,7 +578,7 @@ void SpatRasterSource::setRange() {
 	if (values.size() == (nc * nlyr)) {
 		for (size_t i=0; i<nlyr; i++) {
 			size_t start = nc * i;
-			minmax(values.begin()+start, values.begin()+start+nc, range_min[i], range_max[i]);
+			minmax(values.ptr(start), values.ptr(start)+nc, range_min[i], range_max[i]);
 			hasRange[i] = true;
 		}
 	}
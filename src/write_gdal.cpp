@@ -20,6 +20,7 @@
 #include "string_utils.h"
 #include "file_utils.h"
 #include "vecmath.h"
+#include "pyramid.h"
 
 #include <unordered_map>
 #include <vector>
@@ -632,11 +633,109 @@ bool SpatRaster::writeStartGDAL(SpatOptions &opt) {
 	}
 */
 	
+	overview_builder.reset();
+	overview_factors = opt.overviews;
+	overview_method = opt.overview_method;
+	overview_nextrow = 0;
+	overview_fallback = false;
+	opt.overviews.clear();
+	if (!overview_factors.empty()) {
+		int m;
+		if (!pyramid_method(overview_method, m)) {
+			setError("unknown overview method: " + overview_method);
+			GDALClose( (GDALDatasetH) poDS );
+			return false;
+		}
+		std::sort(overview_factors.begin(), overview_factors.end());
+		overview_factors.erase(std::unique(overview_factors.begin(), overview_factors.end()), overview_factors.end());
+		if (overview_factors[0] < 2) {
+			setError("overview factors must be larger than 1");
+			GDALClose( (GDALDatasetH) poDS );
+			return false;
+		}
+		if (copy_driver != "") {
+			addWarning("overviews are not written for " + driver + " files");
+			overview_factors.resize(0);
+		} else if (poDS->BuildOverviews("NONE", (int) overview_factors.size(), &overview_factors[0], 0, NULL, NULL, NULL) != CE_None) {
+			addWarning("cannot create overviews");
+			overview_factors.resize(0);
+		} else {
+			// factors that are not powers of two are computed by GDAL when the file is closed
+			std::vector<size_t> f(overview_factors.begin(), overview_factors.end());
+			overview_builder = std::make_shared<SpatPyramid>();
+			if (!overview_builder->init(nrow(), ncol(), nlyr(), f, overview_method)) {
+				overview_builder.reset();
+				overview_fallback = true;
+			}
+		}
+	}
+
 	source[0].gdalconnection = poDS;
 	return true;
 }
 
 
+// the overview of a band with nc columns and nr rows
+GDALRasterBand* get_overview(GDALRasterBand *poBand, size_t nc, size_t nr) {
+	for (int i=0; i<poBand->GetOverviewCount(); i++) {
+		GDALRasterBand *ov = poBand->GetOverview(i);
+		if ((ov != NULL) && ((size_t)ov->GetXSize() == nc) && ((size_t)ov->GetYSize() == nr)) {
+			return ov;
+		}
+	}
+	return NULL;
+}
+
+
+bool write_overview_rows(GDALDataset *poDS, SpatPyramid &pyr, size_t nl) {
+	std::vector<double> v;
+	size_t row, nrows;
+	for (size_t i=0; i<pyr.factors.size(); i++) {
+		if (!pyr.take(i, v, row, nrows)) continue;
+		size_t nc = pyr.ncol(i);
+		size_t n = nrows * nc;
+		for (size_t b=0; b<nl; b++) {
+			GDALRasterBand *poBand = poDS->GetRasterBand(b+1);
+			GDALRasterBand *ov = get_overview(poBand, nc, pyr.nrow(i));
+			if (ov == NULL) return false;
+			int hasNA = 0;
+			double na = poBand->GetNoDataValue(&hasNA);
+			double *p = &v[b * n];
+			if (hasNA && (!std::isnan(na))) {
+				for (size_t j=0; j<n; j++) {
+					if (std::isnan(p[j])) p[j] = na;
+				}
+			}
+			if (ov->RasterIO(GF_Write, 0, row, nc, nrows, p, nc, nrows, GDT_Float64, 0, 0, NULL) != CE_None) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+// the overviews are computed from the values that are written. If the values are
+// not written as full rows from top to bottom, GDAL computes them when the file is closed
+void SpatRaster::writeOverviewsGDAL(const std::vector<double> &vals, size_t startrow, size_t nrows, size_t startcol, size_t ncols) {
+	if (!overview_builder) return;
+	if ((startcol != 0) || (ncols != ncol()) || (startrow != overview_nextrow)) {
+		overview_builder.reset();
+		overview_fallback = true;
+		return;
+	}
+	overview_builder->add(vals, nrows);
+	overview_nextrow += nrows;
+	if (overview_nextrow == nrow()) {
+		overview_builder->finish();
+	}
+	if (!write_overview_rows(source[0].gdalconnection, *overview_builder, nlyr())) {
+		overview_builder.reset();
+		overview_fallback = true;
+	}
+}
+
+
 /*
 void min_max_na(std::vector<double> &vals, const double &na, const double &mn, const double &mx) {
 	for (double &v : vals) { 
@@ -746,13 +845,105 @@ bool SpatRaster::writeValuesGDAL(std::vector<double> &vals, size_t startrow, siz
 		GDALClose( source[0].gdalconnection );
 		return false;
 	}
+	writeOverviewsGDAL(vals, startrow, nrows, startcol, ncols);
+	return true;
+}
 
+
+// write native integer values. NA<T> is replaced by the NA flag of the file. 
+// If the file has another data type the values are written as double
+template <typename T>
+bool SpatRaster::writeValuesGDALTyped(std::vector<T> &vals, size_t startrow, size_t nrows) {
+
+	std::string datatype = source[0].datatype;
+	GDALDataType gdt;
+	getGDALDataType(datatype, gdt);
+	size_t nc = nrows * ncol();
+	size_t nl = nlyr();
+	T na = NA<T>::value;
+	int hasNA = 0;
+	double naflag = source[0].gdalconnection->GetRasterBand(1)->GetNoDataValue(&hasNA);
+	bool flagok = (!hasNA) || ((naflag >= std::numeric_limits<T>::lowest()) && (naflag <= std::numeric_limits<T>::max()) && (naflag == std::trunc(naflag)));
+
+	// other file types, and NA flags that T cannot hold, are written as double
+	if ((gdt != gdal_type<T>()) || (!flagok)) {
+		std::vector<double> v;
+		v.reserve(vals.size());
+		for (size_t i=0; i<vals.size(); i++) {
+			v.push_back(vals[i] == na ? NAN : (double) vals[i]);
+		}
+		return writeValuesGDAL(v, startrow, nrows, 0, ncol());
+	}
+
+	if ((compute_stats) && (!gdal_stats)) {
+		for (size_t i=0; i < nl; i++) {
+			size_t start = nc * i;
+			T vmin = std::numeric_limits<T>::max();
+			T vmax = std::numeric_limits<T>::lowest();
+			bool found = false;
+			for (size_t j=start; j<(start+nc); j++) {
+				if (vals[j] == na) continue;
+				vmin = std::min(vmin, vals[j]);
+				vmax = std::max(vmax, vals[j]);
+				found = true;
+			}
+			if (found) {
+				if (std::isnan(source[0].range_min[i])) {
+					source[0].range_min[i] = vmin;
+					source[0].range_max[i] = vmax;
+				} else {
+					source[0].range_min[i] = std::min(source[0].range_min[i], (double)vmin);
+					source[0].range_max[i] = std::max(source[0].range_max[i], (double)vmax);
+				}
+			}
+		}
+	}
+
+	CPLErr err = CE_None;
+	if (hasNA && (naflag != na)) {
+		std::vector<T> v = vals;
+		std::replace(v.begin(), v.end(), na, (T) naflag);
+		err = source[0].gdalconnection->RasterIO(GF_Write, 0, startrow, ncol(), nrows, &v[0], ncol(), nrows, gdt, nl, NULL, 0, 0, 0, NULL );
+	} else {
+		err = source[0].gdalconnection->RasterIO(GF_Write, 0, startrow, ncol(), nrows, &vals[0], ncol(), nrows, gdt, nl, NULL, 0, 0, 0, NULL );
+	}
+	if (err != CE_None ) {
+		setError("cannot write values (err: " + std::to_string(err) +")");
+		GDALClose( source[0].gdalconnection );
+		return false;
+	}
+	if (overview_builder) {
+		std::vector<double> v;
+		v.reserve(vals.size());
+		for (size_t i=0; i<vals.size(); i++) {
+			v.push_back(vals[i] == na ? NAN : (double) vals[i]);
+		}
+		writeOverviewsGDAL(v, startrow, nrows, 0, ncol());
+	}
 	return true;
 }
 
+template bool SpatRaster::writeValuesGDALTyped(std::vector<uint8_t> &vals, size_t startrow, size_t nrows);
+template bool SpatRaster::writeValuesGDALTyped(std::vector<int16_t> &vals, size_t startrow, size_t nrows);
+template bool SpatRaster::writeValuesGDALTyped(std::vector<uint16_t> &vals, size_t startrow, size_t nrows);
+template bool SpatRaster::writeValuesGDALTyped(std::vector<int32_t> &vals, size_t startrow, size_t nrows);
+
 
 bool SpatRaster::writeStopGDAL() {
 
+	if (!overview_factors.empty()) {
+		if (overview_builder && (overview_nextrow != nrow())) {
+			overview_fallback = true;
+		}
+		if (overview_fallback) {
+			std::string method = pyramid_gdal_method(overview_method);
+			if (source[0].gdalconnection->BuildOverviews(method.c_str(), (int) overview_factors.size(), &overview_factors[0], 0, NULL, NULL, NULL) != CE_None) {
+				addWarning("cannot compute overviews");
+			}
+		}
+		overview_builder.reset();
+		overview_factors.resize(0);
+	}
 
 	GDALRasterBand *poBand;
 	source[0].hasRange.resize(nlyr());
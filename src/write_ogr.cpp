@@ -237,11 +237,11 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 
 // polygons
 		} else if (wkb == wkbMultiPolygon) {
-			SpatGeom g = getGeom(i);
+			const SpatGeom &g = geoms[i];
 			OGRMultiPolygon poGeom;
 			for (size_t j=0; j<g.size(); j++) {
 				OGRLinearRing poRing;
-				SpatPart p = g.getPart(j);
+				const SpatPart &p = g.parts[j];
 				for (size_t k=0; k<p.size(); k++) {
 					if (!std::isnan(p.x[k])) {
 						pt.setX(p.x[k]);
@@ -257,7 +257,7 @@ GDALDataset* SpatVector::write_ogr(std::string filename, std::string lyrname, st
 
 				if (p.hasHoles()) {
 					for (size_t h=0; h < p.nHoles(); h++) {
-						SpatHole hole = p.getHole(h);
+						const SpatHole &hole = p.holes[h];
 						OGRLinearRing poHole;
 						for (size_t k=0; k<hole.size(); k++) {
 							pt.setX(hole.x[k]);